@@ -0,0 +1,122 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Default frame statistics values
+const int FRAME_STATS_CAPACITY = 2048; // amount of frames kept in the ring buffer
+const int FRAME_STATS_BINS = 32;       // amount of bins of the frame time histogram
+
+// Keeps the frame times of the last FRAME_STATS_CAPACITY frames in a ring buffer so that single hitches stay
+// visible instead of disappearing in an average. Percentiles and the histogram are recalculated on request.
+class FrameStats
+{
+public:
+    // frame times in milliseconds, Offset points to the oldest value once the buffer is full
+    std::vector<float> Frames;
+    int Offset;
+    int Count;
+    unsigned long long TotalFrames;
+
+    // statistics of the buffered frames, updated by update()
+    float P50;
+    float P95;
+    float P99;
+    float Max;
+    float Histogram[FRAME_STATS_BINS];
+    float HistogramMax; // upper bound of the last bin in milliseconds
+
+    FrameStats() : Frames(FRAME_STATS_CAPACITY, 0.0f), Offset(0), Count(0), TotalFrames(0),
+                   P50(0.0f), P95(0.0f), P99(0.0f), Max(0.0f), HistogramMax(0.0f)
+    {
+        for (int i = 0; i < FRAME_STATS_BINS; ++i)
+            Histogram[i] = 0.0f;
+    }
+
+    // adds the duration of a frame, deltaTime is given in seconds like in the render loop
+    void push(float deltaTime)
+    {
+        Frames[Offset] = deltaTime * 1000.0f;
+        Offset = (Offset + 1) % FRAME_STATS_CAPACITY;
+        if (Count < FRAME_STATS_CAPACITY)
+            ++Count;
+        ++TotalFrames;
+    }
+
+    void clear()
+    {
+        std::fill(Frames.begin(), Frames.end(), 0.0f);
+        Offset = 0;
+        Count = 0;
+        update();
+    }
+
+    // returns the i-th buffered frame time, 0 being the oldest one
+    float at(int i) const
+    {
+        int start = Count < FRAME_STATS_CAPACITY ? 0 : Offset;
+        return Frames[(start + i) % FRAME_STATS_CAPACITY];
+    }
+
+    // value getter for ImGui::PlotLines, data has to point to the FrameStats
+    static float plot_getter(void *data, int idx)
+    {
+        return static_cast<FrameStats *>(data)->at(idx);
+    }
+
+    // recalculates percentiles, maximum and histogram of the buffered frames
+    void update()
+    {
+        P50 = P95 = P99 = Max = 0.0f;
+        for (int i = 0; i < FRAME_STATS_BINS; ++i)
+            Histogram[i] = 0.0f;
+        if (Count == 0)
+            return;
+
+        sorted.assign(Frames.begin(), Frames.begin() + Count);
+        std::sort(sorted.begin(), sorted.end());
+        P50 = percentile(0.50f);
+        P95 = percentile(0.95f);
+        P99 = percentile(0.99f);
+        Max = sorted.back();
+
+        // the histogram covers everything up to twice the p99 so that a single huge spike does not squash it
+        HistogramMax = std::max(P99 * 2.0f, 1.0f);
+        for (int i = 0; i < Count; ++i)
+        {
+            int bin = (int)(sorted[i] / HistogramMax * FRAME_STATS_BINS);
+            Histogram[std::min(bin, FRAME_STATS_BINS - 1)] += 1.0f;
+        }
+    }
+
+    // writes the buffered frames oldest first as csv. Returns false if the file could not be written
+    bool write_csv(const std::string &filename) const
+    {
+        std::ofstream file(filename);
+        if (!file)
+        {
+            std::cout << "Failed to open " << filename << " for writing\n";
+            return false;
+        }
+        file << "frame,frametime_ms\n";
+        unsigned long long first = TotalFrames - Count;
+        for (int i = 0; i < Count; ++i)
+            file << first + i << ',' << at(i) << '\n';
+        return (bool)file;
+    }
+
+private:
+    std::vector<float> sorted;
+
+    // nearest rank percentile of the sorted frames
+    float percentile(float p) const
+    {
+        size_t rank = (size_t)(p * (sorted.size() - 1) + 0.5f);
+        return sorted[std::min(rank, sorted.size() - 1)];
+    }
+};
+#endif
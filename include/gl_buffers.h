@@ -0,0 +1,61 @@
+#ifndef GL_BUFFERS_H
+#define GL_BUFFERS_H
+
+#include <glad/glad.h>
+#include <memory_stats.h>
+
+#include <map>
+
+// sizes of all buffer objects created through gl_buffer_data, keyed by buffer name
+inline std::map<GLuint, GLsizeiptr> &gl_buffer_sizes()
+{
+    static std::map<GLuint, GLsizeiptr> sizes;
+    return sizes;
+}
+
+// glBufferData for the buffer currently bound to target that also accounts for its size in the memory stats
+inline void gl_buffer_data(GLenum target, GLsizeiptr size, const void *data, GLenum usage)
+{
+    GLenum binding = target == GL_ELEMENT_ARRAY_BUFFER ? GL_ELEMENT_ARRAY_BUFFER_BINDING : GL_ARRAY_BUFFER_BINDING;
+    GLint buffer = 0;
+    glGetIntegerv(binding, &buffer);
+
+    GLsizeiptr &tracked = gl_buffer_sizes()[(GLuint)buffer];
+    MemoryStats::instance().sub(MEMORY_GL_BUFFERS, tracked);
+    MemoryStats::instance().add(MEMORY_GL_BUFFERS, size);
+    tracked = size;
+
+    glBufferData(target, size, data, usage);
+}
+
+// glDeleteBuffers for buffers filled through gl_buffer_data
+inline void gl_delete_buffer(GLuint buffer)
+{
+    std::map<GLuint, GLsizeiptr>::iterator it = gl_buffer_sizes().find(buffer);
+    if (it != gl_buffer_sizes().end())
+    {
+        MemoryStats::instance().sub(MEMORY_GL_BUFFERS, it->second);
+        gl_buffer_sizes().erase(it);
+    }
+    glDeleteBuffers(1, &buffer);
+}
+
+// deletes a vertex array together with the vertex and index buffers attached to it
+inline void gl_delete_vertex_array(GLuint vao)
+{
+    if (vao == 0)
+        return;
+    glBindVertexArray(vao);
+    GLint vbo = 0;
+    GLint ibo = 0;
+    glGetVertexAttribiv(0, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &vbo);
+    glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &ibo);
+    glBindVertexArray(0);
+
+    if (vbo != 0)
+        gl_delete_buffer((GLuint)vbo);
+    if (ibo != 0)
+        gl_delete_buffer((GLuint)ibo);
+    glDeleteVertexArrays(1, &vao);
+}
+#endif
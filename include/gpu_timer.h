@@ -0,0 +1,179 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <deque>
+#include <string>
+
+// Default gpu timer values
+const int GPU_TIMER_QUERIES = 4;   // size of the query ring of each pass, i.e. how many frames the GPU may lag behind
+const int GPU_TIMER_HISTORY = 120; // amount of frames kept for plotting
+
+// Measures a single render pass (terrain, imgui, ...) on the GPU through GL_TIME_ELAPSED queries and on the CPU
+// through the time it takes to submit the pass. Queries are kept in a ring and only read back once the driver
+// reports them as available, so the measurement never stalls the pipeline. Results lag a few frames behind.
+class GpuTimer
+{
+public:
+    std::string Name;
+    // latest available timings in milliseconds
+    float GpuMs;
+    float CpuMs;
+    // rolling history of the timings for plotting, HistoryOffset points to the oldest value
+    float GpuHistory[GPU_TIMER_HISTORY];
+    float CpuHistory[GPU_TIMER_HISTORY];
+    int HistoryOffset;
+
+    GpuTimer(const std::string &name) : Name(name), GpuMs(0.0f), CpuMs(0.0f), HistoryOffset(0),
+                                        created(false), active(false), writeSlot(0), readSlot(0)
+    {
+        for (int i = 0; i < GPU_TIMER_HISTORY; ++i)
+        {
+            GpuHistory[i] = 0.0f;
+            CpuHistory[i] = 0.0f;
+        }
+        for (int i = 0; i < GPU_TIMER_QUERIES; ++i)
+        {
+            queries[i] = 0;
+            pending[i] = false;
+            cpuTimes[i] = 0.0f;
+        }
+    }
+
+    // deletes the queries, has to be called while the GL context is still alive
+    void release()
+    {
+        if (created)
+            glDeleteQueries(GPU_TIMER_QUERIES, queries);
+        created = false;
+        for (int i = 0; i < GPU_TIMER_QUERIES; ++i)
+            pending[i] = false;
+    }
+
+    // starts the measurement of the pass. If the GPU is so far behind that every query of the ring is still
+    // in flight the frame is skipped instead of waiting for a result
+    void begin()
+    {
+        if (!created)
+        {
+            glGenQueries(GPU_TIMER_QUERIES, queries);
+            created = true;
+        }
+        cpuStart = std::chrono::steady_clock::now();
+        active = !pending[writeSlot];
+        if (active)
+            glBeginQuery(GL_TIME_ELAPSED, queries[writeSlot]);
+    }
+
+    void end()
+    {
+        float cpuMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - cpuStart).count();
+        if (!active)
+            return;
+        glEndQuery(GL_TIME_ELAPSED);
+        cpuTimes[writeSlot] = cpuMs;
+        pending[writeSlot] = true;
+        writeSlot = (writeSlot + 1) % GPU_TIMER_QUERIES;
+        active = false;
+    }
+
+    // reads back every query that finished in the meantime, oldest first. Never blocks
+    void collect()
+    {
+        while (pending[readSlot])
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(queries[readSlot], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(queries[readSlot], GL_QUERY_RESULT, &elapsed);
+            GpuMs = (float)(elapsed / 1.0e6);
+            CpuMs = cpuTimes[readSlot];
+
+            GpuHistory[HistoryOffset] = GpuMs;
+            CpuHistory[HistoryOffset] = CpuMs;
+            HistoryOffset = (HistoryOffset + 1) % GPU_TIMER_HISTORY;
+
+            pending[readSlot] = false;
+            readSlot = (readSlot + 1) % GPU_TIMER_QUERIES;
+        }
+    }
+
+private:
+    GLuint queries[GPU_TIMER_QUERIES];
+    bool pending[GPU_TIMER_QUERIES];
+    float cpuTimes[GPU_TIMER_QUERIES];
+    bool created;
+    bool active;
+    int writeSlot;
+    int readSlot;
+    std::chrono::steady_clock::time_point cpuStart;
+};
+
+// Owns the timers of all passes of a frame. Passes are created on first use, so new passes only need a
+// GpuTimerScope around their draw calls. Only one pass may be measured at a time since GL_TIME_ELAPSED
+// queries cannot be nested
+class GpuProfiler
+{
+public:
+    GpuTimer &pass(const std::string &name)
+    {
+        for (size_t i = 0; i < timers.size(); ++i)
+        {
+            if (timers[i].Name == name)
+                return timers[i];
+        }
+        timers.emplace_back(name);
+        return timers.back();
+    }
+
+    // called once per frame to read back the finished queries of all passes
+    void collect()
+    {
+        for (size_t i = 0; i < timers.size(); ++i)
+            timers[i].collect();
+    }
+
+    void release()
+    {
+        for (size_t i = 0; i < timers.size(); ++i)
+            timers[i].release();
+    }
+
+    size_t size() const
+    {
+        return timers.size();
+    }
+
+    GpuTimer &operator[](size_t i)
+    {
+        return timers[i];
+    }
+
+private:
+    // a deque keeps references to the timers valid while new passes are added
+    std::deque<GpuTimer> timers;
+};
+
+// measures everything between its construction and the end of the enclosing scope as one pass
+class GpuTimerScope
+{
+public:
+    GpuTimerScope(GpuProfiler &profiler, const std::string &name) : timer(profiler.pass(name))
+    {
+        timer.begin();
+    }
+
+    ~GpuTimerScope()
+    {
+        timer.end();
+    }
+
+private:
+    GpuTimer &timer;
+};
+#endif
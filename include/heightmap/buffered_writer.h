@@ -0,0 +1,105 @@
+#ifndef HEIGHTMAP_BUFFERED_WRITER_H
+#define HEIGHTMAP_BUFFERED_WRITER_H
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Default buffered writer values
+const size_t BUFFERED_WRITER_SIZE = 4 << 20; // bytes collected before they are handed to the OS
+
+// Sequential binary file writer that collects small writes into one large buffer, so that streaming
+// exporters can write element by element while the file only sees a few large sequential writes.
+class BufferedWriter
+{
+public:
+    BufferedWriter(const std::string &filename) : file(std::fopen(filename.c_str(), "wb")), used(0), written(0), failed(false)
+    {
+        if (file != nullptr)
+        {
+            // the internal buffer of stdio would only add another copy
+            std::setvbuf(file, nullptr, _IONBF, 0);
+            buffer.resize(BUFFERED_WRITER_SIZE);
+        }
+    }
+
+    ~BufferedWriter()
+    {
+        close();
+    }
+
+    bool isOpen() const
+    {
+        return file != nullptr;
+    }
+
+    void write(const void *data, size_t size)
+    {
+        if (file == nullptr)
+            return;
+        if (used + size > buffer.size())
+            flush();
+        if (size >= buffer.size())
+        {
+            // large blocks go straight to the file
+            failed |= std::fwrite(data, 1, size, file) != size;
+        }
+        else
+        {
+            std::memcpy(&buffer[used], data, size);
+            used += size;
+        }
+        written += size;
+    }
+
+    template <typename T>
+    void write(const T &value)
+    {
+        write(&value, sizeof(T));
+    }
+
+    // repeats a byte, e.g. for padding
+    void fill(unsigned char value, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+            write(value);
+    }
+
+    void flush()
+    {
+        if (file == nullptr || used == 0)
+            return;
+        failed |= std::fwrite(buffer.data(), 1, used, file) != used;
+        used = 0;
+    }
+
+    // flushes and closes the file, returns false if any write failed
+    bool close()
+    {
+        if (file == nullptr)
+            return !failed;
+        flush();
+        failed |= std::fclose(file) != 0;
+        file = nullptr;
+        std::vector<char>().swap(buffer);
+        return !failed;
+    }
+
+    // bytes written so far, including the ones still in the buffer
+    long long size() const
+    {
+        return written;
+    }
+
+private:
+    std::FILE *file;
+    std::vector<char> buffer;
+    size_t used;
+    long long written;
+    bool failed;
+
+    BufferedWriter(const BufferedWriter &);
+    BufferedWriter &operator=(const BufferedWriter &);
+};
+#endif
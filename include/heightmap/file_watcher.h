@@ -0,0 +1,38 @@
+#ifndef HEIGHTMAP_FILE_WATCHER_H
+#define HEIGHTMAP_FILE_WATCHER_H
+
+#include <chrono>
+#include <string>
+
+// Default file watcher values
+const double FILE_WATCHER_SETTLE = 0.2; // seconds without further writes before a change is reported
+
+// Watches a single file through inotify. The directory of the file is watched rather than the file itself, so files
+// that are replaced by renaming a new file over them (as most writers and editors do) keep being watched. A change
+// is reported once the file was closed after writing or moved into place and no further event arrived for
+// FILE_WATCHER_SETTLE seconds, so snapshots written in several steps are only read once they are complete.
+class FileWatcher
+{
+public:
+    FileWatcher();
+    ~FileWatcher();
+
+    // replaces the watched file
+    bool watch(const std::string &filename);
+    void stop();
+    bool isWatching() const;
+
+    // true once per change, never blocks. Meant to be polled every frame
+    bool changed();
+
+private:
+    int fd;
+    int wd;
+    std::string name; // of the file within the watched directory
+    bool pending;
+    std::chrono::steady_clock::time_point lastEvent;
+
+    FileWatcher(const FileWatcher &);
+    FileWatcher &operator=(const FileWatcher &);
+};
+#endif
@@ -0,0 +1,96 @@
+#ifndef HEIGHTMAP_FRAME_PLAYER_H
+#define HEIGHTMAP_FRAME_PLAYER_H
+
+#include <heightmap/height_decoder.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Default frame player values
+const int FRAME_PLAYER_RING = 8;          // frames decoded ahead of the playhead, including the current one
+const double FRAME_PLAYER_RATE = 24.0;    // frames per second
+const double FRAME_PLAYER_MAX_RATE = 120.0;
+
+// Files of a numbered frame sequence: all files in the directory of filename whose names only differ from it in the
+// last run of digits, e.g. flood_0001.png, flood_0002.png, ... sorted by their number. Empty if filename has no number
+std::vector<std::string> find_frame_sequence(const std::string &filename);
+
+// the heights of a decoded frame
+struct DecodedFrame
+{
+    int index;
+    HeightPlane plane;
+};
+
+// counters of a frame player, decode times summed over all workers
+struct FramePlayerStats
+{
+    long long decoded;
+    long long failed;
+    long long presented;
+    long long dropped;     // frames the playhead passed without them being presented
+    long long bytes;       // decoded
+    double decodeMs;       // average per frame
+    double decodedPerSecond; // frames decoded per second of wall time while decoding
+    int ready;             // frames in the ring that are decoded and not taken yet
+    int decoding;
+};
+
+// Plays a numbered frame sequence at a target rate. The frames from the playhead on are decoded ahead on the job system
+// into a ring of FRAME_PLAYER_RING slots, moving the playhead reuses the slots of the frames it left behind. The player
+// only decodes: the caller asks update() for the frame the playhead is at every frame and takes it out of the ring once
+// it is decoded. A frame that is not decoded in time is skipped rather than waited for and counts as dropped once a
+// later frame is presented. Seeking (scrubbing) moves the playhead and restarts prefetching there, results of decodes
+// still running for frames no longer in the ring are discarded when they arrive.
+class FramePlayer
+{
+public:
+    FramePlayer();
+    ~FramePlayer();
+
+    // opens the sequence filename is a frame of, with the playhead at that frame
+    bool open(const std::string &filename);
+    void close();
+    bool isOpen() const;
+    int frameCount() const;
+    const std::string &frameName(int index) const;
+
+    void play();
+    void pause();
+    bool isPlaying() const;
+    void setRate(double framesPerSecond);
+    double rate() const;
+    void setLoop(bool loop);
+    // how the frames encode heights, frames decoded before are decoded again
+    void setDecoding(const HeightDecoding &decoding);
+    void seek(int index);
+
+    // moves the playhead by the time passed, starts decoding the frames ahead of it and returns it
+    int update();
+    int playhead() const;
+    // moves frame index out of the ring, false if it is not decoded (yet)
+    bool take(int index, DecodedFrame &frame);
+
+    FramePlayerStats stats() const;
+    void resetStats();
+
+private:
+    struct Shared;
+
+    std::shared_ptr<Shared> shared;
+    bool playing;
+    bool loop;
+    double framesPerSecond;
+    int position;  // playhead
+    int lastTaken; // frame presented last, -1 after seeking
+    std::chrono::steady_clock::time_point anchorTime; // the playhead was at anchorFrame at this time
+    int anchorFrame;
+
+    void prefetch();
+
+    FramePlayer(const FramePlayer &);
+    FramePlayer &operator=(const FramePlayer &);
+};
+#endif
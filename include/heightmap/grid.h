@@ -0,0 +1,155 @@
+#ifndef HEIGHTMAP_GRID_H
+#define HEIGHTMAP_GRID_H
+
+#include <heightmap/height_store.h>
+#include <heightmap/morton.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+const size_t RGBA = 4;
+
+// read-only view on the height data a grid is generated from: a decoded RGBA image whose heights are the product of
+// its color channels, a plane of heights in [0, 1] (see height_decoder.h) or a window of width x height heights
+// starting at (originX, originY) of a level of an out of core height store.
+// A plane may come with a copy in Z-order tiles (see morton.h), which the kernels read instead of the rows.
+// Without any of them the grid falls back to the sine function f(x, y)
+struct HeightmapView
+{
+    const unsigned char *pixels;
+    const float *heights;
+    const MortonHeights *morton;
+    int width;
+    int height;
+    const HeightStore *store;
+    int originX;
+    int originY;
+    int level;
+
+    HeightmapView(const unsigned char *pixels = nullptr, int width = 0, int height = 0)
+        : pixels(pixels), heights(nullptr), morton(nullptr), width(width), height(height), store(nullptr), originX(0),
+          originY(0), level(0) {}
+    HeightmapView(const float *heights, int width, int height)
+        : pixels(nullptr), heights(heights), morton(nullptr), width(width), height(height), store(nullptr), originX(0),
+          originY(0), level(0) {}
+    // heights is kept next to the tiled copy so views of the same plane still compare equal
+    HeightmapView(const float *heights, const MortonHeights *morton)
+        : pixels(nullptr), heights(heights), morton(morton), width(morton->width()), height(morton->height()),
+          store(nullptr), originX(0), originY(0), level(0) {}
+    HeightmapView(const HeightStore *store, int originX, int originY, int width, int height, int level = 0)
+        : pixels(nullptr), heights(nullptr), morton(nullptr), width(width), height(height), store(store),
+          originX(originX), originY(originY), level(level) {}
+
+    bool hasData() const { return pixels != nullptr || heights != nullptr || morton != nullptr || store != nullptr; }
+};
+
+// helper function to first draw a heightmap based on sin if no image has been loaded yet
+float f(float x, float y);
+
+// The grid has (N + 1) x (M + 1) vertices, vertex (i, j) is stored at i * (M + 1) + j.
+// It lies at x = j / N, y = i / M and takes its height from pixel column i and row j of the image.
+// Sampling a height store per vertex takes the cache lock every time, bulk passes read whole regions instead.
+inline glm::vec3 grid_position(const HeightmapView &image, float heightScaling, int N, int M, int i, int j)
+{
+    float x = (float)j / (float)N;
+    float y = (float)i / (float)M;
+    if (!image.hasData())
+        return glm::vec3(x, y, f(x, y));
+
+    // the last row and column of vertices reuse the border pixels of the image
+    int column = std::min(i, image.width - 1);
+    int row = std::min(j, image.height - 1);
+    if (image.morton != nullptr)
+        return glm::vec3(x, y, image.morton->at(column, row) * heightScaling / 100);
+    if (image.heights != nullptr)
+        return glm::vec3(x, y, image.heights[(size_t)row * image.width + column] * heightScaling / 100);
+    if (image.store != nullptr)
+    {
+        float height = image.store->sample(image.originX + column, image.originY + row, image.level);
+        return glm::vec3(x, y, height * heightScaling / 100);
+    }
+
+    size_t index = RGBA * ((size_t)row * image.width + column);
+    float red = static_cast<float>(image.pixels[index + 0]);
+    float green = static_cast<float>(image.pixels[index + 1]);
+    float blue = static_cast<float>(image.pixels[index + 2]);
+
+    float z = ((red * green * blue) / (255 * 255 * 255)) * heightScaling / 100;
+    return glm::vec3(x, y, z);
+}
+
+// A strided grid only keeps every stride-th vertex row and column of a grid plus the last ones, so all of its vertices
+// are vertices of the full grid. strided_quads is the number of quads along a side of n quads, strided_vertex the
+// full resolution index of vertex k along that side
+inline int strided_quads(int n, int stride)
+{
+    return (n + stride - 1) / stride;
+}
+
+inline int strided_vertex(int k, int n, int stride)
+{
+    return std::min(k * stride, n);
+}
+
+// normal of a vertex from its neighbours along both grid directions (central differences,
+// one sided at the border). The normal always points to positive z
+inline glm::vec3 grid_normal(const glm::vec3 &previousRow, const glm::vec3 &nextRow,
+                             const glm::vec3 &previousColumn, const glm::vec3 &nextColumn)
+{
+    glm::vec3 normal = glm::cross(nextRow - previousRow, nextColumn - previousColumn);
+    if (normal.z < 0)
+        normal = -normal;
+    return glm::normalize(normal);
+}
+
+// the passes of generate_grid. threads <= 0 uses all hardware threads
+// ---------------------------------------------------------------------
+void generate_positions(int N, int M, const HeightmapView &image, float heightScaling,
+                        std::vector<glm::vec3> &positions, int threads = 1);
+void generate_indices(int N, int M, std::vector<glm::uvec3> &indices, int threads = 1);
+void generate_normals(int N, int M, const std::vector<glm::vec3> &positions, std::vector<glm::vec3> &normals,
+                      int threads = 1);
+// combines positions and normals into a single array for usage in the shader
+void interleave(const std::vector<glm::vec3> &positions, const std::vector<glm::vec3> &normals,
+                std::vector<glm::vec3> &vertices, int threads = 1);
+
+// chunked variants of the passes for streaming consumers that never hold the whole mesh.
+// generate_position_rows fills positions with the vertex rows [firstRow, firstRow + rowCount).
+// generate_vertex_rows fills vertices with the interleaved position and normal of the vertex rows
+// [firstRow, firstRow + rowCount), reading one extra row on each side for the normals.
+// generate_index_rows fills indices with the triangles of the quad rows [firstRow, firstRow + rowCount),
+// with vertex indices relative to the whole grid
+void generate_position_rows(int N, int M, const HeightmapView &image, float heightScaling, int firstRow, int rowCount,
+                            std::vector<glm::vec3> &positions, int threads = 1);
+void generate_vertex_rows(int N, int M, const HeightmapView &image, float heightScaling, int firstRow, int rowCount,
+                          std::vector<glm::vec3> &vertices, int threads = 1);
+void generate_index_rows(int M, int firstRow, int rowCount, std::vector<glm::uvec3> &indices, int threads = 1);
+
+// the vertices [firstColumn, endColumn) of vertex row row of a grid
+struct GridSpan
+{
+    int row;
+    int firstColumn;
+    int endColumn;
+};
+
+// Vertices of an N x M grid whose position or normal differ between two height planes of width x height samples, one
+// span per vertex row. Changed heights are widened by one vertex on every side because the normals of the neighbours
+// read them. Rows without changes have no span
+void grid_dirty_spans(int N, int M, const float *before, const float *after, int width, int height,
+                      std::vector<GridSpan> &spans, int threads = 1);
+// fills vertices with the interleaved position and normal of every vertex of spans, one span after the other
+void generate_vertex_spans(int N, int M, const HeightmapView &image, float heightScaling,
+                           const std::vector<GridSpan> &spans, std::vector<glm::vec3> &vertices, int threads = 1);
+
+// lowest and highest z of all vertices of the grid
+void grid_height_range(int N, int M, const HeightmapView &image, float heightScaling, float &minZ, float &maxZ,
+                       int threads = 1);
+
+// generates the actual grid by filling the vertices (position, normal, position, ...) and indices vector
+void generate_grid(int N, int M, const HeightmapView &image, float heightScaling,
+                   std::vector<glm::vec3> &vertices, std::vector<glm::uvec3> &indices, int threads = 1);
+#endif
@@ -0,0 +1,65 @@
+#ifndef HEIGHTMAP_HEIGHT_DECODER_H
+#define HEIGHTMAP_HEIGHT_DECODER_H
+
+#include <string>
+#include <vector>
+
+// how the pixels of an image encode heights
+enum HeightEncoding
+{
+    HEIGHT_RGB_PRODUCT, // red * green * blue / 255^3, what the visualizer always used
+    HEIGHT_LUMINANCE,   // Rec. 709 luma of the color
+    HEIGHT_CHANNEL,     // a single 8 bit channel
+    HEIGHT_TERRAIN_RGB, // Mapbox Terrain-RGB: -10000 + (R * 65536 + G * 256 + B) * 0.1 meters
+    HEIGHT_TERRARIUM,   // Terrarium: R * 256 + G + B / 256 - 32768 meters
+    HEIGHT_GRAY16,      // 16 bit grayscale, e.g. 16 bit PNG or PGM
+    HEIGHT_ENCODING_COUNT
+};
+
+const char *height_encoding_name(HeightEncoding encoding);
+// names as used on the command line (rgb-product, luminance, channel, terrain-rgb, terrarium, gray16)
+bool height_encoding_from_name(const std::string &name, HeightEncoding &encoding);
+
+struct HeightDecoding
+{
+    HeightEncoding encoding;
+    int channel; // 0 - 3 (red, green, blue, alpha) for HEIGHT_CHANNEL
+
+    HeightDecoding(HeightEncoding encoding = HEIGHT_RGB_PRODUCT, int channel = 0) : encoding(encoding), channel(channel) {}
+};
+
+// Heights decoded from an image, one float per pixel in row major order. Heights are in [0, 1] like the samples of a
+// height store: the 8 and 16 bit encodings keep their fraction of the full range, the encodings in meters are
+// normalized from their lowest to their highest height, which minimum and maximum keep in meters
+struct HeightPlane
+{
+    int width;
+    int height;
+    std::vector<float> heights;
+    float minimum; // decoded units before normalization
+    float maximum;
+    HeightDecoding decoding; // the decoding the heights came from
+
+    HeightPlane() : width(0), height(0), minimum(0.0f), maximum(1.0f) {}
+};
+
+// Converts width x height RGBA pixels into a height plane. The conversion kernels run on SIMD_LANES pixels at a time
+// and rows are spread over threads, threads <= 0 uses all hardware threads. HEIGHT_GRAY16 needs the 16 bit values,
+// RGBA pixels only give it 8 bits of precision
+void decode_heights(const unsigned char *rgba, int width, int height, const HeightDecoding &decoding, HeightPlane &plane,
+                    int threads = 1);
+// 16 bit gray values into a height plane
+void decode_heights16(const unsigned short *gray, int width, int height, HeightPlane &plane, int threads = 1);
+
+// maps the heights of a plane from their lowest to their highest value onto [0, 1] and keeps both in minimum and maximum
+void normalize_heights(HeightPlane &plane, int threads = 1);
+
+// Loads an image file and decodes it into a height plane, 16 bit files stay at 16 bits for HEIGHT_GRAY16.
+// Failures are printed to the console, verbose = false only prints failures
+bool load_heights(const std::string &filename, const HeightDecoding &decoding, HeightPlane &plane, int threads = 1,
+                  bool verbose = true);
+// Loads an image at 1 / stride of its resolution: every stride x stride pixels are box filtered into one height while
+// decoding, so only the pixels and the reduced plane are in memory
+bool load_heights_strided(const std::string &filename, const HeightDecoding &decoding, int stride, HeightPlane &plane,
+                          int threads = 1, bool verbose = true);
+#endif
@@ -0,0 +1,197 @@
+#ifndef HEIGHTMAP_HEIGHT_STORE_H
+#define HEIGHTMAP_HEIGHT_STORE_H
+
+#include <heightmap/height_decoder.h>
+#include <heightmap/tile_reader.h>
+
+#include <memory_stats.h>
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Default height store values
+const int HEIGHT_STORE_TILE_SIZE = 256;            // heights per tile side
+const long long HEIGHT_STORE_BUDGET = 512LL << 20; // bytes of decoded tiles kept in memory
+const long long HEIGHT_STORE_DATA_OFFSET = 4096;   // tiles start here, the header is padded to this size
+const char HEIGHT_STORE_MAGIC[4] = {'H', 'T', 'S', '1'};
+
+// which reduction of the heights below a sample of a downsampled level is read
+enum HeightChannel
+{
+    HEIGHT_AVERAGE,
+    HEIGHT_MIN,
+    HEIGHT_MAX,
+    HEIGHT_CHANNEL_COUNT
+};
+
+// Layout of a height store file (.hts): this header and the level table, padded to HEIGHT_STORE_DATA_OFFSET,
+// followed by the tiles of all levels. Level 0 holds the full resolution heights, every further level halves the
+// resolution of the previous one until a level fits into a single tile. Tiles of a level are stored in row major
+// order, every tile holds one plane of tileSize x tileSize little endian floats per channel in row major order;
+// level 0 only has the average channel, downsampled levels store average, min and max. Tiles at the right and
+// bottom border are padded. Heights are normalized to [0, 1] the same way grid_position converts pixels
+// (red * green * blue / 255^3), so heightScaling is applied while sampling. Version 1 files have no level table
+// and only level 0.
+struct HeightStoreHeader
+{
+    char magic[4];
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t tileSize;
+    int32_t levelCount;
+    uint32_t reserved[2];
+};
+
+// entry of the level table that directly follows the header
+struct HeightStoreLevel
+{
+    int32_t width;
+    int32_t height;
+    int32_t tilesX;
+    int32_t tilesY;
+    int32_t channels;
+    uint32_t reserved;
+    int64_t offset; // of the first tile from the beginning of the file
+};
+
+// cache counters of a height store
+struct HeightStoreStats
+{
+    long long hits;
+    long long misses;     // tiles a sampling call had to wait for
+    long long prefetches; // tiles read ahead of time by prefetch
+    long long evictions;
+    long long residentTiles;
+    long long residentBytes;
+};
+
+// Writes a height store row by row. Rows are collected per band of tiles and a band is written as soon as a row
+// of another band arrives, so rows may come in any order within a band (e.g. bottom up for flipped images).
+// close() computes the downsampled levels from the written file tile by tile.
+class HeightStoreWriter
+{
+public:
+    HeightStoreWriter();
+    ~HeightStoreWriter();
+
+    bool create(const std::string &filename, int width, int height, int tileSize = HEIGHT_STORE_TILE_SIZE);
+    // copies width normalized heights into row y
+    void writeRow(int y, const float *heights);
+    // writes the last band and the downsampled levels, returns false if any write failed
+    bool close();
+
+private:
+    int fd;
+    std::string filename;
+    int width;
+    int height;
+    int tileSize;
+    std::vector<HeightStoreLevel> levels;
+    int band;
+    std::vector<float> bandHeights;
+    MemoryReservation bandMemory;
+    bool failed;
+
+    void flushBand();
+    void writeLevels();
+
+    HeightStoreWriter(const HeightStoreWriter &);
+    HeightStoreWriter &operator=(const HeightStoreWriter &);
+};
+
+// Builds a height store from an image, decoding its pixels like load_heights. Binary 8 bit PGM and PPM files are
+// streamed row by row, so they can be larger than memory (the encodings in meters read them twice to find their
+// range), every other format is decoded with load_heights first. flipVertically matches
+// stbi_set_flip_vertically_on_load.
+bool build_height_store(const std::string &imageFilename, const std::string &storeFilename, bool flipVertically,
+                        const HeightDecoding &decoding = HeightDecoding(), int tileSize = HEIGHT_STORE_TILE_SIZE);
+
+// Read-only, random access view on a height store file. Tiles are read on demand and kept in an LRU cache that
+// stays below the memory budget. All sampling functions are thread safe; tiles are read from disk outside of
+// the cache lock, so workers missing different tiles read them in parallel. Reads go through a TileReader, which
+// also lets prefetching queue many tiles at once.
+class HeightStore
+{
+public:
+    HeightStore();
+    ~HeightStore();
+
+    bool open(const std::string &filename, long long budgetBytes = HEIGHT_STORE_BUDGET);
+    void close();
+    bool isOpen() const;
+
+    // size of level 0
+    int width() const;
+    int height() const;
+    int tileSize() const;
+    int levelCount() const;
+    const HeightStoreLevel &level(int level) const;
+
+    // changes the budget and evicts tiles until it is met again. At least one tile always stays resident
+    void setBudget(long long bytes);
+    long long budget() const;
+
+    // height at (x, y) of a level, coordinates are clamped to the level
+    float sample(int x, int y, int level = 0, HeightChannel channel = HEIGHT_AVERAGE) const;
+    // copies the heights of the region [x, x + regionWidth) x [y, y + regionHeight) of a level into out in row
+    // major order. The region has to lie inside the level
+    void readRegion(int x, int y, int regionWidth, int regionHeight, float *out, int level = 0,
+                    HeightChannel channel = HEIGHT_AVERAGE) const;
+
+    // whether a tile, or all tiles below a region, can be sampled without reading from disk
+    bool isResident(int level, int tileX, int tileY) const;
+    bool isRegionResident(int x, int y, int regionWidth, int regionHeight, int level = 0) const;
+    // reads a tile into the cache unless it is resident already
+    void prefetch(int level, int tileX, int tileY) const;
+    // queues the read of a tile that is neither resident nor being read already and returns whether it did.
+    // done is called on a reader thread once the tile is resident. Queued reads start with submitReads()
+    bool prefetchAsync(int level, int tileX, int tileY, const std::function<void()> &done) const;
+    void submitReads() const;
+
+    HeightStoreStats stats() const;
+    void resetStats();
+    TileReaderStats readerStats() const;
+    std::string readerBackend() const;
+
+private:
+    typedef std::shared_ptr<const std::vector<float>> Tile;
+    struct CachedTile
+    {
+        long long key;
+        Tile heights;
+    };
+
+    int fd;
+    HeightStoreHeader header;
+    std::vector<HeightStoreLevel> levels;
+    std::vector<long long> firstKeys; // cache key of the first tile of every level
+    long long budgetBytes;
+
+    mutable std::mutex mutex;
+    mutable std::list<CachedTile> lru; // most recently used first
+    mutable std::unordered_map<long long, std::list<CachedTile>::iterator> tiles;
+    mutable std::unordered_set<long long> loading; // keys of asynchronous reads in flight
+    mutable HeightStoreStats counters;
+    mutable MemoryReservation cacheMemory;
+    mutable TileReader reader;
+
+    long long tileKey(int level, int tileX, int tileY) const;
+    Tile tile(int level, int tileX, int tileY, bool prefetching = false) const;
+    Tile readTile(int level, int tileX, int tileY) const;
+    long long tileOffset(int level, int tileX, int tileY) const;
+    size_t tileBytes(int level) const;
+    Tile insert(long long key, const Tile &heights) const;
+    void evict() const;
+
+    HeightStore(const HeightStore &);
+    HeightStore &operator=(const HeightStore &);
+};
+#endif
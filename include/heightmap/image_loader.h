@@ -0,0 +1,11 @@
+#ifndef HEIGHTMAP_IMAGE_LOADER_H
+#define HEIGHTMAP_IMAGE_LOADER_H
+
+#include <string>
+#include <vector>
+
+// loads an image as RGBA into the image vector, x and y receive the width and height of the image.
+// error handling is done through printing related strings into the console for now, verbose = false
+// only prints failures
+bool load_image(std::vector<unsigned char> &image, const std::string &filename, int &x, int &y, bool verbose = true);
+#endif
@@ -0,0 +1,79 @@
+#ifndef HEIGHTMAP_IMAGE_PROBE_H
+#define HEIGHTMAP_IMAGE_PROBE_H
+
+#include <heightmap/height_decoder.h>
+
+#include <string>
+
+// Default load budget values
+const long long LOAD_BUDGET = 8LL << 30; // bytes a load may cost if the size of the physical memory is unknown
+const int LOAD_MAX_STRIDE = 64;          // coarsest strided load before a file is converted or rejected
+
+enum ProbeFormat
+{
+    PROBE_IMAGE,        // anything stb_image decodes
+    PROBE_HEIGHT_STORE, // .hts, streamed tile by tile
+    PROBE_TEXT_DEM,     // ESRI ASCII grid, imported into a height store
+    PROBE_UNKNOWN
+};
+
+// what the header of a file tells without decoding it
+struct ImageProbe
+{
+    ProbeFormat format;
+    int width;
+    int height;
+    int channels;
+    int bitsPerChannel;
+    bool streamable; // build_height_store converts it row by row (binary 8 bit PGM and PPM)
+    long long fileBytes;
+
+    ImageProbe()
+        : format(PROBE_UNKNOWN), width(0), height(0), channels(0), bitsPerChannel(8), streamable(false), fileBytes(0) {}
+};
+
+// Reads the size and bit depth of an image with stbi_info and stbi_is_16_bit, or from the header of a height store or
+// an ESRI ASCII grid. False if the file is missing or none of them recognizes it
+bool probe_image(const std::string &filename, ImageProbe &probe);
+
+// bytes a load of every stride-th pixel costs at its peak
+struct LoadEstimate
+{
+    long long image;  // the decoded heights
+    long long decode; // pixels and compressed data while decoding
+    long long mesh;   // vertices and indices of the full grid on the CPU
+    long long gpu;    // vertex and index buffers of the full grid
+
+    LoadEstimate() : image(0), decode(0), mesh(0), gpu(0) {}
+    long long total() const { return image + decode + mesh + gpu; }
+};
+
+LoadEstimate estimate_load(const ImageProbe &probe, const HeightDecoding &decoding, int stride = 1);
+
+enum LoadMode
+{
+    LOAD_FULL,     // decode at full resolution
+    LOAD_STRIDED,  // box filter every stride x stride pixels into one height while decoding
+    LOAD_TILED,    // convert into a height store and stream it
+    LOAD_REJECTED, // neither fits, decoding would exhaust the memory
+    LOAD_MODE_COUNT
+};
+
+const char *load_mode_name(LoadMode mode);
+
+struct LoadPlan
+{
+    LoadMode mode;
+    int stride;
+    LoadEstimate estimate; // of the chosen mode, of the full load if rejected
+
+    LoadPlan() : mode(LOAD_FULL), stride(1) {}
+};
+
+// Admission before decoding: a full load if its estimate fits into budgetBytes, else the smallest stride that fits,
+// else a height store if the file streams into one. Height stores and text DEMs are tiled anyway
+LoadPlan plan_load(const ImageProbe &probe, const HeightDecoding &decoding, long long budgetBytes);
+
+// three quarters of the physical memory, LOAD_BUDGET if it is unknown
+long long default_load_budget();
+#endif
@@ -0,0 +1,106 @@
+#ifndef HEIGHTMAP_JOB_SYSTEM_H
+#define HEIGHTMAP_JOB_SYSTEM_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Default job system values
+const double JOB_SYSTEM_UTILISATION_INTERVAL = 0.5; // seconds over which the utilisation of the workers is averaged
+
+struct Job;
+typedef std::shared_ptr<Job> JobHandle;
+
+// counters of a single worker, busy time is the time spent running jobs
+struct JobWorkerStats
+{
+    long long executed; // jobs run by this worker
+    long long stolen;   // jobs taken from another worker's deque
+    double busySeconds;
+    float utilisation; // share of the last JOB_SYSTEM_UTILISATION_INTERVAL spent running jobs
+};
+
+// Work stealing scheduler shared by loading, meshing and analysis. Every worker owns a deque: jobs submitted by a
+// worker go to the back of its own deque and are taken from there again, so nested work stays hot in its cache,
+// while idle workers steal the oldest jobs from the front of other deques. Threads that are not workers submit to
+// a shared deque that all workers steal from. A job may depend on other jobs and is only queued once all of them
+// finished. wait() runs other jobs while the job waited for is not finished, so jobs may wait on jobs they submitted.
+// Work that has to happen on the thread owning the GL context, e.g. buffer uploads of finished meshes, is posted
+// with runOnMainThread() and executed by runMainThreadJobs() from the render loop.
+class JobSystem
+{
+public:
+    static JobSystem &instance()
+    {
+        static JobSystem jobSystem;
+        return jobSystem;
+    }
+
+    // workers besides the thread calling wait(), hardware threads - 1 by default
+    int workerCount() const;
+
+    JobHandle submit(const std::function<void()> &fn);
+    JobHandle submit(const std::function<void()> &fn, const std::vector<JobHandle> &dependencies);
+    // a job without work that finishes once all dependencies finished
+    JobHandle whenAll(const std::vector<JobHandle> &dependencies);
+    void wait(const JobHandle &job);
+    void waitAll(const std::vector<JobHandle> &jobs);
+    bool isDone(const JobHandle &job) const;
+
+    // queues fn for the main thread, may be called from any thread
+    void runOnMainThread(const std::function<void()> &fn);
+    // runs the queued main thread work, returns the number of functions run
+    int runMainThreadJobs();
+    int mainThreadPending() const;
+
+    // jobs queued and not started yet
+    int queuedJobs() const;
+    std::vector<JobWorkerStats> stats();
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<JobHandle> jobs;
+        std::thread thread;
+        std::atomic<long long> executed;
+        std::atomic<long long> stolen;
+        std::atomic<long long> busyNanoseconds;
+        std::atomic<long long> runningSince; // start of the running job in nanoseconds of the steady clock, 0 if idle
+        long long lastBusyNanoseconds;       // at the last utilisation update, including the running job
+        float utilisation;
+
+        Worker() : executed(0), stolen(0), busyNanoseconds(0), runningSince(0), lastBusyNanoseconds(0), utilisation(0.0f) {}
+    };
+
+    // workers[0 .. workerCount) belong to the worker threads, the last deque is shared by all other threads
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<int> queued;
+    std::atomic<bool> stopping;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::chrono::steady_clock::time_point lastUpdate;
+
+    mutable std::mutex mainMutex;
+    std::vector<std::function<void()>> mainJobs;
+
+    JobSystem();
+    ~JobSystem();
+
+    void schedule(const JobHandle &job);
+    JobHandle take(int self);
+    void execute(const JobHandle &job, int self);
+    void finish(const JobHandle &job);
+    void run(int self);
+
+    JobSystem(const JobSystem &);
+    JobSystem &operator=(const JobSystem &);
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef HEIGHTMAP_MAPPED_FILE_H
+#define HEIGHTMAP_MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only mapping of a whole file, for parsers that read large files once from front to back. The kernel reads
+// ahead of the sequential access and drops pages behind it, so only a part of the file is resident at a time
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // fails for empty files
+    bool open(const std::string &filename);
+    void close();
+
+    const char *data() const;
+    size_t size() const;
+
+private:
+    const char *mapped;
+    size_t length;
+
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+};
+#endif
@@ -0,0 +1,150 @@
+#ifndef HEIGHTMAP_MESH_CACHE_H
+#define HEIGHTMAP_MESH_CACHE_H
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Default mesh cache values
+const long long MESH_CACHE_LIMIT = 2LL << 30;       // bytes of all entries together
+const long long MESH_CACHE_DATA_OFFSET = 4096;     // vertices start here, the header is padded to this size
+const char MESH_CACHE_DIRECTORY[] = "mesh_cache";
+const char MESH_CACHE_MAGIC[4] = {'H', 'M', 'C', '1'};
+
+// 64 bit hash of a block of bytes, not cryptographic. Four independent lanes of 8 byte words so it runs at memory speed
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = 0);
+// hash of the contents of a file, 0 if it cannot be read
+uint64_t hash_file(const std::string &filename);
+
+// everything a generated grid depends on: the bytes of the source file and the parameters of generate_grid
+struct MeshCacheKey
+{
+    uint64_t sourceHash;
+    int32_t N;
+    int32_t M;
+    float heightScaling;
+    int32_t originX; // window and level of height stores, 0 for images
+    int32_t originY;
+    int32_t level;
+    int32_t encoding; // HeightEncoding and channel of images, 0 for height stores
+    int32_t channel;
+    int32_t resample; // ResampleFilter + 1 of resampled images, 0 otherwise
+    int32_t reserved;
+};
+
+// Layout of a cache entry (.mesh): this header padded to MESH_CACHE_DATA_OFFSET, the interleaved vertices (position,
+// normal, ...) as vec3 and the triangles as uvec3, both exactly as generate_grid returns them, so a mapped entry is
+// handed to glBufferData as it is
+struct MeshCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    MeshCacheKey key;
+    int64_t vertexCount; // vec3, positions and normals
+    int64_t triangleCount;
+    int64_t vertexOffset;
+    int64_t indexOffset;
+};
+
+// counters of a mesh cache, entries and bytes as of the last scan of the directory
+struct MeshCacheStats
+{
+    long long hits;
+    long long misses;
+    long long writes;
+    long long evictions;
+    long long entries;
+    long long bytes;
+};
+
+// read-only memory mapping of a cache entry
+class MappedMesh
+{
+public:
+    MappedMesh();
+    ~MappedMesh();
+
+    bool open(const std::string &filename, const MeshCacheKey &key);
+    void close();
+
+    const glm::vec3 *vertices() const;
+    const glm::uvec3 *indices() const;
+    size_t vertexCount() const;
+    size_t triangleCount() const;
+
+private:
+    void *data;
+    size_t size;
+
+    MappedMesh(const MappedMesh &);
+    MappedMesh &operator=(const MappedMesh &);
+};
+
+// Writes a cache entry piece by piece at the offsets the pieces have in the whole grid, from any number of threads at
+// once. The entry is written to a temporary file and only renamed to its final name by commit, so a crash never leaves
+// a truncated entry behind
+class MeshCacheWriter
+{
+public:
+    MeshCacheWriter();
+    ~MeshCacheWriter();
+
+    bool create(const std::string &filename, const MeshCacheKey &key, size_t vertexCount, size_t triangleCount);
+    bool isOpen() const;
+    // offsets and counts in vec3 and uvec3
+    void writeVertices(size_t offset, const glm::vec3 *vertices, size_t count);
+    void writeIndices(size_t offset, const glm::uvec3 *indices, size_t count);
+    bool commit();
+    void abort();
+    long long size() const;
+
+private:
+    int fd;
+    std::string filename;
+    std::string temporary;
+    MeshCacheHeader header;
+    std::atomic<bool> failed;
+
+    void write(const void *data, size_t size, long long offset);
+
+    MeshCacheWriter(const MeshCacheWriter &);
+    MeshCacheWriter &operator=(const MeshCacheWriter &);
+};
+
+// Content addressed cache of generated grids on disk. Every key maps to one file in the cache directory; entries are
+// used least recently used first when the cache grows beyond its limit, with the modification time of a file as its
+// last use. Entries larger than the limit are never written.
+class MeshCache
+{
+public:
+    MeshCache();
+
+    void setDirectory(const std::string &directory);
+    void setLimit(long long bytes);
+    long long limit() const;
+
+    std::string entryPath(const MeshCacheKey &key) const;
+    // maps the entry of key, false if there is none
+    bool lookup(const MeshCacheKey &key, MappedMesh &mesh);
+    // starts writing the entry of key, false if it would exceed the limit or cannot be created
+    bool begin(const MeshCacheKey &key, size_t vertexCount, size_t triangleCount, MeshCacheWriter &writer);
+    // commits a written entry and evicts old ones until the cache fits into its limit again
+    bool finish(MeshCacheWriter &writer);
+    // removes all entries
+    void clear();
+
+    MeshCacheStats stats() const;
+
+private:
+    std::string directory;
+    long long limitBytes;
+    mutable std::mutex mutex;
+    MeshCacheStats counters;
+
+    void evict(long long limit);
+};
+#endif
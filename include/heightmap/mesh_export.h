@@ -0,0 +1,26 @@
+#ifndef HEIGHTMAP_MESH_EXPORT_H
+#define HEIGHTMAP_MESH_EXPORT_H
+
+#include <heightmap/grid.h>
+
+#include <string>
+
+// file formats the grid can be exported to
+enum MeshFormat
+{
+    MESH_PLY, // binary little endian PLY with positions, normals and indexed faces
+    MESH_STL, // binary STL, unindexed triangles with facet normals
+    MESH_GLB, // binary glTF 2.0 with interleaved positions and normals and 32 bit indices
+    MESH_3MF, // 3D manufacturing format, only supported for solids (see solid_export.h)
+    MESH_UNKNOWN
+};
+
+// picks the format from the extension of filename (.ply, .stl, .glb, .3mf)
+MeshFormat mesh_format_from_filename(const std::string &filename);
+
+// Streams the grid of generate_grid directly from the height data into a file. The mesh is generated and written
+// chunkRows rows of vertices at a time, so memory stays bounded by a few chunks no matter how large the grid is.
+// chunkRows <= 0 picks chunks of a few million vertices. Returns the number of bytes written or 0 on failure
+long long export_mesh(const std::string &filename, MeshFormat format, int N, int M, const HeightmapView &image,
+                      float heightScaling, int threads = 1, int chunkRows = 0);
+#endif
@@ -0,0 +1,101 @@
+#ifndef HEIGHTMAP_MESH_PIPELINE_H
+#define HEIGHTMAP_MESH_PIPELINE_H
+
+#include <heightmap/grid.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Default mesh pipeline values
+const int MESH_PIPELINE_BAND_VERTICES = 1 << 18; // vertices per band, bands have at least one vertex row
+const int MESH_PIPELINE_DEPTH = 4;               // bands generated or waiting for their upload at the same time
+const int MESH_PIPELINE_PREVIEW_STRIDE = 16;     // stride of the first level of a progressively refined grid
+const int MESH_PIPELINE_REFINE_FACTOR = 4;       // every further level divides the stride by this
+const long long MESH_PIPELINE_PREVIEW_VERTICES = 1 << 20; // smaller grids are generated at full resolution right away
+
+// stages every band passes through
+enum MeshStage
+{
+    MESH_STAGE_DECODE,  // reads the heights of the band, including a halo row on each side
+    MESH_STAGE_CONVERT, // scales heights to vertex positions
+    MESH_STAGE_MESH,    // triangles of the band
+    MESH_STAGE_NORMALS, // normals, interleaved with the positions
+    MESH_STAGE_UPLOAD,  // main thread
+    MESH_STAGE_COUNT
+};
+
+const char *mesh_stage_name(MeshStage stage);
+
+// The vertex rows [firstRow, firstRow + rowCount) of a grid and the triangles of its quad rows
+// [firstRow, firstRow + quadRows), laid out exactly like the same rows of generate_grid. vertexOffset and indexOffset
+// are the positions of the band in the vertices (in vec3) and indices of the whole grid. Rows, offsets and vertex
+// indices of strided grids refer to the strided grid
+struct MeshBand
+{
+    int firstRow;
+    int rowCount;
+    int quadRows;
+    size_t vertexOffset;
+    size_t indexOffset;
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::uvec3> indices;
+};
+
+// called on the main thread for every finished band, the band is released afterwards
+typedef std::function<void(const MeshBand &band)> MeshBandUpload;
+// called on a worker for every finished band before it goes to the main thread, e.g. to write it to disk
+typedef std::function<void(const MeshBand &band)> MeshBandSink;
+
+// progress and stage timings of the last run, all times in milliseconds
+struct MeshPipelineStats
+{
+    int bands;
+    int uploaded;
+    int inFlight;         // bands started and not uploaded yet
+    int peakInFlight;
+    long long peakBytes;  // of the bands in flight
+    double firstBandMs;   // from start until the first band was uploaded
+    double totalMs;       // from start until the last band was uploaded, the time so far while running
+    double stageMs[MESH_STAGE_COUNT]; // summed over all bands and threads
+};
+
+// Generates a grid band by band as a graph of jobs instead of running every pass over the whole grid one after the
+// other: decode -> convert -> (mesh, normals) -> upload. At most MESH_PIPELINE_DEPTH bands are in flight and every
+// upload starts the next band, so band k is uploaded while the following ones are meshed and decoded, the memory
+// besides the GL buffers stays at a few bands, and the first rows are on screen long before the whole grid is done.
+// Progressive refinement runs the pipeline once per level, from a coarse stride down to the full grid.
+// The upload callback runs from JobSystem::runMainThreadJobs, where the caller copies the band into buffers
+// allocated for the whole grid; uploadedQuadRows() tells how many quad rows can be drawn from them so far. The view
+// has to stay valid until finished was called.
+class MeshPipeline
+{
+public:
+    MeshPipeline();
+
+    // generates the strided grid of an N x M grid, see strided_quads. Its vertices keep the positions they have in
+    // the full grid, so the levels of a progressively refined grid line up
+    void start(int N, int M, const HeightmapView &image, float heightScaling, const MeshBandUpload &upload,
+               const std::function<void()> &finished, int stride = 1, const MeshBandSink &sink = MeshBandSink());
+    bool isRunning() const;
+
+    // quad rows from the first one on whose vertices and triangles are all uploaded, including the band passed to
+    // the upload callback while it runs. Main thread only
+    int uploadedQuadRows() const;
+    MeshPipelineStats stats() const;
+
+private:
+    struct Band;
+    struct Run;
+
+    std::shared_ptr<Run> run;
+
+    static void startBand(const std::shared_ptr<Run> &run);
+    static void uploadBand(const std::shared_ptr<Run> &run, const std::shared_ptr<Band> &band);
+
+    MeshPipeline(const MeshPipeline &);
+    MeshPipeline &operator=(const MeshPipeline &);
+};
+#endif
@@ -0,0 +1,79 @@
+#ifndef HEIGHTMAP_MORTON_H
+#define HEIGHTMAP_MORTON_H
+
+#include <memory_stats.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Default Morton layout values
+const int MORTON_TILE_BITS = 4;                     // 16 x 16 heights per tile, a row of a tile is one cache line
+const int MORTON_BLOCK_BITS = 4;                    // 16 x 16 tiles per block, 256 KB
+const long long MORTON_MIN_HEIGHTS = 2048LL * 2048; // smaller planes stay in the caches in row major order anyway
+
+// spreads the low 16 bits of v to the even bits of the result
+inline uint32_t morton_spread(uint32_t v)
+{
+    v &= 0xFFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+// Z-order index of (x, y): the bits of x and y interleaved, x in the even bits
+inline uint32_t morton_encode(uint32_t x, uint32_t y)
+{
+    return morton_spread(x) | (morton_spread(y) << 1);
+}
+
+// A copy of a row major height plane in a cache friendly layout. The plane is cut into tiles of 16 x 16 heights,
+// every tile is stored as 16 rows of 16 heights (one cache line each), and the tiles of a block of 16 x 16 tiles
+// follow each other in Z-order, so the neighbours of a height in both directions are mostly in the same tile and
+// the neighbouring tiles are close by, usually on the same page. Blocks are stored in row major order; their padding
+// beyond the plane is never read. Because the Z-order interleaves the bits of x and y, the offset of a height is the
+// sum of an offset of its column and an offset of its row, both looked up in tables built once
+class MortonHeights
+{
+public:
+    MortonHeights();
+
+    // converts width x height row major heights, one tile row of 16 heights per copy, rows spread over threads
+    // (threads <= 0 uses all hardware threads)
+    void assign(const float *heights, int width, int height, int threads = 0);
+    void clear();
+    bool empty() const;
+
+    int width() const;
+    int height() const;
+
+    float at(int x, int y) const
+    {
+        return data[columnOffsets[x] + rowOffsets[y]];
+    }
+
+    // the heights of column x start here, height y of the column is at rowOffset(y)
+    const float *column(int x) const
+    {
+        return data.data() + columnOffsets[x];
+    }
+
+    size_t rowOffset(int y) const
+    {
+        return rowOffsets[y];
+    }
+
+private:
+    int columns;
+    int rows;
+    std::vector<float> data;
+    std::vector<size_t> columnOffsets;
+    std::vector<size_t> rowOffsets;
+    MemoryReservation memory;
+
+    MortonHeights(const MortonHeights &);
+    MortonHeights &operator=(const MortonHeights &);
+};
+#endif
@@ -0,0 +1,110 @@
+#ifndef HEIGHTMAP_MOSAIC_H
+#define HEIGHTMAP_MOSAIC_H
+
+#include <heightmap/height_decoder.h>
+
+#include <memory_stats.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Default mosaic values
+const long long MOSAIC_BUDGET = 1LL << 30; // bytes of decoded tiles kept in memory
+
+enum MosaicTileFormat
+{
+    MOSAIC_HGT,        // SRTM tile named after its south west corner (N45E006.hgt), big endian 16 bit meters
+    MOSAIC_ESRI_ASCII, // ESRI ASCII grid, placed by the corner in its header
+    MOSAIC_IMAGE,      // image placed by a world file next to it (.pgw, .pngw, .wld, ...)
+    MOSAIC_TILE_FORMAT_COUNT
+};
+
+// a tile of a mosaic, placed on the sample grid of the mosaic whose rows run from south to north
+struct MosaicTile
+{
+    std::string filename;
+    MosaicTileFormat format;
+    int width; // samples
+    int height;
+    int x; // of the south west sample in the mosaic
+    int y;
+    double west; // coordinates of the south west sample
+    double south;
+};
+
+struct MosaicStats
+{
+    long long decoded; // tiles decoded so far
+    long long hits;    // tiles a window found decoded already
+    long long evictions;
+    long long residentTiles;
+    long long residentBytes;
+    double decodeMs; // of the last window
+};
+
+// Many adjacent DEM tiles as one heightfield. open() indexes a directory by the extents in the tile headers, file names
+// or world files without decoding anything. readWindow() decodes the tiles below a window on the job system, keeps
+// them in an LRU cache below a memory budget and copies their samples onto the sample grid of the mosaic. Tiles that
+// share their edge samples (like SRTM tiles) are placed onto the same samples, so a window across them has every edge
+// sample once and the grid has no duplicated vertices along the seams. All tiles need the cell size of the first one.
+// Rows of image tiles are expected bottom up, as with stbi_set_flip_vertically_on_load(true)
+class Mosaic
+{
+public:
+    Mosaic();
+    ~Mosaic();
+
+    bool open(const std::string &directory);
+    void close();
+    bool isOpen() const;
+
+    // samples of the whole mosaic
+    int width() const;
+    int height() const;
+    double cellSize() const;
+    double west() const;
+    double south() const;
+    size_t tileCount() const;
+    const MosaicTile &tile(size_t index) const;
+
+    void setBudget(long long bytes);
+    // Heights of width x height samples, every stride-th one from (x, y) on, normalized to [0, 1] by the range of the
+    // window like the meter encodings of the height decoders. Samples no tile covers get the lowest height. Tiles are
+    // decoded by threads, threads <= 0 uses all hardware threads. Returns false if no tile lies below the window
+    bool readWindow(int x, int y, int width, int height, int stride, const HeightDecoding &decoding, HeightPlane &plane,
+                    int threads = 0);
+
+    MosaicStats stats() const;
+
+private:
+    typedef std::shared_ptr<const std::vector<float>> Samples; // of a tile in the units of its file, rows bottom up
+
+    std::vector<MosaicTile> tiles;
+    int samplesX;
+    int samplesY;
+    double cell;
+    double originWest;
+    double originSouth;
+    long long budgetBytes;
+    HeightDecoding cachedDecoding; // image tiles in the cache were decoded with it
+
+    mutable std::mutex mutex;
+    std::list<size_t> lru; // tile indices, most recently used first
+    std::unordered_map<size_t, std::pair<Samples, std::list<size_t>::iterator>> cache;
+    MosaicStats counters;
+    MemoryReservation cacheMemory;
+
+    bool addTile(MosaicTile &tile, double cellSize);
+    void evict(const std::vector<size_t> &keep);
+
+    Mosaic(const Mosaic &);
+    Mosaic &operator=(const Mosaic &);
+};
+
+// decodes a single tile into its samples in the units of the file, rows bottom up. Voids of SRTM tiles are NaN
+bool decode_mosaic_tile(const MosaicTile &tile, const HeightDecoding &decoding, std::vector<float> &samples);
+#endif
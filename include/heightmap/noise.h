@@ -0,0 +1,51 @@
+#ifndef HEIGHTMAP_NOISE_H
+#define HEIGHTMAP_NOISE_H
+
+#include <heightmap/height_store.h>
+#include <heightmap/simd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Default noise values
+const int NOISE_LANES = SIMD_LANES;        // samples computed at once by the vectorised path
+const int NOISE_MAX_OCTAVES = 16;
+const float NOISE_WAVELENGTH = 1024.0f;    // samples per feature of the first octave
+
+enum NoiseType
+{
+    NOISE_SIMPLEX, // a single octave
+    NOISE_FBM,     // fractal Brownian motion, octaves of simplex noise summed with decreasing amplitude
+    NOISE_RIDGED,  // ridged multifractal, sharp crests where the noise crosses zero
+    NOISE_TYPE_COUNT
+};
+
+const char *noise_type_name(NoiseType type);
+
+// parameters of a procedural heightfield, the same options and seed always give the same heights
+struct NoiseOptions
+{
+    NoiseType type;
+    uint32_t seed;
+    float wavelength; // in samples, of the first octave
+    int octaves;
+    float lacunarity; // frequency factor from one octave to the next
+    float gain;       // amplitude factor from one octave to the next
+
+    NoiseOptions()
+        : type(NOISE_FBM), seed(1), wavelength(NOISE_WAVELENGTH), octaves(8), lacunarity(2.0f), gain(0.5f) {}
+};
+
+// height of sample (x, y) in [0, 1], one sample at a time. Reference for noise_row
+float noise_sample(const NoiseOptions &options, int x, int y);
+// heights of the samples [x, x + count) of row y, NOISE_LANES samples at a time. Equal to noise_sample up to rounding
+void noise_row(const NoiseOptions &options, int x, int y, int count, float *out);
+// heights of a region in row major order, rows are spread over threads. threads <= 0 uses all hardware threads
+void noise_region(const NoiseOptions &options, int x, int y, int width, int height, float *out, int threads = 1);
+
+// Writes a width x height heightfield straight into a height store, one band of tiles at a time, so the size is only
+// limited by the disk. rowsDone (optional) counts the rows generated so far. Returns false if writing failed
+bool build_noise_store(const std::string &storeFilename, int width, int height, const NoiseOptions &options,
+                       int threads = 0, std::atomic<int> *rowsDone = nullptr, int tileSize = HEIGHT_STORE_TILE_SIZE);
+#endif
@@ -0,0 +1,55 @@
+#ifndef HEIGHTMAP_PARALLEL_H
+#define HEIGHTMAP_PARALLEL_H
+
+#include <heightmap/job_system.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// number of threads used when a caller passes 0 threads
+inline int default_thread_count()
+{
+    unsigned int threads = std::thread::hardware_concurrency();
+    return threads == 0 ? 1 : (int)threads;
+}
+
+// Splits [begin, end) into ranges and calls fn(rangeBegin, rangeEnd) for each of them on the job system. The calling
+// thread works on the ranges as well and returns once all of them are done; it may itself be a job. There are a few
+// ranges per thread, handed out by a shared counter, so threads that got cheap ranges take over the rest instead of
+// waiting for a slow one. threads <= 0 uses all hardware threads, more threads than workers + 1 are not used.
+template <typename Function>
+void parallel_for(int begin, int end, int threads, Function fn)
+{
+    JobSystem &jobs = JobSystem::instance();
+    if (threads <= 0)
+        threads = default_thread_count();
+    int count = end - begin;
+    threads = std::max(1, std::min(std::min(threads, count), jobs.workerCount() + 1));
+    if (threads == 1)
+    {
+        if (count > 0)
+            fn(begin, end);
+        return;
+    }
+
+    int chunks = std::min(count, threads * 4);
+    int step = count / chunks;
+    int remainder = count % chunks;
+    std::atomic<int> next(0);
+    auto runChunks = [&]() {
+        int chunk;
+        while ((chunk = next.fetch_add(1)) < chunks)
+        {
+            int rangeBegin = begin + chunk * step + std::min(chunk, remainder);
+            fn(rangeBegin, rangeBegin + step + (chunk < remainder ? 1 : 0));
+        }
+    };
+    std::vector<JobHandle> helpers;
+    for (int t = 1; t < threads; ++t)
+        helpers.push_back(jobs.submit(runChunks));
+    runChunks();
+    jobs.waitAll(helpers);
+}
+#endif
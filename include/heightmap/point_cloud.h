@@ -0,0 +1,86 @@
+#ifndef HEIGHTMAP_POINT_CLOUD_H
+#define HEIGHTMAP_POINT_CLOUD_H
+
+#include <heightmap/height_decoder.h>
+
+#include <atomic>
+#include <string>
+
+// Default point cloud values
+const int POINT_CLOUD_RESOLUTION = 2048;                  // cells along the longer side of the cloud
+const int POINT_CLOUD_BATCH = 1 << 20;                    // points binned per batch of a pass
+const long long POINT_CLOUD_PARTIAL_BUDGET = 1LL << 30;   // bytes of all per-thread partial grids together
+const int POINT_CLOUD_FILL_RADIUS = 16;                   // cells searched around a hole
+
+enum PointCloudFormat
+{
+    POINT_CLOUD_LAS, // ASPRS LAS 1.0 - 1.4, uncompressed
+    POINT_CLOUD_XYZ, // one "x y z" point per line in any order
+    POINT_CLOUD_UNKNOWN
+};
+
+// format by the file extension (.las, .xyz, .txt, .pts)
+PointCloudFormat point_cloud_format(const std::string &filename);
+
+// which height of the points that fall into a cell is kept
+enum PointReduction
+{
+    POINT_MIN,  // lowest point, ground under vegetation
+    POINT_MAX,  // highest point, surface models with canopy and roofs
+    POINT_MEAN,
+    POINT_REDUCTION_COUNT
+};
+
+// how cells without any point get a height
+enum HoleFill
+{
+    HOLE_FILL_NONE,    // the lowest height
+    HOLE_FILL_NEAREST, // the height of the nearest cell with points
+    HOLE_FILL_IDW,     // inverse distance weighted mean of the cells with points around it
+    HOLE_FILL_COUNT
+};
+
+const char *point_reduction_name(PointReduction reduction);
+const char *hole_fill_name(HoleFill fill);
+
+struct PointCloudOptions
+{
+    int resolution;     // cells along the longer side, the cells are square
+    PointReduction reduction;
+    HoleFill fill;
+    int fillRadius;     // holes farther than this from any point get the lowest height
+    float idwPower;     // weights are 1 / distance^idwPower
+    int classification; // only LAS points of this class (e.g. 2 for ground), -1 for all points
+
+    PointCloudOptions()
+        : resolution(POINT_CLOUD_RESOLUTION), reduction(POINT_MAX), fill(HOLE_FILL_IDW),
+          fillRadius(POINT_CLOUD_FILL_RADIUS), idwPower(2.0f), classification(-1) {}
+};
+
+// extent and counts of a gridded cloud
+struct PointCloudInfo
+{
+    PointCloudFormat format;
+    long long points;   // in the file
+    long long binned;   // that passed the classification filter
+    double minX, minY, minZ;
+    double maxX, maxY, maxZ;
+    double cellSize;
+    long long holes;    // cells without any point
+
+    PointCloudInfo()
+        : format(POINT_CLOUD_UNKNOWN), points(0), binned(0), minX(0.0), minY(0.0), minZ(0.0), maxX(0.0), maxY(0.0),
+          maxZ(0.0), cellSize(0.0), holes(0) {}
+};
+
+// Bins the points of a LAS or XYZ file into a grid of heights, ready to be meshed like a decoded image. The file is
+// mapped and streamed in batches of POINT_CLOUD_BATCH points: every thread bins into its own partial grid, so no cell
+// is shared between threads, and the partial grids are merged at the end by the reduction. XYZ files take one more
+// pass for their extent, LAS headers have it. Holes are filled afterwards, rows spread over threads. The plane is
+// normalized to [0, 1] from the lowest to the highest cell, minimum and maximum keep them in the units of the file.
+// threads <= 0 uses all hardware threads, fewer are used if their partial grids would exceed
+// POINT_CLOUD_PARTIAL_BUDGET. pointsDone (optional) counts the points binned so far, the extent pass of XYZ files is not
+// counted, so it ends at the number of points. Errors are printed
+bool grid_point_cloud(const std::string &filename, const PointCloudOptions &options, HeightPlane &plane,
+                      int threads = 0, std::atomic<long long> *pointsDone = nullptr, PointCloudInfo *info = nullptr);
+#endif
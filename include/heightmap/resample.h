@@ -0,0 +1,31 @@
+#ifndef HEIGHTMAP_RESAMPLE_H
+#define HEIGHTMAP_RESAMPLE_H
+
+#include <heightmap/height_decoder.h>
+
+#include <string>
+
+enum ResampleFilter
+{
+    RESAMPLE_BOX,      // mean of the heights below a target sample, nearest height when enlarging
+    RESAMPLE_BILINEAR, // triangle filter
+    RESAMPLE_BICUBIC,  // Catmull-Rom spline
+    RESAMPLE_LANCZOS3, // windowed sinc with three lobes, sharpest, may ring at cliffs
+    RESAMPLE_FILTER_COUNT
+};
+
+const char *resample_filter_name(ResampleFilter filter);
+// names as used on the command line (box, bilinear, bicubic, lanczos3)
+bool resample_filter_from_name(const std::string &name, ResampleFilter &filter);
+
+// the size with the longer side at resolution and the aspect ratio of width x height, at least 2 samples per side
+void resample_size(int width, int height, int resolution, int &targetWidth, int &targetHeight);
+
+// Resamples a height plane to width x height with a separable filter. Sample centers of both planes are spread evenly
+// over the same extent and the filter widens by the reduction when shrinking, so every source height contributes. Each
+// target row is first filtered vertically from the source rows below it, SIMD_LANES columns at a time, then
+// horizontally, SIMD_LANES taps at a time; rows are spread over threads (threads <= 0 uses all hardware threads) and
+// no intermediate plane is kept. Heights stay in [0, 1], the overshoot of bicubic and Lanczos is clamped
+void resample_heights(const HeightPlane &source, int width, int height, ResampleFilter filter, HeightPlane &target,
+                      int threads = 0);
+#endif
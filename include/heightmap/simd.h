@@ -0,0 +1,58 @@
+#ifndef HEIGHTMAP_SIMD_H
+#define HEIGHTMAP_SIMD_H
+
+#include <cstdint>
+#include <cstring>
+
+// Default SIMD values
+#if defined(__AVX__)
+const int SIMD_LANES = 8; // 32 bit values in one register
+#else
+const int SIMD_LANES = 4;
+#endif
+
+// Vectors of SIMD_LANES values through the GCC/Clang vector extensions. Arithmetic, comparisons and bit operations work
+// element wise and compile to whatever SIMD instructions the target has (SSE, AVX, NEON), scalars in mixed expressions
+// are broadcast. Comparisons give masks with all bits of an element set or cleared. Casts between vector types of the
+// same size reinterpret the bits, __builtin_convertvector converts the values
+typedef float SimdFloat __attribute__((vector_size(SIMD_LANES * sizeof(float))));
+typedef int32_t SimdInt __attribute__((vector_size(SIMD_LANES * sizeof(int32_t))));
+typedef uint32_t SimdUInt __attribute__((vector_size(SIMD_LANES * sizeof(uint32_t))));
+typedef uint16_t SimdUShort __attribute__((vector_size(SIMD_LANES * sizeof(uint16_t))));
+
+// unaligned loads and stores
+inline SimdFloat simd_load(const float *p)
+{
+    SimdFloat v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline void simd_store(float *p, SimdFloat v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+// SIMD_LANES RGBA pixels, one per element
+inline SimdUInt simd_load_pixels(const unsigned char *rgba)
+{
+    SimdUInt v;
+    memcpy(&v, rgba, sizeof(v));
+    return v;
+}
+
+inline SimdFloat simd_select(SimdInt mask, SimdFloat a, SimdFloat b)
+{
+    return (SimdFloat)((mask & (SimdInt)a) | (~mask & (SimdInt)b));
+}
+
+inline SimdFloat simd_min(SimdFloat a, SimdFloat b)
+{
+    return simd_select(a < b, a, b);
+}
+
+inline SimdFloat simd_max(SimdFloat a, SimdFloat b)
+{
+    return simd_select(a > b, a, b);
+}
+#endif
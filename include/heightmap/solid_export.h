@@ -0,0 +1,27 @@
+#ifndef HEIGHTMAP_SOLID_EXPORT_H
+#define HEIGHTMAP_SOLID_EXPORT_H
+
+#include <heightmap/grid.h>
+#include <heightmap/mesh_export.h>
+
+#include <string>
+
+// options of a printable solid
+struct SolidOptions
+{
+    float scale;         // factor applied to all coordinates, 100 makes a square heightmap 100 mm wide
+    float baseThickness; // thickness of the base below the lowest point of the surface, before scaling
+    bool decimate;       // replace flat blocks of the surface with triangle fans
+    int blockSize;       // quads per side of the blocks considered for decimation
+    float flatTolerance; // height difference up to which a block counts as flat, before scaling
+
+    SolidOptions() : scale(100.0f), baseThickness(0.05f), decimate(false), blockSize(16), flatTolerance(1e-4f) {}
+};
+
+// Streams the grid as a closed, printable solid: the surface of generate_grid, side walls along all four borders
+// and a base plate below the lowest point. With decimation every flat block of blockSize x blockSize quads is
+// replaced by a fan around its center that keeps all border vertices, so the mesh stays watertight without
+// T-junctions. Supports MESH_STL and MESH_3MF. Returns the number of bytes written or 0 on failure
+long long export_solid(const std::string &filename, MeshFormat format, int N, int M, const HeightmapView &image,
+                       float heightScaling, const SolidOptions &options = SolidOptions(), int threads = 1);
+#endif
@@ -0,0 +1,90 @@
+#ifndef HEIGHTMAP_TEXT_DEM_H
+#define HEIGHTMAP_TEXT_DEM_H
+
+#include <heightmap/height_decoder.h>
+#include <heightmap/height_store.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Default text DEM values
+const long long TEXT_DEM_CHUNK = 4LL << 20; // bytes of text parsed by one job, chunks end at line boundaries
+
+enum TextDemFormat
+{
+    TEXT_DEM_ESRI_ASCII, // ESRI ASCII grid (.asc): a header of ncols, nrows, corner, cellsize and NODATA_value,
+                         // then nrows rows of ncols heights, the northern row first
+    TEXT_DEM_XYZ,        // one "x y z" point per line (.xyz), points of a regular grid sorted by row and column
+    TEXT_DEM_UNKNOWN
+};
+
+// format by the file extension
+TextDemFormat text_dem_format(const std::string &filename);
+
+// size and range of a text DEM, heights in the units of the file
+struct TextDemInfo
+{
+    TextDemFormat format;
+    int width;
+    int height;
+    double originX; // lower left corner
+    double originY;
+    double cellSize;
+    bool hasNoData;
+    float noData;   // heights equal to this are holes, they are written at the lowest height
+    float minimum;  // of all heights that are not holes
+    float maximum;
+    bool topDown;   // the first row of the file is the northern one
+    long long bytes;
+
+    TextDemInfo()
+        : format(TEXT_DEM_UNKNOWN), width(0), height(0), originX(0.0), originY(0.0), cellSize(1.0), hasNoData(false),
+          noData(-9999.0f), minimum(0.0f), maximum(0.0f), topDown(true), bytes(0) {}
+};
+
+// Parses a decimal floating point number like -12, 3.25 or 1.5e-3 starting at p, without locales or iostreams.
+// Returns the first character after the number, or nullptr if there is no number at p
+const char *parse_double(const char *p, const char *end, double &value);
+const char *parse_float(const char *p, const char *end, float &value);
+
+// characters between the numbers of a line and between lines
+inline bool is_separator(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ',' || c == ';';
+}
+
+inline const char *skip_separators(const char *p, const char *end)
+{
+    while (p < end && is_separator(*p))
+        ++p;
+    return p;
+}
+
+// Splits the text [begin, end) into chunks of about TEXT_DEM_CHUNK bytes that end at line boundaries. boundaries
+// receives begin and the end of every chunk, one more entry than there are chunks
+void split_text_chunks(const char *begin, const char *end, std::vector<const char *> &boundaries);
+
+// reads only the header of an ESRI ASCII grid: size, corner, cell size and NODATA value, but not the range of the heights.
+// XYZ files have no header, their size needs scan_text_dem
+bool read_text_dem_header(const std::string &filename, TextDemInfo &info);
+
+// Maps the file, reads the header and parses all heights once, in chunks spread over threads (threads <= 0 uses
+// all hardware threads), to find the size and the range of the heights. Errors are printed to the console.
+// bytesDone (optional) counts the bytes parsed so far
+bool scan_text_dem(const std::string &filename, TextDemInfo &info, int threads = 0,
+                   std::atomic<long long> *bytesDone = nullptr);
+
+// Converts a text DEM into a height store without holding more than a few chunks of it in memory. The file is
+// scanned first, then parsed a second time in batches of chunks whose heights, normalized to [0, 1] by the range of
+// the scan, are written row by row. flipVertically matches stbi_set_flip_vertically_on_load. bytesDone (optional)
+// counts the bytes parsed so far by both passes, twice the file size in total. info (optional) receives the scan
+bool build_text_dem_store(const std::string &filename, const std::string &storeFilename, bool flipVertically,
+                          int threads = 0, std::atomic<long long> *bytesDone = nullptr, TextDemInfo *info = nullptr,
+                          int tileSize = HEIGHT_STORE_TILE_SIZE);
+// Parses a text DEM that fits into memory into a height plane, normalized like build_text_dem_store with the range in
+// the units of the file kept in minimum and maximum. The scan finds where the heights of every chunk start, so the
+// second pass parses all chunks in parallel straight into their rows
+bool load_text_dem(const std::string &filename, HeightPlane &plane, bool flipVertically, int threads = 0,
+                   TextDemInfo *info = nullptr);
+#endif
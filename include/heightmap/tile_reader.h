@@ -0,0 +1,100 @@
+#ifndef HEIGHTMAP_TILE_READER_H
+#define HEIGHTMAP_TILE_READER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Default tile reader values
+const int TILE_READER_QUEUE_DEPTH = 32;    // reads in flight at most
+const int TILE_READER_THREADS = 4;         // threads of the fallback when io_uring is not available
+const size_t TILE_READER_ALIGNMENT = 4096; // alignment of buffers, offsets and sizes for O_DIRECT
+
+// called once a read finished, data is only valid during the call
+typedef std::function<void(const char *data, size_t size, bool success)> TileReadCallback;
+
+// counters of a tile reader
+struct TileReaderStats
+{
+    int inFlight;        // reads submitted and not completed yet
+    int pending;         // reads queued behind the queue depth
+    int peakInFlight;    // highest queue depth reached
+    long long completed; // reads completed, including failed ones
+    long long failed;
+    long long bytes;     // bytes read successfully
+    double averageMs;    // latency from submission to completion
+    double maxMs;
+};
+
+// Asynchronous reader of fixed blocks of a file. Reads are queued with read() and handed to the kernel in one batch
+// by submit(), at most queueDepth at a time; the rest waits and is submitted as earlier reads complete. Completion
+// callbacks run on the reader's own threads. With io_uring every batch is a single system call and a single thread
+// reaps the completions, otherwise a pool of threads issues blocking preads. The file is opened with O_DIRECT where
+// the file system supports it, so tiles bypass the page cache that the tile cache would only duplicate; all offsets
+// and sizes then have to be multiples of TILE_READER_ALIGNMENT.
+class TileReader
+{
+public:
+    TileReader();
+    ~TileReader();
+
+    bool open(const std::string &filename, bool direct = true, int queueDepth = TILE_READER_QUEUE_DEPTH);
+    void close();
+    bool isOpen() const;
+    // "io_uring" or "thread pool", with " + O_DIRECT" if the page cache is bypassed
+    std::string backend() const;
+
+    // queues a read of size bytes at offset, done is called once it completed. Urgent reads go to the front of the
+    // queue, e.g. the ones somebody is waiting for
+    void read(long long offset, size_t size, const TileReadCallback &done, bool urgent = false);
+    // submits the queued reads
+    void submit();
+    // reads size bytes at offset into out and waits for them, must not be called from a completion callback
+    bool readSync(long long offset, size_t size, void *out);
+
+    TileReaderStats stats() const;
+    void resetStats();
+
+private:
+    struct Request
+    {
+        long long offset;
+        size_t size;
+        size_t alignedSize;
+        char *buffer;
+        TileReadCallback done;
+        double submitted; // seconds, see now()
+        void *iov;        // iovec of io_uring reads
+    };
+    struct Ring;
+
+    int fd;
+    bool direct;
+    int queueDepth;
+    Ring *ring;
+    std::vector<std::thread> threads;
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Request *> pending;   // queued, not handed to the kernel or the pool yet
+    std::deque<Request *> submitted; // handed to the pool, only used without io_uring
+    int inFlight;
+    bool stopping;
+    TileReaderStats counters;
+    double latencySeconds;
+
+    static double now();
+    bool setupRing();
+    void submitRing();
+    void reapRing();
+    void runPool();
+    void complete(Request *request, long long result);
+
+    TileReader(const TileReader &);
+    TileReader &operator=(const TileReader &);
+};
+#endif
@@ -0,0 +1,86 @@
+#ifndef HEIGHTMAP_TILE_STREAMER_H
+#define HEIGHTMAP_TILE_STREAMER_H
+
+#include <heightmap/height_store.h>
+
+#include <glm/glm.hpp>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Default tile streamer values
+const float TILE_STREAMER_PIXEL_ERROR = 2.0f; // screen pixels a single sample may cover before a finer level is needed
+const float TILE_STREAMER_LOOKAHEAD = 1.0f;   // seconds the camera is extrapolated along its velocity for prefetching
+const int TILE_STREAMER_RADIUS = 4;           // tiles requested around the camera per level at most
+
+// camera as seen by the streamer, all distances are in level 0 samples of the store
+struct StreamerView
+{
+    glm::vec2 position; // camera position projected onto the store
+    float altitude;     // distance of the camera above the terrain
+    glm::vec2 velocity; // samples per second
+    float fieldOfView;  // vertical field of view in radians
+    int screenHeight;   // pixels
+};
+
+// counters of the tile streamer
+struct TileStreamerStats
+{
+    long long requested; // tiles requested by update, including resident ones
+    long long loaded;    // tiles read from disk by the streamer
+    int queued;          // requests waiting for the streamer thread
+    int reading;         // requests handed to the tile reader and not completed yet
+    double loadMs;       // average time from handing a request to the reader until its tile is resident
+};
+
+// Keeps the tiles of a height store resident that the camera needs. Every update determines per level the tiles
+// whose samples cover no more than TILE_STREAMER_PIXEL_ERROR pixels around the camera, plus the same around the
+// position the camera reaches after TILE_STREAMER_LOOKAHEAD seconds. The requests replace the pending ones of the
+// previous update and are read in the background, coarse levels and near tiles first, so the render thread only
+// ever samples tiles that are resident. The streamer thread keeps up to TILE_READER_QUEUE_DEPTH reads in flight
+// and hands them to the tile reader in batches.
+class TileStreamer
+{
+public:
+    TileStreamer();
+    ~TileStreamer();
+
+    void start(const HeightStore *store);
+    void stop();
+
+    void update(const StreamerView &view);
+    // finest level whose samples are small enough at the given distance from the camera
+    int levelForDistance(const StreamerView &view, float distance) const;
+
+    TileStreamerStats stats() const;
+
+private:
+    struct TileRequest
+    {
+        int level;
+        int tileX;
+        int tileY;
+        float priority; // lower first
+    };
+
+    const HeightStore *store;
+    std::thread thread;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<TileRequest> queue; // sorted by descending priority, the next request is at the back
+    bool stopping;
+    int reading;
+    std::condition_variable readDone;
+    TileStreamerStats counters;
+    double loadSeconds;
+
+    void request(const StreamerView &view, const glm::vec2 &position, float priorityOffset,
+                 std::vector<TileRequest> &requests) const;
+    void run();
+
+    TileStreamer(const TileStreamer &);
+    TileStreamer &operator=(const TileStreamer &);
+};
+#endif
@@ -0,0 +1,177 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#include <atomic>
+#include <cstdio>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+// subsystems whose memory is accounted for separately
+enum MemoryCategory
+{
+    MEMORY_IMAGE,      // decoded height data
+    MEMORY_MESH,       // vertex and index buffers on the CPU
+    MEMORY_TRANSIENT,  // temporaries that only live during mesh generation
+    MEMORY_GL_BUFFERS, // sizes passed to glBufferData
+    MEMORY_CATEGORY_COUNT
+};
+
+inline const char *memory_category_name(MemoryCategory category)
+{
+    switch (category)
+    {
+    case MEMORY_IMAGE:
+        return "Image";
+    case MEMORY_MESH:
+        return "Mesh";
+    case MEMORY_TRANSIENT:
+        return "Transient";
+    case MEMORY_GL_BUFFERS:
+        return "GL Buffers";
+    default:
+        return "Unknown";
+    }
+}
+
+// Process wide byte counters per subsystem with peak watermarks. The counters are atomic so that
+// worker threads can account for their buffers too.
+class MemoryStats
+{
+public:
+    static MemoryStats &instance()
+    {
+        static MemoryStats stats;
+        return stats;
+    }
+
+    void add(MemoryCategory category, long long bytes)
+    {
+        long long value = current[category].fetch_add(bytes) + bytes;
+        raise(peak[category], value);
+        raise(totalPeak, total.fetch_add(bytes) + bytes);
+    }
+
+    void sub(MemoryCategory category, long long bytes)
+    {
+        current[category].fetch_sub(bytes);
+        total.fetch_sub(bytes);
+    }
+
+    long long bytes(MemoryCategory category) const
+    {
+        return current[category].load();
+    }
+
+    long long peakBytes(MemoryCategory category) const
+    {
+        return peak[category].load();
+    }
+
+    long long totalBytes() const
+    {
+        return total.load();
+    }
+
+    long long totalPeakBytes() const
+    {
+        return totalPeak.load();
+    }
+
+    // sets the peak watermarks back to the current values
+    void resetPeaks()
+    {
+        for (int i = 0; i < MEMORY_CATEGORY_COUNT; ++i)
+            peak[i].store(current[i].load());
+        totalPeak.store(total.load());
+    }
+
+private:
+    std::atomic<long long> current[MEMORY_CATEGORY_COUNT];
+    std::atomic<long long> peak[MEMORY_CATEGORY_COUNT];
+    std::atomic<long long> total;
+    std::atomic<long long> totalPeak;
+
+    MemoryStats() : total(0), totalPeak(0)
+    {
+        for (int i = 0; i < MEMORY_CATEGORY_COUNT; ++i)
+        {
+            current[i].store(0);
+            peak[i].store(0);
+        }
+    }
+
+    static void raise(std::atomic<long long> &watermark, long long value)
+    {
+        long long previous = watermark.load();
+        while (previous < value && !watermark.compare_exchange_weak(previous, value))
+        {
+        }
+    }
+};
+
+// Accounts for a block of memory of a subsystem for as long as it lives. set() is called whenever the
+// owner grows or shrinks, e.g. with the capacity of a vector after it has been filled.
+class MemoryReservation
+{
+public:
+    MemoryReservation(MemoryCategory category, long long bytes = 0) : category(category), bytes(0)
+    {
+        // makes sure the stats outlive reservations with static storage duration
+        MemoryStats::instance();
+        set(bytes);
+    }
+
+    ~MemoryReservation()
+    {
+        set(0);
+    }
+
+    void set(long long newBytes)
+    {
+        if (newBytes > bytes)
+            MemoryStats::instance().add(category, newBytes - bytes);
+        else if (newBytes < bytes)
+            MemoryStats::instance().sub(category, bytes - newBytes);
+        bytes = newBytes;
+    }
+
+    template <typename T>
+    void set(const std::vector<T> &vector)
+    {
+        set((long long)(vector.capacity() * sizeof(T)));
+    }
+
+    long long size() const
+    {
+        return bytes;
+    }
+
+private:
+    MemoryCategory category;
+    long long bytes;
+
+    MemoryReservation(const MemoryReservation &);
+    MemoryReservation &operator=(const MemoryReservation &);
+};
+
+// resident set size of the whole process or 0 where it cannot be determined
+inline long long process_resident_bytes()
+{
+#ifdef __linux__
+    long long pages = 0;
+    long long resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr)
+        return 0;
+    if (fscanf(statm, "%lld %lld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(statm);
+    return resident * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+#endif
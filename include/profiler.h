@@ -0,0 +1,226 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Default profiler values
+const size_t PROFILER_MAX_EVENTS_PER_THREAD = 1 << 20; // further events are dropped to keep long sessions bounded
+
+// a finished zone, times are microseconds since the profiler was created
+struct ProfileEvent
+{
+    const char *name;
+    double start;
+    double duration;
+};
+
+// the events of a single thread. Only the owning thread appends, the mutex is uncontended
+// except while the trace is being exported or cleared
+struct ProfileThread
+{
+    unsigned id;
+    std::string name;
+    std::mutex mutex;
+    std::vector<ProfileEvent> events;
+    size_t dropped;
+
+    ProfileThread() : id(0), dropped(0) {}
+};
+
+// Collects scoped CPU timing zones of all threads and exports them in the Chrome trace_event format
+// (chrome://tracing, Perfetto). Recording is switched on and off at runtime; a disabled profiler only
+// costs a relaxed atomic load per zone. Zone names have to be string literals since only the pointer is stored.
+class Profiler
+{
+public:
+    static Profiler &instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    bool enabled() const
+    {
+        return recording.load(std::memory_order_relaxed);
+    }
+
+    void setEnabled(bool enable)
+    {
+        recording.store(enable, std::memory_order_relaxed);
+    }
+
+    // microseconds since the profiler was created
+    double now() const
+    {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    void record(const char *name, double start, double end)
+    {
+        ProfileThread &thread = current();
+        std::lock_guard<std::mutex> lock(thread.mutex);
+        if (thread.events.size() >= PROFILER_MAX_EVENTS_PER_THREAD)
+        {
+            ++thread.dropped;
+            return;
+        }
+        ProfileEvent event = {name, start, end - start};
+        thread.events.push_back(event);
+    }
+
+    // names the calling thread in the exported trace
+    void setThreadName(const std::string &name)
+    {
+        ProfileThread &thread = current();
+        std::lock_guard<std::mutex> lock(thread.mutex);
+        thread.name = name;
+    }
+
+    size_t eventCount()
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        size_t count = 0;
+        for (size_t i = 0; i < threads.size(); ++i)
+        {
+            std::lock_guard<std::mutex> threadLock(threads[i]->mutex);
+            count += threads[i]->events.size();
+        }
+        return count;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        for (size_t i = 0; i < threads.size(); ++i)
+        {
+            std::lock_guard<std::mutex> threadLock(threads[i]->mutex);
+            threads[i]->events.clear();
+            threads[i]->dropped = 0;
+        }
+    }
+
+    // writes all recorded events as Chrome trace_event JSON. Returns false if the file could not be written
+    bool writeChromeTrace(const std::string &filename)
+    {
+        std::ofstream file(filename);
+        if (!file)
+        {
+            std::cout << "Failed to open " << filename << " for writing\n";
+            return false;
+        }
+
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        for (size_t i = 0; i < threads.size(); ++i)
+        {
+            ProfileThread &thread = *threads[i];
+            std::lock_guard<std::mutex> threadLock(thread.mutex);
+
+            file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.id
+                 << ",\"args\":{\"name\":\"";
+            writeJsonString(file, thread.name.c_str());
+            file << "\"}}";
+            first = false;
+
+            file.precision(3);
+            file << std::fixed;
+            for (size_t j = 0; j < thread.events.size(); ++j)
+            {
+                const ProfileEvent &event = thread.events[j];
+                file << ",\n{\"name\":\"";
+                writeJsonString(file, event.name);
+                file << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread.id
+                     << ",\"ts\":" << event.start << ",\"dur\":" << event.duration << "}";
+            }
+            if (thread.dropped > 0)
+                std::cout << "Profiler: dropped " << thread.dropped << " events of thread " << thread.name << '\n';
+        }
+        file << "\n]}\n";
+        return (bool)file;
+    }
+
+private:
+    std::atomic<bool> recording;
+    std::chrono::steady_clock::time_point epoch;
+    std::mutex threadsMutex;
+    // threads are never removed so that events of finished threads survive until the export
+    std::vector<std::unique_ptr<ProfileThread>> threads;
+
+    Profiler() : recording(false), epoch(std::chrono::steady_clock::now()) {}
+
+    // writes text escaped for a JSON string, quotes, backslashes and control characters would break the trace
+    static void writeJsonString(std::ostream &out, const char *text)
+    {
+        const char *hex = "0123456789abcdef";
+        for (const char *c = text; *c != '\0'; ++c)
+        {
+            unsigned char character = (unsigned char)*c;
+            if (character == '"' || character == '\\')
+                out << '\\' << *c;
+            else if (character < 0x20)
+                out << "\\u00" << hex[character >> 4] << hex[character & 15];
+            else
+                out << *c;
+        }
+    }
+
+    // returns the event buffer of the calling thread and registers it on first use
+    ProfileThread &current()
+    {
+        thread_local ProfileThread *thread = nullptr;
+        if (thread == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(threadsMutex);
+            threads.push_back(std::unique_ptr<ProfileThread>(new ProfileThread()));
+            thread = threads.back().get();
+            thread->id = (unsigned)threads.size();
+            thread->name = "thread " + std::to_string(thread->id);
+        }
+        return *thread;
+    }
+};
+
+// measures the lifetime of the enclosing scope if the profiler is recording
+class ProfileZone
+{
+public:
+    ProfileZone(const char *name) : name(name), start(-1.0)
+    {
+        Profiler &profiler = Profiler::instance();
+        if (profiler.enabled())
+            start = profiler.now();
+    }
+
+    ~ProfileZone()
+    {
+        stop();
+    }
+
+    // ends the zone before the end of the scope, for zones that cover only a part of a function
+    void stop()
+    {
+        if (start < 0.0)
+            return;
+        Profiler &profiler = Profiler::instance();
+        profiler.record(name, start, profiler.now());
+        start = -1.0;
+    }
+
+private:
+    const char *name;
+    double start;
+};
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+// opens a zone that lasts until the end of the current scope
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#endif
@@ -0,0 +1,354 @@
+// Headless benchmark of image loading, height decoding, resampling, procedural terrain and mesh generation on synthetic
+// heightmaps.
+// Writes one JSON document with all measurements so that runs of different versions can be compared.
+//
+// usage: heightmap_bench [--sizes 256,1024,4096,16384] [--threads 1,2,4] [--repeat 3]
+//                        [--memory-limit <MB>] [--output heightmap_bench.json]
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+
+#include <heightmap/grid.h>
+#include <heightmap/height_decoder.h>
+#include <heightmap/image_loader.h>
+#include <heightmap/noise.h>
+#include <heightmap/parallel.h>
+#include <heightmap/resample.h>
+
+#include <memory_stats.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <math.h>
+
+#include "stb_image_write.h"
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+// a single measurement, serialized as one entry of the results array
+struct BenchResult
+{
+   int size;
+   std::string stage;
+   std::string format;
+   int threads;
+   double seconds;
+   double mverticesPerSecond;
+   long long peakBytes;
+   bool skipped;
+};
+
+// parses comma separated numbers like "256,1024"
+std::vector<int> parse_list(const std::string &list)
+{
+   std::vector<int> values;
+   std::stringstream stream(list);
+   std::string item;
+   while (std::getline(stream, item, ','))
+   {
+      if (!item.empty())
+         values.push_back(std::stoi(item));
+   }
+   return values;
+}
+
+// peak resident set size of the process so far, 0 if unknown
+long long process_peak_bytes()
+{
+#ifdef __linux__
+   struct rusage usage;
+   getrusage(RUSAGE_SELF, &usage);
+   return (long long)usage.ru_maxrss * 1024;
+#else
+   return 0;
+#endif
+}
+
+// physical memory of the machine, 0 if unknown
+long long physical_memory_bytes()
+{
+#ifdef __linux__
+   return (long long)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+#else
+   return 0;
+#endif
+}
+
+// deterministic gray terrain with a few octaves of sines so that every pixel differs from its neighbours
+// ------------------------------------------------------------------------------------------------------
+void synthetic_heightmap(int size, std::vector<unsigned char> &image)
+{
+   image.resize((size_t)size * size * RGBA);
+   parallel_for(0, size, 0, [&](int begin, int end) {
+      for (int y = begin; y < end; ++y)
+      {
+         for (int x = 0; x < size; ++x)
+         {
+            float u = (float)x / size;
+            float v = (float)y / size;
+            float h = 0.5f + 0.25f * sin(u * 6.0f) * cos(v * 5.0f) + 0.15f * sin(u * 37.0f + v * 23.0f) +
+                      0.1f * sin(u * 211.0f) * sin(v * 197.0f);
+            unsigned char gray = (unsigned char)(glm::clamp(h, 0.0f, 1.0f) * 255.0f);
+            unsigned char *pixel = &image[RGBA * ((size_t)y * size + x)];
+            pixel[0] = pixel[1] = pixel[2] = gray;
+            pixel[3] = 255;
+         }
+      }
+   });
+}
+
+// writes the image as binary PPM, which stb_image decodes without any decompression
+bool write_ppm(const std::string &filename, int size, const std::vector<unsigned char> &image)
+{
+   std::ofstream file(filename, std::ios::binary);
+   file << "P6\n"
+        << size << ' ' << size << "\n255\n";
+   std::vector<char> row((size_t)size * 3);
+   for (int y = 0; y < size; ++y)
+   {
+      for (int x = 0; x < size; ++x)
+      {
+         for (int c = 0; c < 3; ++c)
+            row[(size_t)x * 3 + c] = (char)image[RGBA * ((size_t)y * size + x) + c];
+      }
+      file.write(row.data(), row.size());
+   }
+   return (bool)file;
+}
+
+// runs fn repeat times and returns the fastest run in seconds
+template <typename Function>
+double measure(int repeat, Function fn)
+{
+   double best = 1e30;
+   for (int r = 0; r < repeat; ++r)
+   {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      fn();
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      best = std::min(best, seconds);
+   }
+   return best;
+}
+
+// bytes generate_grid needs at its peak: image, positions, normals, interleaved vertices and indices
+long long estimated_grid_bytes(int size)
+{
+   long long vertices = (long long)(size + 1) * (size + 1);
+   long long triangles = (long long)size * size * 2;
+   return (long long)size * size * RGBA + vertices * 4 * sizeof(glm::vec3) + triangles * sizeof(glm::uvec3);
+}
+
+void write_json(std::ostream &os, const std::vector<BenchResult> &results)
+{
+   os << "{\n  \"benchmark\": \"heightmap_bench\",\n  \"version\": 1,\n"
+      << "  \"hardware_threads\": " << default_thread_count() << ",\n"
+      << "  \"process_peak_bytes\": " << process_peak_bytes() << ",\n"
+      << "  \"results\": [\n";
+   for (size_t i = 0; i < results.size(); ++i)
+   {
+      const BenchResult &r = results[i];
+      os << "    {\"size\": " << r.size << ", \"stage\": \"" << r.stage << "\"";
+      if (!r.format.empty())
+         os << ", \"format\": \"" << r.format << "\"";
+      os << ", \"threads\": " << r.threads;
+      if (r.skipped)
+         os << ", \"skipped\": true";
+      else
+         os << ", \"seconds\": " << r.seconds << ", \"mvertices_per_s\": " << r.mverticesPerSecond
+            << ", \"peak_bytes\": " << r.peakBytes;
+      os << "}" << (i + 1 < results.size() ? "," : "") << '\n';
+   }
+   os << "  ]\n}\n";
+}
+
+int main(int argc, char **argv)
+{
+   std::vector<int> sizes = {256, 1024, 4096, 16384};
+   std::vector<int> threadCounts = {1, default_thread_count()};
+   int repeat = 3;
+   long long memoryLimit = physical_memory_bytes() / 2;
+   std::string output = "heightmap_bench.json";
+
+   for (int i = 1; i < argc; ++i)
+   {
+      std::string arg = argv[i];
+      if (arg == "--sizes" && i + 1 < argc)
+         sizes = parse_list(argv[++i]);
+      else if (arg == "--threads" && i + 1 < argc)
+         threadCounts = parse_list(argv[++i]);
+      else if (arg == "--repeat" && i + 1 < argc)
+         repeat = std::max(1, std::stoi(argv[++i]));
+      else if (arg == "--memory-limit" && i + 1 < argc)
+         memoryLimit = std::stoll(argv[++i]) * 1024 * 1024;
+      else if (arg == "--output" && i + 1 < argc)
+         output = argv[++i];
+      else
+      {
+         std::cerr << "usage: " << argv[0] << " [--sizes 256,1024] [--threads 1,2,4] [--repeat 3]"
+                   << " [--memory-limit <MB>] [--output heightmap_bench.json]\n";
+         return 1;
+      }
+   }
+   if (threadCounts.size() == 2 && threadCounts[0] == threadCounts[1])
+      threadCounts.pop_back();
+
+   std::vector<BenchResult> results;
+   MemoryStats &memoryStats = MemoryStats::instance();
+   for (size_t s = 0; s < sizes.size(); ++s)
+   {
+      int size = sizes[s];
+      long long vertexCount = (long long)(size + 1) * (size + 1);
+      if (memoryLimit > 0 && estimated_grid_bytes(size) > memoryLimit)
+      {
+         std::cerr << size << "^2: skipped, needs about " << estimated_grid_bytes(size) / (1024 * 1024)
+                   << " MB which exceeds the memory limit\n";
+         BenchResult result = {size, "generate_grid", "", 0, 0.0, 0.0, 0, true};
+         results.push_back(result);
+         continue;
+      }
+
+      std::cerr << size << "^2: preparing synthetic heightmap\n";
+      std::vector<unsigned char> image;
+      synthetic_heightmap(size, image);
+
+      // load_image on the same data in a compressed and an uncompressed format.
+      // PNG encoding through stb_image_write gets very slow for the largest sizes, so it is limited to 4096^2
+      std::vector<std::string> formats = {"ppm", "png"};
+      for (size_t f = 0; f < formats.size(); ++f)
+      {
+         std::string filename = "heightmap_bench_" + std::to_string(size) + "." + formats[f];
+         bool written = formats[f] == "ppm" ? write_ppm(filename, size, image)
+                                            : size <= 4096 && stbi_write_png(filename.c_str(), size, size, RGBA, image.data(), size * RGBA);
+         if (!written)
+            continue;
+
+         std::vector<unsigned char> loaded;
+         int width = 0;
+         int height = 0;
+         double seconds = measure(repeat, [&]() {
+            std::vector<unsigned char>().swap(loaded);
+            load_image(loaded, filename, width, height);
+         });
+         BenchResult result = {size, "load_image", formats[f], 1, seconds, size * (double)size / seconds / 1e6,
+                               (long long)loaded.capacity(), false};
+         results.push_back(result);
+         std::remove(filename.c_str());
+      }
+
+      // the decoders that turn loaded pixels into heights, every encoding on the same pixels
+      HeightPlane plane;
+      for (int e = 0; e < HEIGHT_GRAY16; ++e)
+      {
+         for (size_t t = 0; t < threadCounts.size(); ++t)
+         {
+            HeightDecoding decoding((HeightEncoding)e);
+            double seconds = measure(repeat, [&]() { decode_heights(image.data(), size, size, decoding, plane, threadCounts[t]); });
+            BenchResult result = {size, "decode_heights", height_encoding_name(decoding.encoding), threadCounts[t], seconds,
+                                  size * (double)size / seconds / 1e6, (long long)(plane.heights.capacity() * sizeof(float)),
+                                  false};
+            results.push_back(result);
+         }
+      }
+
+      // every filter down to an eighth of the size, the rate is of source heights
+      HeightPlane reduced;
+      for (int f = 0; f < RESAMPLE_FILTER_COUNT; ++f)
+      {
+         for (size_t t = 0; t < threadCounts.size(); ++t)
+         {
+            ResampleFilter filter = (ResampleFilter)f;
+            int target = std::max(size / 8, 2);
+            double seconds = measure(repeat, [&]() { resample_heights(plane, target, target, filter, reduced, threadCounts[t]); });
+            BenchResult result = {size, "resample", resample_filter_name(filter), threadCounts[t], seconds,
+                                  size * (double)size / seconds / 1e6,
+                                  (long long)(reduced.heights.capacity() * sizeof(float)), false};
+            results.push_back(result);
+         }
+      }
+      std::vector<float>().swap(reduced.heights);
+      std::vector<float>().swap(plane.heights);
+
+      // procedural terrain, the one sample at a time reference only where it finishes in reasonable time
+      NoiseOptions noiseOptions;
+      std::vector<float> noise((size_t)size * size);
+      if (size <= 4096)
+      {
+         double seconds = measure(repeat, [&]() {
+            for (int y = 0; y < size; ++y)
+               for (int x = 0; x < size; ++x)
+                  noise[(size_t)y * size + x] = noise_sample(noiseOptions, x, y);
+         });
+         BenchResult result = {size, "noise_scalar", "", 1, seconds, size * (double)size / seconds / 1e6,
+                               (long long)(noise.size() * sizeof(float)), false};
+         results.push_back(result);
+      }
+      for (size_t t = 0; t < threadCounts.size(); ++t)
+      {
+         double seconds = measure(repeat, [&]() { noise_region(noiseOptions, 0, 0, size, size, noise.data(), threadCounts[t]); });
+         BenchResult result = {size, "noise", "", threadCounts[t], seconds, size * (double)size / seconds / 1e6,
+                               (long long)(noise.size() * sizeof(float)), false};
+         results.push_back(result);
+      }
+      std::vector<float>().swap(noise);
+
+      HeightmapView view(image.data(), size, size);
+      for (size_t t = 0; t < threadCounts.size(); ++t)
+      {
+         int threads = threadCounts[t];
+         std::vector<glm::vec3> positions;
+         std::vector<glm::vec3> normals;
+         std::vector<glm::vec3> vertices;
+         std::vector<glm::uvec3> indices;
+
+         // every pass on its own
+         double seconds = measure(repeat, [&]() { generate_positions(size, size, view, 30.0f, positions, threads); });
+         BenchResult positionsResult = {size, "positions", "", threads, seconds, vertexCount / seconds / 1e6,
+                                        (long long)(positions.capacity() * sizeof(glm::vec3)), false};
+         results.push_back(positionsResult);
+
+         seconds = measure(repeat, [&]() { generate_indices(size, size, indices, threads); });
+         BenchResult indicesResult = {size, "indices", "", threads, seconds, vertexCount / seconds / 1e6,
+                                      (long long)(indices.capacity() * sizeof(glm::uvec3)), false};
+         results.push_back(indicesResult);
+
+         seconds = measure(repeat, [&]() { generate_normals(size, size, positions, normals, threads); });
+         BenchResult normalsResult = {size, "normals", "", threads, seconds, vertexCount / seconds / 1e6,
+                                      (long long)(normals.capacity() * sizeof(glm::vec3)), false};
+         results.push_back(normalsResult);
+
+         std::vector<glm::vec3>().swap(positions);
+         std::vector<glm::vec3>().swap(normals);
+         std::vector<glm::uvec3>().swap(indices);
+
+         // the whole generation, peak memory includes the transient buffers of the passes
+         seconds = measure(repeat, [&]() {
+            std::vector<glm::vec3>().swap(vertices);
+            std::vector<glm::uvec3>().swap(indices);
+            memoryStats.resetPeaks();
+            generate_grid(size, size, view, 30.0f, vertices, indices, threads);
+         });
+         long long peak = memoryStats.peakBytes(MEMORY_TRANSIENT) +
+                          (long long)(vertices.capacity() * sizeof(glm::vec3) + indices.capacity() * sizeof(glm::uvec3));
+         BenchResult gridResult = {size, "generate_grid", "", threads, seconds, vertexCount / seconds / 1e6, peak, false};
+         results.push_back(gridResult);
+         std::cerr << size << "^2, " << threads << " threads: generate_grid " << seconds * 1000.0 << " ms\n";
+      }
+   }
+
+   std::ofstream file(output);
+   write_json(file, results);
+   if (!file)
+   {
+      std::cerr << "Failed to write " << output << '\n';
+      return 1;
+   }
+   std::cerr << "Wrote results to " << output << '\n';
+   return 0;
+}
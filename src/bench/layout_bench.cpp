@@ -0,0 +1,234 @@
+// Headless benchmark of the height layouts. Fills a synthetic size x size plane, converts it to Z-order tiles (see
+// morton.h) and generates the vertices of the full resolution grid band by band from the row major plane and from the
+// tiles, reporting the time and the L1 data cache, last level cache and data TLB read misses of every pass where the
+// kernel gives access to the hardware counters (perf_event_paranoid <= 2, not in most virtual machines).
+//
+// usage: layout_bench [--size 16384] [--band 64] [--threads 1,8] [--repeat 3]
+#include <heightmap/grid.h>
+#include <heightmap/morton.h>
+#include <heightmap/parallel.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// parses comma separated numbers like "1,8"
+std::vector<int> parse_list(const std::string &list)
+{
+   std::vector<int> values;
+   std::stringstream stream(list);
+   std::string item;
+   while (std::getline(stream, item, ','))
+   {
+      if (!item.empty())
+         values.push_back(std::stoi(item));
+   }
+   return values;
+}
+
+// Read misses of the L1 data cache, the last level cache and the data TLB of this process and of the threads it starts
+// after the counters are opened. Counters the kernel does not provide stay closed and are reported as n/a
+class MissCounters
+{
+public:
+   static const int COUNT = 3;
+
+   MissCounters()
+   {
+      const uint64_t caches[COUNT] = {PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_DTLB};
+      for (int i = 0; i < COUNT; ++i)
+      {
+         perf_event_attr attr;
+         memset(&attr, 0, sizeof(attr));
+         attr.size = sizeof(attr);
+         attr.type = PERF_TYPE_HW_CACHE;
+         attr.config = caches[i] | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+         attr.disabled = 1;
+         attr.inherit = 1;
+         attr.exclude_kernel = 1;
+         attr.exclude_hv = 1;
+         descriptors[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+         values[i] = 0;
+      }
+   }
+
+   ~MissCounters()
+   {
+      for (int i = 0; i < COUNT; ++i)
+      {
+         if (descriptors[i] >= 0)
+            close(descriptors[i]);
+      }
+   }
+
+   void start()
+   {
+      for (int i = 0; i < COUNT; ++i)
+      {
+         if (descriptors[i] < 0)
+            continue;
+         ioctl(descriptors[i], PERF_EVENT_IOC_RESET, 0);
+         ioctl(descriptors[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+   }
+
+   // stops counting, inherited counts of finished threads are included in the value
+   void stop()
+   {
+      for (int i = 0; i < COUNT; ++i)
+      {
+         values[i] = 0;
+         if (descriptors[i] < 0)
+            continue;
+         ioctl(descriptors[i], PERF_EVENT_IOC_DISABLE, 0);
+         if (read(descriptors[i], &values[i], sizeof(values[i])) != sizeof(values[i]))
+            values[i] = 0;
+      }
+   }
+
+   // misses of counter i per thousand vertices, or n/a
+   std::string perKilo(int i, long long vertices) const
+   {
+      if (descriptors[i] < 0)
+         return "n/a";
+      char text[32];
+      std::snprintf(text, sizeof(text), "%.1f", values[i] * 1000.0 / vertices);
+      return text;
+   }
+
+private:
+   int descriptors[COUNT];
+   uint64_t values[COUNT];
+};
+
+// runs fn repeat times and returns the fastest run in seconds, counters holds the misses of the last run
+template <typename Function>
+double measure(int repeat, MissCounters &counters, Function fn)
+{
+   double best = 1e30;
+   for (int r = 0; r < repeat; ++r)
+   {
+      counters.start();
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      fn();
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      counters.stop();
+      best = std::min(best, seconds);
+   }
+   return best;
+}
+
+// size x size heights in [0, 1] with detail at every scale
+void fill_synthetic(std::vector<float> &heights, int size)
+{
+   heights.resize((size_t)size * size);
+   parallel_for(0, size, 0, [&](int begin, int end) {
+      for (int y = begin; y < end; ++y)
+      {
+         for (int x = 0; x < size; ++x)
+         {
+            float u = (float)x / size;
+            float v = (float)y / size;
+            heights[(size_t)y * size + x] =
+                0.5f + 0.3f * std::sin(u * 6.0f) * std::cos(v * 5.0f) + 0.1f * std::sin(u * 211.0f + v * 197.0f);
+         }
+      }
+   });
+}
+
+// generates the vertices of the whole grid band rows at a time into the same buffer, like the mesh pipeline
+void generate_bands(const HeightmapView &view, int N, int band, int threads, std::vector<glm::vec3> &vertices)
+{
+   for (int row = 0; row <= N; row += band)
+      generate_vertex_rows(N, N, view, 100.0f, row, std::min(band, N + 1 - row), vertices, threads);
+}
+
+void report(const char *stage, int threads, double seconds, long long vertices, const MissCounters &counters)
+{
+   std::printf("%-10s %3d threads  %8.3f s  %7.1f Mvertices/s  L1D %8s  LLC %8s  dTLB %8s  misses/kvertex\n", stage,
+               threads, seconds, vertices / seconds / 1e6, counters.perKilo(0, vertices).c_str(),
+               counters.perKilo(1, vertices).c_str(), counters.perKilo(2, vertices).c_str());
+}
+
+int main(int argc, char **argv)
+{
+   int size = 16384;
+   int band = 64;
+   std::vector<int> threadCounts = {1, default_thread_count()};
+   int repeat = 3;
+
+   for (int i = 1; i < argc; ++i)
+   {
+      std::string arg = argv[i];
+      if (arg == "--size" && i + 1 < argc)
+         size = std::max(2, std::stoi(argv[++i]));
+      else if (arg == "--band" && i + 1 < argc)
+         band = std::max(1, std::stoi(argv[++i]));
+      else if (arg == "--threads" && i + 1 < argc)
+         threadCounts = parse_list(argv[++i]);
+      else if (arg == "--repeat" && i + 1 < argc)
+         repeat = std::max(1, std::stoi(argv[++i]));
+      else
+      {
+         std::cerr << "usage: " << argv[0] << " [--size 16384] [--band 64] [--threads 1,8] [--repeat 3]\n";
+         return 1;
+      }
+   }
+   if (threadCounts.size() == 2 && threadCounts[0] == threadCounts[1])
+      threadCounts.pop_back();
+
+   // opened before the first parallel_for starts the job system workers, inherited counters only follow threads
+   // started after them
+   MissCounters counters;
+   std::vector<float> heights;
+   fill_synthetic(heights, size);
+   // the grid has a vertex per height, the last row and column reuse the border heights
+   int N = size - 1;
+   long long vertices = (long long)size * size;
+   MortonHeights morton;
+   std::vector<glm::vec3> buffer;
+   std::printf("%dx%d heights, %.3f GB, vertex rows in bands of %d\n", size, size, heights.size() * 4 / 1e9, band);
+
+   for (size_t t = 0; t < threadCounts.size(); ++t)
+   {
+      int threads = threadCounts[t];
+      double seconds = measure(repeat, counters, [&]() { morton.assign(heights.data(), size, size, threads); });
+      std::printf("%-10s %3d threads  %8.3f s  %7.3f GB/s\n", "convert", threads, seconds,
+                  heights.size() * 4 / seconds / 1e9);
+   }
+
+   HeightmapView rowMajor(heights.data(), size, size);
+   HeightmapView tiled(heights.data(), &morton);
+   for (size_t t = 0; t < threadCounts.size(); ++t)
+   {
+      int threads = threadCounts[t];
+      double seconds = measure(repeat, counters, [&]() { generate_bands(rowMajor, N, band, threads, buffer); });
+      report("row major", threads, seconds, vertices, counters);
+      seconds = measure(repeat, counters, [&]() { generate_bands(tiled, N, band, threads, buffer); });
+      report("z-order", threads, seconds, vertices, counters);
+   }
+
+   // both layouts must give the same vertices
+   std::vector<glm::vec3> expected;
+   int check = std::min(band, N + 1);
+   generate_vertex_rows(N, N, rowMajor, 100.0f, N + 1 - check, check, expected, 1);
+   generate_vertex_rows(N, N, tiled, 100.0f, N + 1 - check, check, buffer, 1);
+   if (expected != buffer)
+   {
+      std::cerr << "z-order vertices differ from the row major ones\n";
+      return 1;
+   }
+   return 0;
+}
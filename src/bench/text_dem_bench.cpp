@@ -0,0 +1,177 @@
+// Headless benchmark of the text DEM parser. Writes a synthetic ESRI ASCII grid (or uses --input) and reports the
+// parse throughput in GB/s of strtof on one thread, of the parallel scan and of the whole conversion into a height store.
+//
+// usage: text_dem_bench [--size 4096] [--threads 1,8] [--repeat 3] [--input <file.asc|file.xyz>]
+#include <heightmap/parallel.h>
+#include <heightmap/text_dem.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// the strtof baseline only parses the beginning of large files
+const long long BASELINE_BYTES = 256LL << 20;
+
+// parses comma separated numbers like "1,8"
+std::vector<int> parse_list(const std::string &list)
+{
+   std::vector<int> values;
+   std::stringstream stream(list);
+   std::string item;
+   while (std::getline(stream, item, ','))
+   {
+      if (!item.empty())
+         values.push_back(std::stoi(item));
+   }
+   return values;
+}
+
+// runs fn repeat times and returns the fastest run in seconds
+template <typename Function>
+double measure(int repeat, Function fn)
+{
+   double best = 1e30;
+   for (int r = 0; r < repeat; ++r)
+   {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      fn();
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      best = std::min(best, seconds);
+   }
+   return best;
+}
+
+// size x size heights in meters with three decimals, like the output of GIS tools
+bool write_synthetic_asc(const std::string &filename, int size)
+{
+   std::FILE *file = std::fopen(filename.c_str(), "wb");
+   if (file == nullptr)
+      return false;
+   std::fprintf(file, "ncols %d\nnrows %d\nxllcorner 0.0\nyllcorner 0.0\ncellsize 30.0\nNODATA_value -9999\n", size,
+                size);
+   std::string row;
+   char value[32];
+   for (int y = 0; y < size; ++y)
+   {
+      row.clear();
+      for (int x = 0; x < size; ++x)
+      {
+         float u = (float)x / size;
+         float v = (float)y / size;
+         float h = 1200.0f + 800.0f * std::sin(u * 6.0f) * std::cos(v * 5.0f) + 150.0f * std::sin(u * 211.0f + v * 197.0f);
+         int length = std::snprintf(value, sizeof(value), x == 0 ? "%.3f" : " %.3f", h);
+         row.append(value, length);
+      }
+      row += '\n';
+      if (std::fwrite(row.data(), 1, row.size(), file) != row.size())
+      {
+         std::fclose(file);
+         return false;
+      }
+   }
+   return std::fclose(file) == 0;
+}
+
+void report(const char *stage, int threads, long long bytes, double seconds)
+{
+   std::printf("%-12s %3d threads  %8.3f s  %6.3f GB/s\n", stage, threads, seconds, bytes / seconds / 1e9);
+}
+
+int main(int argc, char **argv)
+{
+   int size = 4096;
+   std::vector<int> threadCounts = {1, default_thread_count()};
+   int repeat = 3;
+   std::string input;
+
+   for (int i = 1; i < argc; ++i)
+   {
+      std::string arg = argv[i];
+      if (arg == "--size" && i + 1 < argc)
+         size = std::max(2, std::stoi(argv[++i]));
+      else if (arg == "--threads" && i + 1 < argc)
+         threadCounts = parse_list(argv[++i]);
+      else if (arg == "--repeat" && i + 1 < argc)
+         repeat = std::max(1, std::stoi(argv[++i]));
+      else if (arg == "--input" && i + 1 < argc)
+         input = argv[++i];
+      else
+      {
+         std::cerr << "usage: " << argv[0] << " [--size 4096] [--threads 1,8] [--repeat 3]"
+                   << " [--input <file.asc|file.xyz>]\n";
+         return 1;
+      }
+   }
+   if (threadCounts.size() == 2 && threadCounts[0] == threadCounts[1])
+      threadCounts.pop_back();
+
+   bool synthetic = input.empty();
+   if (synthetic)
+   {
+      input = "text_dem_bench_" + std::to_string(size) + ".asc";
+      std::cerr << "writing " << size << "x" << size << " synthetic grid to " << input << '\n';
+      if (!write_synthetic_asc(input, size))
+      {
+         std::cerr << "Failed to write " << input << '\n';
+         return 1;
+      }
+   }
+
+   TextDemInfo info;
+   if (!scan_text_dem(input, info))
+      return 1;
+   std::printf("%s: %dx%d, %.3f GB, heights %g to %g\n", input.c_str(), info.width, info.height, info.bytes / 1e9,
+               info.minimum, info.maximum);
+
+   // single threaded strtof on (the beginning of) the file
+   {
+      std::ifstream file(input, std::ios::binary);
+      std::string text((size_t)std::min(info.bytes, BASELINE_BYTES), '\0');
+      file.read(&text[0], text.size());
+      // the header words are not numbers, parsing starts after them
+      size_t start = info.format == TEXT_DEM_ESRI_ASCII ? text.find("\n", text.find("NODATA_value")) : 0;
+      start = start == std::string::npos ? 0 : start;
+      double sum = 0.0;
+      double seconds = measure(repeat, [&]() {
+         const char *p = text.c_str() + start;
+         char *next;
+         for (float value = std::strtof(p, &next); next != p; value = std::strtof(p, &next))
+         {
+            sum += value;
+            p = next;
+            while (*p == ',')
+               ++p;
+         }
+      });
+      report("strtof", 1, (long long)(text.size() - start), seconds);
+      if (sum == 0.0)
+         std::printf("(no heights parsed)\n");
+   }
+
+   for (size_t t = 0; t < threadCounts.size(); ++t)
+   {
+      int threads = threadCounts[t];
+      double seconds = measure(repeat, [&]() { scan_text_dem(input, info, threads); });
+      report("scan", threads, info.bytes, seconds);
+   }
+
+   // parses twice, the reported rate is of the file size
+   std::string store = input + ".bench.hts";
+   for (size_t t = 0; t < threadCounts.size(); ++t)
+   {
+      int threads = threadCounts[t];
+      double seconds = measure(repeat, [&]() { build_text_dem_store(input, store, true, threads); });
+      report("build_store", threads, info.bytes, seconds);
+   }
+   std::remove(store.c_str());
+   if (synthetic)
+      std::remove(input.c_str());
+   return 0;
+}
@@ -0,0 +1,339 @@
+// Headless batch converter: loads heightmaps and streams their meshes to disk without creating a window
+// or GL context. Files are converted in parallel, one file per worker thread.
+//
+// usage: heightmap_convert [--list <file>] [--output-dir <dir>] [--format ply|stl|glb|3mf|hts] [--scale <z scale>]
+//                          [--solid] [--size <mm>] [--base <thickness>] [--decimate] [--encoding <name>]
+//                          [--channel <0-3>] [--resolution <cells>] [--ground] [--mesh-resolution <n>]
+//                          [--filter box|bilinear|bicubic|lanczos3] [--jobs <n>] [inputs...]
+// inputs can be image files or directories, which are searched for images (not recursively). Outputs are named after
+// the input files, inputs that would write the same output are rejected
+// --encoding selects how pixels encode heights (rgb-product, luminance, channel, terrain-rgb, terrarium, gray16), see
+// height_decoder.h, --channel picks the channel of --encoding channel (0 = red)
+// --solid writes closed printable solids (stl and 3mf only), see solid_export.h
+// --format hts builds out of core height stores instead of meshes, see height_store.h. Text DEMs (ESRI ASCII .asc
+// and .xyz, see text_dem.h) can only be converted into height stores
+// LAS point clouds are gridded first, --resolution cells along the longer side, --ground only keeps ground points, see
+// point_cloud.h
+// --mesh-resolution resamples the heights to n samples along the longer side with --filter (lanczos3 by default) before
+// meshing, see resample.h
+#include <heightmap/grid.h>
+#include <heightmap/height_decoder.h>
+#include <heightmap/height_store.h>
+#include <heightmap/mesh_export.h>
+#include <heightmap/parallel.h>
+#include <heightmap/point_cloud.h>
+#include <heightmap/resample.h>
+#include <heightmap/solid_export.h>
+#include <heightmap/text_dem.h>
+
+#include <profiler.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <experimental/filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stb_image/stb_image.h"
+
+// filesystem namespace
+namespace fs = std::experimental::filesystem;
+
+// returns whether stb_image, the text DEM parser or the point cloud gridder are able to load files with the extension of
+// path
+bool is_image(const fs::path &path)
+{
+   std::string extension = path.extension().string();
+   std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+   const char *extensions[] = {".png", ".jpg", ".jpeg", ".bmp", ".tga", ".pgm", ".ppm", ".psd", ".gif", ".hdr", ".pic",
+                               ".asc", ".xyz", ".las"};
+   for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i)
+   {
+      if (extension == extensions[i])
+         return true;
+   }
+   return false;
+}
+
+// adds a file or every image inside of a directory to the inputs
+void add_input(const std::string &input, std::vector<fs::path> &inputs)
+{
+   fs::path path(input);
+   if (fs::is_directory(path))
+   {
+      std::vector<fs::path> files;
+      for (fs::directory_iterator it(path); it != fs::directory_iterator(); ++it)
+      {
+         if (fs::is_regular_file(it->path()) && is_image(it->path()))
+            files.push_back(it->path());
+      }
+      std::sort(files.begin(), files.end());
+      inputs.insert(inputs.end(), files.begin(), files.end());
+   }
+   else
+   {
+      inputs.push_back(path);
+   }
+}
+
+void print_usage(const char *program)
+{
+   std::cerr << "usage: " << program << " [--list <file>] [--output-dir <dir>] [--format ply|stl|glb|3mf|hts]"
+             << " [--scale <z scale>] [--solid] [--size <mm>] [--base <thickness>] [--decimate]"
+             << " [--encoding <name>] [--channel <0-3>] [--resolution <cells>] [--ground] [--mesh-resolution <n>]"
+             << " [--filter box|bilinear|bicubic|lanczos3] [--jobs <n>] [inputs...]\n";
+}
+
+int main(int argc, char **argv)
+{
+   std::vector<fs::path> inputs;
+   fs::path outputDir = ".";
+   std::string extension = ".ply";
+   float heightScaling = 30.0f;
+   int jobs = default_thread_count();
+   bool solid = false;
+   SolidOptions solidOptions;
+   HeightDecoding decoding;
+   PointCloudOptions pointCloudOptions;
+   int meshResolution = 0; // 0 meshes every height
+   ResampleFilter filter = RESAMPLE_LANCZOS3;
+
+   // std::stoi and std::stof throw on values that are not numbers
+   try
+   {
+      for (int i = 1; i < argc; ++i)
+      {
+         std::string arg = argv[i];
+         if (arg == "--list" && i + 1 < argc)
+         {
+            std::ifstream list(argv[++i]);
+            if (!list)
+            {
+               std::cerr << "Failed to open list " << argv[i] << '\n';
+               return 1;
+            }
+            std::string line;
+            while (std::getline(list, line))
+            {
+               if (!line.empty())
+                  add_input(line, inputs);
+            }
+         }
+         else if (arg == "--output-dir" && i + 1 < argc)
+            outputDir = argv[++i];
+         else if (arg == "--format" && i + 1 < argc)
+         {
+            extension = std::string(".") + argv[++i];
+            if (mesh_format_from_filename(extension) == MESH_UNKNOWN && extension != ".hts")
+            {
+               print_usage(argv[0]);
+               return 1;
+            }
+         }
+         else if (arg == "--scale" && i + 1 < argc)
+            heightScaling = std::min(std::max(std::stof(argv[++i]), 0.0f), 100.0f);
+         else if (arg == "--solid")
+            solid = true;
+         else if (arg == "--size" && i + 1 < argc)
+            solidOptions.scale = std::max(std::stof(argv[++i]), 0.0f);
+         else if (arg == "--base" && i + 1 < argc)
+            solidOptions.baseThickness = std::max(std::stof(argv[++i]), 0.0f);
+         else if (arg == "--decimate")
+            solidOptions.decimate = true;
+         else if (arg == "--encoding" && i + 1 < argc)
+         {
+            if (!height_encoding_from_name(argv[++i], decoding.encoding))
+            {
+               print_usage(argv[0]);
+               return 1;
+            }
+         }
+         else if (arg == "--channel" && i + 1 < argc)
+            decoding.channel = std::min(std::max(std::stoi(argv[++i]), 0), 3);
+         else if (arg == "--resolution" && i + 1 < argc)
+            pointCloudOptions.resolution = std::max(2, std::stoi(argv[++i]));
+         else if (arg == "--ground")
+            pointCloudOptions.classification = 2;
+         else if (arg == "--mesh-resolution" && i + 1 < argc)
+            meshResolution = std::max(2, std::stoi(argv[++i]));
+         else if (arg == "--filter" && i + 1 < argc)
+         {
+            if (!resample_filter_from_name(argv[++i], filter))
+            {
+               print_usage(argv[0]);
+               return 1;
+            }
+         }
+         else if (arg == "--jobs" && i + 1 < argc)
+            jobs = std::max(1, std::stoi(argv[++i]));
+         else if (arg.size() > 1 && arg[0] == '-')
+         {
+            print_usage(argv[0]);
+            return 1;
+         }
+         else
+            add_input(arg, inputs);
+      }
+   }
+   catch (const std::logic_error &)
+   {
+      print_usage(argv[0]);
+      return 1;
+   }
+   MeshFormat format = mesh_format_from_filename(extension);
+   if (inputs.empty() || (solid && format != MESH_STL && format != MESH_3MF) || (!solid && format == MESH_3MF))
+   {
+      print_usage(argv[0]);
+      return 1;
+   }
+   // outputs are named after the input files only, inputs of the same name would overwrite each other's output
+   std::vector<fs::path> outputs(inputs.size());
+   std::map<std::string, size_t> outputInputs;
+   for (size_t i = 0; i < inputs.size(); ++i)
+   {
+      outputs[i] = outputDir / inputs[i].filename();
+      outputs[i].replace_extension(extension);
+      std::pair<std::map<std::string, size_t>::iterator, bool> added =
+          outputInputs.insert(std::make_pair(outputs[i].string(), i));
+      if (!added.second)
+      {
+         std::cerr << inputs[added.first->second].string() << " and " << inputs[i].string()
+                   << " would both be written to " << outputs[i].string() << '\n';
+         return 1;
+      }
+   }
+   fs::create_directories(outputDir);
+
+   // same orientation as in the visualizer
+   stbi_set_flip_vertically_on_load(true);
+   Profiler::instance().setThreadName("main");
+
+   std::atomic<size_t> next(0);
+   std::atomic<int> converted(0);
+   std::atomic<int> failed(0);
+   std::atomic<long long> bytesRead(0);
+   std::atomic<long long> bytesWritten(0);
+   std::mutex outputMutex;
+
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   jobs = std::min<int>(jobs, (int)inputs.size());
+   parallel_for(0, jobs, jobs, [&](int, int) {
+      HeightPlane plane;
+      HeightPlane reduced;
+      // resamples the plane for meshing if --mesh-resolution asks for it
+      auto mesh_source = [&]() -> HeightPlane & {
+         int width;
+         int height;
+         resample_size(plane.width, plane.height, meshResolution, width, height);
+         if (meshResolution <= 0 || (width == plane.width && height == plane.height))
+            return plane;
+         resample_heights(plane, width, height, filter, reduced, 1);
+         return reduced;
+      };
+      for (size_t i = next++; i < inputs.size(); i = next++)
+      {
+         const fs::path &input = inputs[i];
+         const fs::path &output = outputs[i];
+
+         int width = 0;
+         int height = 0;
+         long long written = 0;
+         if (extension == ".hts" && text_dem_format(input.string()) != TEXT_DEM_UNKNOWN)
+         {
+            // the chunks of one file are parsed by all threads
+            TextDemInfo info;
+            if (build_text_dem_store(input.string(), output.string(), true, 0, nullptr, &info))
+            {
+               bytesRead += info.bytes;
+               written = (long long)fs::file_size(output);
+               width = info.width;
+               height = info.height;
+            }
+         }
+         else if (text_dem_format(input.string()) != TEXT_DEM_UNKNOWN)
+         {
+            std::lock_guard<std::mutex> lock(outputMutex);
+            std::cout << input.string() << ": text DEMs can only be converted with --format hts\n";
+         }
+         else if (point_cloud_format(input.string()) == POINT_CLOUD_LAS)
+         {
+            PointCloudInfo info;
+            if (grid_point_cloud(input.string(), pointCloudOptions, plane, 1, nullptr, &info))
+            {
+               bytesRead += (long long)fs::file_size(input);
+               const HeightPlane &source = mesh_source();
+               width = source.width;
+               height = source.height;
+               HeightmapView view(source.heights.data(), width, height);
+               if (extension == ".hts")
+               {
+                  HeightStoreWriter writer;
+                  if (writer.create(output.string(), width, height))
+                  {
+                     for (int y = 0; y < height; ++y)
+                        writer.writeRow(y, &source.heights[(size_t)y * width]);
+                     if (writer.close())
+                        written = (long long)fs::file_size(output);
+                  }
+               }
+               else
+               {
+                  written = solid ? export_solid(output.string(), format, width, height, view, heightScaling,
+                                                 solidOptions, 1)
+                                  : export_mesh(output.string(), format, width, height, view, heightScaling, 1);
+               }
+            }
+         }
+         else if (extension == ".hts")
+         {
+            // stores are built without decoding the whole image where possible
+            if (build_height_store(input.string(), output.string(), true, decoding))
+            {
+               bytesRead += (long long)fs::file_size(input);
+               written = (long long)fs::file_size(output);
+            }
+         }
+         else if (load_heights(input.string(), decoding, plane, 1, false))
+         {
+            bytesRead += (long long)fs::file_size(input);
+            const HeightPlane &source = mesh_source();
+            width = source.width;
+            height = source.height;
+            HeightmapView view(source.heights.data(), width, height);
+            written = solid ? export_solid(output.string(), format, width, height, view, heightScaling, solidOptions, 1)
+                            : export_mesh(output.string(), format, width, height, view, heightScaling, 1);
+         }
+
+         std::lock_guard<std::mutex> lock(outputMutex);
+         if (written > 0)
+         {
+            bytesWritten += written;
+            ++converted;
+            std::cout << input.string() << " -> " << output.string();
+            if (width > 0)
+               std::cout << " (" << width << "x" << height << ")";
+            std::cout << '\n';
+         }
+         else
+         {
+            ++failed;
+            std::cout << input.string() << ": conversion failed\n";
+         }
+      }
+   });
+   double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+   std::cout << "Converted " << converted << " of " << inputs.size() << " files in " << seconds << " s with "
+             << jobs << " jobs\n"
+             << "Throughput: " << converted / seconds << " files/s, "
+             << bytesRead / seconds / (1024.0 * 1024.0) << " MB/s read, "
+             << bytesWritten / seconds / (1024.0 * 1024.0) << " MB/s written\n";
+   return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,81 @@
+#include <heightmap/file_watcher.h>
+
+#include <iostream>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+FileWatcher::FileWatcher() : fd(-1), wd(-1), pending(false)
+{
+}
+
+FileWatcher::~FileWatcher()
+{
+   stop();
+}
+
+bool FileWatcher::watch(const std::string &filename)
+{
+   stop();
+   size_t slash = filename.find_last_of('/');
+   std::string directory = slash == std::string::npos ? "." : filename.substr(0, slash + 1);
+   name = slash == std::string::npos ? filename : filename.substr(slash + 1);
+
+   fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   if (fd < 0)
+   {
+      std::cout << "Failed to watch " << filename << ": inotify is not available\n";
+      return false;
+   }
+   wd = ::inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+   if (wd < 0)
+   {
+      std::cout << "Failed to watch " << filename << '\n';
+      stop();
+      return false;
+   }
+   return true;
+}
+
+void FileWatcher::stop()
+{
+   if (fd >= 0)
+      ::close(fd);
+   fd = -1;
+   wd = -1;
+   pending = false;
+}
+
+bool FileWatcher::isWatching() const
+{
+   return wd >= 0;
+}
+
+bool FileWatcher::changed()
+{
+   if (fd < 0)
+      return false;
+   std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+   // events are variable sized, the buffer is aligned for the fixed part of the first one
+   alignas(struct inotify_event) char buffer[4096];
+   ssize_t length;
+   while ((length = ::read(fd, buffer, sizeof(buffer))) > 0)
+   {
+      for (char *p = buffer; p < buffer + length;)
+      {
+         const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(p);
+         if (event->len > 0 && name == event->name)
+         {
+            pending = true;
+            lastEvent = now;
+         }
+         p += sizeof(struct inotify_event) + event->len;
+      }
+   }
+
+   if (!pending || std::chrono::duration<double>(now - lastEvent).count() < FILE_WATCHER_SETTLE)
+      return false;
+   pending = false;
+   return true;
+}
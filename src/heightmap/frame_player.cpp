@@ -0,0 +1,413 @@
+#include <heightmap/frame_player.h>
+#include <heightmap/job_system.h>
+
+#include <memory_stats.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <utility>
+
+#include <dirent.h>
+
+// a slot of the ring, index is the frame it holds or decodes, -1 while unused. A taken frame keeps its index so the
+// frame on screen is not decoded again right away
+struct FrameSlot
+{
+   int index;
+   bool decoding;
+   bool ready;
+   bool taken;
+   DecodedFrame frame;
+   MemoryReservation memory;
+
+   FrameSlot() : index(-1), decoding(false), ready(false), taken(false), memory(MEMORY_IMAGE) {}
+};
+
+struct FramePlayer::Shared
+{
+   std::vector<std::string> files;
+   std::mutex mutex;
+   HeightDecoding decoding;
+   int generation; // of the decoding, results of decodes with a previous one are dropped
+   FrameSlot slots[FRAME_PLAYER_RING];
+
+   // counters, guarded by mutex
+   long long decoded;
+   long long failed;
+   long long presented;
+   long long dropped;
+   long long bytes;
+   long long decodeNanoseconds;
+   long long wallNanoseconds; // time with at least one decode running, without the current stretch
+   int running;
+   std::chrono::steady_clock::time_point runningSince;
+
+   Shared() : generation(0) { reset(); }
+
+   void reset()
+   {
+      decoded = failed = presented = dropped = bytes = decodeNanoseconds = wallNanoseconds = 0;
+      running = 0;
+   }
+};
+
+// splits a file name (without directory) around its last run of digits, false if it has none
+// ---------------------------------------------------------------------------------------------------------
+static bool split_frame_name(const std::string &name, std::string &prefix, std::string &suffix)
+{
+   size_t end = name.find_last_of("0123456789");
+   if (end == std::string::npos)
+      return false;
+   size_t begin = end;
+   while (begin > 0 && name[begin - 1] >= '0' && name[begin - 1] <= '9')
+      --begin;
+   prefix = name.substr(0, begin);
+   suffix = name.substr(end + 1);
+   return true;
+}
+
+std::vector<std::string> find_frame_sequence(const std::string &filename)
+{
+   std::vector<std::string> files;
+   size_t slash = filename.find_last_of('/');
+   std::string directory = slash == std::string::npos ? "" : filename.substr(0, slash + 1);
+   std::string prefix;
+   std::string suffix;
+   if (!split_frame_name(filename.substr(directory.size()), prefix, suffix))
+      return files;
+
+   DIR *dir = ::opendir(directory.empty() ? "." : directory.c_str());
+   if (dir == nullptr)
+      return files;
+   std::vector<std::pair<long long, std::string>> frames;
+   while (struct dirent *entry = ::readdir(dir))
+   {
+      std::string name = entry->d_name;
+      if (name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+          name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+         continue;
+      std::string number = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+      if (number.find_first_not_of("0123456789") != std::string::npos)
+         continue;
+      frames.push_back(std::make_pair(std::atoll(number.c_str()), directory + name));
+   }
+   ::closedir(dir);
+
+   std::sort(frames.begin(), frames.end());
+   for (size_t i = 0; i < frames.size(); ++i)
+      files.push_back(frames[i].second);
+   return files;
+}
+
+FramePlayer::FramePlayer()
+    : playing(false), loop(true), framesPerSecond(FRAME_PLAYER_RATE), position(0), lastTaken(-1), anchorFrame(0)
+{
+}
+
+FramePlayer::~FramePlayer()
+{
+   close();
+}
+
+bool FramePlayer::open(const std::string &filename)
+{
+   close();
+   std::vector<std::string> files = find_frame_sequence(filename);
+   if (files.empty())
+   {
+      std::cout << "No numbered frames found for " << filename << '\n';
+      return false;
+   }
+   shared = std::make_shared<Shared>();
+   shared->files.swap(files);
+   position = 0;
+   for (size_t i = 0; i < shared->files.size(); ++i)
+   {
+      if (shared->files[i] == filename)
+         position = (int)i;
+   }
+   std::cout << "Frame sequence opened: " << shared->files.size() << " frames\n";
+   seek(position);
+   return true;
+}
+
+// decodes still running keep their shared state alive and drop their results
+void FramePlayer::close()
+{
+   shared.reset();
+   playing = false;
+   position = 0;
+   lastTaken = -1;
+}
+
+bool FramePlayer::isOpen() const
+{
+   return shared != nullptr;
+}
+
+int FramePlayer::frameCount() const
+{
+   return shared != nullptr ? (int)shared->files.size() : 0;
+}
+
+const std::string &FramePlayer::frameName(int index) const
+{
+   return shared->files[index];
+}
+
+void FramePlayer::play()
+{
+   if (shared == nullptr)
+      return;
+   if (!loop && position == frameCount() - 1)
+      seek(0);
+   playing = true;
+   anchorFrame = position;
+   anchorTime = std::chrono::steady_clock::now();
+}
+
+void FramePlayer::pause()
+{
+   playing = false;
+}
+
+bool FramePlayer::isPlaying() const
+{
+   return playing;
+}
+
+// the playhead keeps its position, only the time it moves on from there changes
+void FramePlayer::setRate(double rate)
+{
+   framesPerSecond = std::min(std::max(rate, 1e-3), FRAME_PLAYER_MAX_RATE);
+   anchorFrame = position;
+   anchorTime = std::chrono::steady_clock::now();
+}
+
+double FramePlayer::rate() const
+{
+   return framesPerSecond;
+}
+
+void FramePlayer::setLoop(bool enabled)
+{
+   loop = enabled;
+}
+
+// frames decoded with the previous decoding are dropped and decoded again, decodes running still finish with it
+void FramePlayer::setDecoding(const HeightDecoding &decoding)
+{
+   if (shared == nullptr)
+      return;
+   {
+      std::lock_guard<std::mutex> lock(shared->mutex);
+      shared->decoding = decoding;
+      ++shared->generation;
+      for (int s = 0; s < FRAME_PLAYER_RING; ++s)
+      {
+         shared->slots[s].index = -1;
+         shared->slots[s].ready = false;
+         shared->slots[s].decoding = false;
+      }
+   }
+   prefetch();
+}
+
+void FramePlayer::seek(int index)
+{
+   if (shared == nullptr)
+      return;
+   position = std::min(std::max(index, 0), frameCount() - 1);
+   anchorFrame = position;
+   anchorTime = std::chrono::steady_clock::now();
+   lastTaken = -1;
+   // the frame sought is taken again even if it was presented before
+   {
+      std::lock_guard<std::mutex> lock(shared->mutex);
+      for (int s = 0; s < FRAME_PLAYER_RING; ++s)
+      {
+         if (shared->slots[s].taken)
+            shared->slots[s].index = -1;
+      }
+   }
+   prefetch();
+}
+
+int FramePlayer::update()
+{
+   if (shared == nullptr)
+      return -1;
+   if (playing)
+   {
+      double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - anchorTime).count();
+      long long frame = anchorFrame + (long long)std::floor(elapsed * framesPerSecond);
+      int count = frameCount();
+      if (frame >= count && !loop)
+      {
+         frame = count - 1;
+         playing = false;
+      }
+      position = (int)(frame % count);
+   }
+   prefetch();
+   return position;
+}
+
+int FramePlayer::playhead() const
+{
+   return position;
+}
+
+// Makes sure the ring holds the frames from the playhead on. Slots of frames behind the playhead are reused for the
+// ones ahead, frames already decoded or being decoded keep their slots. Taken frames ahead of the playhead, which
+// happens when a short sequence loops, are decoded again in their slot
+// --------------------------------------------------------------------------------------------------------------------
+void FramePlayer::prefetch()
+{
+   int count = frameCount();
+   int window[FRAME_PLAYER_RING];
+   int windowSize = 0;
+   for (int d = 0; d < std::min(FRAME_PLAYER_RING, count); ++d)
+   {
+      int index = position + d;
+      if (index >= count && !loop)
+         break;
+      window[windowSize++] = index % count;
+   }
+
+   std::shared_ptr<Shared> state = shared;
+   std::lock_guard<std::mutex> lock(state->mutex);
+   for (int w = 0; w < windowSize; ++w)
+   {
+      int index = window[w];
+      FrameSlot *slot = nullptr;
+      for (int s = 0; s < FRAME_PLAYER_RING && slot == nullptr; ++s)
+      {
+         if (state->slots[s].index == index)
+            slot = &state->slots[s];
+      }
+      if (slot != nullptr && (!slot->taken || index == position))
+         continue;
+
+      // otherwise a slot that does not hold a frame of the window, there are as many slots as frames in it
+      for (int s = 0; s < FRAME_PLAYER_RING && slot == nullptr; ++s)
+      {
+         if (std::find(window, window + windowSize, state->slots[s].index) == window + windowSize)
+            slot = &state->slots[s];
+      }
+      slot->index = index;
+      slot->decoding = true;
+      slot->ready = false;
+      slot->taken = false;
+      std::vector<float>().swap(slot->frame.plane.heights);
+      slot->memory.set(0);
+      std::string file = state->files[index];
+      HeightDecoding decoding = state->decoding;
+      int generation = state->generation;
+
+      JobSystem::instance().submit([state, slot, index, file, decoding, generation]() {
+         PROFILE_ZONE("Decode frame");
+         std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+         {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            // the playhead moved on before the decode started
+            if (slot->index != index || state->generation != generation)
+               return;
+            if (state->running++ == 0)
+               state->runningSince = start;
+         }
+
+         DecodedFrame frame;
+         frame.index = index;
+         bool success = load_heights(file, decoding, frame.plane, 1, false);
+         std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+         std::lock_guard<std::mutex> lock(state->mutex);
+         if (--state->running == 0)
+            state->wallNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(end - state->runningSince).count();
+         state->decodeNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+         if (!success)
+         {
+            ++state->failed;
+            if (slot->index == index && state->generation == generation)
+               slot->decoding = false;
+            return;
+         }
+         ++state->decoded;
+         state->bytes += (long long)(frame.plane.heights.size() * sizeof(float));
+         if (slot->index != index || state->generation != generation)
+            return;
+         std::swap(slot->frame, frame);
+         slot->memory.set(slot->frame.plane.heights);
+         slot->decoding = false;
+         slot->ready = true;
+      });
+   }
+}
+
+// frames between the one taken last and this one were skipped by the playhead, also across the end of a loop
+// --------------------------------------------------------------------------------------------------------------
+bool FramePlayer::take(int index, DecodedFrame &frame)
+{
+   if (shared == nullptr)
+      return false;
+   std::lock_guard<std::mutex> lock(shared->mutex);
+   for (int s = 0; s < FRAME_PLAYER_RING; ++s)
+   {
+      FrameSlot &slot = shared->slots[s];
+      if (slot.index != index || !slot.ready)
+         continue;
+      std::swap(frame, slot.frame);
+      std::vector<float>().swap(slot.frame.plane.heights);
+      slot.memory.set(0);
+      slot.ready = false;
+      slot.taken = true;
+
+      ++shared->presented;
+      if (playing && lastTaken >= 0 && index != lastTaken)
+         shared->dropped += (index > lastTaken ? index : index + frameCount()) - lastTaken - 1;
+      lastTaken = index;
+      return true;
+   }
+   return false;
+}
+
+FramePlayerStats FramePlayer::stats() const
+{
+   FramePlayerStats stats = FramePlayerStats();
+   if (shared == nullptr)
+      return stats;
+   std::lock_guard<std::mutex> lock(shared->mutex);
+   stats.decoded = shared->decoded;
+   stats.failed = shared->failed;
+   stats.presented = shared->presented;
+   stats.dropped = shared->dropped;
+   stats.bytes = shared->bytes;
+   long long attempts = shared->decoded + shared->failed;
+   stats.decodeMs = attempts > 0 ? shared->decodeNanoseconds / 1e6 / attempts : 0.0;
+   long long wall = shared->wallNanoseconds;
+   if (shared->running > 0)
+      wall += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - shared->runningSince).count();
+   stats.decodedPerSecond = wall > 0 ? shared->decoded / (wall / 1e9) : 0.0;
+   for (int s = 0; s < FRAME_PLAYER_RING; ++s)
+   {
+      stats.ready += shared->slots[s].ready ? 1 : 0;
+      stats.decoding += shared->slots[s].decoding ? 1 : 0;
+   }
+   return stats;
+}
+
+void FramePlayer::resetStats()
+{
+   if (shared == nullptr)
+      return;
+   std::lock_guard<std::mutex> lock(shared->mutex);
+   int running = shared->running;
+   shared->reset();
+   shared->running = running;
+   shared->runningSince = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,364 @@
+#include <heightmap/grid.h>
+#include <heightmap/parallel.h>
+
+#include <memory_stats.h>
+#include <profiler.h>
+
+#include <atomic>
+#include <cstring>
+#include <math.h>
+#include <mutex>
+
+float f(float x, float y)
+{
+   return sin(x * 2.0f * M_PI) * sin(y * 2.0f * M_PI) * 0.1f;
+}
+
+// retrieves the vertex positions from the image, one row of vertices per i
+// -------------------------------------------------------------------------
+void generate_positions(int N, int M, const HeightmapView &image, float heightScaling,
+                        std::vector<glm::vec3> &positions, int threads)
+{
+   PROFILE_ZONE("generate_grid: positions");
+   generate_position_rows(N, M, image, heightScaling, 0, N + 1, positions, threads);
+}
+
+// generates two triangles for every quad of the grid
+// ---------------------------------------------------
+void generate_indices(int N, int M, std::vector<glm::uvec3> &indices, int threads)
+{
+   PROFILE_ZONE("generate_grid: indices");
+   generate_index_rows(M, 0, N, indices, threads);
+}
+
+void generate_index_rows(int M, int firstRow, int rowCount, std::vector<glm::uvec3> &indices, int threads)
+{
+   indices.resize((size_t)rowCount * M * 2);
+   parallel_for(firstRow, firstRow + rowCount, threads, [&](int begin, int end) {
+      for (int j = begin; j < end; ++j)
+      {
+         unsigned int row1 = j * (M + 1);
+         unsigned int row2 = (j + 1) * (M + 1);
+         glm::uvec3 *quad = &indices[(size_t)(j - firstRow) * M * 2];
+         for (int i = 0; i < M; ++i)
+         {
+            *quad++ = glm::uvec3(row1 + i, row1 + i + 1, row2 + i + 1); // triangle 1
+            *quad++ = glm::uvec3(row1 + i, row2 + i + 1, row2 + i);     // triangle 2
+         }
+      }
+   });
+}
+
+// generates the normal of every vertex from its neighbouring vertices
+// --------------------------------------------------------------------
+void generate_normals(int N, int M, const std::vector<glm::vec3> &positions, std::vector<glm::vec3> &normals,
+                      int threads)
+{
+   PROFILE_ZONE("generate_grid: normals");
+   normals.resize(positions.size());
+   parallel_for(0, N + 1, threads, [&](int begin, int end) {
+      for (int i = begin; i < end; ++i)
+      {
+         const glm::vec3 *previousRow = &positions[(size_t)std::max(i - 1, 0) * (M + 1)];
+         const glm::vec3 *row = &positions[(size_t)i * (M + 1)];
+         const glm::vec3 *nextRow = &positions[(size_t)std::min(i + 1, N) * (M + 1)];
+         glm::vec3 *normal = &normals[(size_t)i * (M + 1)];
+         for (int j = 0; j <= M; ++j)
+            normal[j] = grid_normal(previousRow[j], nextRow[j], row[std::max(j - 1, 0)], row[std::min(j + 1, M)]);
+      }
+   });
+}
+
+void interleave(const std::vector<glm::vec3> &positions, const std::vector<glm::vec3> &normals,
+                std::vector<glm::vec3> &vertices, int threads)
+{
+   PROFILE_ZONE("generate_grid: interleave");
+   vertices.resize(positions.size() * 2);
+   parallel_for(0, (int)positions.size(), threads, [&](int begin, int end) {
+      for (int i = begin; i < end; ++i)
+      {
+         vertices[2 * (size_t)i] = positions[i];
+         vertices[2 * (size_t)i + 1] = normals[i];
+      }
+   });
+}
+
+// vertex rows from a height store. Every worker reads the heights of a block of vertex rows, which are image
+// columns, as one region so the tile cache is only consulted once per tile
+// -------------------------------------------------------------------------------------------------------------
+static void generate_store_position_rows(int N, int M, const HeightmapView &image, float heightScaling, int firstRow,
+                                         int rowCount, std::vector<glm::vec3> &positions, int threads)
+{
+   const int blockRows = 64;
+   int blocks = (rowCount + blockRows - 1) / blockRows;
+   parallel_for(0, blocks, threads, [&](int blockBegin, int blockEnd) {
+      std::vector<float> heights;
+      for (int block = blockBegin; block < blockEnd; ++block)
+      {
+         int begin = firstRow + block * blockRows;
+         int end = std::min(begin + blockRows, firstRow + rowCount);
+         int firstColumn = std::min(begin, image.width - 1);
+         int columns = std::min(end - 1, image.width - 1) - firstColumn + 1;
+         int rows = std::min(M, image.height - 1) + 1;
+         heights.resize((size_t)columns * rows);
+         image.store->readRegion(image.originX + firstColumn, image.originY, columns, rows, heights.data(), image.level);
+
+         for (int i = begin; i < end; ++i)
+         {
+            glm::vec3 *row = &positions[(size_t)(i - firstRow) * (M + 1)];
+            int column = std::min(i, image.width - 1) - firstColumn;
+            for (int j = 0; j <= M; ++j)
+            {
+               float z = heights[(size_t)std::min(j, rows - 1) * columns + column] * heightScaling / 100;
+               row[j] = glm::vec3((float)j / (float)N, (float)i / (float)M, z);
+            }
+         }
+      }
+   });
+}
+
+// vertex rows from heights in Z-order tiles. Vertex rows are image columns, so every worker walks a block of as many
+// vertex rows as a tile is wide one tile at a time: the heights of a tile are read while its cache lines are loaded,
+// instead of one line per height down a row major column
+// -----------------------------------------------------------------------------------------------------------------
+static void generate_morton_position_rows(int N, int M, const HeightmapView &image, float heightScaling, int firstRow,
+                                          int rowCount, std::vector<glm::vec3> &positions, int threads)
+{
+   const int tile = 1 << MORTON_TILE_BITS;
+   const MortonHeights &morton = *image.morton;
+   int blocks = (rowCount + tile - 1) / tile;
+   parallel_for(0, blocks, threads, [&](int blockBegin, int blockEnd) {
+      for (int block = blockBegin; block < blockEnd; ++block)
+      {
+         int begin = firstRow + block * tile;
+         int end = std::min(begin + tile, firstRow + rowCount);
+         for (int tileBegin = 0; tileBegin <= M; tileBegin += tile)
+         {
+            int tileEnd = std::min(tileBegin + tile, M + 1);
+            for (int i = begin; i < end; ++i)
+            {
+               glm::vec3 *row = &positions[(size_t)(i - firstRow) * (M + 1)];
+               const float *column = morton.column(std::min(i, image.width - 1));
+               for (int j = tileBegin; j < tileEnd; ++j)
+               {
+                  float z = column[morton.rowOffset(std::min(j, image.height - 1))] * heightScaling / 100;
+                  row[j] = glm::vec3((float)j / (float)N, (float)i / (float)M, z);
+               }
+            }
+         }
+      }
+   });
+}
+
+void generate_position_rows(int N, int M, const HeightmapView &image, float heightScaling, int firstRow, int rowCount,
+                            std::vector<glm::vec3> &positions, int threads)
+{
+   positions.resize((size_t)rowCount * (M + 1));
+   if (image.store != nullptr)
+   {
+      generate_store_position_rows(N, M, image, heightScaling, firstRow, rowCount, positions, threads);
+      return;
+   }
+   if (image.morton != nullptr)
+   {
+      generate_morton_position_rows(N, M, image, heightScaling, firstRow, rowCount, positions, threads);
+      return;
+   }
+   parallel_for(firstRow, firstRow + rowCount, threads, [&](int begin, int end) {
+      for (int i = begin; i < end; ++i)
+      {
+         glm::vec3 *row = &positions[(size_t)(i - firstRow) * (M + 1)];
+         for (int j = 0; j <= M; ++j)
+            row[j] = grid_position(image, heightScaling, N, M, i, j);
+      }
+   });
+}
+
+// generates positions for the requested rows plus a halo row on each side, then normals and interleaving
+// --------------------------------------------------------------------------------------------------------
+void generate_vertex_rows(int N, int M, const HeightmapView &image, float heightScaling, int firstRow, int rowCount,
+                          std::vector<glm::vec3> &vertices, int threads)
+{
+   PROFILE_ZONE("generate_vertex_rows");
+   int haloBegin = std::max(firstRow - 1, 0);
+   int haloEnd = std::min(firstRow + rowCount + 1, N + 1);
+   std::vector<glm::vec3> positions;
+   generate_position_rows(N, M, image, heightScaling, haloBegin, haloEnd - haloBegin, positions, threads);
+   MemoryReservation transientMemory(MEMORY_TRANSIENT, (long long)(positions.size() * sizeof(glm::vec3)));
+
+   vertices.resize((size_t)rowCount * (M + 1) * 2);
+   parallel_for(firstRow, firstRow + rowCount, threads, [&](int begin, int end) {
+      for (int i = begin; i < end; ++i)
+      {
+         const glm::vec3 *previousRow = &positions[(size_t)(std::max(i - 1, 0) - haloBegin) * (M + 1)];
+         const glm::vec3 *row = &positions[(size_t)(i - haloBegin) * (M + 1)];
+         const glm::vec3 *nextRow = &positions[(size_t)(std::min(i + 1, N) - haloBegin) * (M + 1)];
+         glm::vec3 *out = &vertices[(size_t)(i - firstRow) * (M + 1) * 2];
+         for (int j = 0; j <= M; ++j)
+         {
+            *out++ = row[j];
+            *out++ = grid_normal(previousRow[j], nextRow[j], row[std::max(j - 1, 0)], row[std::min(j + 1, M)]);
+         }
+      }
+   });
+}
+
+// Compares the planes row by row, rows without any change are skipped by a single memcmp. Every chunk of rows
+// collects the first and last changed pixel row of every pixel column, which is a vertex row of the grid
+// ---------------------------------------------------------------------------------------------------------------
+void grid_dirty_spans(int N, int M, const float *before, const float *after, int width, int height,
+                      std::vector<GridSpan> &spans, int threads)
+{
+   PROFILE_ZONE("grid_dirty_spans");
+   spans.clear();
+   std::vector<int> first(width, height);
+   std::vector<int> last(width, -1);
+   std::mutex mutex;
+   parallel_for(0, height, threads, [&](int begin, int end) {
+      std::vector<int> chunkFirst;
+      std::vector<int> chunkLast;
+      for (int y = begin; y < end; ++y)
+      {
+         const float *a = before + (size_t)y * width;
+         const float *b = after + (size_t)y * width;
+         if (memcmp(a, b, sizeof(float) * width) == 0)
+            continue;
+         if (chunkFirst.empty())
+         {
+            chunkFirst.assign(width, height);
+            chunkLast.assign(width, -1);
+         }
+         for (int x = 0; x < width; ++x)
+         {
+            if (a[x] != b[x])
+            {
+               chunkFirst[x] = std::min(chunkFirst[x], y);
+               chunkLast[x] = y;
+            }
+         }
+      }
+      if (chunkFirst.empty())
+         return;
+      std::lock_guard<std::mutex> lock(mutex);
+      for (int x = 0; x < width; ++x)
+      {
+         first[x] = std::min(first[x], chunkFirst[x]);
+         last[x] = std::max(last[x], chunkLast[x]);
+      }
+   });
+
+   // changed positions per vertex row. The last vertex row and column reuse the border pixels, see grid_position
+   std::vector<int> positionFirst(N + 1, M + 1);
+   std::vector<int> positionLast(N + 1, -1);
+   for (int i = 0; i <= N; ++i)
+   {
+      int x = std::min(i, width - 1);
+      if (last[x] < 0 || first[x] > M)
+         continue;
+      positionFirst[i] = first[x];
+      positionLast[i] = last[x] == height - 1 ? M : std::min(last[x], M);
+   }
+
+   // normals read the positions of the neighbouring rows and columns
+   for (int i = 0; i <= N; ++i)
+   {
+      int lo = M + 1;
+      int hi = -1;
+      for (int k = std::max(i - 1, 0); k <= std::min(i + 1, N); ++k)
+      {
+         lo = std::min(lo, positionFirst[k]);
+         hi = std::max(hi, positionLast[k]);
+      }
+      if (hi < 0)
+         continue;
+      GridSpan span;
+      span.row = i;
+      span.firstColumn = std::max(lo - 1, 0);
+      span.endColumn = std::min(hi + 1, M) + 1;
+      spans.push_back(span);
+   }
+}
+
+// every span reads the positions of its row and both neighbouring rows, one column wider on each side
+// -----------------------------------------------------------------------------------------------------
+void generate_vertex_spans(int N, int M, const HeightmapView &image, float heightScaling,
+                           const std::vector<GridSpan> &spans, std::vector<glm::vec3> &vertices, int threads)
+{
+   PROFILE_ZONE("generate_vertex_spans");
+   std::vector<size_t> offsets(spans.size() + 1, 0);
+   for (size_t s = 0; s < spans.size(); ++s)
+      offsets[s + 1] = offsets[s] + (size_t)(spans[s].endColumn - spans[s].firstColumn) * 2;
+   vertices.resize(offsets.back());
+
+   parallel_for(0, (int)spans.size(), threads, [&](int begin, int end) {
+      std::vector<glm::vec3> positions;
+      for (int s = begin; s < end; ++s)
+      {
+         const GridSpan &span = spans[s];
+         int lo = std::max(span.firstColumn - 1, 0);
+         int hi = std::min(span.endColumn, M);
+         int columns = hi - lo + 1;
+         int rows[3] = {std::max(span.row - 1, 0), span.row, std::min(span.row + 1, N)};
+         positions.resize((size_t)columns * 3);
+         for (int r = 0; r < 3; ++r)
+            for (int j = lo; j <= hi; ++j)
+               positions[(size_t)r * columns + (j - lo)] = grid_position(image, heightScaling, N, M, rows[r], j);
+
+         const glm::vec3 *previousRow = &positions[0];
+         const glm::vec3 *row = &positions[columns];
+         const glm::vec3 *nextRow = &positions[2 * (size_t)columns];
+         glm::vec3 *out = &vertices[offsets[s]];
+         for (int j = span.firstColumn; j < span.endColumn; ++j)
+         {
+            int c = j - lo;
+            *out++ = row[c];
+            *out++ = grid_normal(previousRow[c], nextRow[c], row[std::max(j - 1, 0) - lo], row[std::min(j + 1, M) - lo]);
+         }
+      }
+   });
+}
+
+void grid_height_range(int N, int M, const HeightmapView &image, float heightScaling, float &minZ, float &maxZ,
+                       int threads)
+{
+   PROFILE_ZONE("grid_height_range");
+   // bands of vertex rows so that height stores are read region by region
+   const int bandRows = 64;
+   int bands = (N + 1 + bandRows - 1) / bandRows;
+   // every range gets at least one band, so there are no more ranges than bands
+   std::vector<float> minima(bands, 1e30f);
+   std::vector<float> maxima(bands, -1e30f);
+   std::atomic<int> nextChunk(0);
+   parallel_for(0, bands, threads, [&](int begin, int end) {
+      int chunk = nextChunk++;
+      std::vector<glm::vec3> positions;
+      for (int band = begin; band < end; ++band)
+      {
+         int firstRow = band * bandRows;
+         generate_position_rows(N, M, image, heightScaling, firstRow, std::min(bandRows, N + 1 - firstRow), positions, 1);
+         for (size_t v = 0; v < positions.size(); ++v)
+         {
+            minima[chunk] = std::min(minima[chunk], positions[v].z);
+            maxima[chunk] = std::max(maxima[chunk], positions[v].z);
+         }
+      }
+   });
+   minZ = *std::min_element(minima.begin(), minima.end());
+   maxZ = *std::max_element(maxima.begin(), maxima.end());
+}
+
+void generate_grid(int N, int M, const HeightmapView &image, float heightScaling,
+                   std::vector<glm::vec3> &vertices, std::vector<glm::uvec3> &indices, int threads)
+{
+   PROFILE_ZONE("generate_grid");
+   std::vector<glm::vec3> positions;
+   std::vector<glm::vec3> normals;
+   MemoryReservation transientMemory(MEMORY_TRANSIENT);
+
+   generate_positions(N, M, image, heightScaling, positions, threads);
+   transientMemory.set(positions);
+   generate_indices(N, M, indices, threads);
+   generate_normals(N, M, positions, normals, threads);
+   transientMemory.set((long long)((positions.capacity() + normals.capacity()) * sizeof(glm::vec3)));
+   interleave(positions, normals, vertices, threads);
+}
@@ -0,0 +1,307 @@
+#include <heightmap/height_decoder.h>
+#include <heightmap/grid.h>
+#include <heightmap/image_loader.h>
+#include <heightmap/parallel.h>
+#include <heightmap/simd.h>
+
+#include <memory_stats.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+
+#include "stb_image/stb_image.h"
+
+// channel c (0 = red) of SIMD_LANES RGBA pixels loaded with simd_load_pixels
+static inline SimdUInt pixel_channel(SimdUInt pixels, int c)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+   return (pixels >> (uint32_t)((3 - c) * 8)) & 0xffu;
+#else
+   return (pixels >> (uint32_t)(c * 8)) & 0xffu;
+#endif
+}
+
+static inline SimdFloat to_float(SimdUInt v)
+{
+   return __builtin_convertvector(v, SimdFloat);
+}
+
+// runs kernel on every SIMD_LANES pixels of the image, the pixels after the last full vector are padded with zeros
+// ------------------------------------------------------------------------------------------------------------------
+template <typename Kernel>
+static void decode_pixels(const unsigned char *rgba, int width, int height, float *out, int threads, Kernel kernel)
+{
+   parallel_for(0, height, threads, [&](int begin, int end) {
+      size_t i = (size_t)begin * width;
+      size_t last = (size_t)end * width;
+      for (; i + SIMD_LANES <= last; i += SIMD_LANES)
+         simd_store(out + i, kernel(simd_load_pixels(rgba + RGBA * i)));
+      if (i < last)
+      {
+         unsigned char tail[SIMD_LANES * RGBA] = {0};
+         float values[SIMD_LANES];
+         memcpy(tail, rgba + RGBA * i, (last - i) * RGBA);
+         simd_store(values, kernel(simd_load_pixels(tail)));
+         memcpy(out + i, values, (last - i) * sizeof(float));
+      }
+   });
+}
+
+void normalize_heights(HeightPlane &plane, int threads)
+{
+   PROFILE_ZONE("normalize_heights");
+   float *heights = plane.heights.data();
+   size_t count = plane.heights.size();
+   float minimum = 1e30f;
+   float maximum = -1e30f;
+   std::mutex mutex;
+   parallel_for(0, plane.height, threads, [&](int begin, int end) {
+      const float *p = heights + (size_t)begin * plane.width;
+      const float *last = heights + (size_t)end * plane.width;
+      SimdFloat lo = SimdFloat() + 1e30f;
+      SimdFloat hi = SimdFloat() - 1e30f;
+      for (; p + SIMD_LANES <= last; p += SIMD_LANES)
+      {
+         SimdFloat v = simd_load(p);
+         lo = simd_min(lo, v);
+         hi = simd_max(hi, v);
+      }
+      float chunkMinimum = 1e30f;
+      float chunkMaximum = -1e30f;
+      for (int lane = 0; lane < SIMD_LANES; ++lane)
+      {
+         chunkMinimum = std::min(chunkMinimum, lo[lane]);
+         chunkMaximum = std::max(chunkMaximum, hi[lane]);
+      }
+      for (; p < last; ++p)
+      {
+         chunkMinimum = std::min(chunkMinimum, *p);
+         chunkMaximum = std::max(chunkMaximum, *p);
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      minimum = std::min(minimum, chunkMinimum);
+      maximum = std::max(maximum, chunkMaximum);
+   });
+   if (count == 0)
+      return;
+
+   plane.minimum = minimum;
+   plane.maximum = maximum;
+   // a flat image stays at the bottom
+   float scale = maximum > minimum ? 1.0f / (maximum - minimum) : 0.0f;
+   parallel_for(0, plane.height, threads, [&](int begin, int end) {
+      float *p = heights + (size_t)begin * plane.width;
+      float *last = heights + (size_t)end * plane.width;
+      for (; p + SIMD_LANES <= last; p += SIMD_LANES)
+         simd_store(p, (simd_load(p) - minimum) * scale);
+      for (; p < last; ++p)
+         *p = (*p - minimum) * scale;
+   });
+}
+
+const char *height_encoding_name(HeightEncoding encoding)
+{
+   switch (encoding)
+   {
+   case HEIGHT_RGB_PRODUCT:
+      return "RGB product";
+   case HEIGHT_LUMINANCE:
+      return "Luminance";
+   case HEIGHT_CHANNEL:
+      return "Single channel";
+   case HEIGHT_TERRAIN_RGB:
+      return "Terrain-RGB";
+   case HEIGHT_TERRARIUM:
+      return "Terrarium";
+   case HEIGHT_GRAY16:
+      return "16 bit gray";
+   default:
+      return "?";
+   }
+}
+
+bool height_encoding_from_name(const std::string &name, HeightEncoding &encoding)
+{
+   const char *names[HEIGHT_ENCODING_COUNT] = {"rgb-product", "luminance", "channel", "terrain-rgb", "terrarium", "gray16"};
+   for (int i = 0; i < HEIGHT_ENCODING_COUNT; ++i)
+   {
+      if (name == names[i])
+      {
+         encoding = (HeightEncoding)i;
+         return true;
+      }
+   }
+   return false;
+}
+
+void decode_heights(const unsigned char *rgba, int width, int height, const HeightDecoding &decoding, HeightPlane &plane,
+                    int threads)
+{
+   PROFILE_ZONE("decode_heights");
+   plane.width = width;
+   plane.height = height;
+   plane.minimum = 0.0f;
+   plane.maximum = 1.0f;
+   plane.decoding = decoding;
+   plane.heights.resize((size_t)width * height);
+   float *out = plane.heights.data();
+   switch (decoding.encoding)
+   {
+   case HEIGHT_LUMINANCE:
+   case HEIGHT_GRAY16:
+      decode_pixels(rgba, width, height, out, threads, [](SimdUInt p) {
+         return (0.2126f * to_float(pixel_channel(p, 0)) + 0.7152f * to_float(pixel_channel(p, 1)) +
+                 0.0722f * to_float(pixel_channel(p, 2))) / 255.0f;
+      });
+      break;
+   case HEIGHT_CHANNEL:
+   {
+      int channel = std::min(std::max(decoding.channel, 0), 3);
+      decode_pixels(rgba, width, height, out, threads,
+                    [channel](SimdUInt p) { return to_float(pixel_channel(p, channel)) / 255.0f; });
+      break;
+   }
+   case HEIGHT_TERRAIN_RGB:
+      decode_pixels(rgba, width, height, out, threads, [](SimdUInt p) {
+         // 24 bits fit into a float exactly
+         SimdUInt value = (pixel_channel(p, 0) << 16u) | (pixel_channel(p, 1) << 8u) | pixel_channel(p, 2);
+         return -10000.0f + to_float(value) * 0.1f;
+      });
+      normalize_heights(plane, threads);
+      break;
+   case HEIGHT_TERRARIUM:
+      decode_pixels(rgba, width, height, out, threads, [](SimdUInt p) {
+         return to_float(pixel_channel(p, 0)) * 256.0f + to_float(pixel_channel(p, 1)) +
+                to_float(pixel_channel(p, 2)) / 256.0f - 32768.0f;
+      });
+      normalize_heights(plane, threads);
+      break;
+   default:
+      // same operations in the same order as before, so grids and cached meshes stay bit identical
+      decode_pixels(rgba, width, height, out, threads, [](SimdUInt p) {
+         return (to_float(pixel_channel(p, 0)) * to_float(pixel_channel(p, 1)) * to_float(pixel_channel(p, 2))) /
+                (255.0f * 255.0f * 255.0f);
+      });
+      break;
+   }
+}
+
+void decode_heights16(const unsigned short *gray, int width, int height, HeightPlane &plane, int threads)
+{
+   PROFILE_ZONE("decode_heights16");
+   plane.width = width;
+   plane.height = height;
+   plane.minimum = 0.0f;
+   plane.maximum = 1.0f;
+   plane.decoding = HeightDecoding(HEIGHT_GRAY16);
+   plane.heights.resize((size_t)width * height);
+   float *out = plane.heights.data();
+   parallel_for(0, height, threads, [&](int begin, int end) {
+      size_t i = (size_t)begin * width;
+      size_t last = (size_t)end * width;
+      for (; i + SIMD_LANES <= last; i += SIMD_LANES)
+      {
+         SimdUShort values;
+         memcpy(&values, gray + i, sizeof(values));
+         simd_store(out + i, __builtin_convertvector(values, SimdFloat) / 65535.0f);
+      }
+      for (; i < last; ++i)
+         out[i] = gray[i] / 65535.0f;
+   });
+}
+
+bool load_heights(const std::string &filename, const HeightDecoding &decoding, HeightPlane &plane, int threads,
+                  bool verbose)
+{
+   PROFILE_ZONE("load_heights");
+   int width = 0;
+   int height = 0;
+   if (decoding.encoding == HEIGHT_GRAY16)
+   {
+      int channels;
+      unsigned short *gray = stbi_load_16(filename.c_str(), &width, &height, &channels, 1);
+      if (gray == nullptr)
+      {
+         std::cout << "Failed to load image " << filename << ": " << stbi_failure_reason() << '\n';
+         return false;
+      }
+      decode_heights16(gray, width, height, plane, threads);
+      stbi_image_free(gray);
+      if (verbose)
+         std::cout << "Image loaded successfully\nImage width: " << width << ", Image height: " << height << '\n';
+      return true;
+   }
+
+   std::vector<unsigned char> rgba;
+   if (!load_image(rgba, filename, width, height, verbose))
+      return false;
+   decode_heights(rgba.data(), width, height, decoding, plane, threads);
+   return true;
+}
+
+// Every band of stride rows is decoded on its own and box filtered into one row of heights, so the decoded heights
+// never exist at full resolution. Bands of the meter encodings come back normalized by their own range, they are
+// turned back into meters and the whole plane is normalized once at the end
+// ----------------------------------------------------------------------------------------------------------------------
+bool load_heights_strided(const std::string &filename, const HeightDecoding &decoding, int stride, HeightPlane &plane,
+                          int threads, bool verbose)
+{
+   if (stride <= 1)
+      return load_heights(filename, decoding, plane, threads, verbose);
+   PROFILE_ZONE("load_heights_strided");
+   int width = 0;
+   int height = 0;
+   int channels;
+   bool gray16 = decoding.encoding == HEIGHT_GRAY16;
+   void *pixels = gray16 ? (void *)stbi_load_16(filename.c_str(), &width, &height, &channels, 1)
+                         : (void *)stbi_load(filename.c_str(), &width, &height, &channels, RGBA);
+   if (pixels == nullptr)
+   {
+      std::cout << "Failed to load image " << filename << ": " << stbi_failure_reason() << '\n';
+      return false;
+   }
+   MemoryReservation pixelMemory(MEMORY_TRANSIENT, (long long)width * height * (gray16 ? 2 : RGBA));
+
+   plane.width = (width + stride - 1) / stride;
+   plane.height = (height + stride - 1) / stride;
+   plane.minimum = 0.0f;
+   plane.maximum = 1.0f;
+   plane.decoding = decoding;
+   plane.heights.resize((size_t)plane.width * plane.height);
+   parallel_for(0, plane.height, threads, [&](int begin, int end) {
+      HeightPlane band;
+      for (int row = begin; row < end; ++row)
+      {
+         int y = row * stride;
+         int rows = std::min(stride, height - y);
+         if (gray16)
+            decode_heights16((const unsigned short *)pixels + (size_t)y * width, width, rows, band, 1);
+         else
+            decode_heights((const unsigned char *)pixels + (size_t)y * width * RGBA, width, rows, decoding, band, 1);
+         float range = band.maximum - band.minimum;
+         float *out = &plane.heights[(size_t)row * plane.width];
+         for (int column = 0; column < plane.width; ++column)
+         {
+            int x = column * stride;
+            int columns = std::min(stride, width - x);
+            float sum = 0.0f;
+            for (int r = 0; r < rows; ++r)
+            {
+               const float *in = &band.heights[(size_t)r * width + x];
+               for (int c = 0; c < columns; ++c)
+                  sum += in[c];
+            }
+            out[column] = sum / (rows * columns) * range + band.minimum;
+         }
+      }
+   });
+   stbi_image_free(pixels);
+   if (decoding.encoding == HEIGHT_TERRAIN_RGB || decoding.encoding == HEIGHT_TERRARIUM)
+      normalize_heights(plane, threads);
+   if (verbose)
+      std::cout << "Image loaded with stride " << stride << "\nImage width: " << width << ", Image height: " << height
+                << ", heights: " << plane.width << "x" << plane.height << '\n';
+   return true;
+}
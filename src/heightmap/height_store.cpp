@@ -0,0 +1,659 @@
+#include <heightmap/height_store.h>
+#include <heightmap/grid.h>
+#include <heightmap/height_decoder.h>
+#include <heightmap/image_loader.h>
+
+#include <profiler.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// reads a decimal number of a PNM header, skipping whitespace and comments
+static bool read_pnm_value(std::FILE *file, int &value)
+{
+   int c = std::fgetc(file);
+   while (c != EOF && (std::isspace(c) || c == '#'))
+   {
+      if (c == '#')
+      {
+         while (c != EOF && c != '\n')
+            c = std::fgetc(file);
+      }
+      c = std::fgetc(file);
+   }
+   if (c == EOF || !std::isdigit(c))
+      return false;
+   value = 0;
+   while (c != EOF && std::isdigit(c))
+   {
+      value = value * 10 + (c - '0');
+      c = std::fgetc(file);
+   }
+   // exactly one whitespace character separates the header from the pixels
+   return c != EOF && std::isspace(c);
+}
+
+HeightStoreWriter::HeightStoreWriter()
+    : fd(-1), width(0), height(0), tileSize(0), band(-1), bandMemory(MEMORY_TRANSIENT), failed(false)
+{
+}
+
+HeightStoreWriter::~HeightStoreWriter()
+{
+   close();
+}
+
+// level table of a store, every level halves the previous one until a level fits into a single tile
+// ---------------------------------------------------------------------------------------------------
+static std::vector<HeightStoreLevel> store_levels(int width, int height, int tileSize)
+{
+   std::vector<HeightStoreLevel> levels;
+   long long offset = HEIGHT_STORE_DATA_OFFSET;
+   while (true)
+   {
+      HeightStoreLevel level;
+      std::memset(&level, 0, sizeof(level));
+      level.width = width;
+      level.height = height;
+      level.tilesX = (width + tileSize - 1) / tileSize;
+      level.tilesY = (height + tileSize - 1) / tileSize;
+      level.channels = levels.empty() ? 1 : HEIGHT_CHANNEL_COUNT;
+      level.offset = offset;
+      offset += (long long)level.tilesX * level.tilesY * level.channels * tileSize * tileSize * sizeof(float);
+      levels.push_back(level);
+      if (width <= tileSize && height <= tileSize)
+         return levels;
+      width = (width + 1) / 2;
+      height = (height + 1) / 2;
+   }
+}
+
+bool HeightStoreWriter::create(const std::string &filename, int width, int height, int tileSize)
+{
+   close();
+   fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0)
+   {
+      std::cout << "Failed to open " << filename << " for writing\n";
+      return false;
+   }
+   this->filename = filename;
+   this->width = width;
+   this->height = height;
+   this->tileSize = tileSize;
+   levels = store_levels(width, height, tileSize);
+   band = -1;
+   failed = false;
+   bandHeights.assign((size_t)tileSize * levels[0].tilesX * tileSize, 0.0f);
+   bandMemory.set(bandHeights);
+
+   HeightStoreHeader header;
+   std::memset(&header, 0, sizeof(header));
+   std::memcpy(header.magic, HEIGHT_STORE_MAGIC, sizeof(header.magic));
+   header.version = 2;
+   header.width = width;
+   header.height = height;
+   header.tileSize = tileSize;
+   header.levelCount = (int32_t)levels.size();
+   size_t tableBytes = levels.size() * sizeof(HeightStoreLevel);
+   failed |= ::pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header);
+   failed |= ::pwrite(fd, levels.data(), tableBytes, sizeof(header)) != (ssize_t)tableBytes;
+   // the file gets its final size right away, so bands can be written in any order
+   const HeightStoreLevel &last = levels.back();
+   long long end = last.offset + (long long)last.tilesX * last.tilesY * last.channels * tileSize * tileSize * sizeof(float);
+   failed |= ::ftruncate(fd, end) != 0;
+   return !failed;
+}
+
+void HeightStoreWriter::writeRow(int y, const float *heights)
+{
+   if (fd < 0 || y < 0 || y >= height)
+      return;
+   if (y / tileSize != band)
+   {
+      flushBand();
+      band = y / tileSize;
+   }
+   std::memcpy(&bandHeights[(size_t)(y % tileSize) * levels[0].tilesX * tileSize], heights, width * sizeof(float));
+}
+
+// rearranges the rows of the current band into tiles of level 0 and writes them
+// -----------------------------------------------------------------------------
+void HeightStoreWriter::flushBand()
+{
+   if (band < 0)
+      return;
+   int tilesX = levels[0].tilesX;
+   size_t stride = (size_t)tilesX * tileSize;
+   size_t tileBytes = (size_t)tileSize * tileSize * sizeof(float);
+   std::vector<float> tile((size_t)tileSize * tileSize);
+   for (int tileX = 0; tileX < tilesX; ++tileX)
+   {
+      for (int row = 0; row < tileSize; ++row)
+         std::memcpy(&tile[(size_t)row * tileSize], &bandHeights[row * stride + (size_t)tileX * tileSize],
+                     tileSize * sizeof(float));
+      long long offset = levels[0].offset + ((long long)band * tilesX + tileX) * (long long)tileBytes;
+      failed |= ::pwrite(fd, tile.data(), tileBytes, offset) != (ssize_t)tileBytes;
+   }
+   std::fill(bandHeights.begin(), bandHeights.end(), 0.0f);
+   band = -1;
+}
+
+// Computes every downsampled level from the previous one. A tile is reduced from the 2 x 2 tiles below it, which
+// are never needed again, so reading the previous level through a small cache touches every tile once
+// ----------------------------------------------------------------------------------------------------------------
+void HeightStoreWriter::writeLevels()
+{
+   if (levels.size() < 2 || failed)
+      return;
+   PROFILE_ZONE("HeightStoreWriter: levels");
+   size_t plane = (size_t)tileSize * tileSize;
+   HeightStore store;
+   if (!store.open(filename, 8 * (long long)(plane * HEIGHT_CHANNEL_COUNT * sizeof(float))))
+   {
+      failed = true;
+      return;
+   }
+
+   std::vector<float> tile(plane * HEIGHT_CHANNEL_COUNT);
+   std::vector<float> source(plane * 4);
+   MemoryReservation levelMemory(MEMORY_TRANSIENT, (long long)((tile.size() + source.size()) * sizeof(float)));
+   for (size_t l = 1; l < levels.size(); ++l)
+   {
+      const HeightStoreLevel &previous = levels[l - 1];
+      const HeightStoreLevel &current = levels[l];
+      size_t tileBytes = tile.size() * sizeof(float);
+      for (int tileY = 0; tileY < current.tilesY; ++tileY)
+      {
+         for (int tileX = 0; tileX < current.tilesX; ++tileX)
+         {
+            int x = tileX * 2 * tileSize;
+            int y = tileY * 2 * tileSize;
+            int sourceWidth = std::min(2 * tileSize, previous.width - x);
+            int sourceHeight = std::min(2 * tileSize, previous.height - y);
+            for (int channel = 0; channel < HEIGHT_CHANNEL_COUNT; ++channel)
+            {
+               store.readRegion(x, y, sourceWidth, sourceHeight, source.data(), (int)l - 1, (HeightChannel)channel);
+               float *out = &tile[channel * plane];
+               for (int row = 0; row < tileSize; ++row)
+               {
+                  // samples beyond the border repeat the last row and column
+                  const float *row0 = &source[(size_t)std::min(2 * row, sourceHeight - 1) * sourceWidth];
+                  const float *row1 = &source[(size_t)std::min(2 * row + 1, sourceHeight - 1) * sourceWidth];
+                  for (int column = 0; column < tileSize; ++column)
+                  {
+                     int column0 = std::min(2 * column, sourceWidth - 1);
+                     int column1 = std::min(2 * column + 1, sourceWidth - 1);
+                     float a = row0[column0];
+                     float b = row0[column1];
+                     float c = row1[column0];
+                     float d = row1[column1];
+                     if (channel == HEIGHT_MIN)
+                        *out++ = std::min(std::min(a, b), std::min(c, d));
+                     else if (channel == HEIGHT_MAX)
+                        *out++ = std::max(std::max(a, b), std::max(c, d));
+                     else
+                        *out++ = (a + b + c + d) / 4.0f;
+                  }
+               }
+            }
+            long long offset = current.offset + ((long long)tileY * current.tilesX + tileX) * (long long)tileBytes;
+            failed |= ::pwrite(fd, tile.data(), tileBytes, offset) != (ssize_t)tileBytes;
+         }
+      }
+   }
+}
+
+bool HeightStoreWriter::close()
+{
+   if (fd < 0)
+      return !failed;
+   flushBand();
+   std::vector<float>().swap(bandHeights);
+   bandMemory.set(0);
+   writeLevels();
+   failed |= ::close(fd) != 0;
+   fd = -1;
+   return !failed;
+}
+
+bool build_height_store(const std::string &imageFilename, const std::string &storeFilename, bool flipVertically,
+                        const HeightDecoding &decoding, int tileSize)
+{
+   PROFILE_ZONE("build_height_store");
+   HeightStoreWriter writer;
+
+   // binary PGM and PPM files are converted while reading
+   std::FILE *file = std::fopen(imageFilename.c_str(), "rb");
+   if (file == nullptr)
+   {
+      std::cout << "Failed to open " << imageFilename << '\n';
+      return false;
+   }
+   char magic[2] = {0, 0};
+   int width = 0;
+   int height = 0;
+   int maxValue = 0;
+   bool pnm = std::fread(magic, 1, 2, file) == 2 && magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6') &&
+              read_pnm_value(file, width) && read_pnm_value(file, height) && read_pnm_value(file, maxValue) &&
+              width > 0 && height > 0 && maxValue > 0 && maxValue < 256;
+   if (pnm)
+   {
+      int channels = magic[1] == '6' ? 3 : 1;
+      long dataOffset = std::ftell(file);
+      if (dataOffset < 0 || !writer.create(storeFilename, width, height, tileSize))
+      {
+         std::fclose(file);
+         return false;
+      }
+      std::vector<unsigned char> pixels((size_t)width * channels);
+      std::vector<unsigned char> rgba((size_t)width * RGBA);
+      HeightPlane row;
+      // reads and decodes the next row, the encodings in meters come back normalized by the range of the row
+      auto decode_row = [&]() {
+         if (std::fread(pixels.data(), 1, pixels.size(), file) != pixels.size())
+         {
+            std::cout << "Failed to read " << imageFilename << ": unexpected end of file\n";
+            return false;
+         }
+         for (int x = 0; x < width; ++x)
+         {
+            const unsigned char *pixel = &pixels[(size_t)x * channels];
+            unsigned char *out = &rgba[(size_t)x * RGBA];
+            out[0] = pixel[0];
+            out[1] = pixel[channels == 3 ? 1 : 0];
+            out[2] = pixel[channels == 3 ? 2 : 0];
+            out[3] = 255;
+         }
+         decode_heights(rgba.data(), width, 1, decoding, row, 1);
+         return true;
+      };
+
+      // the encodings in meters are normalized by the range of the whole image, which takes a first pass over it
+      bool meters = decoding.encoding == HEIGHT_TERRAIN_RGB || decoding.encoding == HEIGHT_TERRARIUM;
+      float minimum = 1e30f;
+      float maximum = -1e30f;
+      bool success = true;
+      for (int y = 0; meters && success && y < height; ++y)
+      {
+         success = decode_row();
+         minimum = std::min(minimum, row.minimum);
+         maximum = std::max(maximum, row.maximum);
+      }
+      success = success && std::fseek(file, dataOffset, SEEK_SET) == 0;
+      float scale = maximum > minimum ? 1.0f / (maximum - minimum) : 0.0f;
+      for (int y = 0; success && y < height; ++y)
+      {
+         success = decode_row();
+         if (success && meters)
+         {
+            float range = row.maximum - row.minimum;
+            for (int x = 0; x < width; ++x)
+               row.heights[x] = (row.heights[x] * range + row.minimum - minimum) * scale;
+         }
+         if (success)
+            writer.writeRow(flipVertically ? height - 1 - y : y, row.heights.data());
+      }
+      std::fclose(file);
+      if (!success)
+      {
+         writer.close();
+         std::remove(storeFilename.c_str());
+         return false;
+      }
+      return writer.close();
+   }
+   std::fclose(file);
+
+   // everything else is decoded completely first
+   HeightPlane plane;
+   if (!load_heights(imageFilename, decoding, plane, 0, false) ||
+       !writer.create(storeFilename, plane.width, plane.height, tileSize))
+      return false;
+   MemoryReservation planeMemory(MEMORY_TRANSIENT);
+   planeMemory.set(plane.heights);
+   // load_heights already flipped the rows if requested
+   for (int y = 0; y < plane.height; ++y)
+      writer.writeRow(y, &plane.heights[(size_t)y * plane.width]);
+   return writer.close();
+}
+
+HeightStore::HeightStore() : fd(-1), budgetBytes(HEIGHT_STORE_BUDGET), cacheMemory(MEMORY_IMAGE)
+{
+   std::memset(&header, 0, sizeof(header));
+   std::memset(&counters, 0, sizeof(counters));
+}
+
+HeightStore::~HeightStore()
+{
+   close();
+}
+
+bool HeightStore::open(const std::string &filename, long long budgetBytes)
+{
+   close();
+   fd = ::open(filename.c_str(), O_RDONLY);
+   if (fd < 0)
+   {
+      std::cout << "Failed to open height store " << filename << '\n';
+      return false;
+   }
+   bool valid = ::pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                std::memcmp(header.magic, HEIGHT_STORE_MAGIC, sizeof(header.magic)) == 0 &&
+                (header.version == 1 || header.version == 2) && header.width > 0 && header.height > 0 &&
+                header.tileSize > 0;
+   if (valid && header.version == 1)
+   {
+      // version 1 stores only have level 0 right at the data offset
+      levels = store_levels(header.width, header.height, header.tileSize);
+      levels.resize(1);
+   }
+   else if (valid)
+   {
+      size_t maxLevels = (HEIGHT_STORE_DATA_OFFSET - sizeof(header)) / sizeof(HeightStoreLevel);
+      valid = header.levelCount > 0 && (size_t)header.levelCount <= maxLevels;
+      if (valid)
+      {
+         levels.resize(header.levelCount);
+         size_t tableBytes = levels.size() * sizeof(HeightStoreLevel);
+         valid = ::pread(fd, levels.data(), tableBytes, sizeof(header)) == (ssize_t)tableBytes;
+      }
+   }
+   if (!valid)
+   {
+      std::cout << "Failed to open height store " << filename << ": invalid header\n";
+      close();
+      return false;
+   }
+   firstKeys.resize(levels.size());
+   long long key = 0;
+   for (size_t l = 0; l < levels.size(); ++l)
+   {
+      firstKeys[l] = key;
+      key += (long long)levels[l].tilesX * levels[l].tilesY;
+   }
+   this->budgetBytes = budgetBytes;
+   resetStats();
+
+   // O_DIRECT needs every tile to start and end on an alignment boundary, which holds for the default tile size
+   bool aligned = true;
+   for (size_t l = 0; l < levels.size(); ++l)
+      aligned &= levels[l].offset % TILE_READER_ALIGNMENT == 0 && tileBytes((int)l) % TILE_READER_ALIGNMENT == 0;
+   if (!reader.open(filename, aligned))
+   {
+      std::cout << "Failed to open height store " << filename << " for reading tiles\n";
+      close();
+      return false;
+   }
+   return true;
+}
+
+void HeightStore::close()
+{
+   // completions of reads in flight still insert into the cache
+   reader.close();
+   std::lock_guard<std::mutex> lock(mutex);
+   if (fd >= 0)
+      ::close(fd);
+   fd = -1;
+   lru.clear();
+   tiles.clear();
+   loading.clear();
+   levels.clear();
+   firstKeys.clear();
+   counters.residentTiles = 0;
+   counters.residentBytes = 0;
+   cacheMemory.set(0);
+   std::memset(&header, 0, sizeof(header));
+}
+
+bool HeightStore::isOpen() const
+{
+   return fd >= 0;
+}
+
+int HeightStore::width() const
+{
+   return header.width;
+}
+
+int HeightStore::height() const
+{
+   return header.height;
+}
+
+int HeightStore::tileSize() const
+{
+   return header.tileSize;
+}
+
+int HeightStore::levelCount() const
+{
+   return (int)levels.size();
+}
+
+const HeightStoreLevel &HeightStore::level(int level) const
+{
+   return levels[level];
+}
+
+void HeightStore::setBudget(long long bytes)
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   budgetBytes = bytes;
+   evict();
+}
+
+long long HeightStore::budget() const
+{
+   return budgetBytes;
+}
+
+float HeightStore::sample(int x, int y, int level, HeightChannel channel) const
+{
+   const HeightStoreLevel &info = levels[level];
+   x = std::min(std::max(x, 0), info.width - 1);
+   y = std::min(std::max(y, 0), info.height - 1);
+   int size = header.tileSize;
+   Tile heights = tile(level, x / size, y / size);
+   size_t plane = info.channels == 1 ? 0 : (size_t)channel * size * size;
+   return (*heights)[plane + (size_t)(y % size) * size + x % size];
+}
+
+void HeightStore::readRegion(int x, int y, int regionWidth, int regionHeight, float *out, int level,
+                             HeightChannel channel) const
+{
+   int size = header.tileSize;
+   size_t plane = levels[level].channels == 1 ? 0 : (size_t)channel * size * size;
+   for (int tileY = y / size; tileY * size < y + regionHeight; ++tileY)
+   {
+      int rowBegin = std::max(y, tileY * size);
+      int rowEnd = std::min(y + regionHeight, (tileY + 1) * size);
+      for (int tileX = x / size; tileX * size < x + regionWidth; ++tileX)
+      {
+         int columnBegin = std::max(x, tileX * size);
+         int columnEnd = std::min(x + regionWidth, (tileX + 1) * size);
+         Tile heights = tile(level, tileX, tileY);
+         for (int row = rowBegin; row < rowEnd; ++row)
+            std::memcpy(&out[(size_t)(row - y) * regionWidth + (columnBegin - x)],
+                        &(*heights)[plane + (size_t)(row - tileY * size) * size + (columnBegin - tileX * size)],
+                        (columnEnd - columnBegin) * sizeof(float));
+      }
+   }
+}
+
+bool HeightStore::isResident(int level, int tileX, int tileY) const
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   return tiles.count(tileKey(level, tileX, tileY)) != 0;
+}
+
+bool HeightStore::isRegionResident(int x, int y, int regionWidth, int regionHeight, int level) const
+{
+   int size = header.tileSize;
+   std::lock_guard<std::mutex> lock(mutex);
+   for (int tileY = y / size; tileY * size < y + regionHeight; ++tileY)
+   {
+      for (int tileX = x / size; tileX * size < x + regionWidth; ++tileX)
+      {
+         if (tiles.count(tileKey(level, tileX, tileY)) == 0)
+            return false;
+      }
+   }
+   return true;
+}
+
+void HeightStore::prefetch(int level, int tileX, int tileY) const
+{
+   if (!isResident(level, tileX, tileY))
+      tile(level, tileX, tileY, true);
+}
+
+bool HeightStore::prefetchAsync(int level, int tileX, int tileY, const std::function<void()> &done) const
+{
+   long long key = tileKey(level, tileX, tileY);
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (tiles.count(key) != 0 || !loading.insert(key).second)
+         return false;
+      ++counters.prefetches;
+   }
+   size_t count = tileBytes(level) / sizeof(float);
+   TileReadCallback completed = [this, key, count, done](const char *data, size_t, bool success) {
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         if (success)
+         {
+            std::shared_ptr<std::vector<float>> heights = std::make_shared<std::vector<float>>(count);
+            std::memcpy(heights->data(), data, count * sizeof(float));
+            insert(key, heights);
+         }
+         loading.erase(key);
+      }
+      done();
+   };
+   reader.read(tileOffset(level, tileX, tileY), tileBytes(level), completed);
+   return true;
+}
+
+void HeightStore::submitReads() const
+{
+   reader.submit();
+}
+
+HeightStoreStats HeightStore::stats() const
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   return counters;
+}
+
+TileReaderStats HeightStore::readerStats() const
+{
+   return reader.stats();
+}
+
+std::string HeightStore::readerBackend() const
+{
+   return reader.backend();
+}
+
+void HeightStore::resetStats()
+{
+   reader.resetStats();
+   std::lock_guard<std::mutex> lock(mutex);
+   counters.hits = 0;
+   counters.misses = 0;
+   counters.prefetches = 0;
+   counters.evictions = 0;
+}
+
+long long HeightStore::tileKey(int level, int tileX, int tileY) const
+{
+   return firstKeys[level] + (long long)tileY * levels[level].tilesX + tileX;
+}
+
+// returns a tile from the cache or reads it, a returned tile stays valid even if it gets evicted meanwhile
+// ---------------------------------------------------------------------------------------------------------
+HeightStore::Tile HeightStore::tile(int level, int tileX, int tileY, bool prefetching) const
+{
+   long long key = tileKey(level, tileX, tileY);
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::unordered_map<long long, std::list<CachedTile>::iterator>::iterator it = tiles.find(key);
+      if (it != tiles.end())
+      {
+         if (!prefetching)
+            ++counters.hits;
+         lru.splice(lru.begin(), lru, it->second);
+         return it->second->heights;
+      }
+      if (prefetching)
+         ++counters.prefetches;
+      else
+         ++counters.misses;
+   }
+
+   Tile heights = readTile(level, tileX, tileY);
+   std::lock_guard<std::mutex> lock(mutex);
+   return insert(key, heights);
+}
+
+// adds a tile to the cache and returns the cached one, which differs if another thread read the same tile in the
+// meantime. Expects the lock to be held
+// ---------------------------------------------------------------------------------------------------------------
+HeightStore::Tile HeightStore::insert(long long key, const Tile &heights) const
+{
+   std::unordered_map<long long, std::list<CachedTile>::iterator>::iterator it = tiles.find(key);
+   if (it != tiles.end())
+      return it->second->heights;
+   CachedTile cached = {key, heights};
+   lru.push_front(cached);
+   tiles[key] = lru.begin();
+   ++counters.residentTiles;
+   counters.residentBytes += (long long)heights->size() * sizeof(float);
+   evict();
+   return heights;
+}
+
+HeightStore::Tile HeightStore::readTile(int level, int tileX, int tileY) const
+{
+   PROFILE_ZONE("HeightStore: read tile");
+   std::shared_ptr<std::vector<float>> heights = std::make_shared<std::vector<float>>(tileBytes(level) / sizeof(float));
+   if (!reader.readSync(tileOffset(level, tileX, tileY), tileBytes(level), heights->data()))
+   {
+      std::cout << "Failed to read tile " << tileX << ", " << tileY << " of level " << level << " of the height store\n";
+      std::fill(heights->begin(), heights->end(), 0.0f);
+   }
+   return heights;
+}
+
+long long HeightStore::tileOffset(int level, int tileX, int tileY) const
+{
+   const HeightStoreLevel &info = levels[level];
+   return info.offset + ((long long)tileY * info.tilesX + tileX) * (long long)tileBytes(level);
+}
+
+size_t HeightStore::tileBytes(int level) const
+{
+   return (size_t)levels[level].channels * header.tileSize * header.tileSize * sizeof(float);
+}
+
+// drops least recently used tiles until the budget is met, expects the lock to be held
+void HeightStore::evict() const
+{
+   while (counters.residentBytes > budgetBytes && lru.size() > 1)
+   {
+      counters.residentBytes -= (long long)lru.back().heights->size() * sizeof(float);
+      --counters.residentTiles;
+      ++counters.evictions;
+      tiles.erase(lru.back().key);
+      lru.pop_back();
+   }
+   cacheMemory.set(counters.residentBytes);
+}
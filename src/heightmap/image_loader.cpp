@@ -0,0 +1,32 @@
+#define STB_IMAGE_IMPLEMENTATION
+
+#include <heightmap/image_loader.h>
+#include <heightmap/grid.h>
+
+#include <profiler.h>
+
+#include <iostream>
+
+#include "stb_image/stb_image.h"
+
+bool load_image(std::vector<unsigned char> &image, const std::string &filename, int &x, int &y, bool verbose)
+{
+   PROFILE_ZONE("load_image");
+   int n;
+   unsigned char *data = stbi_load(filename.c_str(), &x, &y, &n, RGBA);
+   if (data != nullptr)
+   {
+      image = std::vector<unsigned char>(data, data + (size_t)x * y * RGBA);
+      if (verbose)
+      {
+         std::cout << "Image loaded successfully\n";
+         std::cout << "Image width: " << x << ", Image height: " << y << '\n';
+      }
+   }
+   else
+   {
+      std::cout << "Failed to load image " << filename << ": " << stbi_failure_reason() << '\n';
+   }
+   stbi_image_free(data);
+   return (data != nullptr);
+}
@@ -0,0 +1,158 @@
+#include <heightmap/image_probe.h>
+#include <heightmap/height_store.h>
+#include <heightmap/text_dem.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stb_image/stb_image.h"
+
+// size of a vertex (position and normal) and of the two triangles of a quad in the grid buffers
+static const long long GRID_VERTEX_BYTES = 24;
+static const long long GRID_QUAD_BYTES = 24;
+
+// binary 8 bit PGM and PPM files are streamed into height stores by build_height_store
+static bool is_streamable_pnm(const std::string &filename)
+{
+   std::FILE *file = std::fopen(filename.c_str(), "rb");
+   if (file == nullptr)
+      return false;
+   char magic[2] = {0, 0};
+   int values[3] = {0, 0, 0};
+   bool pnm = std::fread(magic, 1, 2, file) == 2 && magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6') &&
+              std::fscanf(file, "%d %d %d", &values[0], &values[1], &values[2]) == 3;
+   std::fclose(file);
+   return pnm && values[2] > 0 && values[2] < 256;
+}
+
+bool probe_image(const std::string &filename, ImageProbe &probe)
+{
+   probe = ImageProbe();
+   struct stat status;
+   if (::stat(filename.c_str(), &status) != 0)
+      return false;
+   probe.fileBytes = (long long)status.st_size;
+
+   // the raw formats announce themselves in their header
+   std::FILE *file = std::fopen(filename.c_str(), "rb");
+   if (file == nullptr)
+      return false;
+   HeightStoreHeader header;
+   bool store = std::fread(&header, sizeof(header), 1, file) == 1 &&
+                std::memcmp(header.magic, HEIGHT_STORE_MAGIC, sizeof(header.magic)) == 0;
+   std::fclose(file);
+   if (store)
+   {
+      probe.format = PROBE_HEIGHT_STORE;
+      probe.width = header.width;
+      probe.height = header.height;
+      probe.channels = 1;
+      probe.bitsPerChannel = 32;
+      probe.streamable = true;
+      return header.width > 0 && header.height > 0;
+   }
+   TextDemInfo info;
+   if (read_text_dem_header(filename, info))
+   {
+      probe.format = PROBE_TEXT_DEM;
+      probe.width = info.width;
+      probe.height = info.height;
+      probe.channels = 1;
+      probe.bitsPerChannel = 32;
+      probe.streamable = true;
+      return true;
+   }
+
+   if (!stbi_info(filename.c_str(), &probe.width, &probe.height, &probe.channels))
+      return false;
+   probe.format = PROBE_IMAGE;
+   probe.bitsPerChannel = stbi_is_16_bit(filename.c_str()) ? 16 : 8;
+   probe.streamable = is_streamable_pnm(filename);
+   return true;
+}
+
+// Decoding holds the compressed file, the pixels in their own format and the pixels converted for the decoder at once
+// (PNG needs them all). Full loads copy the converted pixels once more in load_image, strided loads decode the pixels
+// band by band. The grid has a vertex per height plus one more row and column and two triangles per quad
+// ----------------------------------------------------------------------------------------------------------------------
+LoadEstimate estimate_load(const ImageProbe &probe, const HeightDecoding &decoding, int stride)
+{
+   LoadEstimate estimate;
+   stride = stride < 1 ? 1 : stride;
+   long long width = (probe.width + stride - 1) / stride;
+   long long height = (probe.height + stride - 1) / stride;
+   estimate.image = width * height * (long long)sizeof(float);
+   long long quads = width * height;
+   long long vertices = (width + 1) * (height + 1);
+   estimate.mesh = vertices * GRID_VERTEX_BYTES + quads * GRID_QUAD_BYTES;
+   estimate.gpu = estimate.mesh;
+   if (probe.format != PROBE_IMAGE)
+      return estimate;
+
+   long long pixels = (long long)probe.width * probe.height;
+   long long native = pixels * probe.channels * (probe.bitsPerChannel / 8);
+   long long converted = decoding.encoding == HEIGHT_GRAY16 ? pixels * 2 : pixels * 4;
+   estimate.decode = probe.fileBytes + native + converted;
+   if (stride == 1 && decoding.encoding != HEIGHT_GRAY16)
+      estimate.decode += converted;
+   return estimate;
+}
+
+const char *load_mode_name(LoadMode mode)
+{
+   switch (mode)
+   {
+   case LOAD_FULL:
+      return "Full";
+   case LOAD_STRIDED:
+      return "Strided";
+   case LOAD_TILED:
+      return "Tiled";
+   case LOAD_REJECTED:
+      return "Rejected";
+   default:
+      return "Unknown";
+   }
+}
+
+LoadPlan plan_load(const ImageProbe &probe, const HeightDecoding &decoding, long long budgetBytes)
+{
+   LoadPlan plan;
+   plan.estimate = estimate_load(probe, decoding);
+   if (probe.format == PROBE_HEIGHT_STORE || probe.format == PROBE_TEXT_DEM)
+   {
+      plan.mode = LOAD_TILED;
+      return plan;
+   }
+   if (plan.estimate.total() <= budgetBytes)
+      return plan;
+
+   for (int stride = 2; stride <= LOAD_MAX_STRIDE; ++stride)
+   {
+      LoadEstimate estimate = estimate_load(probe, decoding, stride);
+      if (estimate.total() <= budgetBytes)
+      {
+         plan.mode = LOAD_STRIDED;
+         plan.stride = stride;
+         plan.estimate = estimate;
+         return plan;
+      }
+      // the decode buffers do not shrink with the stride
+      if (estimate.decode > budgetBytes)
+         break;
+   }
+   plan.mode = probe.streamable ? LOAD_TILED : LOAD_REJECTED;
+   return plan;
+}
+
+long long default_load_budget()
+{
+   long long pages = ::sysconf(_SC_PHYS_PAGES);
+   long long pageSize = ::sysconf(_SC_PAGE_SIZE);
+   if (pages <= 0 || pageSize <= 0)
+      return LOAD_BUDGET;
+   return pages * pageSize / 4 * 3;
+}
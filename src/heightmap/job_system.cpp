@@ -0,0 +1,296 @@
+#include <heightmap/job_system.h>
+
+#include <profiler.h>
+
+#include <algorithm>
+#include <string>
+
+struct Job
+{
+   std::function<void()> fn;
+   std::atomic<int> pending; // unfinished dependencies, plus one until submit() has registered all of them
+   std::mutex mutex;
+   bool finished;
+   std::vector<JobHandle> dependents; // jobs queued once this one finished
+   std::condition_variable done;
+
+   Job() : pending(1), finished(false) {}
+};
+
+// index of the worker running on the current thread, the shared deque for all other threads
+static thread_local int currentWorker = -1;
+
+static long long now_nanoseconds()
+{
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+JobSystem::JobSystem() : queued(0), stopping(false), lastUpdate(std::chrono::steady_clock::now())
+{
+   unsigned int hardware = std::thread::hardware_concurrency();
+   int count = hardware > 1 ? (int)hardware - 1 : 1;
+   for (int i = 0; i <= count; ++i)
+      workers.push_back(std::unique_ptr<Worker>(new Worker()));
+   for (int i = 0; i < count; ++i)
+      workers[i]->thread = std::thread(&JobSystem::run, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+   {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      stopping = true;
+   }
+   wake.notify_all();
+   for (size_t i = 0; i < workers.size(); ++i)
+   {
+      if (workers[i]->thread.joinable())
+         workers[i]->thread.join();
+   }
+}
+
+int JobSystem::workerCount() const
+{
+   return (int)workers.size() - 1;
+}
+
+JobHandle JobSystem::submit(const std::function<void()> &fn)
+{
+   return submit(fn, std::vector<JobHandle>());
+}
+
+// The job starts with one pending dependency of its own, so it cannot be queued by a dependency finishing while
+// the others are still being registered
+// -----------------------------------------------------------------------------------------------------------------
+JobHandle JobSystem::submit(const std::function<void()> &fn, const std::vector<JobHandle> &dependencies)
+{
+   JobHandle job = std::make_shared<Job>();
+   job->fn = fn;
+   for (size_t i = 0; i < dependencies.size(); ++i)
+   {
+      const JobHandle &dependency = dependencies[i];
+      if (!dependency)
+         continue;
+      std::lock_guard<std::mutex> lock(dependency->mutex);
+      if (!dependency->finished)
+      {
+         job->pending.fetch_add(1);
+         dependency->dependents.push_back(job);
+      }
+   }
+   if (job->pending.fetch_sub(1) == 1)
+      schedule(job);
+   return job;
+}
+
+JobHandle JobSystem::whenAll(const std::vector<JobHandle> &dependencies)
+{
+   return submit(std::function<void()>(), dependencies);
+}
+
+void JobSystem::schedule(const JobHandle &job)
+{
+   Worker &worker = *workers[currentWorker >= 0 ? currentWorker : workerCount()];
+   {
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      worker.jobs.push_back(job);
+   }
+   {
+      // taken so a worker about to sleep either sees the job or is woken up
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      queued.fetch_add(1);
+   }
+   wake.notify_one();
+}
+
+// newest job of the own deque first, then the oldest job of any other deque starting with the next one
+// ------------------------------------------------------------------------------------------------------
+JobHandle JobSystem::take(int self)
+{
+   int count = (int)workers.size();
+   int own = self >= 0 ? self : count - 1;
+   {
+      Worker &worker = *workers[own];
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      if (!worker.jobs.empty())
+      {
+         JobHandle job = worker.jobs.back();
+         worker.jobs.pop_back();
+         queued.fetch_sub(1);
+         return job;
+      }
+   }
+   for (int i = 1; i < count; ++i)
+   {
+      Worker &victim = *workers[(own + i) % count];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.jobs.empty())
+      {
+         JobHandle job = victim.jobs.front();
+         victim.jobs.pop_front();
+         queued.fetch_sub(1);
+         if (self >= 0)
+            workers[self]->stolen.fetch_add(1, std::memory_order_relaxed);
+         return job;
+      }
+   }
+   return JobHandle();
+}
+
+void JobSystem::execute(const JobHandle &job, int self)
+{
+   if (job->fn)
+   {
+      Worker *worker = self >= 0 ? workers[self].get() : nullptr;
+      long long start = now_nanoseconds();
+      long long outer = 0;
+      // a job run by wait() inside another job pauses the time of the outer one
+      if (worker != nullptr)
+      {
+         outer = worker->runningSince.exchange(start, std::memory_order_relaxed);
+         if (outer != 0)
+            worker->busyNanoseconds.fetch_add(start - outer, std::memory_order_relaxed);
+      }
+      job->fn();
+      if (worker != nullptr)
+      {
+         long long end = now_nanoseconds();
+         long long running = worker->runningSince.exchange(outer != 0 ? end : 0, std::memory_order_relaxed);
+         worker->busyNanoseconds.fetch_add(end - running, std::memory_order_relaxed);
+         worker->executed.fetch_add(1, std::memory_order_relaxed);
+      }
+   }
+   finish(job);
+}
+
+void JobSystem::finish(const JobHandle &job)
+{
+   std::vector<JobHandle> dependents;
+   {
+      std::lock_guard<std::mutex> lock(job->mutex);
+      job->finished = true;
+      job->fn = std::function<void()>(); // releases whatever the function captured
+      dependents.swap(job->dependents);
+   }
+   job->done.notify_all();
+   for (size_t i = 0; i < dependents.size(); ++i)
+   {
+      if (dependents[i]->pending.fetch_sub(1) == 1)
+         schedule(dependents[i]);
+   }
+}
+
+void JobSystem::run(int self)
+{
+   currentWorker = self;
+   Profiler::instance().setThreadName("Worker " + std::to_string(self));
+   while (true)
+   {
+      JobHandle job = take(self);
+      if (job)
+      {
+         execute(job, self);
+         continue;
+      }
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+      if (stopping)
+         return;
+   }
+}
+
+// Runs queued jobs while the job is not finished. Once nothing is left to run, the job is running on another
+// thread or waits for dependencies that are, and the caller sleeps until it finished
+// -----------------------------------------------------------------------------------------------------------
+void JobSystem::wait(const JobHandle &job)
+{
+   if (!job)
+      return;
+   while (!isDone(job))
+   {
+      JobHandle other = take(currentWorker);
+      if (other)
+      {
+         execute(other, currentWorker);
+         continue;
+      }
+      std::unique_lock<std::mutex> lock(job->mutex);
+      // woken up regularly, a job queued meanwhile may be the one that unblocks this one
+      job->done.wait_for(lock, std::chrono::milliseconds(1), [&job] { return job->finished; });
+   }
+}
+
+void JobSystem::waitAll(const std::vector<JobHandle> &jobs)
+{
+   for (size_t i = 0; i < jobs.size(); ++i)
+      wait(jobs[i]);
+}
+
+bool JobSystem::isDone(const JobHandle &job) const
+{
+   if (!job)
+      return true;
+   std::lock_guard<std::mutex> lock(job->mutex);
+   return job->finished;
+}
+
+void JobSystem::runOnMainThread(const std::function<void()> &fn)
+{
+   std::lock_guard<std::mutex> lock(mainMutex);
+   mainJobs.push_back(fn);
+}
+
+int JobSystem::runMainThreadJobs()
+{
+   std::vector<std::function<void()>> jobs;
+   {
+      std::lock_guard<std::mutex> lock(mainMutex);
+      jobs.swap(mainJobs);
+   }
+   for (size_t i = 0; i < jobs.size(); ++i)
+      jobs[i]();
+   return (int)jobs.size();
+}
+
+int JobSystem::mainThreadPending() const
+{
+   std::lock_guard<std::mutex> lock(mainMutex);
+   return (int)mainJobs.size();
+}
+
+int JobSystem::queuedJobs() const
+{
+   return queued.load();
+}
+
+// the utilisation is updated at most every JOB_SYSTEM_UTILISATION_INTERVAL, in between the last values are returned
+// -------------------------------------------------------------------------------------------------------------------
+std::vector<JobWorkerStats> JobSystem::stats()
+{
+   std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+   double elapsed = std::chrono::duration<double>(now - lastUpdate).count();
+   bool update = elapsed >= JOB_SYSTEM_UTILISATION_INTERVAL;
+   if (update)
+      lastUpdate = now;
+
+   std::vector<JobWorkerStats> stats(workerCount());
+   for (int i = 0; i < workerCount(); ++i)
+   {
+      Worker &worker = *workers[i];
+      long long busy = worker.busyNanoseconds.load(std::memory_order_relaxed);
+      // a job that runs for longer than the interval counts as busy while it runs, not only once it finished
+      long long running = worker.runningSince.load(std::memory_order_relaxed);
+      if (running != 0)
+         busy += std::max(now_nanoseconds() - running, 0LL);
+      if (update)
+      {
+         worker.utilisation = (float)std::min((busy - worker.lastBusyNanoseconds) / (elapsed * 1e9), 1.0);
+         worker.lastBusyNanoseconds = busy;
+      }
+      stats[i].executed = worker.executed.load(std::memory_order_relaxed);
+      stats[i].stolen = worker.stolen.load(std::memory_order_relaxed);
+      stats[i].busySeconds = busy / 1e9;
+      stats[i].utilisation = worker.utilisation;
+   }
+   return stats;
+}
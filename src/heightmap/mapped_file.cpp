@@ -0,0 +1,55 @@
+#include <heightmap/mapped_file.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile() : mapped(nullptr), length(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+   close();
+}
+
+bool MappedFile::open(const std::string &filename)
+{
+   close();
+   int fd = ::open(filename.c_str(), O_RDONLY);
+   if (fd < 0)
+      return false;
+   struct stat status;
+   if (::fstat(fd, &status) != 0 || status.st_size == 0)
+   {
+      ::close(fd);
+      return false;
+   }
+   void *data = ::mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   ::close(fd);
+   if (data == MAP_FAILED)
+      return false;
+   ::madvise(data, (size_t)status.st_size, MADV_SEQUENTIAL);
+   mapped = (const char *)data;
+   length = (size_t)status.st_size;
+   return true;
+}
+
+void MappedFile::close()
+{
+   if (mapped != nullptr)
+      ::munmap((void *)mapped, length);
+   mapped = nullptr;
+   length = 0;
+}
+
+const char *MappedFile::data() const
+{
+   return mapped;
+}
+
+size_t MappedFile::size() const
+{
+   return length;
+}
@@ -0,0 +1,420 @@
+#include <heightmap/mesh_cache.h>
+
+#include <profiler.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint32_t MESH_CACHE_VERSION = 3;
+static const uint64_t HASH_PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t HASH_PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+
+static inline uint64_t rotate_left(uint64_t value, int bits)
+{
+   return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t load_word(const unsigned char *bytes)
+{
+   uint64_t word;
+   std::memcpy(&word, bytes, sizeof(word));
+   return word;
+}
+
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed)
+{
+   const unsigned char *bytes = static_cast<const unsigned char *>(data);
+   const unsigned char *end = bytes + size;
+   uint64_t hash;
+   if (size >= 32)
+   {
+      uint64_t lanes[4] = {seed + HASH_PRIME1 + HASH_PRIME2, seed + HASH_PRIME2, seed, seed - HASH_PRIME1};
+      for (; bytes + 32 <= end; bytes += 32)
+      {
+         for (int i = 0; i < 4; ++i)
+            lanes[i] = rotate_left(lanes[i] + load_word(bytes + 8 * i) * HASH_PRIME2, 31) * HASH_PRIME1;
+      }
+      hash = rotate_left(lanes[0], 1) + rotate_left(lanes[1], 7) + rotate_left(lanes[2], 12) + rotate_left(lanes[3], 18);
+   }
+   else
+   {
+      hash = seed + HASH_PRIME1;
+   }
+   hash += (uint64_t)size;
+   for (; bytes + 8 <= end; bytes += 8)
+      hash = rotate_left(hash ^ (load_word(bytes) * HASH_PRIME2), 27) * HASH_PRIME1;
+   for (; bytes < end; ++bytes)
+      hash = rotate_left(hash ^ (*bytes * HASH_PRIME1), 11) * HASH_PRIME2;
+
+   hash ^= hash >> 33;
+   hash *= HASH_PRIME2;
+   hash ^= hash >> 29;
+   hash *= HASH_PRIME1;
+   hash ^= hash >> 32;
+   return hash;
+}
+
+// maps the file and hashes it in one go, the kernel reads ahead since the mapping is read sequentially
+// ------------------------------------------------------------------------------------------------------
+uint64_t hash_file(const std::string &filename)
+{
+   PROFILE_ZONE("hash_file");
+   int fd = ::open(filename.c_str(), O_RDONLY);
+   if (fd < 0)
+      return 0;
+   struct stat status;
+   if (::fstat(fd, &status) != 0)
+   {
+      ::close(fd);
+      return 0;
+   }
+   uint64_t hash;
+   if (status.st_size == 0)
+   {
+      hash = hash_bytes(nullptr, 0);
+   }
+   else
+   {
+      void *data = ::mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED)
+      {
+         ::close(fd);
+         return 0;
+      }
+      ::madvise(data, (size_t)status.st_size, MADV_SEQUENTIAL);
+      hash = hash_bytes(data, (size_t)status.st_size);
+      ::munmap(data, (size_t)status.st_size);
+   }
+   ::close(fd);
+   // 0 means unknown to callers
+   return hash == 0 ? 1 : hash;
+}
+
+static MeshCacheHeader make_header(const MeshCacheKey &key, size_t vertexCount, size_t triangleCount)
+{
+   MeshCacheHeader header;
+   std::memset(&header, 0, sizeof(header));
+   std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+   header.version = MESH_CACHE_VERSION;
+   header.key = key;
+   header.vertexCount = (int64_t)vertexCount;
+   header.triangleCount = (int64_t)triangleCount;
+   header.vertexOffset = MESH_CACHE_DATA_OFFSET;
+   header.indexOffset = MESH_CACHE_DATA_OFFSET + (int64_t)(vertexCount * sizeof(glm::vec3));
+   return header;
+}
+
+MappedMesh::MappedMesh() : data(nullptr), size(0)
+{
+}
+
+MappedMesh::~MappedMesh()
+{
+   close();
+}
+
+bool MappedMesh::open(const std::string &filename, const MeshCacheKey &key)
+{
+   close();
+   int fd = ::open(filename.c_str(), O_RDONLY);
+   if (fd < 0)
+      return false;
+   struct stat status;
+   bool valid = ::fstat(fd, &status) == 0 && status.st_size >= MESH_CACHE_DATA_OFFSET;
+   if (valid)
+   {
+      data = ::mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      valid = data != MAP_FAILED;
+      if (!valid)
+         data = nullptr;
+      else
+         size = (size_t)status.st_size;
+   }
+   ::close(fd);
+   if (!valid)
+      return false;
+
+   // a different key with the same file name is a hash collision, a short file a failed write
+   const MeshCacheHeader *header = static_cast<const MeshCacheHeader *>(data);
+   valid = std::memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+           header->version == MESH_CACHE_VERSION && std::memcmp(&header->key, &key, sizeof(key)) == 0 &&
+           header->vertexOffset == MESH_CACHE_DATA_OFFSET &&
+           header->indexOffset == header->vertexOffset + header->vertexCount * (int64_t)sizeof(glm::vec3) &&
+           header->indexOffset + header->triangleCount * (int64_t)sizeof(glm::uvec3) <= (int64_t)size;
+   if (!valid)
+   {
+      close();
+      return false;
+   }
+   ::madvise(data, size, MADV_SEQUENTIAL);
+   return true;
+}
+
+void MappedMesh::close()
+{
+   if (data != nullptr)
+      ::munmap(data, size);
+   data = nullptr;
+   size = 0;
+}
+
+const glm::vec3 *MappedMesh::vertices() const
+{
+   const MeshCacheHeader *header = static_cast<const MeshCacheHeader *>(data);
+   return reinterpret_cast<const glm::vec3 *>(static_cast<const char *>(data) + header->vertexOffset);
+}
+
+const glm::uvec3 *MappedMesh::indices() const
+{
+   const MeshCacheHeader *header = static_cast<const MeshCacheHeader *>(data);
+   return reinterpret_cast<const glm::uvec3 *>(static_cast<const char *>(data) + header->indexOffset);
+}
+
+size_t MappedMesh::vertexCount() const
+{
+   return data == nullptr ? 0 : (size_t) static_cast<const MeshCacheHeader *>(data)->vertexCount;
+}
+
+size_t MappedMesh::triangleCount() const
+{
+   return data == nullptr ? 0 : (size_t) static_cast<const MeshCacheHeader *>(data)->triangleCount;
+}
+
+MeshCacheWriter::MeshCacheWriter() : fd(-1), failed(false)
+{
+   std::memset(&header, 0, sizeof(header));
+}
+
+MeshCacheWriter::~MeshCacheWriter()
+{
+   abort();
+}
+
+// the temporary file gets its final size right away, pieces are written into it in any order
+// ---------------------------------------------------------------------------------------------
+bool MeshCacheWriter::create(const std::string &filename, const MeshCacheKey &key, size_t vertexCount,
+                             size_t triangleCount)
+{
+   abort();
+   this->filename = filename;
+   temporary = filename + ".tmp";
+   header = make_header(key, vertexCount, triangleCount);
+   fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0)
+   {
+      std::cout << "Failed to create mesh cache entry " << temporary << '\n';
+      return false;
+   }
+   failed = false;
+   if (::ftruncate(fd, size()) != 0)
+   {
+      std::cout << "Failed to create mesh cache entry " << temporary << '\n';
+      abort();
+      return false;
+   }
+   write(&header, sizeof(header), 0);
+   return !failed;
+}
+
+bool MeshCacheWriter::isOpen() const
+{
+   return fd >= 0;
+}
+
+void MeshCacheWriter::writeVertices(size_t offset, const glm::vec3 *vertices, size_t count)
+{
+   write(vertices, count * sizeof(glm::vec3), header.vertexOffset + (long long)(offset * sizeof(glm::vec3)));
+}
+
+void MeshCacheWriter::writeIndices(size_t offset, const glm::uvec3 *indices, size_t count)
+{
+   write(indices, count * sizeof(glm::uvec3), header.indexOffset + (long long)(offset * sizeof(glm::uvec3)));
+}
+
+void MeshCacheWriter::write(const void *data, size_t size, long long offset)
+{
+   const char *bytes = static_cast<const char *>(data);
+   while (size > 0 && !failed)
+   {
+      ssize_t written = ::pwrite(fd, bytes, size, (off_t)offset);
+      if (written <= 0)
+      {
+         failed = true;
+         return;
+      }
+      bytes += written;
+      size -= (size_t)written;
+      offset += written;
+   }
+}
+
+bool MeshCacheWriter::commit()
+{
+   if (fd < 0)
+      return false;
+   bool success = !failed && ::close(fd) == 0;
+   fd = -1;
+   if (success)
+      success = std::rename(temporary.c_str(), filename.c_str()) == 0;
+   if (!success)
+   {
+      std::cout << "Failed to write mesh cache entry " << filename << '\n';
+      ::unlink(temporary.c_str());
+   }
+   return success;
+}
+
+void MeshCacheWriter::abort()
+{
+   if (fd < 0)
+      return;
+   ::close(fd);
+   fd = -1;
+   ::unlink(temporary.c_str());
+}
+
+long long MeshCacheWriter::size() const
+{
+   return header.indexOffset + header.triangleCount * (long long)sizeof(glm::uvec3);
+}
+
+MeshCache::MeshCache() : directory(MESH_CACHE_DIRECTORY), limitBytes(MESH_CACHE_LIMIT)
+{
+   std::memset(&counters, 0, sizeof(counters));
+}
+
+void MeshCache::setDirectory(const std::string &directory)
+{
+   this->directory = directory;
+   evict(limit());
+}
+
+void MeshCache::setLimit(long long bytes)
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      limitBytes = bytes;
+   }
+   evict(bytes);
+}
+
+long long MeshCache::limit() const
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   return limitBytes;
+}
+
+std::string MeshCache::entryPath(const MeshCacheKey &key) const
+{
+   char name[32];
+   snprintf(name, sizeof(name), "%016llx.mesh", (unsigned long long)hash_bytes(&key, sizeof(key)));
+   return directory + "/" + name;
+}
+
+bool MeshCache::lookup(const MeshCacheKey &key, MappedMesh &mesh)
+{
+   std::string path = entryPath(key);
+   bool hit = mesh.open(path, key);
+   if (hit)
+   {
+      // the modification time is the last use for the eviction
+      ::utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+   }
+   std::lock_guard<std::mutex> lock(mutex);
+   if (hit)
+      ++counters.hits;
+   else
+      ++counters.misses;
+   return hit;
+}
+
+bool MeshCache::begin(const MeshCacheKey &key, size_t vertexCount, size_t triangleCount, MeshCacheWriter &writer)
+{
+   long long bytes = MESH_CACHE_DATA_OFFSET + (long long)(vertexCount * sizeof(glm::vec3) + triangleCount * sizeof(glm::uvec3));
+   if (bytes > limit())
+      return false;
+   ::mkdir(directory.c_str(), 0755);
+   return writer.create(entryPath(key), key, vertexCount, triangleCount);
+}
+
+bool MeshCache::finish(MeshCacheWriter &writer)
+{
+   if (!writer.commit())
+      return false;
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++counters.writes;
+   }
+   evict(limit());
+   return true;
+}
+
+void MeshCache::clear()
+{
+   evict(0);
+}
+
+MeshCacheStats MeshCache::stats() const
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   return counters;
+}
+
+// Deletes the least recently used entries until the rest fits into limit and counts what is left
+// -------------------------------------------------------------------------------------------------
+void MeshCache::evict(long long limit)
+{
+   struct Entry
+   {
+      std::string path;
+      long long size;
+      long long used; // nanoseconds
+   };
+   std::vector<Entry> entries;
+   long long total = 0;
+   DIR *dir = ::opendir(directory.c_str());
+   if (dir != nullptr)
+   {
+      const std::string suffix = ".mesh";
+      while (struct dirent *entry = ::readdir(dir))
+      {
+         std::string name = entry->d_name;
+         if (name.size() <= suffix.size() || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+            continue;
+         Entry e;
+         e.path = directory + "/" + name;
+         struct stat status;
+         if (::stat(e.path.c_str(), &status) != 0)
+            continue;
+         e.size = (long long)status.st_size;
+         e.used = (long long)status.st_mtim.tv_sec * 1000000000LL + status.st_mtim.tv_nsec;
+         total += e.size;
+         entries.push_back(e);
+      }
+      ::closedir(dir);
+   }
+
+   std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.used < b.used; });
+   long long evicted = 0;
+   size_t first = 0;
+   for (; first < entries.size() && total > limit; ++first)
+   {
+      if (::unlink(entries[first].path.c_str()) == 0)
+         ++evicted;
+      total -= entries[first].size;
+   }
+
+   std::lock_guard<std::mutex> lock(mutex);
+   counters.evictions += evicted;
+   counters.entries = (long long)(entries.size() - first);
+   counters.bytes = total;
+}
@@ -0,0 +1,235 @@
+#include <heightmap/mesh_export.h>
+#include <heightmap/buffered_writer.h>
+
+#include <memory_stats.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+// vertices per chunk when the caller does not choose the chunk size
+const long long EXPORT_CHUNK_VERTICES = 1 << 22;
+
+MeshFormat mesh_format_from_filename(const std::string &filename)
+{
+   std::string extension = filename.substr(std::min(filename.size(), filename.find_last_of('.')));
+   std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+   if (extension == ".ply")
+      return MESH_PLY;
+   if (extension == ".stl")
+      return MESH_STL;
+   if (extension == ".glb")
+      return MESH_GLB;
+   if (extension == ".3mf")
+      return MESH_3MF;
+   return MESH_UNKNOWN;
+}
+
+// binary PLY: header, all vertices, then all faces. Both element counts are known in advance
+// -------------------------------------------------------------------------------------------
+static void write_ply(BufferedWriter &writer, int N, int M, const HeightmapView &image, float heightScaling,
+                      int threads, int chunkRows)
+{
+   long long vertexCount = (long long)(N + 1) * (M + 1);
+   long long faceCount = (long long)N * M * 2;
+   std::ostringstream header;
+   header << "ply\n"
+          << "format binary_little_endian 1.0\n"
+          << "element vertex " << vertexCount << '\n'
+          << "property float x\nproperty float y\nproperty float z\n"
+          << "property float nx\nproperty float ny\nproperty float nz\n"
+          << "element face " << faceCount << '\n'
+          << "property list uchar uint vertex_indices\n"
+          << "end_header\n";
+   writer.write(header.str().data(), header.str().size());
+
+   std::vector<glm::vec3> vertices;
+   MemoryReservation chunkMemory(MEMORY_TRANSIENT);
+   for (int row = 0; row <= N; row += chunkRows)
+   {
+      int count = std::min(chunkRows, N + 1 - row);
+      generate_vertex_rows(N, M, image, heightScaling, row, count, vertices, threads);
+      chunkMemory.set(vertices);
+      writer.write(vertices.data(), vertices.size() * sizeof(glm::vec3));
+   }
+   std::vector<glm::vec3>().swap(vertices);
+
+   std::vector<glm::uvec3> indices;
+   for (int row = 0; row < N; row += chunkRows)
+   {
+      int count = std::min(chunkRows, N - row);
+      generate_index_rows(M, row, count, indices, threads);
+      chunkMemory.set(indices);
+      for (size_t i = 0; i < indices.size(); ++i)
+      {
+         writer.write((unsigned char)3);
+         writer.write(indices[i]);
+      }
+   }
+}
+
+// binary STL: every triangle is written with its facet normal and its three positions
+// ------------------------------------------------------------------------------------
+static void write_stl_triangle(BufferedWriter &writer, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c)
+{
+   glm::vec3 normal = glm::cross(b - a, c - a);
+   float length = glm::length(normal);
+   if (length > 0.0f)
+      normal /= length;
+   writer.write(normal);
+   writer.write(a);
+   writer.write(b);
+   writer.write(c);
+   writer.write((uint16_t)0);
+}
+
+static bool write_stl(BufferedWriter &writer, int N, int M, const HeightmapView &image, float heightScaling,
+                      int threads, int chunkRows)
+{
+   long long triangleCount = (long long)N * M * 2;
+   if (triangleCount > UINT32_MAX)
+   {
+      std::cout << "Export failed: " << triangleCount << " triangles exceed the STL limit\n";
+      return false;
+   }
+
+   char header[80] = "heightmap-visualizer binary STL";
+   writer.write(header, sizeof(header));
+   writer.write((uint32_t)triangleCount);
+
+   // a chunk of quad rows needs the vertex row below its last quad row as well
+   std::vector<glm::vec3> vertices;
+   MemoryReservation chunkMemory(MEMORY_TRANSIENT);
+   for (int row = 0; row < N; row += chunkRows)
+   {
+      int count = std::min(chunkRows, N - row);
+      generate_vertex_rows(N, M, image, heightScaling, row, count + 1, vertices, threads);
+      chunkMemory.set(vertices);
+      for (int j = 0; j < count; ++j)
+      {
+         const glm::vec3 *row1 = &vertices[(size_t)j * (M + 1) * 2];
+         const glm::vec3 *row2 = &vertices[(size_t)(j + 1) * (M + 1) * 2];
+         for (int i = 0; i < M; ++i)
+         {
+            // same triangles as generate_index_rows, positions are every second element
+            write_stl_triangle(writer, row1[2 * i], row1[2 * (i + 1)], row2[2 * (i + 1)]);
+            write_stl_triangle(writer, row1[2 * i], row2[2 * (i + 1)], row2[2 * i]);
+         }
+      }
+   }
+   return true;
+}
+
+// binary glTF: JSON chunk describing one interleaved vertex buffer view and one index buffer view,
+// followed by the BIN chunk holding both. The z-up grid is rotated into the y-up glTF convention
+// ---------------------------------------------------------------------------------------------------
+static bool write_glb(BufferedWriter &writer, int N, int M, const HeightmapView &image, float heightScaling,
+                      int threads, int chunkRows)
+{
+   long long vertexCount = (long long)(N + 1) * (M + 1);
+   long long indexCount = (long long)N * M * 6;
+   long long vertexBytes = vertexCount * 2 * sizeof(glm::vec3);
+   long long indexBytes = indexCount * sizeof(uint32_t);
+
+   float minZ = 0.0f;
+   float maxZ = 0.0f;
+   grid_height_range(N, M, image, heightScaling, minZ, maxZ, threads);
+
+   std::ostringstream json;
+   json.precision(9);
+   json << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"heightmap-visualizer\"},"
+        << "\"scene\":0,\"scenes\":[{\"nodes\":[0]}],"
+        << "\"nodes\":[{\"mesh\":0,\"rotation\":[-0.70710678,0,0,0.70710678]}],"
+        << "\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0,\"NORMAL\":1},\"indices\":2}]}],"
+        << "\"buffers\":[{\"byteLength\":" << vertexBytes + indexBytes << "}],"
+        << "\"bufferViews\":["
+        << "{\"buffer\":0,\"byteOffset\":0,\"byteLength\":" << vertexBytes << ",\"byteStride\":24,\"target\":34962},"
+        << "{\"buffer\":0,\"byteOffset\":" << vertexBytes << ",\"byteLength\":" << indexBytes << ",\"target\":34963}],"
+        << "\"accessors\":["
+        << "{\"bufferView\":0,\"byteOffset\":0,\"componentType\":5126,\"count\":" << vertexCount << ",\"type\":\"VEC3\","
+        << "\"min\":[0,0," << minZ << "],\"max\":[" << (float)M / (float)N << ',' << (float)N / (float)M << ',' << maxZ << "]},"
+        << "{\"bufferView\":0,\"byteOffset\":12,\"componentType\":5126,\"count\":" << vertexCount << ",\"type\":\"VEC3\"},"
+        << "{\"bufferView\":1,\"byteOffset\":0,\"componentType\":5125,\"count\":" << indexCount << ",\"type\":\"SCALAR\"}]}";
+   std::string jsonChunk = json.str();
+   jsonChunk.resize((jsonChunk.size() + 3) & ~(size_t)3, ' ');
+
+   long long totalBytes = 12 + 8 + (long long)jsonChunk.size() + 8 + vertexBytes + indexBytes;
+   if (totalBytes > UINT32_MAX)
+   {
+      std::cout << "Export failed: " << totalBytes << " bytes exceed the 4 GB limit of GLB, use PLY or STL instead\n";
+      return false;
+   }
+
+   writer.write((uint32_t)0x46546C67); // "glTF"
+   writer.write((uint32_t)2);
+   writer.write((uint32_t)totalBytes);
+   writer.write((uint32_t)jsonChunk.size());
+   writer.write((uint32_t)0x4E4F534A); // "JSON"
+   writer.write(jsonChunk.data(), jsonChunk.size());
+   writer.write((uint32_t)(vertexBytes + indexBytes));
+   writer.write((uint32_t)0x004E4942); // "BIN"
+
+   std::vector<glm::vec3> vertices;
+   MemoryReservation chunkMemory(MEMORY_TRANSIENT);
+   for (int row = 0; row <= N; row += chunkRows)
+   {
+      int count = std::min(chunkRows, N + 1 - row);
+      generate_vertex_rows(N, M, image, heightScaling, row, count, vertices, threads);
+      chunkMemory.set(vertices);
+      writer.write(vertices.data(), vertices.size() * sizeof(glm::vec3));
+   }
+   std::vector<glm::vec3>().swap(vertices);
+
+   std::vector<glm::uvec3> indices;
+   for (int row = 0; row < N; row += chunkRows)
+   {
+      int count = std::min(chunkRows, N - row);
+      generate_index_rows(M, row, count, indices, threads);
+      chunkMemory.set(indices);
+      writer.write(indices.data(), indices.size() * sizeof(glm::uvec3));
+   }
+   return true;
+}
+
+long long export_mesh(const std::string &filename, MeshFormat format, int N, int M, const HeightmapView &image,
+                      float heightScaling, int threads, int chunkRows)
+{
+   PROFILE_ZONE("export_mesh");
+   if (format == MESH_UNKNOWN || format == MESH_3MF)
+   {
+      std::cout << "Export failed: unsupported mesh format of " << filename << " (use .ply, .stl or .glb)\n";
+      return 0;
+   }
+   if (chunkRows <= 0)
+      chunkRows = (int)std::max(1LL, EXPORT_CHUNK_VERTICES / (M + 1));
+
+   BufferedWriter writer(filename);
+   if (!writer.isOpen())
+   {
+      std::cout << "Failed to open " << filename << " for writing\n";
+      return 0;
+   }
+
+   bool success = false;
+   if (format == MESH_PLY)
+   {
+      write_ply(writer, N, M, image, heightScaling, threads, chunkRows);
+      success = true;
+   }
+   else if (format == MESH_STL)
+      success = write_stl(writer, N, M, image, heightScaling, threads, chunkRows);
+   else
+      success = write_glb(writer, N, M, image, heightScaling, threads, chunkRows);
+
+   if (!writer.close() || !success)
+   {
+      std::cout << "Failed to write " << filename << '\n';
+      std::remove(filename.c_str());
+      return 0;
+   }
+   return writer.size();
+}
@@ -0,0 +1,382 @@
+#include <heightmap/mesh_pipeline.h>
+#include <heightmap/job_system.h>
+#include <heightmap/parallel.h>
+
+#include <memory_stats.h>
+#include <profiler.h>
+
+#include <algorithm>
+
+struct MeshPipeline::Band
+{
+   int haloBegin; // vertex rows whose heights are decoded, one more than the band on each side for the normals
+   int haloEnd;
+   std::vector<float> heights;
+   std::vector<glm::vec3> positions;
+   MeshBand mesh;
+   MemoryReservation memory;
+
+   Band() : memory(MEMORY_TRANSIENT) {}
+};
+
+struct MeshPipeline::Run
+{
+   int N;
+   int M;
+   int stride;
+   int rows;    // quad rows and columns of the strided grid
+   int columns;
+   HeightmapView image;
+   float heightScaling;
+   MeshBandUpload upload;
+   std::function<void()> finished;
+   MeshBandSink sink;
+   int bandRows;
+   int bandCount;
+   std::chrono::steady_clock::time_point startTime;
+   std::atomic<long long> stageNanoseconds[MESH_STAGE_COUNT];
+
+   // only touched by the main thread
+   int nextBand;
+   int uploaded;
+   int uploadedPrefix; // bands from the first one on that are all uploaded
+   std::vector<char> bandUploaded;
+   int inFlight;
+   int peakInFlight;
+   long long bytes;
+   long long peakBytes;
+   double firstBandMs;
+   double totalMs;
+};
+
+const char *mesh_stage_name(MeshStage stage)
+{
+   switch (stage)
+   {
+   case MESH_STAGE_DECODE:
+      return "Decode";
+   case MESH_STAGE_CONVERT:
+      return "Convert";
+   case MESH_STAGE_MESH:
+      return "Mesh";
+   case MESH_STAGE_NORMALS:
+      return "Normals";
+   case MESH_STAGE_UPLOAD:
+      return "Upload";
+   default:
+      return "?";
+   }
+}
+
+// adds the time of a stage of a band to the totals of its run
+class StageTimer
+{
+public:
+   StageTimer(std::atomic<long long> &total) : total(total), start(std::chrono::steady_clock::now()) {}
+   ~StageTimer()
+   {
+      total += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+   }
+
+private:
+   std::atomic<long long> &total;
+   std::chrono::steady_clock::time_point start;
+};
+
+static double milliseconds_since(const std::chrono::steady_clock::time_point &start)
+{
+   return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Normalized heights of the vertex rows [haloBegin, haloEnd) of the strided grid, one per vertex column. Vertex rows
+// are image columns. A height store is read as a single region and transposed like in generate_store_position_rows,
+// strided grids read only the columns they need
+// ---------------------------------------------------------------------------------------------------------------------
+static void decode_band(const HeightmapView &image, int N, int M, int stride, int haloBegin, int haloEnd,
+                        std::vector<float> &heights)
+{
+   PROFILE_ZONE("MeshPipeline: decode");
+   if (!image.hasData())
+      return;
+   int columns = strided_quads(M, stride);
+   heights.resize((size_t)(haloEnd - haloBegin) * (columns + 1));
+   if (image.store != nullptr)
+   {
+      int rows = std::min(M, image.height - 1) + 1;
+      int firstColumn = std::min(strided_vertex(haloBegin, N, stride), image.width - 1);
+      int regionColumns = stride == 1 ? std::min(haloEnd - 1, image.width - 1) - firstColumn + 1 : 1;
+      std::vector<float> region((size_t)regionColumns * rows);
+      if (stride == 1)
+         image.store->readRegion(image.originX + firstColumn, image.originY, regionColumns, rows, region.data(), image.level);
+      for (int a = haloBegin; a < haloEnd; ++a)
+      {
+         float *row = &heights[(size_t)(a - haloBegin) * (columns + 1)];
+         int column = std::min(strided_vertex(a, N, stride), image.width - 1);
+         if (stride > 1)
+         {
+            image.store->readRegion(image.originX + column, image.originY, 1, rows, region.data(), image.level);
+            column = firstColumn;
+         }
+         for (int b = 0; b <= columns; ++b)
+            row[b] = region[(size_t)std::min(strided_vertex(b, M, stride), rows - 1) * regionColumns + column - firstColumn];
+      }
+      return;
+   }
+   if (image.morton != nullptr)
+   {
+      // tile by tile across the band, like generate_position_rows
+      const int tile = 1 << MORTON_TILE_BITS;
+      const MortonHeights &morton = *image.morton;
+      parallel_for(haloBegin, haloEnd, 0, [&](int begin, int end) {
+         for (int tileBegin = 0; tileBegin <= columns; tileBegin += tile)
+         {
+            int tileEnd = std::min(tileBegin + tile, columns + 1);
+            for (int a = begin; a < end; ++a)
+            {
+               float *row = &heights[(size_t)(a - haloBegin) * (columns + 1)];
+               const float *column = morton.column(std::min(strided_vertex(a, N, stride), image.width - 1));
+               for (int b = tileBegin; b < tileEnd; ++b)
+                  row[b] = column[morton.rowOffset(std::min(strided_vertex(b, M, stride), image.height - 1))];
+            }
+         }
+      });
+      return;
+   }
+   parallel_for(haloBegin, haloEnd, 0, [&](int begin, int end) {
+      for (int a = begin; a < end; ++a)
+      {
+         float *row = &heights[(size_t)(a - haloBegin) * (columns + 1)];
+         int column = std::min(strided_vertex(a, N, stride), image.width - 1);
+         for (int b = 0; b <= columns; ++b)
+         {
+            size_t pixelRow = (size_t)std::min(strided_vertex(b, M, stride), image.height - 1);
+            if (image.heights != nullptr)
+            {
+               row[b] = image.heights[pixelRow * image.width + column];
+               continue;
+            }
+            const unsigned char *pixel = &image.pixels[RGBA * (pixelRow * image.width + column)];
+            float red = static_cast<float>(pixel[0]);
+            float green = static_cast<float>(pixel[1]);
+            float blue = static_cast<float>(pixel[2]);
+            row[b] = (red * green * blue) / (255 * 255 * 255);
+         }
+      }
+   });
+}
+
+// scales the heights of the band to positions the same way grid_position does, at the full resolution coordinates
+// of the strided vertices
+// -------------------------------------------------------------------------------------------------------------------
+static void convert_band(const HeightmapView &image, int N, int M, int stride, float heightScaling, int haloBegin,
+                         int haloEnd, const std::vector<float> &heights, std::vector<glm::vec3> &positions)
+{
+   PROFILE_ZONE("MeshPipeline: convert");
+   int columns = strided_quads(M, stride);
+   positions.resize((size_t)(haloEnd - haloBegin) * (columns + 1));
+   parallel_for(haloBegin, haloEnd, 0, [&](int begin, int end) {
+      for (int a = begin; a < end; ++a)
+      {
+         glm::vec3 *row = &positions[(size_t)(a - haloBegin) * (columns + 1)];
+         int i = strided_vertex(a, N, stride);
+         if (heights.empty())
+         {
+            for (int b = 0; b <= columns; ++b)
+               row[b] = grid_position(image, heightScaling, N, M, i, strided_vertex(b, M, stride));
+            continue;
+         }
+         const float *height = &heights[(size_t)(a - haloBegin) * (columns + 1)];
+         for (int b = 0; b <= columns; ++b)
+         {
+            int j = strided_vertex(b, M, stride);
+            row[b] = glm::vec3((float)j / (float)N, (float)i / (float)M, height[b] * heightScaling / 100);
+         }
+      }
+   });
+}
+
+// normals of the band from its positions and the halo rows, interleaved with the positions. N and M are the quads of
+// the strided grid
+// ---------------------------------------------------------------------------------------------------------------------
+static void normals_band(int N, int M, int haloBegin, const std::vector<glm::vec3> &positions, MeshBand &band)
+{
+   PROFILE_ZONE("MeshPipeline: normals");
+   band.vertices.resize((size_t)band.rowCount * (M + 1) * 2);
+   parallel_for(band.firstRow, band.firstRow + band.rowCount, 0, [&](int begin, int end) {
+      for (int i = begin; i < end; ++i)
+      {
+         const glm::vec3 *previousRow = &positions[(size_t)(std::max(i - 1, 0) - haloBegin) * (M + 1)];
+         const glm::vec3 *row = &positions[(size_t)(i - haloBegin) * (M + 1)];
+         const glm::vec3 *nextRow = &positions[(size_t)(std::min(i + 1, N) - haloBegin) * (M + 1)];
+         glm::vec3 *out = &band.vertices[(size_t)(i - band.firstRow) * (M + 1) * 2];
+         for (int j = 0; j <= M; ++j)
+         {
+            *out++ = row[j];
+            *out++ = grid_normal(previousRow[j], nextRow[j], row[std::max(j - 1, 0)], row[std::min(j + 1, M)]);
+         }
+      }
+   });
+}
+
+MeshPipeline::MeshPipeline()
+{
+}
+
+void MeshPipeline::start(int N, int M, const HeightmapView &image, float heightScaling, const MeshBandUpload &upload,
+                         const std::function<void()> &finished, int stride, const MeshBandSink &sink)
+{
+   std::shared_ptr<Run> next = std::make_shared<Run>();
+   next->N = N;
+   next->M = M;
+   next->stride = std::max(stride, 1);
+   next->rows = strided_quads(N, next->stride);
+   next->columns = strided_quads(M, next->stride);
+   next->image = image;
+   next->heightScaling = heightScaling;
+   next->upload = upload;
+   next->finished = finished;
+   next->sink = sink;
+   next->bandRows = std::max(MESH_PIPELINE_BAND_VERTICES / (next->columns + 1), 1);
+   next->bandCount = (next->rows + 1 + next->bandRows - 1) / next->bandRows;
+   next->startTime = std::chrono::steady_clock::now();
+   for (int i = 0; i < MESH_STAGE_COUNT; ++i)
+      next->stageNanoseconds[i] = 0;
+   next->nextBand = 0;
+   next->uploaded = 0;
+   next->uploadedPrefix = 0;
+   next->bandUploaded.assign(next->bandCount, 0);
+   next->inFlight = 0;
+   next->peakInFlight = 0;
+   next->bytes = 0;
+   next->peakBytes = 0;
+   next->firstBandMs = 0.0;
+   next->totalMs = 0.0;
+   run = next;
+   for (int i = 0; i < MESH_PIPELINE_DEPTH; ++i)
+      startBand(run);
+}
+
+bool MeshPipeline::isRunning() const
+{
+   return run && run->uploaded < run->bandCount;
+}
+
+int MeshPipeline::uploadedQuadRows() const
+{
+   if (!run)
+      return 0;
+   // a quad row needs the vertex row after it as well
+   int rows = std::min(run->uploadedPrefix * run->bandRows, run->rows + 1);
+   return std::max(rows - 1, 0);
+}
+
+MeshPipelineStats MeshPipeline::stats() const
+{
+   MeshPipelineStats stats = MeshPipelineStats();
+   if (!run)
+      return stats;
+   stats.bands = run->bandCount;
+   stats.uploaded = run->uploaded;
+   stats.inFlight = run->inFlight;
+   stats.peakInFlight = run->peakInFlight;
+   stats.peakBytes = run->peakBytes;
+   stats.firstBandMs = run->firstBandMs;
+   stats.totalMs = isRunning() ? milliseconds_since(run->startTime) : run->totalMs;
+   for (int i = 0; i < MESH_STAGE_COUNT; ++i)
+      stats.stageMs[i] = run->stageNanoseconds[i] / 1e6;
+   return stats;
+}
+
+// Submits the jobs of the next band. Decoding and converting feed the normals, the triangles only depend on the
+// grid size; once both are done the band is handed to the main thread
+// ---------------------------------------------------------------------------------------------------------------
+void MeshPipeline::startBand(const std::shared_ptr<Run> &run)
+{
+   if (run->nextBand >= run->bandCount)
+      return;
+   std::shared_ptr<Band> band = std::make_shared<Band>();
+   int N = run->rows;
+   int M = run->columns;
+   MeshBand &mesh = band->mesh;
+   mesh.firstRow = run->nextBand * run->bandRows;
+   mesh.rowCount = std::min(run->bandRows, N + 1 - mesh.firstRow);
+   mesh.quadRows = std::min(mesh.firstRow + mesh.rowCount, N) - mesh.firstRow;
+   mesh.vertexOffset = (size_t)mesh.firstRow * (M + 1) * 2;
+   mesh.indexOffset = (size_t)mesh.firstRow * M * 2;
+   band->haloBegin = std::max(mesh.firstRow - 1, 0);
+   band->haloEnd = std::min(mesh.firstRow + mesh.rowCount + 1, N + 1);
+   ++run->nextBand;
+
+   // heights and positions of the halo rows, the interleaved vertices and the triangles
+   long long haloVertices = (long long)(band->haloEnd - band->haloBegin) * (M + 1);
+   band->memory.set(haloVertices * (long long)(sizeof(float) + sizeof(glm::vec3)) +
+                    (long long)mesh.rowCount * (M + 1) * 2 * (long long)sizeof(glm::vec3) +
+                    (long long)mesh.quadRows * M * 2 * (long long)sizeof(glm::uvec3));
+   ++run->inFlight;
+   run->bytes += band->memory.size();
+   run->peakInFlight = std::max(run->peakInFlight, run->inFlight);
+   run->peakBytes = std::max(run->peakBytes, run->bytes);
+
+   JobSystem &jobs = JobSystem::instance();
+   JobHandle decode = jobs.submit([run, band]() {
+      StageTimer timer(run->stageNanoseconds[MESH_STAGE_DECODE]);
+      decode_band(run->image, run->N, run->M, run->stride, band->haloBegin, band->haloEnd, band->heights);
+   });
+   JobHandle convert = jobs.submit(
+       [run, band]() {
+          StageTimer timer(run->stageNanoseconds[MESH_STAGE_CONVERT]);
+          convert_band(run->image, run->N, run->M, run->stride, run->heightScaling, band->haloBegin, band->haloEnd,
+                       band->heights, band->positions);
+          std::vector<float>().swap(band->heights);
+       },
+       {decode});
+   JobHandle triangles = jobs.submit([run, band]() {
+      StageTimer timer(run->stageNanoseconds[MESH_STAGE_MESH]);
+      generate_index_rows(run->columns, band->mesh.firstRow, band->mesh.quadRows, band->mesh.indices, 0);
+   });
+   JobHandle normals = jobs.submit(
+       [run, band]() {
+          StageTimer timer(run->stageNanoseconds[MESH_STAGE_NORMALS]);
+          normals_band(run->rows, run->columns, band->haloBegin, band->positions, band->mesh);
+          std::vector<glm::vec3>().swap(band->positions);
+       },
+       {convert});
+   jobs.submit(
+       [run, band]() {
+          if (run->sink)
+             run->sink(band->mesh);
+          JobSystem::instance().runOnMainThread([run, band]() { uploadBand(run, band); });
+       },
+       {triangles, normals});
+}
+
+// hands a finished band to the caller and starts the next one in its place
+void MeshPipeline::uploadBand(const std::shared_ptr<Run> &run, const std::shared_ptr<Band> &band)
+{
+   // counted as uploaded already while the callback runs, so it can ask for uploadedQuadRows()
+   int index = band->mesh.firstRow / run->bandRows;
+   run->bandUploaded[index] = 1;
+   while (run->uploadedPrefix < run->bandCount && run->bandUploaded[run->uploadedPrefix])
+      ++run->uploadedPrefix;
+   {
+      PROFILE_ZONE("MeshPipeline: upload");
+      StageTimer timer(run->stageNanoseconds[MESH_STAGE_UPLOAD]);
+      run->upload(band->mesh);
+   }
+   ++run->uploaded;
+   --run->inFlight;
+   run->bytes -= band->memory.size();
+   std::vector<glm::vec3>().swap(band->mesh.vertices);
+   std::vector<glm::uvec3>().swap(band->mesh.indices);
+   band->memory.set(0);
+   if (run->uploaded == 1)
+      run->firstBandMs = milliseconds_since(run->startTime);
+
+   startBand(run);
+   if (run->uploaded == run->bandCount)
+   {
+      run->totalMs = milliseconds_since(run->startTime);
+      if (run->finished)
+         run->finished();
+   }
+}
@@ -0,0 +1,79 @@
+#include <heightmap/morton.h>
+#include <heightmap/parallel.h>
+
+#include <profiler.h>
+
+#include <algorithm>
+#include <cstring>
+
+MortonHeights::MortonHeights() : columns(0), rows(0), memory(MEMORY_IMAGE)
+{
+}
+
+// The tile bits of x go to the even bits of the tile index within a block, the tile bits of y to the odd bits, and
+// the block of y also contributes its row of blocks. Adding the column and the row offset gives the full offset
+// ----------------------------------------------------------------------------------------------------------------------
+void MortonHeights::assign(const float *heights, int width, int height, int threads)
+{
+   PROFILE_ZONE("MortonHeights::assign");
+   const int tile = 1 << MORTON_TILE_BITS;
+   const int blockSide = tile << MORTON_BLOCK_BITS;
+   const size_t tileSize = (size_t)tile * tile;
+   const size_t blockSize = (size_t)blockSide * blockSide;
+   int blocksX = (width + blockSide - 1) / blockSide;
+   int blocksY = (height + blockSide - 1) / blockSide;
+
+   columns = width;
+   rows = height;
+   columnOffsets.resize(width);
+   rowOffsets.resize(height);
+   for (int x = 0; x < width; ++x)
+   {
+      uint32_t tileX = (x >> MORTON_TILE_BITS) & ((1 << MORTON_BLOCK_BITS) - 1);
+      columnOffsets[x] = (size_t)(x / blockSide) * blockSize + morton_spread(tileX) * tileSize + (x & (tile - 1));
+   }
+   for (int y = 0; y < height; ++y)
+   {
+      uint32_t tileY = (y >> MORTON_TILE_BITS) & ((1 << MORTON_BLOCK_BITS) - 1);
+      rowOffsets[y] = (size_t)(y / blockSide) * blocksX * blockSize + (morton_spread(tileY) << 1) * tileSize +
+                      (size_t)(y & (tile - 1)) * tile;
+   }
+   // every height is written below, the padding is never read
+   std::vector<float>().swap(data);
+   data.resize((size_t)blocksX * blocksY * blockSize);
+   memory.set(data);
+
+   parallel_for(0, height, threads, [&](int begin, int end) {
+      for (int y = begin; y < end; ++y)
+      {
+         const float *in = heights + (size_t)y * width;
+         float *out = data.data() + rowOffsets[y];
+         for (int x = 0; x < width; x += tile)
+            memcpy(out + columnOffsets[x], in + x, std::min(tile, width - x) * sizeof(float));
+      }
+   });
+}
+
+void MortonHeights::clear()
+{
+   columns = rows = 0;
+   std::vector<float>().swap(data);
+   std::vector<size_t>().swap(columnOffsets);
+   std::vector<size_t>().swap(rowOffsets);
+   memory.set(0);
+}
+
+bool MortonHeights::empty() const
+{
+   return data.empty();
+}
+
+int MortonHeights::width() const
+{
+   return columns;
+}
+
+int MortonHeights::height() const
+{
+   return rows;
+}
@@ -0,0 +1,492 @@
+#include <heightmap/mosaic.h>
+#include <heightmap/parallel.h>
+#include <heightmap/text_dem.h>
+
+#include <profiler.h>
+
+#include "stb_image/stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+// extension of a file name in lower case, without the dot
+static std::string lower_extension(const std::string &filename)
+{
+   size_t dot = filename.find_last_of('.');
+   if (dot == std::string::npos || filename.find('/', dot) != std::string::npos)
+      return "";
+   std::string extension = filename.substr(dot + 1);
+   for (size_t i = 0; i < extension.size(); ++i)
+      extension[i] = (char)std::tolower((unsigned char)extension[i]);
+   return extension;
+}
+
+// Reads the south west corner of an SRTM tile from its name, like N45E006 or s12w077, and its size from the file
+// size: 1201 x 1201 samples for 3 arc seconds, 3601 x 3601 for 1 arc second. Neighbouring tiles share their edges
+// ----------------------------------------------------------------------------------------------------------------------
+static bool index_hgt(const std::string &path, const std::string &name, MosaicTile &tile, double &cellSize)
+{
+   if (name.size() < 7)
+      return false;
+   char latitude = (char)std::toupper((unsigned char)name[0]);
+   char longitude = (char)std::toupper((unsigned char)name[3]);
+   if ((latitude != 'N' && latitude != 'S') || (longitude != 'E' && longitude != 'W'))
+      return false;
+   for (int i = 1; i < 7; ++i)
+   {
+      if (i != 3 && (name[i] < '0' || name[i] > '9'))
+         return false;
+   }
+   struct stat status;
+   if (::stat(path.c_str(), &status) != 0)
+      return false;
+   int size = (int)std::lround(std::sqrt(status.st_size / 2.0));
+   if (size < 2 || (long long)size * size * 2 != (long long)status.st_size)
+      return false;
+   tile.width = tile.height = size;
+   tile.south = std::atoi(name.substr(1, 2).c_str()) * (latitude == 'N' ? 1.0 : -1.0);
+   tile.west = std::atoi(name.substr(4, 3).c_str()) * (longitude == 'E' ? 1.0 : -1.0);
+   cellSize = 1.0 / (size - 1);
+   return true;
+}
+
+// An ESRI ASCII grid gives the corner of its lower left cell, its sample sits in the middle of the cell
+// ------------------------------------------------------------------------------------------------------------
+static bool index_asc(const std::string &path, MosaicTile &tile, double &cellSize)
+{
+   TextDemInfo info;
+   if (!read_text_dem_header(path, info))
+      return false;
+   tile.width = info.width;
+   tile.height = info.height;
+   tile.west = info.originX + info.cellSize / 2;
+   tile.south = info.originY + info.cellSize / 2;
+   cellSize = info.cellSize;
+   return true;
+}
+
+// An image is placed by its world file: six lines with the pixel width, two rotation terms, the (negative) pixel height
+// and the center of the upper left pixel. tile.pgw, tile.pngw and tile.wld are tried for tile.png
+// ----------------------------------------------------------------------------------------------------------------------
+static bool index_image(const std::string &path, MosaicTile &tile, double &cellSize)
+{
+   int width;
+   int height;
+   int channels;
+   if (!stbi_info(path.c_str(), &width, &height, &channels))
+      return false;
+   std::string base = path.substr(0, path.find_last_of('.') + 1);
+   std::string extension = path.substr(base.size());
+   std::string candidates[] = {base + extension.substr(0, 1) + extension.substr(extension.size() - 1) + "w",
+                               base + extension + "w", base + "wld"};
+   for (size_t c = 0; c < sizeof(candidates) / sizeof(candidates[0]); ++c)
+   {
+      std::ifstream file(candidates[c]);
+      double terms[6];
+      int read = 0;
+      while (read < 6 && file >> terms[read])
+         ++read;
+      if (read < 6)
+         continue;
+      double pixelWidth = terms[0];
+      double pixelHeight = -terms[3];
+      if (terms[1] != 0.0 || terms[2] != 0.0 || pixelWidth <= 0.0 ||
+          std::fabs(pixelHeight - pixelWidth) > pixelWidth * 1e-6)
+      {
+         std::cout << "Skipping " << path << ": only north up world files with square pixels are supported\n";
+         return false;
+      }
+      tile.width = width;
+      tile.height = height;
+      tile.west = terms[4];
+      tile.south = terms[5] - pixelHeight * (height - 1);
+      cellSize = pixelWidth;
+      return true;
+   }
+   return false;
+}
+
+bool decode_mosaic_tile(const MosaicTile &tile, const HeightDecoding &decoding, std::vector<float> &samples)
+{
+   PROFILE_ZONE("decode_mosaic_tile");
+   size_t count = (size_t)tile.width * tile.height;
+   if (tile.format == MOSAIC_HGT)
+   {
+      std::vector<unsigned char> bytes(count * 2);
+      std::ifstream file(tile.filename, std::ios::binary);
+      if (!file.read((char *)bytes.data(), bytes.size()))
+      {
+         std::cout << "Failed to read " << tile.filename << '\n';
+         return false;
+      }
+      // rows run from north to south in the file
+      samples.resize(count);
+      for (int row = 0; row < tile.height; ++row)
+      {
+         const unsigned char *in = &bytes[(size_t)row * tile.width * 2];
+         float *out = &samples[(size_t)(tile.height - 1 - row) * tile.width];
+         for (int x = 0; x < tile.width; ++x)
+         {
+            int16_t value = (int16_t)(in[2 * x] << 8 | in[2 * x + 1]);
+            out[x] = value == -32768 ? std::numeric_limits<float>::quiet_NaN() : (float)value;
+         }
+      }
+      return true;
+   }
+
+   HeightPlane plane;
+   bool loaded = tile.format == MOSAIC_ESRI_ASCII ? load_text_dem(tile.filename, plane, true, 1)
+                                                  : load_heights(tile.filename, decoding, plane, 1, false);
+   if (!loaded)
+      return false;
+   if (plane.width != tile.width || plane.height != tile.height)
+   {
+      std::cout << tile.filename << " changed its size since the mosaic was opened\n";
+      return false;
+   }
+   // back into the units of the file, so that tiles normalized by their own range fit together
+   float range = plane.maximum - plane.minimum;
+   for (size_t i = 0; i < count; ++i)
+      plane.heights[i] = plane.heights[i] * range + plane.minimum;
+   samples.swap(plane.heights);
+   return true;
+}
+
+Mosaic::Mosaic()
+    : samplesX(0), samplesY(0), cell(0.0), originWest(0.0), originSouth(0.0), budgetBytes(MOSAIC_BUDGET),
+      counters(), cacheMemory(MEMORY_IMAGE)
+{
+}
+
+Mosaic::~Mosaic()
+{
+   close();
+}
+
+bool Mosaic::addTile(MosaicTile &tile, double cellSize)
+{
+   if (tiles.empty())
+      cell = cellSize;
+   else if (std::fabs(cellSize - cell) > cell * 1e-6)
+   {
+      std::cout << "Skipping " << tile.filename << ": cell size " << cellSize << " instead of " << cell << '\n';
+      return false;
+   }
+   tiles.push_back(tile);
+   return true;
+}
+
+// Only the headers, names and world files are read. Tiles are placed relative to the westernmost and southernmost
+// sample by whole cells, so small differences in the printed coordinates do not open gaps or overlaps
+// ----------------------------------------------------------------------------------------------------------------------
+bool Mosaic::open(const std::string &directory)
+{
+   PROFILE_ZONE("Mosaic::open");
+   close();
+   DIR *dir = ::opendir(directory.c_str());
+   if (dir == nullptr)
+   {
+      std::cout << "Failed to open directory " << directory << '\n';
+      return false;
+   }
+   std::vector<std::string> names;
+   while (struct dirent *entry = ::readdir(dir))
+   {
+      if (entry->d_name[0] != '.')
+         names.push_back(entry->d_name);
+   }
+   ::closedir(dir);
+   std::sort(names.begin(), names.end());
+
+   std::string prefix = directory.empty() || directory[directory.size() - 1] == '/' ? directory : directory + "/";
+   for (size_t i = 0; i < names.size(); ++i)
+   {
+      MosaicTile tile;
+      tile.filename = prefix + names[i];
+      std::string extension = lower_extension(names[i]);
+      double cellSize = 0.0;
+      bool indexed = false;
+      if (extension == "hgt")
+      {
+         tile.format = MOSAIC_HGT;
+         indexed = index_hgt(tile.filename, names[i], tile, cellSize);
+      }
+      else if (extension == "asc")
+      {
+         tile.format = MOSAIC_ESRI_ASCII;
+         indexed = index_asc(tile.filename, tile, cellSize);
+      }
+      else if (extension == "png" || extension == "jpg" || extension == "jpeg" || extension == "bmp" ||
+               extension == "tga" || extension == "pgm" || extension == "ppm")
+      {
+         tile.format = MOSAIC_IMAGE;
+         indexed = index_image(tile.filename, tile, cellSize);
+      }
+      if (indexed && cellSize > 0.0)
+         addTile(tile, cellSize);
+   }
+   if (tiles.empty())
+   {
+      std::cout << "No placeable tiles (.hgt, .asc or images with world files) in " << directory << '\n';
+      return false;
+   }
+
+   originWest = tiles[0].west;
+   originSouth = tiles[0].south;
+   for (size_t i = 1; i < tiles.size(); ++i)
+   {
+      originWest = std::min(originWest, tiles[i].west);
+      originSouth = std::min(originSouth, tiles[i].south);
+   }
+   for (size_t i = 0; i < tiles.size(); ++i)
+   {
+      MosaicTile &tile = tiles[i];
+      tile.x = (int)std::lround((tile.west - originWest) / cell);
+      tile.y = (int)std::lround((tile.south - originSouth) / cell);
+      samplesX = std::max(samplesX, tile.x + tile.width);
+      samplesY = std::max(samplesY, tile.y + tile.height);
+   }
+   std::cout << "Mosaic of " << tiles.size() << " tiles, " << samplesX << "x" << samplesY << " samples\n";
+   return true;
+}
+
+void Mosaic::close()
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   tiles.clear();
+   samplesX = samplesY = 0;
+   cell = originWest = originSouth = 0.0;
+   lru.clear();
+   cache.clear();
+   counters = MosaicStats();
+   cacheMemory.set(0);
+}
+
+bool Mosaic::isOpen() const
+{
+   return !tiles.empty();
+}
+
+int Mosaic::width() const
+{
+   return samplesX;
+}
+
+int Mosaic::height() const
+{
+   return samplesY;
+}
+
+double Mosaic::cellSize() const
+{
+   return cell;
+}
+
+double Mosaic::west() const
+{
+   return originWest;
+}
+
+double Mosaic::south() const
+{
+   return originSouth;
+}
+
+size_t Mosaic::tileCount() const
+{
+   return tiles.size();
+}
+
+const MosaicTile &Mosaic::tile(size_t index) const
+{
+   return tiles[index];
+}
+
+void Mosaic::setBudget(long long bytes)
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   budgetBytes = bytes;
+   evict(std::vector<size_t>());
+}
+
+MosaicStats Mosaic::stats() const
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   return counters;
+}
+
+// drops the least recently used tiles but those in keep until the cache fits into the budget, mutex is held
+void Mosaic::evict(const std::vector<size_t> &keep)
+{
+   std::list<size_t>::iterator it = lru.end();
+   while (counters.residentBytes > budgetBytes && it != lru.begin())
+   {
+      --it;
+      if (std::find(keep.begin(), keep.end(), *it) != keep.end())
+         continue;
+      counters.residentBytes -= (long long)(cache[*it].first->size() * sizeof(float));
+      --counters.residentTiles;
+      ++counters.evictions;
+      cache.erase(*it);
+      it = lru.erase(it);
+   }
+   cacheMemory.set(counters.residentBytes);
+}
+
+// first sample of a row or column of the window with stride that lies in [begin, end), or count if none does
+static int first_sample(int origin, int stride, int count, int begin, int end)
+{
+   int k = begin > origin ? (begin - origin + stride - 1) / stride : 0;
+   return k < count && origin + k * stride < end ? k : count;
+}
+
+// The tiles below the window come from the cache or are decoded one per job. Every sample of the window is read from
+// the tiles that cover its position on the grid of the mosaic, so the edge shared by two tiles ends up in one sample
+// ----------------------------------------------------------------------------------------------------------------------
+bool Mosaic::readWindow(int x, int y, int width, int height, int stride, const HeightDecoding &decoding,
+                        HeightPlane &plane, int threads)
+{
+   PROFILE_ZONE("Mosaic::readWindow");
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   stride = std::max(1, stride);
+   width = std::max(1, width);
+   height = std::max(1, height);
+
+   std::vector<size_t> needed;
+   for (size_t i = 0; i < tiles.size(); ++i)
+   {
+      const MosaicTile &tile = tiles[i];
+      if (first_sample(x, stride, width, tile.x, tile.x + tile.width) < width &&
+          first_sample(y, stride, height, tile.y, tile.y + tile.height) < height)
+         needed.push_back(i);
+   }
+   if (needed.empty())
+   {
+      std::cout << "No tile lies below the window\n";
+      return false;
+   }
+
+   std::vector<Samples> samples(needed.size());
+   std::vector<size_t> missing; // indices into needed
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      // image tiles decoded with another encoding are stale
+      if (decoding.encoding != cachedDecoding.encoding || decoding.channel != cachedDecoding.channel)
+      {
+         for (std::list<size_t>::iterator it = lru.begin(); it != lru.end();)
+         {
+            if (tiles[*it].format != MOSAIC_IMAGE)
+            {
+               ++it;
+               continue;
+            }
+            counters.residentBytes -= (long long)(cache[*it].first->size() * sizeof(float));
+            --counters.residentTiles;
+            cache.erase(*it);
+            it = lru.erase(it);
+         }
+         cachedDecoding = decoding;
+      }
+      for (size_t n = 0; n < needed.size(); ++n)
+      {
+         auto found = cache.find(needed[n]);
+         if (found == cache.end())
+         {
+            missing.push_back(n);
+            continue;
+         }
+         samples[n] = found->second.first;
+         lru.splice(lru.begin(), lru, found->second.second);
+         ++counters.hits;
+      }
+   }
+
+   parallel_for(0, (int)missing.size(), threads, [&](int begin, int end) {
+      for (int m = begin; m < end; ++m)
+      {
+         size_t n = missing[m];
+         std::shared_ptr<std::vector<float>> decoded = std::make_shared<std::vector<float>>();
+         if (decode_mosaic_tile(tiles[needed[n]], decoding, *decoded))
+            samples[n] = decoded;
+      }
+   });
+
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t m = 0; m < missing.size(); ++m)
+      {
+         size_t n = missing[m];
+         if (!samples[n] || cache.count(needed[n]) != 0)
+            continue;
+         lru.push_front(needed[n]);
+         cache[needed[n]] = std::make_pair(samples[n], lru.begin());
+         counters.residentBytes += (long long)(samples[n]->size() * sizeof(float));
+         ++counters.residentTiles;
+         ++counters.decoded;
+      }
+      evict(needed);
+   }
+
+   plane.width = width;
+   plane.height = height;
+   plane.decoding = decoding;
+   plane.heights.assign((size_t)width * height, std::numeric_limits<float>::quiet_NaN());
+   parallel_for(0, height, threads, [&](int begin, int end) {
+      for (size_t n = 0; n < needed.size(); ++n)
+      {
+         if (!samples[n])
+            continue;
+         const MosaicTile &tile = tiles[needed[n]];
+         const std::vector<float> &source = *samples[n];
+         int firstColumn = first_sample(x, stride, width, tile.x, tile.x + tile.width);
+         for (int row = std::max(begin, first_sample(y, stride, height, tile.y, tile.y + tile.height)); row < end;
+              ++row)
+         {
+            int sourceRow = y + row * stride - tile.y;
+            if (sourceRow >= tile.height)
+               break;
+            const float *in = &source[(size_t)sourceRow * tile.width];
+            float *out = &plane.heights[(size_t)row * width];
+            for (int column = firstColumn; column < width; ++column)
+            {
+               int sourceColumn = x + column * stride - tile.x;
+               if (sourceColumn >= tile.width)
+                  break;
+               // a void in one tile may be filled by the tile that shares the edge
+               float value = in[sourceColumn];
+               if (value == value)
+                  out[column] = value;
+            }
+         }
+      }
+   });
+
+   // samples without height get the lowest one
+   float lowest = std::numeric_limits<float>::max();
+   for (size_t i = 0; i < plane.heights.size(); ++i)
+   {
+      if (plane.heights[i] == plane.heights[i])
+         lowest = std::min(lowest, plane.heights[i]);
+   }
+   if (lowest == std::numeric_limits<float>::max())
+      lowest = 0.0f;
+   for (size_t i = 0; i < plane.heights.size(); ++i)
+   {
+      if (plane.heights[i] != plane.heights[i])
+         plane.heights[i] = lowest;
+   }
+   normalize_heights(plane, threads);
+
+   std::lock_guard<std::mutex> lock(mutex);
+   counters.decodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+   return true;
+}
@@ -0,0 +1,230 @@
+#include <heightmap/noise.h>
+#include <heightmap/parallel.h>
+
+#include <profiler.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// The noise functions are written once against these traits and instantiated for single samples and for vectors.
+// Comparisons give bool for scalars and masks of all bits set or cleared for vectors, select() hides the difference
+struct ScalarNoise
+{
+   typedef float F;
+   typedef int32_t I;
+   typedef uint32_t U;
+};
+
+struct VectorNoise
+{
+   typedef SimdFloat F;
+   typedef SimdInt I;
+   typedef SimdUInt U;
+};
+
+static inline float noise_floor(float v)
+{
+   return std::floor(v);
+}
+
+static inline SimdFloat noise_floor(SimdFloat v)
+{
+   // truncation rounds negative values up, the mask of those is -1
+   SimdFloat truncated = __builtin_convertvector(__builtin_convertvector(v, SimdInt), SimdFloat);
+   return truncated + __builtin_convertvector(truncated > v, SimdFloat);
+}
+
+static inline int32_t noise_int(float v)
+{
+   return (int32_t)v;
+}
+
+static inline SimdInt noise_int(SimdFloat v)
+{
+   return __builtin_convertvector(v, SimdInt);
+}
+
+static inline float select(bool mask, float a, float b)
+{
+   return mask ? a : b;
+}
+
+static inline SimdFloat select(SimdInt mask, SimdFloat a, SimdFloat b)
+{
+   return simd_select(mask, a, b);
+}
+
+// integer hash of a lattice point, no permutation table so that vectors need no gathers
+template <typename T>
+static inline typename T::U lattice_hash(typename T::I i, typename T::I j, uint32_t seed)
+{
+   typedef typename T::U U;
+   U h = ((U)i * 0x8da6b343u) ^ ((U)j * 0xd8163841u) ^ seed;
+   h ^= h >> 16;
+   h *= 0x7feb352du;
+   h ^= h >> 15;
+   h *= 0x846ca68bu;
+   h ^= h >> 16;
+   return h;
+}
+
+// contribution of a simplex corner at offset (x, y) with one of eight gradients (+-1, +-0.5), (+-0.5, +-1)
+template <typename T>
+static inline typename T::F simplex_corner(typename T::F x, typename T::F y, typename T::U h)
+{
+   typedef typename T::F F;
+   F zero = F();
+   F u = select((h & 4u) != 0, y, x);
+   F v = select((h & 4u) != 0, x, y);
+   u = select((h & 1u) != 0, -u, u);
+   v = select((h & 2u) != 0, -v, v);
+   F t = 0.5f - x * x - y * y;
+   t = select(t > zero, t, zero);
+   t *= t;
+   return t * t * (u + 0.5f * v);
+}
+
+// 2D simplex noise in about [-1, 1]
+// -----------------------------------
+template <typename T>
+static inline typename T::F simplex(typename T::F x, typename T::F y, uint32_t seed)
+{
+   typedef typename T::F F;
+   typedef typename T::I I;
+   const float F2 = 0.36602540378f; // (sqrt(3) - 1) / 2, skews the input onto the simplex lattice
+   const float G2 = 0.21132486540f; // (3 - sqrt(3)) / 6, unskews it again
+
+   F zero = F();
+   F one = zero + 1.0f;
+   F s = (x + y) * F2;
+   F i = noise_floor(x + s);
+   F j = noise_floor(y + s);
+   F t = (i + j) * G2;
+   F x0 = x - (i - t);
+   F y0 = y - (j - t);
+   // the middle corner is in the lower or the upper triangle of the skewed cell
+   F i1 = select(x0 > y0, one, zero);
+   F j1 = one - i1;
+   F x1 = x0 - i1 + G2;
+   F y1 = y0 - j1 + G2;
+   F x2 = x0 - 1.0f + 2.0f * G2;
+   F y2 = y0 - 1.0f + 2.0f * G2;
+
+   I ii = noise_int(i);
+   I jj = noise_int(j);
+   F n = simplex_corner<T>(x0, y0, lattice_hash<T>(ii, jj, seed));
+   n += simplex_corner<T>(x1, y1, lattice_hash<T>(ii + noise_int(i1), jj + noise_int(j1), seed));
+   n += simplex_corner<T>(x2, y2, lattice_hash<T>(ii + 1, jj + 1, seed));
+   return 90.0f * n;
+}
+
+// height in [0, 1] of a sample position. Every octave hashes with its own seed so the octaves are not correlated
+// -----------------------------------------------------------------------------------------------------------------
+template <typename T>
+static inline typename T::F fractal(const NoiseOptions &options, typename T::F x, typename T::F y)
+{
+   typedef typename T::F F;
+   F zero = F();
+   F one = zero + 1.0f;
+   int octaves = options.type == NOISE_SIMPLEX ? 1 : std::min(std::max(options.octaves, 1), NOISE_MAX_OCTAVES);
+   float frequency = 1.0f / std::max(options.wavelength, 1e-3f);
+   float amplitude = 1.0f;
+   float total = 0.0f;
+   F sum = zero;
+   F weight = one;
+   for (int octave = 0; octave < octaves; ++octave)
+   {
+      F n = simplex<T>(x * frequency, y * frequency, options.seed + (uint32_t)octave * 0x9e3779b9u);
+      if (options.type == NOISE_RIDGED)
+      {
+         // crests where the noise crosses zero, higher octaves mostly add detail on the crests
+         F ridge = one - select(n < zero, -n, n);
+         ridge *= ridge * weight;
+         weight = select(ridge * 2.0f < one, ridge * 2.0f, one);
+         sum += ridge * amplitude;
+      }
+      else
+      {
+         sum += n * amplitude;
+      }
+      total += amplitude;
+      amplitude *= options.gain;
+      frequency *= options.lacunarity;
+   }
+   F height = options.type == NOISE_RIDGED ? sum / total : 0.5f + 0.5f * sum / total;
+   height = select(height < zero, zero, height);
+   return select(height > one, one, height);
+}
+
+const char *noise_type_name(NoiseType type)
+{
+   switch (type)
+   {
+   case NOISE_SIMPLEX:
+      return "Simplex";
+   case NOISE_FBM:
+      return "fBm";
+   case NOISE_RIDGED:
+      return "Ridged";
+   default:
+      return "?";
+   }
+}
+
+float noise_sample(const NoiseOptions &options, int x, int y)
+{
+   return fractal<ScalarNoise>(options, (float)x, (float)y);
+}
+
+void noise_row(const NoiseOptions &options, int x, int y, int count, float *out)
+{
+   SimdFloat lanes;
+   for (int lane = 0; lane < NOISE_LANES; ++lane)
+      lanes[lane] = (float)lane;
+   SimdFloat row = SimdFloat() + (float)y;
+   for (int k = 0; k < count; k += NOISE_LANES)
+   {
+      SimdFloat heights = fractal<VectorNoise>(options, lanes + (float)(x + k), row);
+      int n = std::min(NOISE_LANES, count - k);
+      for (int lane = 0; lane < n; ++lane)
+         out[k + lane] = heights[lane];
+   }
+}
+
+void noise_region(const NoiseOptions &options, int x, int y, int width, int height, float *out, int threads)
+{
+   PROFILE_ZONE("noise_region");
+   parallel_for(0, height, threads, [&](int begin, int end) {
+      for (int row = begin; row < end; ++row)
+         noise_row(options, x, y + row, width, out + (size_t)row * width);
+   });
+}
+
+// every band of tiles is generated by all threads and then handed to the writer row by row
+// -------------------------------------------------------------------------------------------
+bool build_noise_store(const std::string &storeFilename, int width, int height, const NoiseOptions &options,
+                       int threads, std::atomic<int> *rowsDone, int tileSize)
+{
+   PROFILE_ZONE("build_noise_store");
+   HeightStoreWriter writer;
+   if (width <= 0 || height <= 0 || !writer.create(storeFilename, width, height, tileSize))
+      return false;
+
+   std::vector<float> band((size_t)width * tileSize);
+   MemoryReservation bandMemory(MEMORY_TRANSIENT, (long long)(band.size() * sizeof(float)));
+   for (int y = 0; y < height; y += tileSize)
+   {
+      int rows = std::min(tileSize, height - y);
+      noise_region(options, 0, y, width, rows, band.data(), threads);
+      for (int row = 0; row < rows; ++row)
+         writer.writeRow(y + row, &band[(size_t)row * width]);
+      if (rowsDone != nullptr)
+         *rowsDone += rows;
+   }
+   bool success = writer.close();
+   if (!success)
+      std::cout << "Failed to write height store " << storeFilename << '\n';
+   return success;
+}
@@ -0,0 +1,515 @@
+#include <heightmap/point_cloud.h>
+#include <heightmap/mapped_file.h>
+#include <heightmap/parallel.h>
+#include <heightmap/text_dem.h>
+
+#include <memory_stats.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+// offsets into the public header block of a LAS file, all little endian
+static const size_t LAS_VERSION_MINOR = 25;
+static const size_t LAS_HEADER_SIZE = 94;
+static const size_t LAS_POINT_OFFSET = 96;
+static const size_t LAS_POINT_FORMAT = 104;
+static const size_t LAS_RECORD_LENGTH = 105;
+static const size_t LAS_LEGACY_POINT_COUNT = 107;
+static const size_t LAS_SCALE = 131;
+static const size_t LAS_OFFSET = 155;
+static const size_t LAS_BOUNDS = 179; // max x, min x, max y, min y, max z, min z
+static const size_t LAS_POINT_COUNT = 247; // 64 bit count of LAS 1.4
+static const size_t LAS_MIN_HEADER_SIZE = 227;
+
+// what a thread accumulates for a cell: the reduced height and the number of points
+struct PointCell
+{
+   float value;
+   uint32_t count;
+};
+
+// where the points of a pass come from, LAS records or lines of text
+struct PointSource
+{
+   MappedFile file;
+   PointCloudFormat format;
+   // LAS
+   const char *records;
+   long long count;
+   int recordLength;
+   int pointFormat;
+   double scale[3];
+   double offset[3];
+   // XYZ, chunks that start and end at line boundaries
+   std::vector<const char *> chunks; // boundaries, one more than chunks
+};
+
+// the grid the points are binned into
+struct PointGrid
+{
+   double minX;
+   double minY;
+   double cellSize;
+   int width;
+   int height;
+   PointReduction reduction;
+   int classification;
+};
+
+template <typename T>
+static inline T read_le(const char *p)
+{
+   // LAS files are little endian, like every platform the visualizer runs on
+   T value;
+   std::memcpy(&value, p, sizeof(T));
+   return value;
+}
+
+// calls point(x, y, z) for every line of the chunk that starts with three numbers, other lines are skipped
+// ----------------------------------------------------------------------------------------------------------
+template <typename Function>
+static void for_each_xyz_point(const char *p, const char *end, Function point)
+{
+   // projected coordinates need the precision of doubles
+   double x, y, z;
+   for (p = skip_separators(p, end); p < end; p = skip_separators(p, end))
+   {
+      const char *q = parse_double(p, end, x);
+      if (q != nullptr && (q = parse_double(skip_separators(q, end), end, y)) != nullptr &&
+          (q = parse_double(skip_separators(q, end), end, z)) != nullptr)
+         point(x, y, z);
+      const char *newline = (const char *)std::memchr(p, '\n', end - p);
+      p = newline == nullptr ? end : newline + 1;
+   }
+}
+
+PointCloudFormat point_cloud_format(const std::string &filename)
+{
+   size_t dot = filename.find_last_of('.');
+   std::string extension = dot == std::string::npos ? "" : filename.substr(dot);
+   std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+   if (extension == ".las")
+      return POINT_CLOUD_LAS;
+   if (extension == ".xyz" || extension == ".txt" || extension == ".pts")
+      return POINT_CLOUD_XYZ;
+   return POINT_CLOUD_UNKNOWN;
+}
+
+const char *point_reduction_name(PointReduction reduction)
+{
+   switch (reduction)
+   {
+   case POINT_MIN:
+      return "Minimum";
+   case POINT_MAX:
+      return "Maximum";
+   case POINT_MEAN:
+      return "Mean";
+   default:
+      return "?";
+   }
+}
+
+const char *hole_fill_name(HoleFill fill)
+{
+   switch (fill)
+   {
+   case HOLE_FILL_NONE:
+      return "None";
+   case HOLE_FILL_NEAREST:
+      return "Nearest";
+   case HOLE_FILL_IDW:
+      return "Inverse distance";
+   default:
+      return "?";
+   }
+}
+
+// reads the public header block of a LAS file, the extent comes from its bounds
+// --------------------------------------------------------------------------------
+static bool open_las(PointSource &source, PointCloudInfo &info)
+{
+   const char *data = source.file.data();
+   size_t size = source.file.size();
+   if (size < LAS_MIN_HEADER_SIZE || std::memcmp(data, "LASF", 4) != 0)
+   {
+      std::cout << "Not a LAS file\n";
+      return false;
+   }
+   int pointFormat = (unsigned char)data[LAS_POINT_FORMAT];
+   // the two high bits mark LAZ compression
+   if (pointFormat & 0xc0)
+   {
+      std::cout << "Compressed LAS (LAZ) files are not supported\n";
+      return false;
+   }
+   source.pointFormat = pointFormat & 0x3f;
+   source.recordLength = read_le<uint16_t>(data + LAS_RECORD_LENGTH);
+   uint32_t pointOffset = read_le<uint32_t>(data + LAS_POINT_OFFSET);
+   size_t headerSize = read_le<uint16_t>(data + LAS_HEADER_SIZE);
+   long long count = read_le<uint32_t>(data + LAS_LEGACY_POINT_COUNT);
+   // LAS 1.4 files with more points than the legacy count holds only have the 64 bit count, which has to be inside the
+   // header and the file
+   bool extendedCount = data[LAS_VERSION_MINOR] >= 4 && count == 0;
+   if (headerSize < LAS_MIN_HEADER_SIZE || headerSize > size ||
+       (extendedCount && headerSize < LAS_POINT_COUNT + sizeof(uint64_t)))
+   {
+      std::cout << "Invalid LAS header\n";
+      return false;
+   }
+   if (extendedCount)
+      count = (long long)read_le<uint64_t>(data + LAS_POINT_COUNT);
+   // the classification is the last field every point format has
+   int classificationOffset = source.pointFormat >= 6 ? 16 : 15;
+   if (source.recordLength < classificationOffset + 1 || pointOffset > size)
+   {
+      std::cout << "Invalid LAS header\n";
+      return false;
+   }
+   // a truncated file only has the complete records
+   count = std::min(count, (long long)((size - pointOffset) / source.recordLength));
+   for (int axis = 0; axis < 3; ++axis)
+   {
+      source.scale[axis] = read_le<double>(data + LAS_SCALE + 8 * axis);
+      source.offset[axis] = read_le<double>(data + LAS_OFFSET + 8 * axis);
+   }
+   source.records = data + pointOffset;
+   source.count = count;
+   info.points = count;
+   info.maxX = read_le<double>(data + LAS_BOUNDS);
+   info.minX = read_le<double>(data + LAS_BOUNDS + 8);
+   info.maxY = read_le<double>(data + LAS_BOUNDS + 16);
+   info.minY = read_le<double>(data + LAS_BOUNDS + 24);
+   info.maxZ = read_le<double>(data + LAS_BOUNDS + 32);
+   info.minZ = read_le<double>(data + LAS_BOUNDS + 40);
+   return true;
+}
+
+// splits the text into chunks and finds the extent of the points in parallel, the first pass over XYZ files
+// -------------------------------------------------------------------------------------------------------------
+static bool open_xyz(PointSource &source, PointCloudInfo &info, int threads)
+{
+   split_text_chunks(source.file.data(), source.file.data() + source.file.size(), source.chunks);
+
+   std::mutex mutex;
+   info.minX = info.minY = info.minZ = DBL_MAX;
+   info.maxX = info.maxY = info.maxZ = -DBL_MAX;
+   parallel_for(0, (int)source.chunks.size() - 1, threads, [&](int begin, int end) {
+      double low[3] = {DBL_MAX, DBL_MAX, DBL_MAX};
+      double high[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+      long long count = 0;
+      for (int c = begin; c < end; ++c)
+      {
+         for_each_xyz_point(source.chunks[c], source.chunks[c + 1], [&](double x, double y, double z) {
+            low[0] = std::min(low[0], x);
+            low[1] = std::min(low[1], y);
+            low[2] = std::min(low[2], z);
+            high[0] = std::max(high[0], x);
+            high[1] = std::max(high[1], y);
+            high[2] = std::max(high[2], z);
+            ++count;
+         });
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      info.points += count;
+      info.minX = std::min(info.minX, low[0]);
+      info.minY = std::min(info.minY, low[1]);
+      info.minZ = std::min(info.minZ, low[2]);
+      info.maxX = std::max(info.maxX, high[0]);
+      info.maxY = std::max(info.maxY, high[1]);
+      info.maxZ = std::max(info.maxZ, high[2]);
+   });
+   if (info.points == 0)
+   {
+      std::cout << "No x y z points found\n";
+      return false;
+   }
+   return true;
+}
+
+static inline void bin_point(const PointGrid &grid, std::vector<PointCell> &cells, double x, double y, float z)
+{
+   int column = std::min(std::max((int)((x - grid.minX) / grid.cellSize), 0), grid.width - 1);
+   int row = std::min(std::max((int)((y - grid.minY) / grid.cellSize), 0), grid.height - 1);
+   PointCell &cell = cells[(size_t)row * grid.width + column];
+   if (grid.reduction == POINT_MIN)
+      cell.value = std::min(cell.value, z);
+   else if (grid.reduction == POINT_MAX)
+      cell.value = std::max(cell.value, z);
+   else
+      cell.value += z;
+   ++cell.count;
+}
+
+// Bins all points into the partial grids, batch by batch. Lane l of a batch takes the l-th share of its points and
+// only ever writes partials[l], so the lanes need no synchronization
+// ------------------------------------------------------------------------------------------------------------------
+static void bin_points(const PointSource &source, const PointGrid &grid, std::vector<std::vector<PointCell>> &partials,
+                       std::atomic<long long> *pointsDone, long long &binned)
+{
+   PROFILE_ZONE("bin_points");
+   int lanes = (int)partials.size();
+   std::atomic<long long> binnedPoints(0);
+   if (source.format == POINT_CLOUD_LAS)
+   {
+      int classificationOffset = source.pointFormat >= 6 ? 16 : 15;
+      int classMask = source.pointFormat >= 6 ? 0xff : 0x1f;
+      for (long long first = 0; first < source.count; first += (long long)POINT_CLOUD_BATCH * lanes)
+      {
+         long long batch = std::min((long long)POINT_CLOUD_BATCH * lanes, source.count - first);
+         parallel_for(0, lanes, lanes, [&](int begin, int end) {
+            for (int lane = begin; lane < end; ++lane)
+            {
+               long long laneBegin = first + batch * lane / lanes;
+               long long laneEnd = first + batch * (lane + 1) / lanes;
+               std::vector<PointCell> &cells = partials[lane];
+               long long count = 0;
+               const char *record = source.records + laneBegin * source.recordLength;
+               for (long long i = laneBegin; i < laneEnd; ++i, record += source.recordLength)
+               {
+                  if (grid.classification >= 0 && (record[classificationOffset] & classMask) != grid.classification)
+                     continue;
+                  double x = read_le<int32_t>(record) * source.scale[0] + source.offset[0];
+                  double y = read_le<int32_t>(record + 4) * source.scale[1] + source.offset[1];
+                  double z = read_le<int32_t>(record + 8) * source.scale[2] + source.offset[2];
+                  bin_point(grid, cells, x, y, (float)z);
+                  ++count;
+               }
+               binnedPoints += count;
+               if (pointsDone != nullptr)
+                  *pointsDone += laneEnd - laneBegin;
+            }
+         });
+      }
+   }
+   else
+   {
+      int chunks = (int)source.chunks.size() - 1;
+      for (int first = 0; first < chunks; first += lanes)
+      {
+         parallel_for(0, std::min(lanes, chunks - first), lanes, [&](int begin, int end) {
+            for (int lane = begin; lane < end; ++lane)
+            {
+               std::vector<PointCell> &cells = partials[lane];
+               long long count = 0;
+               for_each_xyz_point(source.chunks[first + lane], source.chunks[first + lane + 1],
+                                  [&](double x, double y, double z) {
+                                     bin_point(grid, cells, x, y, (float)z);
+                                     ++count;
+                                  });
+               binnedPoints += count;
+               if (pointsDone != nullptr)
+                  *pointsDone += count;
+            }
+         });
+      }
+   }
+   binned = binnedPoints;
+}
+
+// Merges the partial grids cell by cell into the plane, rows spread over threads. Cells without points become NaN
+// -------------------------------------------------------------------------------------------------------------------
+static long long merge_partials(const PointGrid &grid, const std::vector<std::vector<PointCell>> &partials,
+                                HeightPlane &plane, int threads)
+{
+   PROFILE_ZONE("merge_partials");
+   std::atomic<long long> holes(0);
+   parallel_for(0, grid.height, threads, [&](int begin, int end) {
+      long long rangeHoles = 0;
+      for (size_t i = (size_t)begin * grid.width; i < (size_t)end * grid.width; ++i)
+      {
+         PointCell merged = partials[0][i];
+         for (size_t lane = 1; lane < partials.size(); ++lane)
+         {
+            const PointCell &cell = partials[lane][i];
+            if (grid.reduction == POINT_MIN)
+               merged.value = std::min(merged.value, cell.value);
+            else if (grid.reduction == POINT_MAX)
+               merged.value = std::max(merged.value, cell.value);
+            else
+               merged.value += cell.value;
+            merged.count += cell.count;
+         }
+         if (merged.count == 0)
+         {
+            plane.heights[i] = NAN;
+            ++rangeHoles;
+         }
+         else
+         {
+            plane.heights[i] = grid.reduction == POINT_MEAN ? merged.value / merged.count : merged.value;
+         }
+      }
+      holes += rangeHoles;
+   });
+   return holes;
+}
+
+// Gives every hole the height of the nearest cell with points, or the inverse distance weighted mean of the cells with
+// points around it. The search grows ring by ring up to the fill radius; once a ring holds a cell with points, every
+// cell up to sqrt(2) times its distance is taken, so small gaps only look at their direct neighbours. Reads the merged
+// heights and writes a copy, so filled holes do not feed other holes
+// ---------------------------------------------------------------------------------------------------------------------
+static void fill_holes(HeightPlane &plane, const PointCloudOptions &options, int threads)
+{
+   PROFILE_ZONE("fill_holes");
+   int width = plane.width;
+   int height = plane.height;
+   int radius = std::max(options.fillRadius, 1);
+   std::vector<float> filled(plane.heights);
+   MemoryReservation filledMemory(MEMORY_TRANSIENT);
+   filledMemory.set(filled);
+   const float *heights = plane.heights.data();
+   // weights by squared distance, the same for every hole
+   int maxDistance = (int)std::ceil(radius * 1.41421356f);
+   std::vector<float> weights((size_t)2 * maxDistance * maxDistance + 1);
+   for (size_t d2 = 1; d2 < weights.size(); ++d2)
+      weights[d2] = 1.0f / std::pow((float)d2, options.idwPower * 0.5f);
+
+   parallel_for(0, height, threads, [&](int begin, int end) {
+      for (int y = begin; y < end; ++y)
+      {
+         for (int x = 0; x < width; ++x)
+         {
+            if (!std::isnan(heights[(size_t)y * width + x]))
+               continue;
+            auto valid = [&](int dx, int dy) {
+               int sx = x + dx;
+               int sy = y + dy;
+               return sx >= 0 && sx < width && sy >= 0 && sy < height && !std::isnan(heights[(size_t)sy * width + sx]);
+            };
+            int reach = 0;
+            for (int r = 1; r <= radius && reach == 0; ++r)
+            {
+               for (int d = -r; d <= r && reach == 0; ++d)
+               {
+                  if (valid(d, -r) || valid(d, r) || valid(-r, d) || valid(r, d))
+                     reach = std::min((int)std::ceil(r * 1.41421356f), maxDistance);
+               }
+            }
+            if (reach == 0)
+               continue;
+
+            float weightSum = 0.0f;
+            float sum = 0.0f;
+            int nearest = reach * reach + 1;
+            float nearestHeight = 0.0f;
+            for (int dy = std::max(-reach, -y); dy <= std::min(reach, height - 1 - y); ++dy)
+            {
+               const float *row = heights + (size_t)(y + dy) * width;
+               for (int dx = std::max(-reach, -x); dx <= std::min(reach, width - 1 - x); ++dx)
+               {
+                  int d2 = dx * dx + dy * dy;
+                  float h = row[x + dx];
+                  if (d2 > reach * reach || std::isnan(h))
+                     continue;
+                  if (d2 < nearest)
+                  {
+                     nearest = d2;
+                     nearestHeight = h;
+                  }
+                  weightSum += weights[d2];
+                  sum += weights[d2] * h;
+               }
+            }
+            filled[(size_t)y * width + x] = options.fill == HOLE_FILL_NEAREST ? nearestHeight : sum / weightSum;
+         }
+      }
+   });
+   plane.heights.swap(filled);
+}
+
+bool grid_point_cloud(const std::string &filename, const PointCloudOptions &options, HeightPlane &plane, int threads,
+                      std::atomic<long long> *pointsDone, PointCloudInfo *info)
+{
+   PROFILE_ZONE("grid_point_cloud");
+   PointCloudInfo cloud;
+   PointSource source;
+   source.format = cloud.format = point_cloud_format(filename);
+   if (source.format == POINT_CLOUD_UNKNOWN)
+   {
+      std::cout << filename << " is neither a LAS file (.las) nor a text point cloud (.xyz, .txt, .pts)\n";
+      return false;
+   }
+   if (!source.file.open(filename))
+   {
+      std::cout << "Failed to open " << filename << '\n';
+      return false;
+   }
+   if (threads <= 0)
+      threads = default_thread_count();
+   bool opened = source.format == POINT_CLOUD_LAS ? open_las(source, cloud) : open_xyz(source, cloud, threads);
+   if (!opened || cloud.points == 0)
+   {
+      std::cout << "Failed to read points from " << filename << '\n';
+      return false;
+   }
+
+   PointGrid grid;
+   double extent = std::max(cloud.maxX - cloud.minX, cloud.maxY - cloud.minY);
+   int resolution = std::max(options.resolution, 2);
+   grid.minX = cloud.minX;
+   grid.minY = cloud.minY;
+   grid.cellSize = extent > 0.0 ? extent / resolution : 1.0;
+   grid.width = std::min((int)((cloud.maxX - cloud.minX) / grid.cellSize) + 1, resolution);
+   grid.height = std::min((int)((cloud.maxY - cloud.minY) / grid.cellSize) + 1, resolution);
+   grid.reduction = options.reduction;
+   grid.classification = source.format == POINT_CLOUD_LAS ? options.classification : -1;
+   cloud.cellSize = grid.cellSize;
+
+   // every lane needs a whole grid, so lanes are limited by the budget rather than by the threads
+   size_t cells = (size_t)grid.width * grid.height;
+   long long partialBytes = (long long)(cells * sizeof(PointCell));
+   int lanes = (int)std::max(1LL, std::min((long long)threads, POINT_CLOUD_PARTIAL_BUDGET / partialBytes));
+   PointCell empty = {options.reduction == POINT_MIN ? FLT_MAX : options.reduction == POINT_MAX ? -FLT_MAX : 0.0f, 0};
+   std::vector<std::vector<PointCell>> partials(lanes);
+   MemoryReservation partialMemory(MEMORY_TRANSIENT, partialBytes * lanes);
+   parallel_for(0, lanes, lanes, [&](int begin, int end) {
+      for (int lane = begin; lane < end; ++lane)
+         partials[lane].assign(cells, empty);
+   });
+
+   bin_points(source, grid, partials, pointsDone, cloud.binned);
+   source.file.close();
+   if (info != nullptr)
+      *info = cloud;
+   if (cloud.binned == 0)
+   {
+      std::cout << "No points of " << filename << " passed the classification filter\n";
+      return false;
+   }
+
+   plane.width = grid.width;
+   plane.height = grid.height;
+   plane.decoding = HeightDecoding();
+   plane.heights.resize(cells);
+   cloud.holes = merge_partials(grid, partials, plane, threads);
+   std::vector<std::vector<PointCell>>().swap(partials);
+   partialMemory.set(0);
+
+   if (cloud.holes > 0 && options.fill != HOLE_FILL_NONE)
+      fill_holes(plane, options, threads);
+   // remaining holes go to the lowest cell
+   float lowest = FLT_MAX;
+   for (size_t i = 0; i < cells; ++i)
+   {
+      if (!std::isnan(plane.heights[i]))
+         lowest = std::min(lowest, plane.heights[i]);
+   }
+   for (size_t i = 0; i < cells; ++i)
+   {
+      if (std::isnan(plane.heights[i]))
+         plane.heights[i] = lowest;
+   }
+   normalize_heights(plane, threads);
+   if (info != nullptr)
+      *info = cloud;
+   return true;
+}
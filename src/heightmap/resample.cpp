@@ -0,0 +1,228 @@
+#include <heightmap/resample.h>
+#include <heightmap/parallel.h>
+#include <heightmap/simd.h>
+
+#include <memory_stats.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// which source samples contribute to each target sample along one axis. Taps of a target sample start at first and
+// are padded with zero weights to taps (a multiple of SIMD_LANES), counts holds the taps that are not padding
+struct ResampleTaps
+{
+   int taps;
+   std::vector<int> first;
+   std::vector<int> counts;
+   std::vector<float> weights; // taps per target sample
+};
+
+static double filter_radius(ResampleFilter filter)
+{
+   switch (filter)
+   {
+   case RESAMPLE_BILINEAR:
+      return 1.0;
+   case RESAMPLE_BICUBIC:
+      return 2.0;
+   case RESAMPLE_LANCZOS3:
+      return 3.0;
+   default:
+      return 0.5;
+   }
+}
+
+static double sinc(double x)
+{
+   if (std::fabs(x) < 1e-8)
+      return 1.0;
+   x *= M_PI;
+   return std::sin(x) / x;
+}
+
+static double filter_weight(ResampleFilter filter, double x)
+{
+   x = std::fabs(x);
+   switch (filter)
+   {
+   case RESAMPLE_BILINEAR:
+      return x < 1.0 ? 1.0 - x : 0.0;
+   case RESAMPLE_BICUBIC:
+      // Catmull-Rom, a = -0.5
+      if (x < 1.0)
+         return (1.5 * x - 2.5) * x * x + 1.0;
+      if (x < 2.0)
+         return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+      return 0.0;
+   case RESAMPLE_LANCZOS3:
+      return x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+   default:
+      return x <= 0.5 ? 1.0 : 0.0;
+   }
+}
+
+// Weights of the target samples along an axis of sourceSize samples. Taps beyond the border are folded onto the border
+// sample, which keeps the taps of every target sample contiguous, and the weights of a target sample add up to 1
+// ----------------------------------------------------------------------------------------------------------------------
+static void resample_taps(int sourceSize, int targetSize, ResampleFilter filter, ResampleTaps &taps)
+{
+   double scale = (double)sourceSize / targetSize;
+   double stretch = std::max(scale, 1.0);
+   double support = filter_radius(filter) * stretch;
+   int window = std::min(sourceSize, (int)std::ceil(2.0 * support) + 2);
+   taps.taps = (window + SIMD_LANES - 1) / SIMD_LANES * SIMD_LANES;
+   taps.first.resize(targetSize);
+   taps.counts.resize(targetSize);
+   taps.weights.assign((size_t)targetSize * taps.taps, 0.0f);
+
+   std::vector<double> weights(window);
+   for (int t = 0; t < targetSize; ++t)
+   {
+      double center = (t + 0.5) * scale;
+      int begin = (int)std::floor(center - support);
+      int end = (int)std::ceil(center + support);
+      int first = std::min(std::max(begin, 0), sourceSize - window);
+      std::fill(weights.begin(), weights.end(), 0.0);
+      double sum = 0.0;
+      for (int s = begin; s <= end; ++s)
+      {
+         // box filters include the left edge only, so neighbours do not share a sample
+         double x = (s + 0.5 - center) / stretch;
+         double weight = filter == RESAMPLE_BOX && x == 0.5 ? 0.0 : filter_weight(filter, x);
+         if (weight == 0.0)
+            continue;
+         int index = std::min(std::max(s, 0), sourceSize - 1) - first;
+         weights[std::min(std::max(index, 0), window - 1)] += weight;
+         sum += weight;
+      }
+      // a box narrower than a sample when enlarging falls between centers, the nearest sample is taken
+      if (sum == 0.0)
+      {
+         weights[std::min(std::max((int)center - first, 0), window - 1)] = 1.0;
+         sum = 1.0;
+      }
+      int last = 0;
+      float *out = &taps.weights[(size_t)t * taps.taps];
+      for (int i = 0; i < window; ++i)
+      {
+         out[i] = (float)(weights[i] / sum);
+         if (weights[i] != 0.0)
+            last = i + 1;
+      }
+      taps.first[t] = first;
+      taps.counts[t] = last;
+   }
+}
+
+const char *resample_filter_name(ResampleFilter filter)
+{
+   switch (filter)
+   {
+   case RESAMPLE_BOX:
+      return "Box";
+   case RESAMPLE_BILINEAR:
+      return "Bilinear";
+   case RESAMPLE_BICUBIC:
+      return "Bicubic";
+   case RESAMPLE_LANCZOS3:
+      return "Lanczos-3";
+   default:
+      return "Unknown";
+   }
+}
+
+bool resample_filter_from_name(const std::string &name, ResampleFilter &filter)
+{
+   static const char *names[RESAMPLE_FILTER_COUNT] = {"box", "bilinear", "bicubic", "lanczos3"};
+   for (int i = 0; i < RESAMPLE_FILTER_COUNT; ++i)
+   {
+      if (name == names[i])
+      {
+         filter = (ResampleFilter)i;
+         return true;
+      }
+   }
+   return false;
+}
+
+void resample_size(int width, int height, int resolution, int &targetWidth, int &targetHeight)
+{
+   resolution = std::max(resolution, 2);
+   if (width >= height)
+   {
+      targetWidth = resolution;
+      targetHeight = (int)std::lround((double)height * resolution / std::max(width, 1));
+   }
+   else
+   {
+      targetHeight = resolution;
+      targetWidth = (int)std::lround((double)width * resolution / std::max(height, 1));
+   }
+   targetWidth = std::max(targetWidth, 2);
+   targetHeight = std::max(targetHeight, 2);
+}
+
+void resample_heights(const HeightPlane &source, int width, int height, ResampleFilter filter, HeightPlane &target,
+                      int threads)
+{
+   PROFILE_ZONE("resample_heights");
+   target.width = width;
+   target.height = height;
+   target.minimum = source.minimum;
+   target.maximum = source.maximum;
+   target.decoding = source.decoding;
+   target.heights.resize((size_t)width * height);
+   if (source.heights.empty() || width <= 0 || height <= 0)
+      return;
+
+   ResampleTaps columns;
+   ResampleTaps rows;
+   resample_taps(source.width, width, filter, columns);
+   resample_taps(source.height, height, filter, rows);
+   MemoryReservation tapMemory(MEMORY_TRANSIENT, (long long)((columns.weights.size() + rows.weights.size()) *
+                                                             sizeof(float)));
+
+   const float *in = source.heights.data();
+   int sourceWidth = source.width;
+   parallel_for(0, height, threads, [&](int begin, int end) {
+      // one vertically filtered source row, padded for the SIMD loads of the horizontal taps
+      std::vector<float> row(sourceWidth + columns.taps, 0.0f);
+      for (int y = begin; y < end; ++y)
+      {
+         const float *weights = &rows.weights[(size_t)y * rows.taps];
+         const float *first = in + (size_t)rows.first[y] * sourceWidth;
+         int count = rows.counts[y];
+         int x = 0;
+         for (; x + SIMD_LANES <= sourceWidth; x += SIMD_LANES)
+         {
+            SimdFloat sum = SimdFloat() + 0.0f;
+            for (int k = 0; k < count; ++k)
+               sum += weights[k] * simd_load(first + (size_t)k * sourceWidth + x);
+            simd_store(&row[x], sum);
+         }
+         for (; x < sourceWidth; ++x)
+         {
+            float sum = 0.0f;
+            for (int k = 0; k < count; ++k)
+               sum += weights[k] * first[(size_t)k * sourceWidth + x];
+            row[x] = sum;
+         }
+
+         float *out = &target.heights[(size_t)y * width];
+         for (int t = 0; t < width; ++t)
+         {
+            const float *w = &columns.weights[(size_t)t * columns.taps];
+            const float *r = &row[columns.first[t]];
+            SimdFloat sum = SimdFloat() + 0.0f;
+            for (int k = 0; k < columns.counts[t]; k += SIMD_LANES)
+               sum += simd_load(w + k) * simd_load(r + k);
+            float value = 0.0f;
+            for (int lane = 0; lane < SIMD_LANES; ++lane)
+               value += sum[lane];
+            out[t] = std::min(std::max(value, 0.0f), 1.0f);
+         }
+      }
+   });
+}
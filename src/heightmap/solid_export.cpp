@@ -0,0 +1,549 @@
+#include <heightmap/solid_export.h>
+#include <heightmap/buffered_writer.h>
+
+#include <memory_stats.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+// vertex rows per band when no decimation forces the band height
+const long long SOLID_BAND_VERTICES = 1 << 20;
+
+typedef unsigned long long VertexId;
+
+// vertex of the solid, ids index the vertex list of indexed formats
+struct SolidVertex
+{
+   VertexId id;
+   glm::vec3 position;
+};
+
+// Generates the closed solid band by band. Vertex ids: the (N + 1) x (M + 1) grid vertices, then the ring of
+// bottom vertices below the border (counter clockwise seen from above), the center of the base and finally
+// the centers of the decimated blocks in row major order. All triangles are counter clockwise seen from outside.
+class SolidGenerator
+{
+public:
+   float MinZ;
+   float BaseZ;
+   long long TriangleCount;
+
+   SolidGenerator(int N, int M, const HeightmapView &image, float heightScaling, const SolidOptions &options, int threads)
+       : MinZ(0.0f), BaseZ(0.0f), TriangleCount(0), N(N), M(M), image(image), heightScaling(heightScaling),
+         options(options), threads(threads), blockMemory(MEMORY_TRANSIENT)
+   {
+      blockSize = options.decimate ? std::max(2, options.blockSize) : 0;
+      bandRows = options.decimate ? blockSize : (int)std::max(1LL, SOLID_BAND_VERTICES / (M + 1));
+      blockRows = options.decimate ? N / blockSize : 0;
+      blockColumns = options.decimate ? M / blockSize : 0;
+      gridVertices = (VertexId)(N + 1) * (M + 1);
+      ringVertices = 2 * (VertexId)(N + M);
+   }
+
+   // finds the lowest point of the surface and the flat blocks, which fixes all vertex ids and the triangle count
+   void prepare()
+   {
+      PROFILE_ZONE("export_solid: prepare");
+      MinZ = 1e30f;
+      blockCenters.assign((size_t)blockRows * blockColumns, NAN);
+      blockMemory.set(blockCenters);
+      long long flatBlocks = 0;
+      for (int r0 = 0; r0 < N; r0 += bandRows)
+      {
+         int rows = std::min(bandRows, N - r0);
+         load_band(r0, rows);
+         for (size_t v = 0; v < positions.size(); ++v)
+            MinZ = std::min(MinZ, positions[v].z);
+
+         if (!options.decimate || rows != blockSize)
+            continue;
+         for (int b = 0; b < blockColumns; ++b)
+         {
+            int c0 = b * blockSize;
+            float low = 1e30f;
+            float high = -1e30f;
+            for (int i = 0; i <= blockSize; ++i)
+            {
+               for (int j = 0; j <= blockSize; ++j)
+               {
+                  float z = position(r0 + i, c0 + j).z;
+                  low = std::min(low, z);
+                  high = std::max(high, z);
+               }
+            }
+            if (high - low <= options.flatTolerance)
+            {
+               blockCenters[(size_t)(r0 / blockSize) * blockColumns + b] =
+                   (position(r0, c0).z + position(r0, c0 + blockSize).z + position(r0 + blockSize, c0).z +
+                    position(r0 + blockSize, c0 + blockSize).z) / 4.0f;
+               ++flatBlocks;
+            }
+         }
+      }
+      BaseZ = MinZ - options.baseThickness;
+
+      long long surface = (long long)N * M * 2 - flatBlocks * (2LL * blockSize * blockSize - 4LL * blockSize);
+      TriangleCount = surface + 2 * (long long)ringVertices + (long long)ringVertices;
+   }
+
+   // calls vertex(SolidVertex) for every vertex in id order
+   template <typename Function>
+   void vertices(Function vertex)
+   {
+      PROFILE_ZONE("export_solid: vertices");
+      for (int r0 = 0; r0 < N; r0 += bandRows)
+      {
+         int rows = std::min(bandRows, N - r0);
+         load_band(r0, rows);
+         // the last band also emits the last vertex row
+         int lastRow = r0 + rows == N ? r0 + rows : r0 + rows - 1;
+         for (int i = r0; i <= lastRow; ++i)
+         {
+            for (int j = 0; j <= M; ++j)
+               vertex(grid_vertex(i, j));
+         }
+      }
+      for (VertexId k = 0; k < ringVertices; ++k)
+         vertex(ring_vertex(k));
+      vertex(base_center());
+
+      VertexId id = gridVertices + ringVertices + 1;
+      for (int r = 0; r < blockRows; ++r)
+      {
+         for (int b = 0; b < blockColumns; ++b)
+         {
+            float z = blockCenters[(size_t)r * blockColumns + b];
+            if (std::isnan(z))
+               continue;
+            float half = blockSize / 2.0f;
+            glm::vec3 center((b * blockSize + half) / N, (r * blockSize + half) / M, z);
+            SolidVertex centerVertex = {id++, center * options.scale};
+            vertex(centerVertex);
+         }
+      }
+   }
+
+   // calls triangle(SolidVertex, SolidVertex, SolidVertex) for every triangle of the solid
+   template <typename Function>
+   void triangles(Function triangle)
+   {
+      PROFILE_ZONE("export_solid: triangles");
+      VertexId nextCenter = gridVertices + ringVertices + 1;
+      for (int r0 = 0; r0 < N; r0 += bandRows)
+      {
+         int rows = std::min(bandRows, N - r0);
+         load_band(r0, rows);
+
+         // surface, decimated blocks become a fan around their center
+         bool blockBand = options.decimate && rows == blockSize;
+         for (int c0 = 0; c0 < M;)
+         {
+            int b = blockBand ? c0 / blockSize : -1;
+            if (blockBand && b < blockColumns && !std::isnan(blockCenters[(size_t)(r0 / blockSize) * blockColumns + b]))
+            {
+               float half = blockSize / 2.0f;
+               glm::vec3 position((c0 + half) / N, (r0 + half) / M, blockCenters[(size_t)(r0 / blockSize) * blockColumns + b]);
+               SolidVertex center = {nextCenter++, position * options.scale};
+               block_fan(r0, c0, center, triangle);
+               c0 += blockSize;
+               continue;
+            }
+
+            int c1 = blockBand ? std::min(c0 + blockSize, M) : M;
+            for (int i = r0; i < r0 + rows; ++i)
+            {
+               for (int j = c0; j < c1; ++j)
+               {
+                  // same triangles as generate_index_rows
+                  triangle(grid_vertex(i, j), grid_vertex(i, j + 1), grid_vertex(i + 1, j + 1));
+                  triangle(grid_vertex(i, j), grid_vertex(i + 1, j + 1), grid_vertex(i + 1, j));
+               }
+            }
+            c0 = c1;
+         }
+
+         // side walls along the border, following the ring counter clockwise
+         if (r0 == 0)
+         {
+            for (int j = 0; j < M; ++j)
+               wall(0, j, 0, j + 1, triangle);
+         }
+         for (int i = r0; i < r0 + rows; ++i)
+         {
+            wall(i, M, i + 1, M, triangle);
+            wall(i + 1, 0, i, 0, triangle);
+         }
+         if (r0 + rows == N)
+         {
+            for (int j = M; j > 0; --j)
+               wall(N, j, N, j - 1, triangle);
+         }
+      }
+
+      // base plate as a fan around its center through every ring vertex, facing down
+      SolidVertex center = base_center();
+      for (VertexId k = 0; k < ringVertices; ++k)
+         triangle(center, ring_vertex((k + 1) % ringVertices), ring_vertex(k));
+   }
+
+private:
+   int N;
+   int M;
+   HeightmapView image;
+   float heightScaling;
+   SolidOptions options;
+   int threads;
+   int blockSize;
+   int bandRows;
+   int blockRows;
+   int blockColumns;
+   VertexId gridVertices;
+   VertexId ringVertices;
+   // z of the center of every flat block, NaN for blocks that are kept at full resolution
+   std::vector<float> blockCenters;
+   MemoryReservation blockMemory;
+   // vertex rows [bandBegin, bandBegin + rows] of the current band
+   std::vector<glm::vec3> positions;
+   int bandBegin;
+
+   void load_band(int r0, int rows)
+   {
+      generate_position_rows(N, M, image, heightScaling, r0, rows + 1, positions, threads);
+      bandBegin = r0;
+   }
+
+   const glm::vec3 &position(int i, int j) const
+   {
+      return positions[(size_t)(i - bandBegin) * (M + 1) + j];
+   }
+
+   SolidVertex grid_vertex(int i, int j) const
+   {
+      SolidVertex vertex = {(VertexId)i * (M + 1) + j, position(i, j) * options.scale};
+      return vertex;
+   }
+
+   // index of the bottom vertex below border vertex (i, j) in the ring
+   VertexId ring_index(int i, int j) const
+   {
+      if (i == 0 && j < M)
+         return j;
+      if (j == M && i < N)
+         return M + i;
+      if (i == N && j > 0)
+         return (VertexId)M + N + (M - j);
+      return ((VertexId)2 * M + N + (N - i)) % ringVertices;
+   }
+
+   SolidVertex ring_vertex(VertexId k) const
+   {
+      int i = 0;
+      int j = 0;
+      if (k < (VertexId)M)
+         j = (int)k;
+      else if (k < (VertexId)M + N)
+      {
+         i = (int)(k - M);
+         j = M;
+      }
+      else if (k < (VertexId)2 * M + N)
+      {
+         i = N;
+         j = M - (int)(k - M - N);
+      }
+      else
+         i = N - (int)(k - 2 * M - N);
+      SolidVertex vertex = {gridVertices + k, glm::vec3((float)j / N, (float)i / M, BaseZ) * options.scale};
+      return vertex;
+   }
+
+   SolidVertex base_center() const
+   {
+      SolidVertex vertex = {gridVertices + ringVertices,
+                            glm::vec3((float)M / N / 2.0f, (float)N / M / 2.0f, BaseZ) * options.scale};
+      return vertex;
+   }
+
+   // wall quad below the border edge from (i1, j1) to (i2, j2), which runs counter clockwise around the grid
+   template <typename Function>
+   void wall(int i1, int j1, int i2, int j2, Function &triangle) const
+   {
+      SolidVertex top1 = grid_vertex(i1, j1);
+      SolidVertex top2 = grid_vertex(i2, j2);
+      SolidVertex bottom1 = ring_vertex(ring_index(i1, j1));
+      SolidVertex bottom2 = ring_vertex(ring_index(i2, j2));
+      triangle(top1, bottom1, bottom2);
+      triangle(top1, bottom2, top2);
+   }
+
+   // fan around center through every border vertex of the block at (r0, c0), counter clockwise seen from above
+   template <typename Function>
+   void block_fan(int r0, int c0, const SolidVertex &center, Function &triangle) const
+   {
+      int n = blockSize;
+      SolidVertex first = grid_vertex(r0, c0);
+      SolidVertex previous = first;
+      for (int k = 1; k <= 4 * n; ++k)
+      {
+         SolidVertex current = first;
+         if (k < n)
+            current = grid_vertex(r0, c0 + k);
+         else if (k < 2 * n)
+            current = grid_vertex(r0 + (k - n), c0 + n);
+         else if (k < 3 * n)
+            current = grid_vertex(r0 + n, c0 + n - (k - 2 * n));
+         else if (k < 4 * n)
+            current = grid_vertex(r0 + n - (k - 3 * n), c0);
+         triangle(center, previous, current);
+         previous = current;
+      }
+   }
+};
+
+// binary STL: the triangle count is known after prepare, so the file is written in a single pass
+// ------------------------------------------------------------------------------------------------
+static bool write_solid_stl(BufferedWriter &writer, SolidGenerator &generator)
+{
+   if (generator.TriangleCount > UINT32_MAX)
+   {
+      std::cout << "Export failed: " << generator.TriangleCount << " triangles exceed the STL limit\n";
+      return false;
+   }
+   char header[80] = "heightmap-visualizer binary STL solid";
+   writer.write(header, sizeof(header));
+   writer.write((uint32_t)generator.TriangleCount);
+   generator.triangles([&](const SolidVertex &a, const SolidVertex &b, const SolidVertex &c) {
+      glm::vec3 normal = glm::cross(b.position - a.position, c.position - a.position);
+      float length = glm::length(normal);
+      if (length > 0.0f)
+         normal /= length;
+      writer.write(normal);
+      writer.write(a.position);
+      writer.write(b.position);
+      writer.write(c.position);
+      writer.write((uint16_t)0);
+   });
+   return true;
+}
+
+// Minimal streaming ZIP writer for the 3MF package. Entries are stored uncompressed and their sizes and CRC
+// follow the data in a descriptor, so an entry can be written without knowing its size. ZIP64 records are always
+// written so that entries and archives beyond 4 GB work.
+class ZipWriter
+{
+public:
+   ZipWriter(BufferedWriter &writer) : writer(writer), crc(0), entrySize(0)
+   {
+      for (uint32_t n = 0; n < 256; ++n)
+      {
+         uint32_t c = n;
+         for (int k = 0; k < 8; ++k)
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+         crcTable[n] = c;
+      }
+   }
+
+   void beginEntry(const std::string &name)
+   {
+      Entry entry = {name, (unsigned long long)writer.size(), 0, 0};
+      entries.push_back(entry);
+      writer.write((uint32_t)0x04034b50);
+      writer.write((uint16_t)45);     // version needed: zip64
+      writer.write((uint16_t)0x0008); // sizes follow in the data descriptor
+      writer.write((uint16_t)0);      // stored
+      writer.write((uint16_t)0);      // time
+      writer.write((uint16_t)0x0021); // date: 1980-01-01
+      writer.write((uint32_t)0);      // crc
+      writer.write((uint32_t)0xFFFFFFFF);
+      writer.write((uint32_t)0xFFFFFFFF);
+      writer.write((uint16_t)name.size());
+      writer.write((uint16_t)20);
+      writer.write(name.data(), name.size());
+      writer.write((uint16_t)0x0001); // zip64 extra field, sizes are in the descriptor
+      writer.write((uint16_t)16);
+      writer.write((unsigned long long)0);
+      writer.write((unsigned long long)0);
+      crc = 0xFFFFFFFFu;
+      entrySize = 0;
+   }
+
+   void write(const char *data, size_t size)
+   {
+      for (size_t i = 0; i < size; ++i)
+         crc = crcTable[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+      writer.write(data, size);
+      entrySize += size;
+   }
+
+   void write(const std::string &text)
+   {
+      write(text.data(), text.size());
+   }
+
+   void endEntry()
+   {
+      Entry &entry = entries.back();
+      entry.crc = crc ^ 0xFFFFFFFFu;
+      entry.size = entrySize;
+      writer.write((uint32_t)0x08074b50);
+      writer.write(entry.crc);
+      writer.write(entry.size);
+      writer.write(entry.size);
+   }
+
+   // writes the central directory
+   void finish()
+   {
+      unsigned long long directoryOffset = writer.size();
+      for (size_t i = 0; i < entries.size(); ++i)
+      {
+         const Entry &entry = entries[i];
+         writer.write((uint32_t)0x02014b50);
+         writer.write((uint16_t)45); // made by
+         writer.write((uint16_t)45); // needed
+         writer.write((uint16_t)0x0008);
+         writer.write((uint16_t)0);
+         writer.write((uint16_t)0);
+         writer.write((uint16_t)0x0021);
+         writer.write(entry.crc);
+         writer.write((uint32_t)0xFFFFFFFF);
+         writer.write((uint32_t)0xFFFFFFFF);
+         writer.write((uint16_t)entry.name.size());
+         writer.write((uint16_t)28);
+         writer.write((uint16_t)0); // comment
+         writer.write((uint16_t)0); // disk
+         writer.write((uint16_t)0); // internal attributes
+         writer.write((uint32_t)0); // external attributes
+         writer.write((uint32_t)0xFFFFFFFF);
+         writer.write(entry.name.data(), entry.name.size());
+         writer.write((uint16_t)0x0001);
+         writer.write((uint16_t)24);
+         writer.write(entry.size);
+         writer.write(entry.size);
+         writer.write(entry.offset);
+      }
+      unsigned long long directorySize = writer.size() - directoryOffset;
+
+      // zip64 end of central directory record and locator
+      unsigned long long zip64Offset = writer.size();
+      writer.write((uint32_t)0x06064b50);
+      writer.write((unsigned long long)44);
+      writer.write((uint16_t)45);
+      writer.write((uint16_t)45);
+      writer.write((uint32_t)0);
+      writer.write((uint32_t)0);
+      writer.write((unsigned long long)entries.size());
+      writer.write((unsigned long long)entries.size());
+      writer.write(directorySize);
+      writer.write(directoryOffset);
+      writer.write((uint32_t)0x07064b50);
+      writer.write((uint32_t)0);
+      writer.write(zip64Offset);
+      writer.write((uint32_t)1);
+
+      // end of central directory record
+      writer.write((uint32_t)0x06054b50);
+      writer.write((uint16_t)0);
+      writer.write((uint16_t)0);
+      writer.write((uint16_t)entries.size());
+      writer.write((uint16_t)entries.size());
+      writer.write((uint32_t)0xFFFFFFFF);
+      writer.write((uint32_t)0xFFFFFFFF);
+      writer.write((uint16_t)0);
+   }
+
+private:
+   struct Entry
+   {
+      std::string name;
+      unsigned long long offset;
+      unsigned long long size;
+      uint32_t crc;
+   };
+
+   BufferedWriter &writer;
+   std::vector<Entry> entries;
+   uint32_t crcTable[256];
+   uint32_t crc;
+   unsigned long long entrySize;
+};
+
+// 3MF: an OPC package holding the content types, the relationship to the model and the model itself.
+// The model lists all vertices before all triangles, so the generator runs twice
+// -----------------------------------------------------------------------------------------------------
+static bool write_solid_3mf(BufferedWriter &writer, SolidGenerator &generator)
+{
+   ZipWriter zip(writer);
+   zip.beginEntry("[Content_Types].xml");
+   zip.write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+             "<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">"
+             "<Default Extension=\"rels\" ContentType=\"application/vnd.openxmlformats-package.relationships+xml\"/>"
+             "<Default Extension=\"model\" ContentType=\"application/vnd.ms-package.3dmanufacturing-3dmodel+xml\"/>"
+             "</Types>\n");
+   zip.endEntry();
+
+   zip.beginEntry("_rels/.rels");
+   zip.write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+             "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">"
+             "<Relationship Target=\"/3D/3dmodel.model\" Id=\"rel0\" "
+             "Type=\"http://schemas.microsoft.com/3dmanufacturing/2013/01/3dmodel\"/>"
+             "</Relationships>\n");
+   zip.endEntry();
+
+   zip.beginEntry("3D/3dmodel.model");
+   zip.write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+             "<model unit=\"millimeter\" xml:lang=\"en-US\" "
+             "xmlns=\"http://schemas.microsoft.com/3dmanufacturing/core/2015/02\">\n"
+             "<resources><object id=\"1\" type=\"model\"><mesh>\n<vertices>\n");
+   char line[128];
+   generator.vertices([&](const SolidVertex &v) {
+      int length = snprintf(line, sizeof(line), "<vertex x=\"%.6g\" y=\"%.6g\" z=\"%.6g\"/>\n",
+                            v.position.x, v.position.y, v.position.z);
+      zip.write(line, length);
+   });
+   zip.write("</vertices>\n<triangles>\n");
+   generator.triangles([&](const SolidVertex &a, const SolidVertex &b, const SolidVertex &c) {
+      int length = snprintf(line, sizeof(line), "<triangle v1=\"%llu\" v2=\"%llu\" v3=\"%llu\"/>\n", a.id, b.id, c.id);
+      zip.write(line, length);
+   });
+   zip.write("</triangles>\n</mesh></object></resources>\n<build><item objectid=\"1\"/></build>\n</model>\n");
+   zip.endEntry();
+
+   zip.finish();
+   return true;
+}
+
+long long export_solid(const std::string &filename, MeshFormat format, int N, int M, const HeightmapView &image,
+                       float heightScaling, const SolidOptions &options, int threads)
+{
+   PROFILE_ZONE("export_solid");
+   if (format != MESH_STL && format != MESH_3MF)
+   {
+      std::cout << "Export failed: solids can only be written as .stl or .3mf\n";
+      return 0;
+   }
+
+   BufferedWriter writer(filename);
+   if (!writer.isOpen())
+   {
+      std::cout << "Failed to open " << filename << " for writing\n";
+      return 0;
+   }
+
+   SolidGenerator generator(N, M, image, heightScaling, options, threads);
+   generator.prepare();
+   bool success = format == MESH_STL ? write_solid_stl(writer, generator) : write_solid_3mf(writer, generator);
+
+   if (!writer.close() || !success)
+   {
+      std::cout << "Failed to write " << filename << '\n';
+      std::remove(filename.c_str());
+      return 0;
+   }
+   return writer.size();
+}
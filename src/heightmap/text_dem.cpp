@@ -0,0 +1,558 @@
+#include <heightmap/text_dem.h>
+#include <heightmap/mapped_file.h>
+#include <heightmap/parallel.h>
+
+#include <profiler.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// powers of ten that are exact in a double
+static const double POWERS_OF_TEN[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                       1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static inline bool is_digit(char c)
+{
+   return (unsigned char)(c - '0') < 10;
+}
+
+// a part of the text that starts and ends at a line boundary
+struct TextChunk
+{
+   const char *begin;
+   const char *end;
+   long long count; // heights in the chunk
+   float minimum;
+   float maximum;
+   const char *error; // first character that could not be parsed, nullptr if none
+};
+
+// a mapped text DEM with its header read and its heights split into chunks
+struct TextDem
+{
+   MappedFile file;
+   TextDemInfo info;
+   const char *data; // first character after the header
+   std::vector<TextChunk> chunks;
+};
+
+const char *parse_double(const char *p, const char *end, double &value)
+{
+   bool negative = false;
+   if (p < end && (*p == '-' || *p == '+'))
+   {
+      negative = *p == '-';
+      ++p;
+   }
+
+   // up to 19 significant digits fit into the mantissa, the digits after them only shift the exponent
+   uint64_t mantissa = 0;
+   int exponent = 0;
+   int significant = 0;
+   bool anyDigits = false;
+   for (; p < end && is_digit(*p); ++p)
+   {
+      anyDigits = true;
+      if (significant < 19)
+      {
+         mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+         significant += mantissa != 0;
+      }
+      else
+      {
+         ++exponent;
+      }
+   }
+   if (p < end && *p == '.')
+   {
+      for (++p; p < end && is_digit(*p); ++p)
+      {
+         anyDigits = true;
+         if (significant < 19)
+         {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            significant += mantissa != 0;
+            --exponent;
+         }
+      }
+   }
+   if (!anyDigits)
+      return nullptr;
+
+   // an 'e' without digits is not part of the number
+   if (p < end && (*p == 'e' || *p == 'E'))
+   {
+      const char *q = p + 1;
+      bool negativeExponent = false;
+      if (q < end && (*q == '-' || *q == '+'))
+      {
+         negativeExponent = *q == '-';
+         ++q;
+      }
+      if (q < end && is_digit(*q))
+      {
+         int written = 0;
+         for (; q < end && is_digit(*q); ++q)
+            written = std::min(written * 10 + (*q - '0'), 10000);
+         exponent += negativeExponent ? -written : written;
+         p = q;
+      }
+   }
+
+   double result = (double)mantissa;
+   if (mantissa != 0)
+   {
+      if (exponent < 0)
+         result = exponent >= -22 ? result / POWERS_OF_TEN[-exponent] : result * std::pow(10.0, exponent);
+      else if (exponent > 0)
+         result = exponent <= 22 ? result * POWERS_OF_TEN[exponent] : result * std::pow(10.0, exponent);
+   }
+   value = negative ? -result : result;
+   return p;
+}
+
+const char *parse_float(const char *p, const char *end, float &value)
+{
+   double result;
+   p = parse_double(p, end, result);
+   value = (float)result;
+   return p;
+}
+
+TextDemFormat text_dem_format(const std::string &filename)
+{
+   size_t dot = filename.find_last_of('.');
+   std::string extension = dot == std::string::npos ? "" : filename.substr(dot);
+   std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+   if (extension == ".asc")
+      return TEXT_DEM_ESRI_ASCII;
+   if (extension == ".xyz")
+      return TEXT_DEM_XYZ;
+   return TEXT_DEM_UNKNOWN;
+}
+
+// Parses the heights of a chunk and calls height(value) for each of them. Returns nullptr once the whole chunk is
+// parsed, otherwise the character that is not a number
+// --------------------------------------------------------------------------------------------------------------------
+template <typename Sink>
+static const char *parse_chunk(TextDemFormat format, const char *p, const char *end, Sink height)
+{
+   float value;
+   if (format == TEXT_DEM_ESRI_ASCII)
+   {
+      for (p = skip_separators(p, end); p < end; p = skip_separators(p, end))
+      {
+         const char *next = parse_float(p, end, value);
+         if (next == nullptr || (next < end && !is_separator(*next)))
+            return p;
+         height(value);
+         p = next;
+      }
+      return nullptr;
+   }
+
+   // x and y of every line are only validated, their grid comes from the first rows
+   float x, y;
+   for (p = skip_separators(p, end); p < end; p = skip_separators(p, end))
+   {
+      const char *line = p;
+      if ((p = parse_float(p, end, x)) == nullptr || (p = parse_float(skip_separators(p, end), end, y)) == nullptr ||
+          (p = parse_float(skip_separators(p, end), end, value)) == nullptr)
+         return line;
+      height(value);
+      // further columns are ignored
+      const char *newline = (const char *)std::memchr(p, '\n', end - p);
+      p = newline == nullptr ? end : newline + 1;
+   }
+   return nullptr;
+}
+
+// reads "key value" lines up to the first line that starts with a number
+// --------------------------------------------------------------------------
+static bool read_esri_header(TextDem &dem, const char *&p, const char *end)
+{
+   TextDemInfo &info = dem.info;
+   bool corner = true;
+   double x = 0.0;
+   double y = 0.0;
+   for (p = skip_separators(p, end); p < end && std::isalpha((unsigned char)*p); p = skip_separators(p, end))
+   {
+      std::string key;
+      for (; p < end && (std::isalnum((unsigned char)*p) || *p == '_'); ++p)
+         key += (char)std::tolower((unsigned char)*p);
+      while (p < end && (*p == ' ' || *p == '\t'))
+         ++p;
+      // header values are few, strtod needs a terminated copy
+      const char *valueEnd = p;
+      while (valueEnd < end && !is_separator(*valueEnd))
+         ++valueEnd;
+      std::string text(p, valueEnd);
+      char *parsed = nullptr;
+      double value = std::strtod(text.c_str(), &parsed);
+      if (text.empty() || *parsed != '\0')
+      {
+         std::cout << "Invalid value of " << key << " in the ESRI ASCII header\n";
+         return false;
+      }
+      p = valueEnd;
+
+      if (key == "ncols")
+         info.width = (int)value;
+      else if (key == "nrows")
+         info.height = (int)value;
+      else if (key == "xllcorner" || key == "xllcenter")
+      {
+         x = value;
+         corner = key == "xllcorner";
+      }
+      else if (key == "yllcorner" || key == "yllcenter")
+         y = value;
+      else if (key == "cellsize")
+         info.cellSize = value;
+      else if (key == "nodata_value")
+      {
+         info.hasNoData = true;
+         info.noData = (float)value;
+      }
+   }
+   if (info.width <= 0 || info.height <= 0)
+   {
+      std::cout << "ESRI ASCII header without ncols and nrows\n";
+      return false;
+   }
+   info.originX = corner ? x : x - info.cellSize / 2;
+   info.originY = corner ? y : y - info.cellSize / 2;
+   info.topDown = true;
+   return true;
+}
+
+// Finds the width of the grid from the points of the first row, which share their y. A second row with a larger y
+// means the rows run from south to north
+// ---------------------------------------------------------------------------------------------------------------------
+static bool read_xyz_header(TextDem &dem, const char *&p, const char *end)
+{
+   TextDemInfo &info = dem.info;
+   double x, y, z;
+   // a line of column names is skipped
+   p = skip_separators(p, end);
+   if (p < end && parse_double(p, end, x) == nullptr)
+   {
+      const char *newline = (const char *)std::memchr(p, '\n', end - p);
+      p = newline == nullptr ? end : newline + 1;
+   }
+
+   double firstX = 0.0;
+   double firstY = 0.0;
+   double secondX = 0.0;
+   int width = 0;
+   for (const char *q = skip_separators(p, end); q < end; q = skip_separators(q, end))
+   {
+      if ((q = parse_double(q, end, x)) == nullptr || (q = parse_double(skip_separators(q, end), end, y)) == nullptr ||
+          (q = parse_double(skip_separators(q, end), end, z)) == nullptr)
+         break;
+      if (width == 0)
+      {
+         firstX = x;
+         firstY = y;
+      }
+      else if (y != firstY)
+      {
+         info.topDown = y < firstY;
+         break;
+      }
+      if (width == 1)
+         secondX = x;
+      ++width;
+      const char *newline = (const char *)std::memchr(q, '\n', end - q);
+      q = newline == nullptr ? end : newline + 1;
+   }
+   if (width < 2)
+   {
+      std::cout << "XYZ file without a row of at least two points\n";
+      return false;
+   }
+   info.width = width;
+   info.cellSize = std::fabs(secondX - firstX);
+   info.originX = std::min(firstX, secondX);
+   info.originY = firstY;
+   return true;
+}
+
+void split_text_chunks(const char *begin, const char *end, std::vector<const char *> &boundaries)
+{
+   boundaries.push_back(begin);
+   for (const char *p = begin; p < end;)
+   {
+      const char *chunkEnd = end - p > TEXT_DEM_CHUNK ? p + TEXT_DEM_CHUNK : end;
+      if (chunkEnd < end)
+      {
+         const char *newline = (const char *)std::memchr(chunkEnd, '\n', end - chunkEnd);
+         chunkEnd = newline == nullptr ? end : newline + 1;
+      }
+      boundaries.push_back(chunkEnd);
+      p = chunkEnd;
+   }
+}
+
+// splits the heights after the header into chunks of about TEXT_DEM_CHUNK bytes
+// -------------------------------------------------------------------------------
+static void split_chunks(TextDem &dem)
+{
+   std::vector<const char *> boundaries;
+   split_text_chunks(dem.data, dem.file.data() + dem.file.size(), boundaries);
+   for (size_t c = 0; c + 1 < boundaries.size(); ++c)
+   {
+      TextChunk chunk = {boundaries[c], boundaries[c + 1], 0, 0.0f, 0.0f, nullptr};
+      dem.chunks.push_back(chunk);
+   }
+}
+
+// line number of a position for error messages
+static long long line_of(const TextDem &dem, const char *position)
+{
+   return 1 + std::count(dem.file.data(), position, '\n');
+}
+
+// maps the file and reads its header, the heights are not touched yet
+static bool map_text_dem(const std::string &filename, TextDem &dem)
+{
+   TextDemInfo &info = dem.info;
+   info.format = text_dem_format(filename);
+   if (info.format == TEXT_DEM_UNKNOWN)
+   {
+      std::cout << filename << " is neither an ESRI ASCII grid (.asc) nor an XYZ file (.xyz)\n";
+      return false;
+   }
+   if (!dem.file.open(filename))
+   {
+      std::cout << "Failed to open " << filename << '\n';
+      return false;
+   }
+   info.bytes = (long long)dem.file.size();
+   const char *end = dem.file.data() + dem.file.size();
+   dem.data = dem.file.data();
+   if (!(info.format == TEXT_DEM_ESRI_ASCII ? read_esri_header(dem, dem.data, end) : read_xyz_header(dem, dem.data, end)))
+   {
+      std::cout << "Failed to read " << filename << '\n';
+      return false;
+   }
+   return true;
+}
+
+// Maps the file, reads the header and parses every chunk in parallel, counting its heights and their range
+// ------------------------------------------------------------------------------------------------------------
+static bool open_text_dem(const std::string &filename, TextDem &dem, int threads, std::atomic<long long> *bytesDone)
+{
+   PROFILE_ZONE("open_text_dem");
+   if (!map_text_dem(filename, dem))
+      return false;
+   TextDemInfo &info = dem.info;
+   split_chunks(dem);
+
+   bool hasNoData = info.hasNoData;
+   float noData = info.noData;
+   TextDemFormat format = info.format;
+   parallel_for(0, (int)dem.chunks.size(), threads, [&](int begin, int end) {
+      for (int c = begin; c < end; ++c)
+      {
+         TextChunk &chunk = dem.chunks[c];
+         long long count = 0;
+         float minimum = 1e30f;
+         float maximum = -1e30f;
+         chunk.error = parse_chunk(format, chunk.begin, chunk.end, [&](float height) {
+            ++count;
+            if (hasNoData && height == noData)
+               return;
+            minimum = std::min(minimum, height);
+            maximum = std::max(maximum, height);
+         });
+         chunk.count = count;
+         chunk.minimum = minimum;
+         chunk.maximum = maximum;
+         if (bytesDone != nullptr)
+            *bytesDone += chunk.end - chunk.begin;
+      }
+   });
+
+   long long count = 0;
+   info.minimum = 1e30f;
+   info.maximum = -1e30f;
+   for (size_t c = 0; c < dem.chunks.size(); ++c)
+   {
+      const TextChunk &chunk = dem.chunks[c];
+      if (chunk.error != nullptr)
+      {
+         std::cout << "Failed to read " << filename << ": no number in line " << line_of(dem, chunk.error) << '\n';
+         return false;
+      }
+      count += chunk.count;
+      info.minimum = std::min(info.minimum, chunk.minimum);
+      info.maximum = std::max(info.maximum, chunk.maximum);
+   }
+   if (info.minimum > info.maximum)
+   {
+      // nothing but holes
+      info.minimum = 0.0f;
+      info.maximum = 0.0f;
+   }
+   if (info.format == TEXT_DEM_XYZ)
+   {
+      info.height = (int)(count / info.width);
+      if (info.topDown)
+         info.originY -= (info.height - 1) * info.cellSize;
+   }
+   if (count != (long long)info.width * info.height)
+   {
+      std::cout << "Failed to read " << filename << ": " << count << " heights instead of " << info.width << " x "
+                << info.height << '\n';
+      return false;
+   }
+   return true;
+}
+
+bool read_text_dem_header(const std::string &filename, TextDemInfo &info)
+{
+   TextDem dem;
+   if (text_dem_format(filename) != TEXT_DEM_ESRI_ASCII || !map_text_dem(filename, dem))
+      return false;
+   info = dem.info;
+   return true;
+}
+
+bool scan_text_dem(const std::string &filename, TextDemInfo &info, int threads, std::atomic<long long> *bytesDone)
+{
+   PROFILE_ZONE("scan_text_dem");
+   TextDem dem;
+   bool success = open_text_dem(filename, dem, threads, bytesDone);
+   info = dem.info;
+   return success;
+}
+
+// Chunks are parsed in batches of a few per thread into one buffer each. The rows are then handed to the writer in
+// file order, a row may span several chunks and a chunk may hold many rows
+// ---------------------------------------------------------------------------------------------------------------------
+bool build_text_dem_store(const std::string &filename, const std::string &storeFilename, bool flipVertically,
+                          int threads, std::atomic<long long> *bytesDone, TextDemInfo *info, int tileSize)
+{
+   PROFILE_ZONE("build_text_dem_store");
+   TextDem dem;
+   bool opened = open_text_dem(filename, dem, threads, bytesDone);
+   if (info != nullptr)
+      *info = dem.info;
+   HeightStoreWriter writer;
+   if (!opened || !writer.create(storeFilename, dem.info.width, dem.info.height, tileSize))
+      return false;
+
+   const TextDemInfo &scanned = dem.info;
+   // holes get the lowest height, a flat file stays at the bottom
+   float minimum = scanned.minimum;
+   float scale = scanned.maximum > scanned.minimum ? 1.0f / (scanned.maximum - scanned.minimum) : 0.0f;
+   if (threads <= 0)
+      threads = default_thread_count();
+   int batchSize = threads * 4;
+   std::vector<std::vector<float>> batch(batchSize);
+   MemoryReservation batchMemory(MEMORY_TRANSIENT);
+   std::vector<float> row(scanned.width);
+   int column = 0;
+   int rowIndex = 0;
+   for (size_t first = 0; first < dem.chunks.size(); first += batchSize)
+   {
+      int chunks = (int)std::min(dem.chunks.size() - first, (size_t)batchSize);
+      long long batchBytes = 0;
+      for (int c = 0; c < chunks; ++c)
+      {
+         batch[c].resize(dem.chunks[first + c].count);
+         batchBytes += (long long)(batch[c].capacity() * sizeof(float));
+      }
+      batchMemory.set(batchBytes);
+      parallel_for(0, chunks, threads, [&](int begin, int end) {
+         for (int c = begin; c < end; ++c)
+         {
+            const TextChunk &chunk = dem.chunks[first + c];
+            float *out = batch[c].data();
+            parse_chunk(scanned.format, chunk.begin, chunk.end, [&](float height) {
+               *out++ = scanned.hasNoData && height == scanned.noData ? 0.0f : (height - minimum) * scale;
+            });
+            if (bytesDone != nullptr)
+               *bytesDone += chunk.end - chunk.begin;
+         }
+      });
+
+      for (int c = 0; c < chunks; ++c)
+      {
+         const float *heights = batch[c].data();
+         size_t count = batch[c].size();
+         while (count > 0)
+         {
+            size_t n = std::min(count, (size_t)(scanned.width - column));
+            std::memcpy(&row[column], heights, n * sizeof(float));
+            heights += n;
+            count -= n;
+            column += (int)n;
+            if (column == scanned.width)
+            {
+               // flipped stores start with the southern row, like flipped images
+               bool reverse = flipVertically == scanned.topDown;
+               writer.writeRow(reverse ? scanned.height - 1 - rowIndex : rowIndex, row.data());
+               column = 0;
+               ++rowIndex;
+            }
+         }
+      }
+   }
+   bool success = writer.close();
+   if (!success)
+      std::cout << "Failed to write height store " << storeFilename << '\n';
+   return success;
+}
+
+// The scan counted the heights of every chunk, so the second pass knows where the heights of each chunk go and parses
+// all chunks at once straight into the plane
+// ----------------------------------------------------------------------------------------------------------------------
+bool load_text_dem(const std::string &filename, HeightPlane &plane, bool flipVertically, int threads, TextDemInfo *info)
+{
+   PROFILE_ZONE("load_text_dem");
+   TextDem dem;
+   bool opened = open_text_dem(filename, dem, threads, nullptr);
+   if (info != nullptr)
+      *info = dem.info;
+   if (!opened)
+      return false;
+
+   const TextDemInfo &scanned = dem.info;
+   std::vector<long long> firsts(dem.chunks.size() + 1, 0);
+   for (size_t c = 0; c < dem.chunks.size(); ++c)
+      firsts[c + 1] = firsts[c] + dem.chunks[c].count;
+   plane.width = scanned.width;
+   plane.height = scanned.height;
+   plane.minimum = scanned.minimum;
+   plane.maximum = scanned.maximum;
+   plane.decoding = HeightDecoding();
+   plane.heights.resize((size_t)scanned.width * scanned.height);
+   float minimum = scanned.minimum;
+   float scale = scanned.maximum > scanned.minimum ? 1.0f / (scanned.maximum - scanned.minimum) : 0.0f;
+   bool reverse = flipVertically == scanned.topDown;
+   parallel_for(0, (int)dem.chunks.size(), threads, [&](int begin, int end) {
+      for (int c = begin; c < end; ++c)
+      {
+         long long index = firsts[c];
+         int row = (int)(index / scanned.width);
+         int column = (int)(index % scanned.width);
+         float *out = &plane.heights[(size_t)(reverse ? scanned.height - 1 - row : row) * scanned.width];
+         parse_chunk(scanned.format, dem.chunks[c].begin, dem.chunks[c].end, [&](float height) {
+            out[column] = scanned.hasNoData && height == scanned.noData ? 0.0f : (height - minimum) * scale;
+            if (++column == scanned.width && ++row < scanned.height)
+            {
+               column = 0;
+               out = &plane.heights[(size_t)(reverse ? scanned.height - 1 - row : row) * scanned.width];
+            }
+         });
+      }
+   });
+   return true;
+}
@@ -0,0 +1,432 @@
+#include <heightmap/tile_reader.h>
+
+#include <memory_stats.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HEIGHTMAP_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+// Shared submission and completion rings of io_uring, mapped from the kernel. liburing is not required, the
+// handful of system calls is issued directly
+struct TileReader::Ring
+{
+   int fd;
+#ifdef HEIGHTMAP_HAVE_IO_URING
+   unsigned *sqTail;
+   unsigned *sqMask;
+   unsigned *sqArray;
+   unsigned *cqHead;
+   unsigned *cqTail;
+   unsigned *cqMask;
+   io_uring_sqe *sqes;
+   io_uring_cqe *cqes;
+   void *sqMemory;
+   size_t sqMemorySize;
+   void *cqMemory;
+   size_t cqMemorySize;
+   size_t sqesSize;
+   std::thread reaper;
+#endif
+};
+
+TileReader::TileReader()
+    : fd(-1), direct(false), queueDepth(TILE_READER_QUEUE_DEPTH), ring(nullptr), inFlight(0), stopping(false),
+      latencySeconds(0.0)
+{
+   std::memset(&counters, 0, sizeof(counters));
+}
+
+TileReader::~TileReader()
+{
+   close();
+}
+
+double TileReader::now()
+{
+   return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool TileReader::open(const std::string &filename, bool direct, int queueDepth)
+{
+   close();
+   this->direct = false;
+   this->queueDepth = std::max(queueDepth, 1);
+#ifdef O_DIRECT
+   if (direct)
+   {
+      // some file systems accept O_DIRECT when opening and only fail the reads, so probe with one
+      fd = ::open(filename.c_str(), O_RDONLY | O_DIRECT);
+      void *probe = nullptr;
+      if (fd >= 0 && posix_memalign(&probe, TILE_READER_ALIGNMENT, TILE_READER_ALIGNMENT) == 0)
+      {
+         this->direct = ::pread(fd, probe, TILE_READER_ALIGNMENT, 0) >= 0;
+         std::free(probe);
+      }
+      if (!this->direct && fd >= 0)
+      {
+         ::close(fd);
+         fd = -1;
+      }
+   }
+#endif
+   if (fd < 0)
+      fd = ::open(filename.c_str(), O_RDONLY);
+   if (fd < 0)
+      return false;
+
+   stopping = false;
+   std::memset(&counters, 0, sizeof(counters));
+   latencySeconds = 0.0;
+   if (!setupRing())
+   {
+      for (int i = 0; i < TILE_READER_THREADS; ++i)
+         threads.push_back(std::thread(&TileReader::runPool, this));
+   }
+   return true;
+}
+
+void TileReader::close()
+{
+   if (fd < 0)
+      return;
+   // reads that never reached the kernel fail right away, the ones in flight are waited for
+   std::deque<Request *> dropped;
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      dropped.swap(pending);
+   }
+   for (size_t i = 0; i < dropped.size(); ++i)
+   {
+      dropped[i]->done(nullptr, 0, false);
+      delete dropped[i];
+   }
+
+#ifdef HEIGHTMAP_HAVE_IO_URING
+   if (ring != nullptr)
+   {
+      {
+         // a nop without request wakes the reaper, which leaves once nothing is in flight anymore
+         std::lock_guard<std::mutex> lock(mutex);
+         stopping = true;
+         unsigned tail = *ring->sqTail;
+         unsigned index = tail & *ring->sqMask;
+         io_uring_sqe *sqe = &ring->sqes[index];
+         std::memset(sqe, 0, sizeof(*sqe));
+         sqe->opcode = IORING_OP_NOP;
+         sqe->user_data = 0;
+         ring->sqArray[index] = index;
+         __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+         syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, nullptr, 0);
+      }
+      ring->reaper.join();
+      munmap(ring->sqes, ring->sqesSize);
+      if (ring->cqMemory != ring->sqMemory)
+         munmap(ring->cqMemory, ring->cqMemorySize);
+      munmap(ring->sqMemory, ring->sqMemorySize);
+      ::close(ring->fd);
+      delete ring;
+      ring = nullptr;
+   }
+#endif
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+   }
+   wake.notify_all();
+   for (size_t i = 0; i < threads.size(); ++i)
+      threads[i].join();
+   threads.clear();
+   ::close(fd);
+   fd = -1;
+}
+
+bool TileReader::isOpen() const
+{
+   return fd >= 0;
+}
+
+std::string TileReader::backend() const
+{
+   std::string name = ring != nullptr ? "io_uring" : "thread pool";
+   return direct ? name + " + O_DIRECT" : name;
+}
+
+void TileReader::read(long long offset, size_t size, const TileReadCallback &done, bool urgent)
+{
+   Request *request = new Request();
+   request->offset = offset;
+   request->size = size;
+   request->alignedSize = direct ? (size + TILE_READER_ALIGNMENT - 1) / TILE_READER_ALIGNMENT * TILE_READER_ALIGNMENT : size;
+   request->buffer = nullptr;
+   request->done = done;
+   request->submitted = 0.0;
+   request->iov = nullptr;
+   std::lock_guard<std::mutex> lock(mutex);
+   if (urgent)
+      pending.push_front(request);
+   else
+      pending.push_back(request);
+}
+
+// hands queued reads to the kernel or the pool until the queue depth is reached
+// ------------------------------------------------------------------------------
+void TileReader::submit()
+{
+   std::unique_lock<std::mutex> lock(mutex);
+   if (stopping)
+      return;
+   int count = 0;
+   while (!pending.empty() && inFlight < queueDepth)
+   {
+      Request *request = pending.front();
+      pending.pop_front();
+      void *buffer = nullptr;
+      if (posix_memalign(&buffer, TILE_READER_ALIGNMENT, request->alignedSize) != 0)
+      {
+         lock.unlock();
+         request->done(nullptr, 0, false);
+         delete request;
+         lock.lock();
+         continue;
+      }
+      MemoryStats::instance().add(MEMORY_TRANSIENT, (long long)request->alignedSize);
+      request->buffer = (char *)buffer;
+      request->submitted = now();
+      ++inFlight;
+      ++count;
+
+#ifdef HEIGHTMAP_HAVE_IO_URING
+      if (ring != nullptr)
+      {
+         iovec *iov = new iovec;
+         iov->iov_base = request->buffer;
+         iov->iov_len = request->alignedSize;
+         request->iov = iov;
+         unsigned tail = *ring->sqTail;
+         unsigned index = tail & *ring->sqMask;
+         io_uring_sqe *sqe = &ring->sqes[index];
+         std::memset(sqe, 0, sizeof(*sqe));
+         sqe->opcode = IORING_OP_READV;
+         sqe->fd = fd;
+         sqe->off = (unsigned long long)request->offset;
+         sqe->addr = (unsigned long long)(uintptr_t)iov;
+         sqe->len = 1;
+         sqe->user_data = (unsigned long long)(uintptr_t)request;
+         ring->sqArray[index] = index;
+         __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+         continue;
+      }
+#endif
+      submitted.push_back(request);
+   }
+   counters.peakInFlight = std::max(counters.peakInFlight, inFlight);
+
+#ifdef HEIGHTMAP_HAVE_IO_URING
+   // the whole batch is a single system call
+   if (ring != nullptr && count > 0)
+   {
+      PROFILE_ZONE("TileReader: submit");
+      syscall(__NR_io_uring_enter, ring->fd, count, 0, 0, nullptr, 0);
+      return;
+   }
+#endif
+   lock.unlock();
+   if (count > 0)
+      wake.notify_all();
+}
+
+bool TileReader::readSync(long long offset, size_t size, void *out)
+{
+   std::mutex doneMutex;
+   std::condition_variable doneCondition;
+   bool finished = false;
+   bool result = false;
+   read(offset, size, [&](const char *data, size_t bytes, bool success) {
+      if (success)
+         std::memcpy(out, data, bytes);
+      std::lock_guard<std::mutex> lock(doneMutex);
+      result = success;
+      finished = true;
+      doneCondition.notify_one();
+   }, true);
+   submit();
+   std::unique_lock<std::mutex> lock(doneMutex);
+   doneCondition.wait(lock, [&] { return finished; });
+   return result;
+}
+
+TileReaderStats TileReader::stats() const
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   TileReaderStats stats = counters;
+   stats.inFlight = inFlight;
+   stats.pending = (int)pending.size();
+   stats.averageMs = counters.completed > 0 ? latencySeconds * 1000.0 / counters.completed : 0.0;
+   return stats;
+}
+
+void TileReader::resetStats()
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   std::memset(&counters, 0, sizeof(counters));
+   latencySeconds = 0.0;
+}
+
+// maps the rings of a new io_uring instance, fails on kernels or sandboxes without io_uring
+// -----------------------------------------------------------------------------------------
+bool TileReader::setupRing()
+{
+#ifdef HEIGHTMAP_HAVE_IO_URING
+   io_uring_params params;
+   std::memset(&params, 0, sizeof(params));
+   int ringFd = (int)syscall(__NR_io_uring_setup, (unsigned)queueDepth + 1, &params);
+   if (ringFd < 0)
+      return false;
+
+   Ring *r = new Ring();
+   r->fd = ringFd;
+   r->sqMemorySize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+   r->cqMemorySize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+   bool singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+   if (singleMapping)
+      r->sqMemorySize = r->cqMemorySize = std::max(r->sqMemorySize, r->cqMemorySize);
+   r->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+   r->sqMemory = mmap(nullptr, r->sqMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+   r->cqMemory = singleMapping ? r->sqMemory
+                               : mmap(nullptr, r->cqMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                                      IORING_OFF_CQ_RING);
+   void *sqes = mmap(nullptr, r->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+   if (r->sqMemory == MAP_FAILED || r->cqMemory == MAP_FAILED || sqes == MAP_FAILED)
+   {
+      if (sqes != MAP_FAILED)
+         munmap(sqes, r->sqesSize);
+      if (r->cqMemory != MAP_FAILED && r->cqMemory != r->sqMemory)
+         munmap(r->cqMemory, r->cqMemorySize);
+      if (r->sqMemory != MAP_FAILED)
+         munmap(r->sqMemory, r->sqMemorySize);
+      ::close(ringFd);
+      delete r;
+      return false;
+   }
+
+   char *sq = (char *)r->sqMemory;
+   char *cq = (char *)r->cqMemory;
+   r->sqTail = (unsigned *)(sq + params.sq_off.tail);
+   r->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+   r->sqArray = (unsigned *)(sq + params.sq_off.array);
+   r->cqHead = (unsigned *)(cq + params.cq_off.head);
+   r->cqTail = (unsigned *)(cq + params.cq_off.tail);
+   r->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+   r->sqes = (io_uring_sqe *)sqes;
+   r->cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+   ring = r;
+   ring->reaper = std::thread(&TileReader::reapRing, this);
+   return true;
+#else
+   return false;
+#endif
+}
+
+// waits for completions of the ring and submits the reads that queued up behind the queue depth meanwhile
+// --------------------------------------------------------------------------------------------------------
+void TileReader::reapRing()
+{
+#ifdef HEIGHTMAP_HAVE_IO_URING
+   Profiler::instance().setThreadName("Tile reader");
+   bool stopRequested = false;
+   while (true)
+   {
+      int result = (int)syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (result < 0 && errno != EINTR)
+         break;
+
+      unsigned head = *ring->cqHead;
+      unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+      while (head != tail)
+      {
+         io_uring_cqe cqe = ring->cqes[head & *ring->cqMask];
+         ++head;
+         __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+         if (cqe.user_data == 0)
+            stopRequested = true;
+         else
+            complete((Request *)(uintptr_t)cqe.user_data, cqe.res);
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (stopRequested && inFlight == 0)
+         break;
+   }
+#endif
+}
+
+void TileReader::runPool()
+{
+   Profiler::instance().setThreadName("Tile reader");
+   while (true)
+   {
+      Request *request = nullptr;
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         wake.wait(lock, [this] { return stopping || !submitted.empty(); });
+         if (submitted.empty())
+            return;
+         request = submitted.front();
+         submitted.pop_front();
+      }
+
+      long long done = 0;
+      while (done < (long long)request->alignedSize)
+      {
+         ssize_t count = ::pread(fd, request->buffer + done, request->alignedSize - done, request->offset + done);
+         if (count < 0 && errno == EINTR)
+            continue;
+         if (count <= 0)
+            break;
+         done += count;
+      }
+      complete(request, done);
+   }
+}
+
+// reports a finished read to its callback and refills the queue
+// --------------------------------------------------------------
+void TileReader::complete(Request *request, long long result)
+{
+   double latency = now() - request->submitted;
+   bool success = result >= (long long)request->size;
+   request->done(request->buffer, request->size, success);
+
+   std::free(request->buffer);
+   MemoryStats::instance().sub(MEMORY_TRANSIENT, (long long)request->alignedSize);
+#ifdef HEIGHTMAP_HAVE_IO_URING
+   delete (iovec *)request->iov;
+#endif
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      --inFlight;
+      ++counters.completed;
+      if (success)
+         counters.bytes += (long long)request->size;
+      else
+         ++counters.failed;
+      latencySeconds += latency;
+      counters.maxMs = std::max(counters.maxMs, latency * 1000.0);
+   }
+   delete request;
+   submit();
+}
@@ -0,0 +1,204 @@
+#include <heightmap/tile_streamer.h>
+
+#include <profiler.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+TileStreamer::TileStreamer() : store(nullptr), stopping(false), reading(0), loadSeconds(0.0)
+{
+   std::memset(&counters, 0, sizeof(counters));
+}
+
+TileStreamer::~TileStreamer()
+{
+   stop();
+}
+
+void TileStreamer::start(const HeightStore *store)
+{
+   stop();
+   this->store = store;
+   stopping = false;
+   std::memset(&counters, 0, sizeof(counters));
+   loadSeconds = 0.0;
+   thread = std::thread(&TileStreamer::run, this);
+}
+
+void TileStreamer::stop()
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+      queue.clear();
+   }
+   wake.notify_all();
+   if (thread.joinable())
+      thread.join();
+   // completion callbacks of reads in flight still refer to the streamer
+   std::unique_lock<std::mutex> lock(mutex);
+   readDone.wait(lock, [this] { return reading == 0; });
+   store = nullptr;
+}
+
+// projected size of a sample: a sample of level L at distance d covers 2^L * K / d pixels,
+// with K = screenHeight / (2 tan(fieldOfView / 2))
+// -----------------------------------------------------------------------------------------
+int TileStreamer::levelForDistance(const StreamerView &view, float distance) const
+{
+   float projection = view.screenHeight / (2.0f * std::tan(view.fieldOfView / 2.0f));
+   float spacing = TILE_STREAMER_PIXEL_ERROR * distance / projection;
+   if (spacing < 2.0f)
+      return 0;
+   return std::min((int)std::floor(std::log2(spacing)), store->levelCount() - 1);
+}
+
+void TileStreamer::update(const StreamerView &view)
+{
+   if (store == nullptr)
+      return;
+   PROFILE_ZONE("TileStreamer: update");
+   std::vector<TileRequest> requests;
+   request(view, view.position, 0.0f, requests);
+   // prefetching ranks behind everything that is needed right now
+   if (glm::length(view.velocity) > 0.0f)
+      request(view, view.position + view.velocity * TILE_STREAMER_LOOKAHEAD, (float)store->levelCount(), requests);
+   long long requested = (long long)requests.size();
+
+   // drop duplicates, keeping the most urgent request of a tile, and tiles that are resident already
+   std::sort(requests.begin(), requests.end(), [](const TileRequest &a, const TileRequest &b) {
+      if (a.level != b.level)
+         return a.level < b.level;
+      if (a.tileY != b.tileY)
+         return a.tileY < b.tileY;
+      if (a.tileX != b.tileX)
+         return a.tileX < b.tileX;
+      return a.priority < b.priority;
+   });
+   std::vector<TileRequest> pending;
+   for (size_t i = 0; i < requests.size(); ++i)
+   {
+      const TileRequest &r = requests[i];
+      bool duplicate = !pending.empty() && pending.back().level == r.level && pending.back().tileX == r.tileX &&
+                       pending.back().tileY == r.tileY;
+      if (!duplicate && !store->isResident(r.level, r.tileX, r.tileY))
+         pending.push_back(r);
+   }
+   std::sort(pending.begin(), pending.end(),
+             [](const TileRequest &a, const TileRequest &b) { return a.priority > b.priority; });
+
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      queue.swap(pending);
+      counters.requested += requested;
+   }
+   wake.notify_one();
+}
+
+// Requests the tiles of every level around position. Level L is needed where the camera is between
+// 2^L K / e and 2^(L+1) K / e samples away, which is a ring of about the same number of tiles on every level.
+// Coarse levels come first so that there always is something to show, near tiles before far ones
+// -----------------------------------------------------------------------------------------------------------
+void TileStreamer::request(const StreamerView &view, const glm::vec2 &position, float priorityOffset,
+                           std::vector<TileRequest> &requests) const
+{
+   float projection = view.screenHeight / (2.0f * std::tan(view.fieldOfView / 2.0f));
+   int levels = store->levelCount();
+   for (int level = 0; level < levels; ++level)
+   {
+      const HeightStoreLevel &info = store->level(level);
+      float scale = (float)(1 << level);
+      float tileSpan = store->tileSize() * scale;
+
+      // horizontal distance up to which this level is needed, the coarsest level covers everything
+      float groundRadius = 1e30f;
+      if (level + 1 < levels)
+      {
+         float outer = 2.0f * scale * projection / TILE_STREAMER_PIXEL_ERROR;
+         if (outer <= view.altitude)
+            continue;
+         groundRadius = std::sqrt(outer * outer - view.altitude * view.altitude);
+      }
+      int radius = (int)std::min((float)TILE_STREAMER_RADIUS, std::ceil(groundRadius / tileSpan));
+
+      int centerX = (int)std::floor(position.x / tileSpan);
+      int centerY = (int)std::floor(position.y / tileSpan);
+      for (int tileY = std::max(centerY - radius, 0); tileY <= std::min(centerY + radius, info.tilesY - 1); ++tileY)
+      {
+         for (int tileX = std::max(centerX - radius, 0); tileX <= std::min(centerX + radius, info.tilesX - 1); ++tileX)
+         {
+            glm::vec2 center((tileX + 0.5f) * tileSpan, (tileY + 0.5f) * tileSpan);
+            float distance = glm::length(center - position);
+            if (distance - tileSpan * 0.7072f > groundRadius)
+               continue;
+            TileRequest r;
+            r.level = level;
+            r.tileX = tileX;
+            r.tileY = tileY;
+            r.priority = priorityOffset + (levels - 1 - level) +
+                         std::min(distance / (tileSpan * (TILE_STREAMER_RADIUS + 2)), 0.99f);
+            requests.push_back(r);
+         }
+      }
+   }
+}
+
+TileStreamerStats TileStreamer::stats() const
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   TileStreamerStats stats = counters;
+   stats.queued = (int)queue.size();
+   stats.reading = reading;
+   stats.loadMs = counters.loaded > 0 ? loadSeconds * 1000.0 / counters.loaded : 0.0;
+   return stats;
+}
+
+// hands the most urgent requests to the tile reader whenever reads complete, as one batch per wake up
+// ---------------------------------------------------------------------------------------------------
+void TileStreamer::run()
+{
+   Profiler::instance().setThreadName("Tile streamer");
+   while (true)
+   {
+      std::vector<TileRequest> batch;
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         wake.wait(lock, [this] { return stopping || (!queue.empty() && reading < TILE_READER_QUEUE_DEPTH); });
+         if (stopping)
+            return;
+         while (!queue.empty() && reading + (int)batch.size() < TILE_READER_QUEUE_DEPTH)
+         {
+            batch.push_back(queue.back());
+            queue.pop_back();
+         }
+         reading += (int)batch.size();
+      }
+
+      PROFILE_ZONE("TileStreamer: batch");
+      int skipped = 0;
+      for (size_t i = 0; i < batch.size(); ++i)
+      {
+         std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+         bool queued = store->prefetchAsync(batch[i].level, batch[i].tileX, batch[i].tileY, [this, start]() {
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            {
+               std::lock_guard<std::mutex> lock(mutex);
+               --reading;
+               ++counters.loaded;
+               loadSeconds += seconds;
+            }
+            wake.notify_one();
+            readDone.notify_all();
+         });
+         // resident already or being read for an earlier request
+         if (!queued)
+            ++skipped;
+      }
+      store->submitReads();
+
+      std::lock_guard<std::mutex> lock(mutex);
+      reading -= skipped;
+   }
+}
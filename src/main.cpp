@@ -1,14 +1,39 @@
-#define STB_IMAGE_IMPLEMENTATION
-
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
 #include <shader/shader.h>
 #include <camera.h>
+#include <gpu_timer.h>
+#include <frame_stats.h>
+#include <profiler.h>
+#include <memory_stats.h>
+#include <gl_buffers.h>
+#include <heightmap/grid.h>
+#include <heightmap/height_store.h>
+#include <heightmap/tile_streamer.h>
+#include <heightmap/image_loader.h>
+#include <heightmap/height_decoder.h>
+#include <heightmap/job_system.h>
+#include <heightmap/mesh_pipeline.h>
+#include <heightmap/mesh_cache.h>
+#include <heightmap/file_watcher.h>
+#include <heightmap/frame_player.h>
+#include <heightmap/noise.h>
+#include <heightmap/text_dem.h>
+#include <heightmap/point_cloud.h>
+#include <heightmap/mosaic.h>
+#include <heightmap/image_probe.h>
+#include <heightmap/resample.h>
+#include <heightmap/morton.h>
+#include <heightmap/mesh_export.h>
+#include <heightmap/solid_export.h>
 
 #include <iostream>
 #include <vector>
 #include <string>
+#include <memory>
+#include <chrono>
+#include <thread>
 #include <math.h>
 #include <experimental/filesystem>
 
@@ -29,13 +54,43 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
 void keyboard_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
 void processInput(GLFWwindow *window);
 
-bool load_image(std::vector<unsigned char> &image, const std::string &filename, int &x, int &y);
 void returnColorValues(int &x, int &y, int &width, const size_t &RGBA, std::vector<unsigned char> &image);
 bool write_char_array(std::ostream &os, const char *string);
-float f(float x, float y);
-void generate_grid(int N, int M, std::vector<glm::vec3> &vertices, std::vector<glm::uvec3> &indices);
+HeightmapView current_heightmap();
+HeightmapView resampled_heightmap();
+HeightmapView image_heightmap();
+void generate_heightmap(const HeightmapView &heightmap, std::vector<glm::vec3> &vertices, std::vector<glm::uvec3> &indices,
+                        GLuint &vao);
+void generate_heightmap_progressive(const HeightmapView &heightmap, std::vector<glm::vec3> &vertices,
+                                    std::vector<glm::uvec3> &indices, GLuint &vao);
+void start_grid_level(const HeightmapView &heightmap, int stride, GLuint &vao);
+void finish_grid_level(const HeightmapView &heightmap, GLuint &vao);
+void draw_grid(GLuint vao);
+void load_image_async(const std::string &filename, int stride = 1);
+void build_image_store_async(const std::string &filename, const HeightDecoding &decoding);
+void hash_source_async(const std::string &filename);
+void reload_image_async(const std::string &filename, std::vector<glm::vec3> &vertices, std::vector<glm::uvec3> &indices,
+                        GLuint &vao);
+bool grid_updates_incrementally(GLuint vao);
+bool open_height_store(const std::string &filename);
+void build_noise_store_async(const std::string &filename, int size, const NoiseOptions &options);
+void import_text_dem_async(const std::string &filename);
+void grid_point_cloud_async(const std::string &filename, const PointCloudOptions &options);
+bool open_mosaic(const std::string &directory);
+void read_mosaic_window_async();
+void present_frame(DecodedFrame &frame, std::vector<glm::vec3> &vertices, std::vector<glm::uvec3> &indices, GLuint &vao);
+MeshCacheKey mesh_cache_key(const HeightmapView &heightmap);
+void upload_heightmap(const HeightmapView &heightmap, int n, int m, const std::vector<glm::vec3> &vertices,
+                      const std::vector<glm::uvec3> &indices, GLuint &vao);
+glm::mat4 heightmap_model();
+glm::vec3 camera_store_position(const glm::mat4 &model);
+void place_camera(const glm::mat4 &model, const glm::vec3 &storePosition);
+void follow_window(const StreamerView &view);
 GLuint generate_vao(const std::vector<glm::vec3> &vertices, const std::vector<glm::uvec3> &indices);
-void draw_vao(GLuint vao, GLsizei n);
+GLuint create_vao(GLsizeiptr vertexBytes, const void *vertexData, GLsizeiptr indexBytes, const void *indexData);
+void upload_band(GLuint vao, const MeshBand &band);
+void upload_vertex_spans(GLuint vao, const std::vector<GridSpan> &spans, const std::vector<glm::vec3> &vertices);
+void draw_vao(GLuint vao, GLsizei n, size_t first = 0);
 
 // settings
 const uint16_t SCR_WIDTH = 1280;
@@ -64,12 +119,114 @@ bool shiftKeyPressed = false;
 // timing
 float deltaTime = 0.0f; // time between current frame and last frame
 float lastFrame = 0.0f;
-
-const size_t RGBA = 4;
-static std::vector<unsigned char> image;
+GpuProfiler gpuProfiler; // per pass GPU and CPU timings shown in the performance window
+FrameStats frameStats;   // frame time ring buffer for percentiles and the frame time graph
+static char frameStatsPath[128] = "frametimes.csv";
+static char tracePath[128] = "trace.json";
+bool traceOn = false;
+
+static HeightPlane image;      // heights of the loaded image, decoded once while loading
+HeightDecoding heightDecoding; // how the pixels of loaded images encode heights
+MemoryReservation imageMemory(MEMORY_IMAGE);
+MemoryReservation meshMemory(MEMORY_MESH);
+
+// out of core height data (.hts files), only a window of it is turned into a grid
+HeightStore heightStore;
+bool storeLoaded = false;
+int storeOrigin[2] = {0, 0};
+int storeWindow = 1024;
+int storeBudgetMB = (int)(HEIGHT_STORE_BUDGET >> 20);
+int storeLevel = 0;
+bool followCamera = false; // moves the window along with the camera and picks its level by the camera altitude
+TileStreamer tileStreamer;
+HeightmapView gridView;     // height data the current grid was generated from
+glm::vec3 lastStorePosition; // camera position of the previous frame in store samples
+
+// loading and grid generation run on the job system, their results are taken over by the main thread
+int backgroundTasks = 0; // submitted and not taken over yet, only touched by the main thread
+MeshPipeline meshPipeline;  // generates the grid band by band, bands are drawn as soon as they are uploaded
+GLsizei gridIndexCount = 0; // indices of the current grid that can be drawn
+int gridStride = 1;         // the current grid only has every gridStride-th vertex of the full grid
+GLuint refineVao = 0;       // finer level of the grid being generated, drawn over the current grid band by band
+int refineStride = 0;       // stride of refineVao, 0 while the grid is not being refined
+double gridStartTime = 0.0;
+float gridPreviewMs = 0.0f; // from Generate Grid until the first band of the coarsest level was uploaded
+float gridFullMs = 0.0f;    // until the full resolution grid was complete
+
+// generated grids on disk, keyed by the hash of the loaded file and the parameters of the grid
+MeshCache meshCache;
+MeshCacheWriter meshCacheWriter; // entry of the grid being generated, written band by band by the workers
+bool meshCacheOn = true;
+int meshCacheLimitMB = (int)(MESH_CACHE_LIMIT >> 20);
+uint64_t sourceHash = 0; // of the loaded file, 0 while it is not known yet
+
+// reloads the loaded image when the file changes on disk, only the vertices whose heights changed are re-meshed
+FileWatcher fileWatcher;
+bool hotReload = true;
+bool reloadPending = false;     // the file changed while the workers were busy
+float gridHeightScaling = 0.0f; // heightScaling the current grid was generated with
+int reloadCount = 0;
+int reloadRows = 0;             // vertex rows with changed vertices in the last reload
+long long reloadVertices = 0;   // vertices re-meshed and uploaded by the last reload
+float reloadMs = 0.0f;          // from noticing the change until the grid was updated
+
+// numbered frame sequences (simulation output) played back as the loaded image, decoded ahead on the workers
+FramePlayer framePlayer;
+int shownFrame = -1;     // frame of the sequence that is the loaded image
+float frameRate = (float)FRAME_PLAYER_RATE;
+bool frameLoop = true;
+float frameUpdateMs = 0.0f; // diffing, re-meshing and uploading the last frame
+
+// procedural terrain written into a height store, for testing with sizes no image comes in
+NoiseOptions noiseOptions;
+int noiseSizeLog2 = 12;
+static char noisePath[128] = "terrain.hts";
+std::atomic<int> noiseRowsDone(0);
+int noiseRows = 0; // of the store being generated, 0 while none is
+
+// text DEMs (.asc, .xyz) converted into a height store next to them
+std::atomic<long long> importBytesDone(0);
+long long importBytes = 0; // both passes over the file being imported, 0 while none is
+
+// lidar point clouds binned into the loaded image
+PointCloudOptions pointCloudOptions;
+std::atomic<long long> pointsDone(0);
+bool griddingPoints = false;
+
+// directories of DEM tiles, only the tiles below the window are decoded into the loaded image
+Mosaic mosaic;
+int mosaicOrigin[2] = {0, 0}; // south west sample of the window in the mosaic
+int mosaicSize[2] = {0, 0};   // samples of the window, every mosaicStride-th one of the mosaic
+int mosaicStride = 1;
+int mosaicBudgetMB = (int)(MOSAIC_BUDGET >> 20);
+
+// images are probed before they are decoded, loads estimated above the budget are strided, tiled or rejected
+int loadBudgetMB = (int)(default_load_budget() >> 20);
+int imageStride = 1; // the loaded image has a height per imageStride x imageStride pixels of its file
+LoadPlan loadPlan;   // of the last image probed by Load File
+
+// the loaded image is resampled to meshResolution samples along its longer side before it is meshed
+bool resampleOn = false;
+ResampleFilter resampleFilter = RESAMPLE_LANCZOS3;
+int meshResolution = 2048;
+static HeightPlane resampled;
+MemoryReservation resampledMemory(MEMORY_IMAGE);
+unsigned imageVersion = 0;     // counts the changes of the loaded image
+unsigned resampledVersion = 0; // imageVersion resampled was made from
+ResampleFilter resampledFilter = RESAMPLE_BOX;
+float resampleMs = 0.0f;
+
+// large images are meshed from a copy in Z-order tiles, which keeps the heights of neighbouring vertices close
+bool mortonOn = true;
+MortonHeights mortonImage;
+unsigned mortonVersion = 0; // imageVersion mortonImage was made from
+float mortonMs = 0.0f;
 
 static char filepath[128] = {0};
 static char currentFilename[128] = "-";
+static char exportPath[128] = "heightmap.ply";
+bool exportSolid = false; // export a closed printable solid instead of the surface (.stl and .3mf)
+SolidOptions solidOptions;
 bool imageLoaded = false;
 float heightScaling = 30.0f;
 glm::vec3 heightmapColor{1.0f, 1.0f, 1.0f};
@@ -83,9 +240,31 @@ int image_height = M;
 // filesystem namespace
 namespace fs = std::experimental::filesystem;
 
-int main()
+int main(int argc, char **argv)
 {
+   // command line options
+   // --trace <file>: record CPU profiler zones from startup on and write them as chrome trace on exit
+   std::string traceOnExit;
+   for (int i = 1; i < argc; ++i)
+   {
+      std::string arg = argv[i];
+      if (arg == "--trace" && i + 1 < argc)
+      {
+         traceOnExit = argv[++i];
+         strncpy(tracePath, traceOnExit.c_str(), sizeof(tracePath) - 1);
+         traceOn = true;
+      }
+      else
+      {
+         std::cout << "Unknown argument: " << arg << "\n"
+                   << "Usage: " << argv[0] << " [--trace <file>]\n";
+      }
+   }
+   Profiler::instance().setThreadName("main");
+   Profiler::instance().setEnabled(traceOn);
+
    fs::current_path("../");
+   meshCache.setDirectory(MESH_CACHE_DIRECTORY);
 
    // glfw: initialize and configure
    glfwInit();
@@ -209,8 +388,8 @@ int main()
    std::vector<glm::vec3> vertices;
    std::vector<glm::uvec3> indices;
 
-   generate_grid(N, M, vertices, indices);
-   GLuint vao = generate_vao(vertices, indices);
+   GLuint vao = 0;
+   generate_heightmap(current_heightmap(), vertices, indices, vao);
 
    modelShader.use();
    modelShader.setVec3("heightmapColor", heightmapColor);
@@ -219,8 +398,12 @@ int main()
    //----------------------------------------
    while (!glfwWindowShouldClose(window))
    {
+      PROFILE_ZONE("Frame");
       float currentFrame = glfwGetTime();
       deltaTime = currentFrame - lastFrame;
+      // the first frame would only measure the startup time
+      if (lastFrame > 0.0f)
+         frameStats.push(deltaTime);
       lastFrame = currentFrame;
 
       if (vsyncOn)
@@ -238,7 +421,68 @@ int main()
          camera.resetMovementSpeed(cameraMovementSpeed);
 
       // input
-      processInput(window);
+      {
+         PROFILE_ZONE("Input");
+         processInput(window);
+      }
+
+      // take over images and meshes finished by the workers and upload them
+      {
+         PROFILE_ZONE("Main thread jobs");
+         JobSystem::instance().runMainThreadJobs();
+      }
+
+      // the reload waits until nothing else reads the image any more
+      if (fileWatcher.changed() && hotReload)
+         reloadPending = true;
+      if (reloadPending && backgroundTasks == 0)
+      {
+         reloadPending = false;
+         reload_image_async(currentFilename, vertices, indices, vao);
+      }
+
+      // the frame at the playhead replaces the image once it is decoded, frames not decoded in time are skipped
+      if (framePlayer.isOpen() && backgroundTasks == 0)
+      {
+         PROFILE_ZONE("Frame playback");
+         int frame = framePlayer.update();
+         DecodedFrame decoded;
+         if (frame != shownFrame && framePlayer.take(frame, decoded))
+            present_frame(decoded, vertices, indices, vao);
+      }
+
+      // stream the tiles around the camera and move the window of the grid along with it
+      if (storeLoaded && gridView.store != nullptr)
+      {
+         PROFILE_ZONE("Tile streaming");
+         glm::vec3 storePosition = camera_store_position(heightmap_model());
+         StreamerView streamerView;
+         float step = (float)(1 << gridView.level);
+         streamerView.position = glm::vec2(storePosition);
+         streamerView.altitude = std::max(storePosition.z, 0.0f) * N * step;
+         streamerView.velocity = deltaTime > 0.0f ? (streamerView.position - glm::vec2(lastStorePosition)) / deltaTime : glm::vec2(0.0f);
+         streamerView.fieldOfView = glm::radians(camera.Zoom);
+         streamerView.screenHeight = SCR_HEIGHT;
+         tileStreamer.update(streamerView);
+         lastStorePosition = storePosition;
+
+         // the grid only switches to the new window once all of its tiles are resident, so it never waits on I/O
+         if (followCamera)
+         {
+            follow_window(streamerView);
+            HeightmapView heightmap = current_heightmap();
+            bool moved = heightmap.originX != gridView.originX || heightmap.originY != gridView.originY ||
+                         heightmap.level != gridView.level;
+            if (moved && backgroundTasks == 0 && heightStore.isRegionResident(heightmap.originX, heightmap.originY, heightmap.width, heightmap.height, heightmap.level))
+            {
+               generate_heightmap(heightmap, vertices, indices, vao);
+               place_camera(heightmap_model(), storePosition);
+            }
+         }
+      }
+
+      // read back the timer queries of previous frames that are done by now
+      gpuProfiler.collect();
 
       // render
       glClearColor(0.01f, 0.01f, 0.01f, 1.0f);
@@ -252,14 +496,7 @@ int main()
       modelShader.setMat4("projection", projection);
       modelShader.setMat4("view", view);
 
-      glm::mat4 model = glm::mat4(1.0f);
-      glm::mat4 xFlip = glm::mat4(1.0f);
-      xFlip[0][0] = -1.0f;
-      model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
-      model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1, 0, 0));
-      model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0, 0, 1));
-      model = glm::scale(model, glm::vec3(10.0f, 10.0f * M / N, 10.0f));
-      model = model * xFlip;
+      glm::mat4 model = heightmap_model();
       modelShader.setMat4("model", model);
 
       // lighting information for the shader
@@ -274,6 +511,7 @@ int main()
       modelShader.setFloat("material.shininess", 32.0f);
 
       // ImGui Setup
+      ProfileZone imguiZone("ImGui build");
       ImGui_ImplOpenGL3_NewFrame();
       ImGui_ImplGlfw_NewFrame();
       ImGui::NewFrame();
@@ -284,11 +522,73 @@ int main()
       ImGui::PushItemWidth(300);
       ImGui::InputText("File Path", filepath, IM_ARRAYSIZE(filepath));
       bool loadFile = ImGui::Button("Load File");
-      if (loadFile)
+      // the image must not change while a worker still generates a grid from it
+      if (loadFile && backgroundTasks > 0)
       {
-         bool success = load_image(image, filepath, image_width, image_height);
-         if (success)
-            strcpy(currentFilename, filepath);
+         std::cout << "Still loading or generating, try again once done.\n";
+      }
+      else if (loadFile)
+      {
+         PROFILE_ZONE("Load File");
+         write_char_array(std::cout, filepath);
+         std::cout << std::endl;
+         framePlayer.close();
+         std::string extension = fs::path(filepath).extension().string();
+         if (fs::is_directory(filepath))
+         {
+            if (open_mosaic(filepath))
+               read_mosaic_window_async();
+         }
+         else if (extension == ".hts")
+         {
+            open_height_store(filepath);
+         }
+         else if (text_dem_format(filepath) != TEXT_DEM_UNKNOWN)
+         {
+            import_text_dem_async(filepath);
+         }
+         else if (point_cloud_format(filepath) == POINT_CLOUD_LAS)
+         {
+            grid_point_cloud_async(filepath, pointCloudOptions);
+         }
+         else
+         {
+            // the header tells whether decoding fits into the budget, unknown files are left to stb_image to report
+            ImageProbe probe;
+            loadPlan = LoadPlan();
+            if (probe_image(filepath, probe))
+               loadPlan = plan_load(probe, heightDecoding, (long long)loadBudgetMB << 20);
+            if (loadPlan.mode != LOAD_FULL)
+               std::cout << probe.width << "x" << probe.height << " " << probe.bitsPerChannel << " bit image needs about "
+                         << estimate_load(probe, heightDecoding).total() / (1024 * 1024) << " MB, budget "
+                         << loadBudgetMB << " MB: " << load_mode_name(loadPlan.mode) << " load\n";
+            if (loadPlan.mode == LOAD_TILED)
+               build_image_store_async(filepath, heightDecoding);
+            else if (loadPlan.mode == LOAD_REJECTED)
+               std::cout << "Not loading " << filepath << ", convert it to binary PGM or PPM to stream it\n";
+            else
+               // decoded on a worker, the image is taken over once it is done
+               load_image_async(filepath, loadPlan.stride);
+         }
+      }
+
+      ImGui::SameLine();
+      if (ImGui::Button("Open Sequence"))
+      {
+         if (backgroundTasks > 0)
+         {
+            std::cout << "Still loading or generating, try again once done.\n";
+         }
+         else if (framePlayer.open(filepath))
+         {
+            // the frames replace a loaded height store, a watched file would be reloaded over them
+            fileWatcher.stop();
+            reloadPending = false;
+            framePlayer.setRate(frameRate);
+            framePlayer.setLoop(frameLoop);
+            framePlayer.setDecoding(heightDecoding);
+            shownFrame = -1;
+         }
       }
 
       ImGui::SameLine();
@@ -296,16 +596,16 @@ int main()
       bool generateGrid = ImGui::Button("Generate Grid");
       if (generateGrid)
       {
-         if (imageLoaded)
+         if (backgroundTasks > 0)
+         {
+            std::cout << "Still loading or generating, try again once done.\n";
+         }
+         else if (imageLoaded)
          {
-            N = image_width;
-            M = image_height;
             modelShader.setVec3("heightmapColor", heightmapColor);
+            PROFILE_ZONE("Generate Grid");
             std::cout << "Generating grid" << '\n';
-            vertices.clear();
-            indices.clear();
-            generate_grid(N, M, vertices, indices);
-            vao = generate_vao(vertices, indices);
+            generate_heightmap_progressive(current_heightmap(), vertices, indices, vao);
          }
          else
          {
@@ -326,6 +626,269 @@ int main()
       ImGui::Text("Height: %i", image_height);
       ImGui::SameLine();
       ImGui::Text("Loaded file: %s", currentFilename);
+      if (backgroundTasks > 0)
+      {
+         ImGui::SameLine();
+         ImGui::Text("(working...)");
+      }
+      if (importBytes > 0)
+         ImGui::ProgressBar((float)importBytesDone.load() / importBytes, ImVec2(300, 0), "Importing text DEM");
+      if (framePlayer.isOpen())
+      {
+         if (ImGui::Button(framePlayer.isPlaying() ? "Pause" : "Play"))
+         {
+            if (framePlayer.isPlaying())
+               framePlayer.pause();
+            else
+               framePlayer.play();
+         }
+         ImGui::SameLine();
+         if (ImGui::Checkbox("Loop", &frameLoop))
+            framePlayer.setLoop(frameLoop);
+         ImGui::SameLine();
+         ImGui::PushItemWidth(150);
+         if (ImGui::SliderFloat("Rate (fps)", &frameRate, 1.0f, (float)FRAME_PLAYER_MAX_RATE, "%.0f"))
+            framePlayer.setRate(frameRate);
+         ImGui::SameLine();
+         int frame = framePlayer.playhead();
+         if (ImGui::SliderInt("Frame", &frame, 0, framePlayer.frameCount() - 1))
+            framePlayer.seek(frame);
+         ImGui::PopItemWidth();
+         ImGui::SameLine();
+         if (ImGui::Button("Close Sequence"))
+            framePlayer.close();
+      }
+      if (ImGui::TreeNode("Point Cloud"))
+      {
+         const char *reductions[POINT_REDUCTION_COUNT];
+         for (int i = 0; i < POINT_REDUCTION_COUNT; ++i)
+            reductions[i] = point_reduction_name((PointReduction)i);
+         const char *fills[HOLE_FILL_COUNT];
+         for (int i = 0; i < HOLE_FILL_COUNT; ++i)
+            fills[i] = hole_fill_name((HoleFill)i);
+         ImGui::PushItemWidth(150);
+         ImGui::SliderInt("Resolution", &pointCloudOptions.resolution, 64, 16384, "%d", ImGuiSliderFlags_Logarithmic);
+         ImGui::SameLine();
+         int reduction = pointCloudOptions.reduction;
+         if (ImGui::Combo("Cell Height", &reduction, reductions, POINT_REDUCTION_COUNT))
+            pointCloudOptions.reduction = (PointReduction)reduction;
+         int fill = pointCloudOptions.fill;
+         if (ImGui::Combo("Hole Filling", &fill, fills, HOLE_FILL_COUNT))
+            pointCloudOptions.fill = (HoleFill)fill;
+         ImGui::SameLine();
+         ImGui::SliderInt("Fill Radius", &pointCloudOptions.fillRadius, 1, 64);
+         ImGui::PopItemWidth();
+         bool groundOnly = pointCloudOptions.classification == 2;
+         if (ImGui::Checkbox("Ground Points Only (LAS class 2)", &groundOnly))
+            pointCloudOptions.classification = groundOnly ? 2 : -1;
+         if (griddingPoints)
+         {
+            ImGui::Text("Gridding: %.1f million points read", pointsDone.load() / 1e6);
+         }
+         else if (ImGui::Button("Grid Point Cloud"))
+         {
+            // the file path may be .las, .xyz, .txt or .pts, Load File treats .xyz as a gridded DEM
+            if (backgroundTasks > 0)
+               std::cout << "Still loading or generating, try again once done.\n";
+            else
+               grid_point_cloud_async(filepath, pointCloudOptions);
+         }
+         ImGui::TreePop();
+      }
+      if (mosaic.isOpen() && ImGui::TreeNode("Tile Mosaic"))
+      {
+         MosaicStats stats = mosaic.stats();
+         ImGui::Text("%d tiles, %dx%d samples of %g from %.4f, %.4f", (int)mosaic.tileCount(), mosaic.width(),
+                     mosaic.height(), mosaic.cellSize(), mosaic.west(), mosaic.south());
+         ImGui::PushItemWidth(200);
+         ImGui::DragInt2("Window Origin", mosaicOrigin, 16.0f, 0, std::max(mosaic.width(), mosaic.height()));
+         ImGui::DragInt2("Window Size", mosaicSize, 16.0f, 1, std::max(mosaic.width(), mosaic.height()));
+         ImGui::PopItemWidth();
+         ImGui::PushItemWidth(150);
+         ImGui::SliderInt("Stride", &mosaicStride, 1, 64);
+         ImGui::SameLine();
+         if (ImGui::SliderInt("Tile Cache (MB)", &mosaicBudgetMB, 64, 16384, "%d", ImGuiSliderFlags_Logarithmic))
+            mosaic.setBudget((long long)mosaicBudgetMB << 20);
+         ImGui::PopItemWidth();
+         if (ImGui::Button("Load Window"))
+         {
+            if (backgroundTasks > 0)
+               std::cout << "Still loading or generating, try again once done.\n";
+            else
+               read_mosaic_window_async();
+         }
+         ImGui::SameLine();
+         ImGui::Text("%lld decoded, %lld cached, %lld evicted, %lld tiles (%.1f MB) resident, last window %.1f ms",
+                     stats.decoded, stats.hits, stats.evictions, stats.residentTiles, stats.residentBytes / 1048576.0,
+                     stats.decodeMs);
+         ImGui::TreePop();
+      }
+      if (ImGui::TreeNode("Procedural Terrain"))
+      {
+         ImGui::PushItemWidth(150);
+         int noiseType = (int)noiseOptions.type;
+         const char *noiseTypes[NOISE_TYPE_COUNT];
+         for (int i = 0; i < NOISE_TYPE_COUNT; ++i)
+            noiseTypes[i] = noise_type_name((NoiseType)i);
+         if (ImGui::Combo("Noise", &noiseType, noiseTypes, NOISE_TYPE_COUNT))
+            noiseOptions.type = (NoiseType)noiseType;
+         ImGui::SameLine();
+         int seed = (int)noiseOptions.seed;
+         if (ImGui::InputInt("Seed", &seed))
+            noiseOptions.seed = (uint32_t)seed;
+         ImGui::SliderInt("Octaves", &noiseOptions.octaves, 1, NOISE_MAX_OCTAVES);
+         ImGui::SameLine();
+         ImGui::SliderFloat("Wavelength", &noiseOptions.wavelength, 16.0f, 16384.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+         ImGui::SliderFloat("Lacunarity", &noiseOptions.lacunarity, 1.5f, 3.0f);
+         ImGui::SameLine();
+         ImGui::SliderFloat("Gain", &noiseOptions.gain, 0.2f, 0.8f);
+         char sizeLabel[32];
+         snprintf(sizeLabel, sizeof(sizeLabel), "%d x %d", 1 << noiseSizeLog2, 1 << noiseSizeLog2);
+         ImGui::SliderInt("Size", &noiseSizeLog2, 8, 15, sizeLabel);
+         ImGui::SameLine();
+         ImGui::InputText("Store Path", noisePath, IM_ARRAYSIZE(noisePath));
+         ImGui::PopItemWidth();
+         if (noiseRows > 0)
+         {
+            ImGui::ProgressBar((float)noiseRowsDone.load() / noiseRows, ImVec2(300, 0));
+         }
+         else if (ImGui::Button("Generate Terrain"))
+         {
+            if (backgroundTasks > 0)
+               std::cout << "Still loading or generating, try again once done.\n";
+            else
+               build_noise_store_async(noisePath, 1 << noiseSizeLog2, noiseOptions);
+         }
+         ImGui::TreePop();
+      }
+      if (storeLoaded)
+      {
+         ImGui::PushItemWidth(200);
+         ImGui::DragInt2("Window Origin", storeOrigin, 16.0f, 0, std::max(image_width, image_height) - 1);
+         ImGui::SameLine();
+         ImGui::SliderInt("Window Size", &storeWindow, 64, 4096);
+         ImGui::SliderInt("Level", &storeLevel, 0, heightStore.levelCount() - 1);
+         ImGui::SameLine();
+         ImGui::Checkbox("Follow Camera", &followCamera);
+         if (ImGui::SliderInt("Cache Budget (MB)", &storeBudgetMB, 16, 8192))
+            heightStore.setBudget((long long)storeBudgetMB << 20);
+         ImGui::PopItemWidth();
+      }
+
+      ImGui::PushItemWidth(300);
+      ImGui::InputText("Export Path", exportPath, IM_ARRAYSIZE(exportPath));
+      ImGui::PopItemWidth();
+      ImGui::SameLine();
+      if (ImGui::Button("Export Mesh"))
+      {
+         // exporting may resample the image again, which the grid workers might still be reading
+         if (backgroundTasks > 0)
+         {
+            std::cout << "Still loading or generating, try again once done.\n";
+         }
+         else
+         {
+            PROFILE_ZONE("Export Mesh");
+            MeshFormat format = mesh_format_from_filename(exportPath);
+            // the grid follows the heights being exported, N and M are only those of the last generated grid
+            HeightmapView view = current_heightmap();
+            int n = N;
+            int m = M;
+            if (view.hasData())
+            {
+               n = view.width;
+               m = view.height;
+            }
+            long long written = exportSolid ? export_solid(exportPath, format, n, m, view, heightScaling, solidOptions, 0)
+                                            : export_mesh(exportPath, format, n, m, view, heightScaling, 0);
+            if (written > 0)
+               std::cout << "Exported " << written / (1024 * 1024) << " MB to " << exportPath << '\n';
+         }
+      }
+      ImGui::Checkbox("Mesh Cache", &meshCacheOn);
+      ImGui::SameLine();
+      ImGui::PushItemWidth(150);
+      if (ImGui::SliderInt("Cache Limit (MB)", &meshCacheLimitMB, 64, 65536))
+         meshCache.setLimit((long long)meshCacheLimitMB << 20);
+      ImGui::PopItemWidth();
+      ImGui::SameLine();
+      if (ImGui::Button("Clear Cache"))
+         meshCache.clear();
+      if (ImGui::Checkbox("Hot Reload", &hotReload) && !hotReload)
+         reloadPending = false;
+
+      const char *encodings[HEIGHT_ENCODING_COUNT];
+      for (int i = 0; i < HEIGHT_ENCODING_COUNT; ++i)
+         encodings[i] = height_encoding_name((HeightEncoding)i);
+      ImGui::PushItemWidth(150);
+      int encoding = heightDecoding.encoding;
+      bool decodingChanged = ImGui::Combo("Height Encoding", &encoding, encodings, HEIGHT_ENCODING_COUNT);
+      heightDecoding.encoding = (HeightEncoding)encoding;
+      if (heightDecoding.encoding == HEIGHT_CHANNEL)
+      {
+         const char *channels[] = {"Red", "Green", "Blue", "Alpha"};
+         ImGui::SameLine();
+         decodingChanged |= ImGui::Combo("Channel", &heightDecoding.channel, channels, IM_ARRAYSIZE(channels));
+      }
+      ImGui::PopItemWidth();
+      if (decodingChanged)
+      {
+         // the pixels are decoded again from the file, height stores and point clouds keep their heights
+         if (framePlayer.isOpen())
+         {
+            framePlayer.setDecoding(heightDecoding);
+            shownFrame = -1;
+         }
+         else if (fileWatcher.isWatching())
+         {
+            // only images loaded from a file are watched, gridded point clouds are not decoded
+            reloadPending = true;
+         }
+      }
+      if (!image.heights.empty() &&
+          (image.decoding.encoding == HEIGHT_TERRAIN_RGB || image.decoding.encoding == HEIGHT_TERRARIUM))
+         ImGui::Text("Heights from %.1f m to %.1f m", image.minimum, image.maximum);
+      if (ImGui::TreeNode("Resampling"))
+      {
+         ImGui::Checkbox("Resample Before Meshing", &resampleOn);
+         const char *filters[RESAMPLE_FILTER_COUNT];
+         for (int i = 0; i < RESAMPLE_FILTER_COUNT; ++i)
+            filters[i] = resample_filter_name((ResampleFilter)i);
+         ImGui::PushItemWidth(150);
+         int filter = resampleFilter;
+         if (ImGui::Combo("Filter", &filter, filters, RESAMPLE_FILTER_COUNT))
+            resampleFilter = (ResampleFilter)filter;
+         ImGui::SameLine();
+         ImGui::SliderInt("Mesh Resolution", &meshResolution, 64, 16384, "%d", ImGuiSliderFlags_Logarithmic);
+         ImGui::PopItemWidth();
+         if (!resampled.heights.empty())
+            ImGui::Text("Last resampled to %dx%d with %s in %.1f ms", resampled.width, resampled.height,
+                        resample_filter_name(resampledFilter), resampleMs);
+         ImGui::TreePop();
+      }
+      ImGui::Checkbox("Z-Order Tiles", &mortonOn);
+      if (!mortonImage.empty())
+      {
+         ImGui::SameLine();
+         ImGui::Text("%dx%d tiled in %.1f ms", mortonImage.width(), mortonImage.height(), mortonMs);
+      }
+      ImGui::Checkbox("Printable Solid", &exportSolid);
+      if (exportSolid)
+      {
+         ImGui::PushItemWidth(150);
+         ImGui::InputFloat("Size (mm)", &solidOptions.scale);
+         ImGui::SameLine();
+         ImGui::InputFloat("Base Thickness", &solidOptions.baseThickness);
+         ImGui::PopItemWidth();
+         ImGui::Checkbox("Decimate Flat Areas", &solidOptions.decimate);
+         if (solidOptions.decimate)
+         {
+            ImGui::SameLine();
+            ImGui::PushItemWidth(150);
+            ImGui::SliderInt("Block Size", &solidOptions.blockSize, 2, 64);
+            ImGui::PopItemWidth();
+         }
+      }
 
       ImGui::Separator();
 
@@ -350,6 +913,156 @@ int main()
       ImGui::Checkbox("VSync", &vsyncOn);
 
       ImGui::Text("Frametime: %.3f ms (FPS %.1f)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+
+      frameStats.update();
+      ImGui::Text("p50 %.2f ms  p95 %.2f ms  p99 %.2f ms  max %.2f ms", frameStats.P50, frameStats.P95, frameStats.P99, frameStats.Max);
+      ImGui::PlotLines("Frametimes", FrameStats::plot_getter, &frameStats, frameStats.Count, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 60));
+      char histogramOverlay[64];
+      snprintf(histogramOverlay, sizeof(histogramOverlay), "0 - %.1f ms", frameStats.HistogramMax);
+      ImGui::PlotHistogram("Histogram", frameStats.Histogram, FRAME_STATS_BINS, 0, histogramOverlay, 0.0f, FLT_MAX, ImVec2(0, 60));
+      ImGui::PushItemWidth(200);
+      ImGui::InputText("##frameStatsPath", frameStatsPath, IM_ARRAYSIZE(frameStatsPath));
+      ImGui::PopItemWidth();
+      ImGui::SameLine();
+      if (ImGui::Button("Dump CSV"))
+      {
+         if (frameStats.write_csv(frameStatsPath))
+            std::cout << "Wrote " << frameStats.Count << " frame times to " << frameStatsPath << '\n';
+      }
+      ImGui::SameLine();
+      if (ImGui::Button("Clear"))
+         frameStats.clear();
+
+      ImGui::Separator();
+      MemoryStats &memoryStats = MemoryStats::instance();
+      ImGui::Text("Memory        current      peak");
+      for (int i = 0; i < MEMORY_CATEGORY_COUNT; ++i)
+      {
+         MemoryCategory category = (MemoryCategory)i;
+         ImGui::Text("%-10s %8.1f MB %8.1f MB", memory_category_name(category),
+                     memoryStats.bytes(category) / (1024.0 * 1024.0), memoryStats.peakBytes(category) / (1024.0 * 1024.0));
+      }
+      ImGui::Text("%-10s %8.1f MB %8.1f MB", "Total", memoryStats.totalBytes() / (1024.0 * 1024.0),
+                  memoryStats.totalPeakBytes() / (1024.0 * 1024.0));
+      ImGui::Text("Process resident: %.1f MB", process_resident_bytes() / (1024.0 * 1024.0));
+      ImGui::PushItemWidth(150);
+      ImGui::SliderInt("Load Budget (MB)", &loadBudgetMB, 256, 262144, "%d", ImGuiSliderFlags_Logarithmic);
+      ImGui::PopItemWidth();
+      ImGui::Text("Last load: %s, stride %d, about %.1f MB (image %.1f, decode %.1f, mesh %.1f, GPU %.1f)",
+                  load_mode_name(loadPlan.mode), loadPlan.stride, loadPlan.estimate.total() / (1024.0 * 1024.0),
+                  loadPlan.estimate.image / (1024.0 * 1024.0), loadPlan.estimate.decode / (1024.0 * 1024.0),
+                  loadPlan.estimate.mesh / (1024.0 * 1024.0), loadPlan.estimate.gpu / (1024.0 * 1024.0));
+      if (ImGui::Button("Reset Peaks"))
+         memoryStats.resetPeaks();
+      if (storeLoaded)
+      {
+         HeightStoreStats storeStats = heightStore.stats();
+         long long lookups = storeStats.hits + storeStats.misses;
+         ImGui::Text("Height store: %lld tiles, %.1f of %d MB", storeStats.residentTiles,
+                     storeStats.residentBytes / (1024.0 * 1024.0), storeBudgetMB);
+         ImGui::Text("Hit rate %.1f %%, %lld misses, %lld evictions", lookups > 0 ? 100.0 * storeStats.hits / lookups : 0.0,
+                     storeStats.misses, storeStats.evictions);
+         ImGui::SameLine();
+         if (ImGui::Button("Reset##store"))
+            heightStore.resetStats();
+         TileStreamerStats streamerStats = tileStreamer.stats();
+         ImGui::Text("Streamer: %d queued, %d reading, %lld loaded (%.2f ms per tile), %lld prefetched", streamerStats.queued,
+                     streamerStats.reading, streamerStats.loaded, streamerStats.loadMs, storeStats.prefetches);
+         TileReaderStats readerStats = heightStore.readerStats();
+         ImGui::Text("Reader (%s): queue depth %d of %d, peak %d, %d waiting", heightStore.readerBackend().c_str(),
+                     readerStats.inFlight, TILE_READER_QUEUE_DEPTH, readerStats.peakInFlight, readerStats.pending);
+         ImGui::Text("Read latency avg %.2f ms, max %.2f ms, %.1f MB in %lld reads, %lld failed", readerStats.averageMs,
+                     readerStats.maxMs, readerStats.bytes / (1024.0 * 1024.0), readerStats.completed, readerStats.failed);
+      }
+
+      ImGui::Separator();
+      MeshPipelineStats pipelineStats = meshPipeline.stats();
+      if (pipelineStats.bands > 0)
+      {
+         ImGui::Text("Grid 1/%d%s, preview after %.1f ms, full resolution %s %.1f ms", refineStride > 0 ? refineStride : gridStride,
+                     refineStride > 0 ? " refining" : "", gridPreviewMs, gridFullMs < 0.0f ? "pending," : "after",
+                     gridFullMs < 0.0f ? (glfwGetTime() - gridStartTime) * 1000.0 : gridFullMs);
+         ImGui::Text("Grid pipeline: %d of %d bands, first band after %.1f ms, %s %.1f ms", pipelineStats.uploaded,
+                     pipelineStats.bands, pipelineStats.firstBandMs, meshPipeline.isRunning() ? "running for" : "done after",
+                     pipelineStats.totalMs);
+         ImGui::Text("In flight: %d bands (peak %d, %.1f MB)", pipelineStats.inFlight, pipelineStats.peakInFlight,
+                     pipelineStats.peakBytes / (1024.0 * 1024.0));
+         std::string stages;
+         for (int i = 0; i < MESH_STAGE_COUNT; ++i)
+         {
+            char stage[64];
+            snprintf(stage, sizeof(stage), "%s%s %.1f ms", i > 0 ? ", " : "", mesh_stage_name((MeshStage)i),
+                     pipelineStats.stageMs[i]);
+            stages += stage;
+         }
+         ImGui::Text("%s", stages.c_str());
+      }
+      MeshCacheStats cacheStats = meshCache.stats();
+      ImGui::Text("Mesh cache: %lld entries, %.1f of %d MB, %lld hits, %lld misses, %lld written, %lld evicted%s",
+                  cacheStats.entries, cacheStats.bytes / (1024.0 * 1024.0), meshCacheLimitMB, cacheStats.hits,
+                  cacheStats.misses, cacheStats.writes, cacheStats.evictions,
+                  imageLoaded && sourceHash == 0 ? " (hashing file)" : "");
+      if (reloadCount > 0)
+         ImGui::Text("Hot reload: %d reloads, last %d rows, %lld vertices (%.2f %% of the grid) in %.1f ms", reloadCount,
+                     reloadRows, reloadVertices, 100.0 * reloadVertices / ((double)(N + 1) * (M + 1)), reloadMs);
+      if (framePlayer.isOpen())
+      {
+         FramePlayerStats playerStats = framePlayer.stats();
+         ImGui::Text("Playback: frame %d of %d, %lld presented, %lld dropped, ring %d ready, %d decoding", shownFrame + 1,
+                     framePlayer.frameCount(), playerStats.presented, playerStats.dropped, playerStats.ready,
+                     playerStats.decoding);
+         ImGui::Text("Decode: %.1f ms per frame, %.1f frames/s (%.1f MB/s), %lld failed, update %.1f ms",
+                     playerStats.decodeMs, playerStats.decodedPerSecond,
+                     playerStats.decoded > 0 ? playerStats.decodedPerSecond * playerStats.bytes / playerStats.decoded / (1024.0 * 1024.0) : 0.0,
+                     playerStats.failed, frameUpdateMs);
+         ImGui::SameLine();
+         if (ImGui::Button("Reset##player"))
+            framePlayer.resetStats();
+      }
+      JobSystem &jobSystem = JobSystem::instance();
+      std::vector<JobWorkerStats> workerStats = jobSystem.stats();
+      ImGui::Text("Jobs: %d queued, %d waiting for the main thread", jobSystem.queuedJobs(), jobSystem.mainThreadPending());
+      for (size_t i = 0; i < workerStats.size(); ++i)
+      {
+         char overlay[64];
+         snprintf(overlay, sizeof(overlay), "Worker %zu: %.0f %%", i, workerStats[i].utilisation * 100.0f);
+         ImGui::ProgressBar(workerStats[i].utilisation, ImVec2(200, 0), overlay);
+         ImGui::SameLine();
+         ImGui::Text("%lld jobs, %lld stolen, %.1f s busy", workerStats[i].executed, workerStats[i].stolen,
+                     workerStats[i].busySeconds);
+      }
+
+      ImGui::Separator();
+      if (ImGui::Checkbox("Record CPU trace", &traceOn))
+         Profiler::instance().setEnabled(traceOn);
+      ImGui::SameLine();
+      ImGui::Text("%zu events", Profiler::instance().eventCount());
+      ImGui::PushItemWidth(200);
+      ImGui::InputText("##tracePath", tracePath, IM_ARRAYSIZE(tracePath));
+      ImGui::PopItemWidth();
+      ImGui::SameLine();
+      if (ImGui::Button("Export Trace"))
+      {
+         if (Profiler::instance().writeChromeTrace(tracePath))
+            std::cout << "Wrote chrome trace to " << tracePath << '\n';
+      }
+      ImGui::SameLine();
+      if (ImGui::Button("Clear Trace"))
+         Profiler::instance().clear();
+
+      ImGui::Separator();
+      ImGui::Text("Passes (GPU / CPU)");
+      for (size_t i = 0; i < gpuProfiler.size(); ++i)
+      {
+         GpuTimer &pass = gpuProfiler[i];
+         char overlay[64];
+         ImGui::PushID((int)i);
+         snprintf(overlay, sizeof(overlay), "GPU %.3f ms", pass.GpuMs);
+         ImGui::PlotLines(pass.Name.c_str(), pass.GpuHistory, GPU_TIMER_HISTORY, pass.HistoryOffset, overlay, 0.0f, FLT_MAX, ImVec2(0, 40));
+         snprintf(overlay, sizeof(overlay), "CPU %.3f ms", pass.CpuMs);
+         ImGui::PlotLines("##cpu", pass.CpuHistory, GPU_TIMER_HISTORY, pass.HistoryOffset, overlay, 0.0f, FLT_MAX, ImVec2(0, 40));
+         ImGui::PopID();
+      }
       ImGui::End();
 
       // --------------------------------------------------------------------------------
@@ -361,20 +1074,32 @@ int main()
       ImGui::ColorEdit3("Dir Diffuse", (float *)&dirDiffuse);
       ImGui::ColorEdit3("Dir Specular", (float *)&dirSpecular);
       ImGui::End();
+      imguiZone.stop();
 
       // drwa all triangles of the heightmap
-      draw_vao(vao, (GLsizei)indices.size() * 3);
-      glFrontFace(GL_CW);
-      draw_vao(vao, (GLsizei)indices.size() * 3);
-      glFrontFace(GL_CCW);
+      {
+         GpuTimerScope terrainPass(gpuProfiler, "Terrain");
+         PROFILE_ZONE("Terrain draw");
+         draw_grid(vao);
+         glFrontFace(GL_CW);
+         draw_grid(vao);
+         glFrontFace(GL_CCW);
+      }
 
       // Imgui Rendering
-      ImGui::Render();
-      ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+      {
+         GpuTimerScope imguiPass(gpuProfiler, "ImGui");
+         PROFILE_ZONE("ImGui render");
+         ImGui::Render();
+         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+      }
 
       // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
       //------------------------------------------
-      glfwSwapBuffers(window);
+      {
+         PROFILE_ZONE("SwapBuffers");
+         glfwSwapBuffers(window);
+      }
       glfwPollEvents();
    }
    /*
@@ -382,6 +1107,19 @@ int main()
    glDeleteBuffers(1, &VBO);
    glDeleteBuffers(1, &EBO);
 */
+   // the workers may still hand over results that hold GL objects
+   while (backgroundTasks > 0)
+   {
+      if (JobSystem::instance().runMainThreadJobs() == 0)
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+   gpuProfiler.release();
+   gl_delete_vertex_array(vao);
+   gl_delete_vertex_array(refineVao);
+
+   if (!traceOnExit.empty() && Profiler::instance().writeChromeTrace(traceOnExit))
+      std::cout << "Wrote chrome trace to " << traceOnExit << '\n';
+
    // glfw: terminate, clearing all previously allocated GLFW resources
    //---------------------------------------------------
    glfwTerminate();
@@ -461,31 +1199,6 @@ void keyboard_callback(GLFWwindow *window, int key, int scancode, int action, in
       }
    }
 }
-// function to load images by pressing the load image button if a filepath is given
-// x and y resemble the image_width and image_height in this case
-// error handling is done through printing related strings into the console for now
-// ----------------------------------------------------------------------------------------------
-bool load_image(std::vector<unsigned char> &image, const std::string &filename, int &x, int &y)
-{
-   write_char_array(std::cout, filepath);
-   std::cout << std::endl;
-   int n;
-   unsigned char *data = stbi_load(filename.c_str(), &x, &y, &n, 4);
-   if (data != nullptr)
-   {
-      image = std::vector<unsigned char>(data, data + x * y * 4);
-      std::cout << "Image loaded successfully\n";
-      imageLoaded = true;
-      std::cout << "Image width: " << image_width << ", Image height: " << image_height << '\n';
-   }
-   else
-   {
-      std::cout << "Failed to load image\n";
-   }
-   stbi_image_free(data);
-   return (data != nullptr);
-}
-
 // function to return the color of a pixel at a given position on an image
 // done mainly through image vector's data
 // ---------------------------------------------------------------------------
@@ -521,196 +1234,412 @@ bool write_char_array(std::ostream &os, const char *string)
    return false;
 }
 
-// helper function to first draw a heightmap based on sin if no image has been loaded yet
-// ---------------------------------------------------------------------------------------
-float f(float x, float y)
+// returns the loaded image as height source for the grid or the sine fallback if no image is loaded yet
+// -----------------------------------------------------------------------------------------------------
+HeightmapView current_heightmap()
 {
-   return sin(x * 2.0f * M_PI) * sin(y * 2.0f * M_PI) * 0.1f;
+   if (!imageLoaded)
+      return HeightmapView();
+   if (storeLoaded)
+   {
+      // the origin is given in samples of level 0, the window is clamped to the level
+      int level = std::min(std::max(storeLevel, 0), heightStore.levelCount() - 1);
+      const HeightStoreLevel &info = heightStore.level(level);
+      int x = std::min(std::max(storeOrigin[0] >> level, 0), info.width - 1);
+      int y = std::min(std::max(storeOrigin[1] >> level, 0), info.height - 1);
+      return HeightmapView(&heightStore, x, y, std::min(storeWindow, info.width - x), std::min(storeWindow, info.height - y), level);
+   }
+   if (resampleOn)
+      return resampled_heightmap();
+   return image_heightmap();
 }
 
-// generates the actual grid by filling the vertices and indices vector
-// ---------------------------------------------------------------------
-void generate_grid(int N, int M, std::vector<glm::vec3> &vertices, std::vector<glm::uvec3> &indices)
+// The loaded image, read from its copy in Z-order tiles if it is large enough for the tiles to pay off. The copy is
+// made again only after the image changed and freed when it is not used, but never while grid workers may read it
+// ----------------------------------------------------------------------------------------------------------------------
+HeightmapView image_heightmap()
 {
-   // retrieve the vertices from the image
+   if (backgroundTasks > 0)
    {
-      for (int i = 0; i <= N; ++i) // i = row
-      {
-         for (int j = 0; j <= M; ++j) // y = column
-         {
-            float x = (float)j / (float)N; // at position j/N is x
-            float y = (float)i / (float)M; // at position i/N is y
-            float z = f(x, y);
-            if (imageLoaded)
-            {
-               size_t index = RGBA * (j * image_width + i);
-               float red = static_cast<float>(image[index + 0]);
-               float green = static_cast<float>(image[index + 1]);
-               float blue = static_cast<float>(image[index + 2]);
-
-               z = ((red * green * blue) / (255 * 255 * 255)) * heightScaling / 100;
-            }
-            vertices.push_back(glm::vec3(x, y, z));
-         }
-      }
-
-      std::vector<glm::vec3> face_normals;
-      // generate all indices and normals of each face
-      for (int j = 0; j < N; ++j)
-      {
-         for (int i = 0; i < M; ++i)
-         {
-            int row1 = j * (M + 1);
-            int row2 = (j + 1) * (M + 1);
-
-            // triangle 1
-            glm::vec3 vector1 = vertices[row2 + i + 1];
-            glm::vec3 vector2 = vertices[row1 + i + 1];
-
-            glm::vec3 cross = glm::cross(vector1, vector2);
-            face_normals.push_back(glm::normalize(cross));
-
-            indices.push_back(glm::uvec3(row1 + i, row1 + i + 1, row2 + i + 1));
-
-            // triangle 2
-            vector1 = vertices[row2 + i];
-            vector2 = vertices[row2 + i + 1];
+      if (mortonOn && !mortonImage.empty() && mortonVersion == imageVersion)
+         return HeightmapView(image.heights.data(), &mortonImage);
+      return HeightmapView(image.heights.data(), image_width, image_height);
+   }
+   if (!mortonOn || image.heights.empty() || (long long)image.width * image.height < MORTON_MIN_HEIGHTS)
+   {
+      if (!mortonImage.empty())
+         mortonImage.clear();
+      return HeightmapView(image.heights.data(), image_width, image_height);
+   }
+   if (mortonVersion != imageVersion || mortonImage.empty())
+   {
+      double start = glfwGetTime();
+      mortonImage.assign(image.heights.data(), image.width, image.height, 0);
+      mortonVersion = imageVersion;
+      mortonMs = (float)((glfwGetTime() - start) * 1000.0);
+   }
+   return HeightmapView(image.heights.data(), &mortonImage);
+}
 
-            cross = glm::cross(vector1, vector2);
-            face_normals.push_back(glm::normalize(cross));
+// The loaded image resampled to meshResolution along its longer side. It is resampled again only after the image, the
+// filter or the resolution changed, all threads filter rows of it
+// ----------------------------------------------------------------------------------------------------------------------
+HeightmapView resampled_heightmap()
+{
+   int width;
+   int height;
+   resample_size(image.width, image.height, meshResolution, width, height);
+   if (image.heights.empty() || (width == image.width && height == image.height))
+      return image_heightmap();
+   if (resampledVersion != imageVersion || resampledFilter != resampleFilter || resampled.width != width ||
+       resampled.height != height || resampled.heights.empty())
+   {
+      double start = glfwGetTime();
+      resample_heights(image, width, height, resampleFilter, resampled, 0);
+      resampledMemory.set(resampled.heights);
+      resampledVersion = imageVersion;
+      resampledFilter = resampleFilter;
+      resampleMs = (float)((glfwGetTime() - start) * 1000.0);
+   }
+   return HeightmapView(resampled.heights.data(), resampled.width, resampled.height);
+}
 
-            indices.push_back(glm::uvec3(row1 + i, row2 + i + 1, row2 + i));
-         }
-      }
+// generates the grid of heightmap and replaces the VAO
+// -----------------------------------------------------
+void generate_heightmap(const HeightmapView &heightmap, std::vector<glm::vec3> &vertices, std::vector<glm::uvec3> &indices,
+                        GLuint &vao)
+{
+   int n = N;
+   int m = M;
+   if (heightmap.hasData())
+   {
+      n = heightmap.width;
+      m = heightmap.height;
+   }
+   generate_grid(n, m, heightmap, heightScaling, vertices, indices, 0);
+   upload_heightmap(heightmap, n, m, vertices, indices, vao);
+}
 
-      // generate all normals for the vertices
-      std::vector<glm::vec3> temp_normals;
-      for (int i = 0; i < vertices.size(); ++i) // i = row
+// Generates the grid progressively: a strided preview first, then finer levels down to the full grid, every level
+// through the mesh pipeline. The buffers of a level are allocated up front and drawn band by band over the previous
+// level as the bands are uploaded. No copy of the grid is kept in memory
+// ---------------------------------------------------------------------------------------------------------------------
+void generate_heightmap_progressive(const HeightmapView &heightmap, std::vector<glm::vec3> &vertices,
+                                    std::vector<glm::uvec3> &indices, GLuint &vao)
+{
+   if (heightmap.hasData())
+   {
+      N = heightmap.width;
+      M = heightmap.height;
+   }
+   gridView = heightmap;
+   gridHeightScaling = heightScaling;
+   std::vector<glm::vec3>().swap(vertices);
+   std::vector<glm::uvec3>().swap(indices);
+   meshMemory.set(0);
+   gl_delete_vertex_array(vao);
+   vao = 0;
+   gridIndexCount = 0;
+   gridStride = 1;
+   gridStartTime = glfwGetTime();
+   gridPreviewMs = -1.0f;
+   gridFullMs = -1.0f;
+
+   // a grid generated before from the same file with the same parameters is uploaded straight from the cache
+   meshCacheWriter.abort();
+   if (meshCacheOn && sourceHash != 0 && heightmap.hasData())
+   {
+      MeshCacheKey key = mesh_cache_key(heightmap);
+      MappedMesh cached;
+      if (meshCache.lookup(key, cached))
       {
-         // the different positions of the vertices around a given vertex i
-         int vec1Pos = i - N - 1;
-         int vec2Pos = i - N;
-         int vec3Pos = i + 1;
-         int vec4Pos = i + N + 1;
-         int vec5Pos = i + N;
-         int vec6Pos = i - 1;
-
-         // initialize all the vectors around i as (0, 0, 0) 
-         glm::vec3 vec1(0, 0, 0);
-         glm::vec3 vec2(0, 0, 0);
-         glm::vec3 vec3(0, 0, 0);
-         glm::vec3 vec4(0, 0, 0);
-         glm::vec3 vec5(0, 0, 0);
-         glm::vec3 vec6(0, 0, 0);
-
-         glm::vec3 indicesAroundVector[6];
-
-         int vec1X = (vec1Pos) / N;
-         int vec1Y = (vec1Pos) % N;
-
-         // for each vertex around i check whether the vertex is on the grid or not. 
-         // If that's the case then save it's value into the indicesAroundVector[] array.
-         // Otherwise just use the previously initialized (0, 0, 0)
-         if (vec1X >= 0 && vec1Y >= 0 && vec1X <= N && vec1Y <= M)
-         {
-            vec1 = vertices[vec1Pos];
-            indicesAroundVector[0] = vec1;
-         }
-         else
-         {
-            indicesAroundVector[0] = glm::vec3(0, 0, 0);
-         }
+         PROFILE_ZONE("Mesh cache upload");
+         vao = create_vao((GLsizeiptr)(cached.vertexCount() * sizeof(glm::vec3)), cached.vertices(),
+                          (GLsizeiptr)(cached.triangleCount() * sizeof(glm::uvec3)), cached.indices());
+         gridIndexCount = (GLsizei)(cached.triangleCount() * 3);
+         gridPreviewMs = gridFullMs = (float)((glfwGetTime() - gridStartTime) * 1000.0);
+         return;
+      }
+      // the full resolution level is written to the cache as it is generated, unless it exceeds the limit
+      meshCache.begin(key, (size_t)(N + 1) * (M + 1) * 2, (size_t)N * M * 2, meshCacheWriter);
+   }
 
-         int vec2X = (vec2Pos) / N;
-         int vec2Y = (vec2Pos) % N;
+   // small grids are done in a few milliseconds anyway
+   int stride = (long long)(N + 1) * (M + 1) > MESH_PIPELINE_PREVIEW_VERTICES ? MESH_PIPELINE_PREVIEW_STRIDE : 1;
+   ++backgroundTasks;
+   start_grid_level(heightmap, stride, vao);
+}
 
-         if (vec2X >= 0 && vec2Y >= 0 && vec2X <= N && vec2Y <= M)
-         {
-            vec2 = vertices[vec2Pos];
-            indicesAroundVector[1] = vec2;
-         }
-         else
-         {
-            indicesAroundVector[1] = glm::vec3(0, 0, 0);
-         }
+void start_grid_level(const HeightmapView &heightmap, int stride, GLuint &vao)
+{
+   int rows = strided_quads(N, stride);
+   int columns = strided_quads(M, stride);
+   refineStride = stride;
+   refineVao = create_vao((GLsizeiptr)((size_t)(rows + 1) * (columns + 1) * 2 * sizeof(glm::vec3)), nullptr,
+                          (GLsizeiptr)((size_t)rows * columns * 2 * sizeof(glm::uvec3)), nullptr);
+   MeshBandSink sink;
+   if (stride == 1 && meshCacheWriter.isOpen())
+   {
+      sink = [](const MeshBand &band) {
+         meshCacheWriter.writeVertices(band.vertexOffset, band.vertices.data(), band.vertices.size());
+         meshCacheWriter.writeIndices(band.indexOffset, band.indices.data(), band.indices.size());
+      };
+   }
+   GLuint *vaoOut = &vao;
+   meshPipeline.start(
+       N, M, heightmap, heightScaling,
+       [](const MeshBand &band) {
+          upload_band(refineVao, band);
+          if (gridPreviewMs < 0.0f)
+             gridPreviewMs = (float)((glfwGetTime() - gridStartTime) * 1000.0);
+       },
+       [heightmap, vaoOut]() { finish_grid_level(heightmap, *vaoOut); }, stride, sink);
+}
 
-         int vec3X = (vec3Pos) / N;
-         int vec3Y = (vec3Pos) % N;
+// the finished level replaces the current grid, the next finer one is started until the full grid is done
+// -----------------------------------------------------------------------------------------------------------
+void finish_grid_level(const HeightmapView &heightmap, GLuint &vao)
+{
+   gl_delete_vertex_array(vao);
+   vao = refineVao;
+   gridStride = refineStride;
+   gridIndexCount = (GLsizei)((size_t)strided_quads(N, gridStride) * strided_quads(M, gridStride) * 2 * 3);
+   refineVao = 0;
+   refineStride = 0;
+   if (gridStride > 1)
+   {
+      start_grid_level(heightmap, std::max(gridStride / MESH_PIPELINE_REFINE_FACTOR, 1), vao);
+      return;
+   }
+   gridFullMs = (float)((glfwGetTime() - gridStartTime) * 1000.0);
+   if (meshCacheWriter.isOpen())
+      meshCache.finish(meshCacheWriter);
+   --backgroundTasks;
+}
 
-         if (vec3X >= 0 && vec3Y >= 0 && vec3X <= N && vec3Y <= M)
-         {
-            vec3 = vertices[vec3Pos];
-            indicesAroundVector[0] = vec3;
-         }
-         else
-         {
-            indicesAroundVector[2] = glm::vec3(0, 0, 0);
-         }
+// Draws the current grid. While a finer level is generated, its uploaded quad rows are drawn instead of the current
+// grid's, which is drawn from its first quad row that is not completely covered by them on
+// -------------------------------------------------------------------------------------------------------------------
+void draw_grid(GLuint vao)
+{
+   if (refineStride == 0)
+   {
+      draw_vao(vao, gridIndexCount);
+      return;
+   }
+   int quadRows = meshPipeline.uploadedQuadRows();
+   draw_vao(refineVao, (GLsizei)((size_t)quadRows * strided_quads(M, refineStride) * 2 * 3));
+   size_t first = (size_t)(strided_vertex(quadRows, N, refineStride) / gridStride) * strided_quads(M, gridStride) * 2 * 3;
+   if (first < (size_t)gridIndexCount)
+      draw_vao(vao, gridIndexCount - (GLsizei)first, first);
+}
 
-         int vec4X = (vec4Pos) / N;
-         int vec4Y = (vec4Pos) % N;
+// decodes an image into heights on the job system and replaces the loaded image or height store with it once it is done
+// ------------------------------------------------------------------------------------------------------------
+void load_image_async(const std::string &filename, int stride)
+{
+   ++backgroundTasks;
+   HeightDecoding decoding = heightDecoding;
+   JobSystem::instance().submit([filename, decoding, stride]() {
+      std::shared_ptr<HeightPlane> loaded = std::make_shared<HeightPlane>();
+      bool success = load_heights_strided(filename, decoding, stride, *loaded, 0);
+      JobSystem::instance().runOnMainThread([filename, loaded, success, stride]() {
+         --backgroundTasks;
+         if (!success)
+            return;
+         imageStride = stride;
+         tileStreamer.stop();
+         heightStore.close();
+         std::swap(image, *loaded);
+         imageMemory.set(image.heights);
+         ++imageVersion;
+         image_width = image.width;
+         image_height = image.height;
+         imageLoaded = true;
+         storeLoaded = false;
+         storeLevel = 0;
+         strncpy(currentFilename, filename.c_str(), sizeof(currentFilename) - 1);
+         hash_source_async(filename);
+         fileWatcher.watch(filename);
+      });
+   });
+}
 
-         if (vec4X >= 0 && vec4Y >= 0 && vec4X <= N && vec4Y <= M)
-         {
-            vec4 = vertices[vec4Pos];
-            indicesAroundVector[0] = vec4;
-         }
-         else
+// Loads the changed image on the job system and compares it with the loaded one. When the current grid is the full
+// resolution grid of the loaded image, only the vertices around changed pixels are generated and uploaded into the
+// existing buffers, so a small edit costs a few rows instead of the whole grid. Everything else, like a new image size,
+// regenerates the grid. Load and Generate wait while backgroundTasks is set, so the image is not touched meanwhile
+// ---------------------------------------------------------------------------------------------------------------------
+void reload_image_async(const std::string &filename, std::vector<glm::vec3> &vertices, std::vector<glm::uvec3> &indices,
+                        GLuint &vao)
+{
+   ++backgroundTasks;
+   double start = glfwGetTime();
+   bool incremental = grid_updates_incrementally(vao);
+   const float *resident = image.heights.data();
+   HeightDecoding decoding = heightDecoding;
+   int n = N;
+   int m = M;
+   int width = image_width;
+   int height = image_height;
+   float scaling = heightScaling;
+   int stride = imageStride;
+   std::vector<glm::vec3> *verticesOut = &vertices;
+   std::vector<glm::uvec3> *indicesOut = &indices;
+   GLuint *vaoOut = &vao;
+   JobSystem::instance().submit([=]() {
+      PROFILE_ZONE("Hot reload");
+      std::shared_ptr<HeightPlane> loaded = std::make_shared<HeightPlane>();
+      std::shared_ptr<std::vector<GridSpan>> spans = std::make_shared<std::vector<GridSpan>>();
+      std::shared_ptr<std::vector<glm::vec3>> changed = std::make_shared<std::vector<glm::vec3>>();
+      bool success = load_heights_strided(filename, decoding, stride, *loaded, 0, false);
+      bool remesh = success && incremental && loaded->width == width && loaded->height == height;
+      if (remesh)
+      {
+         grid_dirty_spans(n, m, resident, loaded->heights.data(), width, height, *spans, 0);
+         generate_vertex_spans(n, m, HeightmapView(loaded->heights.data(), width, height), scaling, *spans, *changed, 0);
+      }
+      JobSystem::instance().runOnMainThread([=]() {
+         --backgroundTasks;
+         // a file written while it was read is read again by the next change
+         if (!success || filename != currentFilename)
+            return;
+         std::swap(image, *loaded);
+         imageMemory.set(image.heights);
+         ++imageVersion;
+         image_width = image.width;
+         image_height = image.height;
+         hash_source_async(filename);
+         ++reloadCount;
+         if (!remesh)
          {
-            indicesAroundVector[3] = glm::vec3(0, 0, 0);
+            reloadRows = N + 1;
+            reloadVertices = (long long)(N + 1) * (M + 1);
+            reloadMs = (float)((glfwGetTime() - start) * 1000.0);
+            if (*vaoOut != 0)
+               generate_heightmap_progressive(current_heightmap(), *verticesOut, *indicesOut, *vaoOut);
+            return;
          }
+         gridView = current_heightmap();
+         upload_vertex_spans(*vaoOut, *spans, *changed);
+         reloadRows = (int)spans->size();
+         reloadVertices = (long long)(changed->size() / 2);
+         reloadMs = (float)((glfwGetTime() - start) * 1000.0);
+      });
+   });
+}
 
-         int vec5X = (vec5Pos) / N;
-         int vec5Y = (vec5Pos) % N;
+// hashes the loaded file for the mesh cache in the background, the cache is not used until the hash is known
+// --------------------------------------------------------------------------------------------------------------
+void hash_source_async(const std::string &filename)
+{
+   sourceHash = 0;
+   JobSystem::instance().submit([filename]() {
+      uint64_t hash = hash_file(filename);
+      JobSystem::instance().runOnMainThread([filename, hash]() {
+         // another file may have been loaded meanwhile
+         if (filename == currentFilename)
+            sourceHash = hash;
+      });
+   });
+}
 
-         if (vec5X >= 0 && vec5Y >= 0 && vec5X <= N && vec5Y <= M)
-         {
-            vec5 = vertices[vec5Pos];
-            indicesAroundVector[0] = vec5;
-         }
-         else
-         {
-            indicesAroundVector[4] = glm::vec3(0, 0, 0);
-         }
+MeshCacheKey mesh_cache_key(const HeightmapView &heightmap)
+{
+   MeshCacheKey key;
+   memset(&key, 0, sizeof(key));
+   key.sourceHash = sourceHash;
+   key.N = N;
+   key.M = M;
+   key.heightScaling = heightScaling;
+   key.originX = heightmap.originX;
+   key.originY = heightmap.originY;
+   key.level = heightmap.level;
+   if (heightmap.heights != nullptr &&
+       (heightmap.heights == image.heights.data() || heightmap.heights == resampled.heights.data()))
+   {
+      key.encoding = image.decoding.encoding;
+      key.channel = image.decoding.channel;
+   }
+   if (heightmap.heights != nullptr && heightmap.heights == resampled.heights.data())
+      key.resample = resampledFilter + 1;
+   return key;
+}
 
-         int vec6X = (vec6Pos) / N;
-         int vec6Y = (vec6Pos) % N;
+// makes the generated vertices and indices the current grid, main thread only
+// ----------------------------------------------------------------------------
+void upload_heightmap(const HeightmapView &heightmap, int n, int m, const std::vector<glm::vec3> &vertices,
+                      const std::vector<glm::uvec3> &indices, GLuint &vao)
+{
+   N = n;
+   M = m;
+   gridView = heightmap;
+   gridHeightScaling = heightScaling;
+   meshMemory.set((long long)(vertices.capacity() * sizeof(glm::vec3) + indices.capacity() * sizeof(glm::uvec3)));
+   gl_delete_vertex_array(vao);
+   vao = generate_vao(vertices, indices);
+   gridIndexCount = (GLsizei)indices.size() * 3;
+   gridStride = 1;
+}
 
-         if (vec6X >= 0 && vec6Y >= 0 && vec6X <= N && vec6Y <= M)
-         {
-            vec6 = vertices[vec6Pos];
-            indicesAroundVector[5] = vec6;
-         }
-         else
-         {
-            indicesAroundVector[5] = glm::vec3(0, 0, 0);
-         }
+glm::mat4 heightmap_model()
+{
+   glm::mat4 model = glm::mat4(1.0f);
+   glm::mat4 xFlip = glm::mat4(1.0f);
+   xFlip[0][0] = -1.0f;
+   model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
+   model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1, 0, 0));
+   model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0, 0, 1));
+   model = glm::scale(model, glm::vec3(10.0f, 10.0f * M / N, 10.0f));
+   return model * xFlip;
+}
 
-         // calculate the normal of i by adding up all the vectors around i
-         glm::vec3 normalOfI = indicesAroundVector[0] + indicesAroundVector[1] + indicesAroundVector[2] +
-                               indicesAroundVector[3] + indicesAroundVector[4] + indicesAroundVector[5];
-         if (normalOfI.z < 0)
-            normalOfI.z = normalOfI.z * -1;
-         // push them into the temporary normals array in a normalized way
-         temp_normals.push_back(glm::normalize(normalOfI));
-      }
+// Position of the camera in level 0 samples of the height store the grid was generated from, z stays in grid space.
+// Vertex (i, j) lies at x = j / N, y = i / M and samples column i and row j of the window, see grid_position
+// -------------------------------------------------------------------------------------------------------------------
+glm::vec3 camera_store_position(const glm::mat4 &model)
+{
+   glm::vec3 grid = glm::vec3(glm::inverse(model) * glm::vec4(camera.Position, 1.0f));
+   float step = (float)(1 << gridView.level);
+   return glm::vec3((gridView.originX + grid.y * M) * step, (gridView.originY + grid.x * N) * step, grid.z);
+}
 
-      // combine vertices and normals into a single array for usage in the shader
-      std::vector<glm::vec3> newVertices;
-      for (int i = 0; i < vertices.size(); i++)
-      {
-         newVertices.push_back(vertices[i]);
-         newVertices.push_back(temp_normals[i]);
-      }
+// moves the camera to a store position after the grid changed its window, so the view does not jump
+void place_camera(const glm::mat4 &model, const glm::vec3 &storePosition)
+{
+   float step = (float)(1 << gridView.level);
+   glm::vec3 grid((storePosition.y / step - gridView.originY) / N, (storePosition.x / step - gridView.originX) / M,
+                  storePosition.z);
+   camera.Position = glm::vec3(model * glm::vec4(grid, 1.0f));
+}
 
-      vertices = newVertices;
-   }
+// Picks the level the camera altitude needs and centers the window on the camera. The origin snaps to a quarter
+// of the window so the grid is only regenerated after the camera moved that far
+// ----------------------------------------------------------------------------------------------------------------
+void follow_window(const StreamerView &view)
+{
+   int level = tileStreamer.levelForDistance(view, std::max(view.altitude, 1.0f));
+   int snap = std::max(storeWindow / 4, 1) << level;
+   int x = std::max((int)std::floor((view.position.x - (storeWindow << level) / 2.0f) / snap), 0) * snap;
+   int y = std::max((int)std::floor((view.position.y - (storeWindow << level) / 2.0f) / snap), 0) * snap;
+   storeLevel = level;
+   storeOrigin[0] = x;
+   storeOrigin[1] = y;
 }
 
 // Generates the VAOs, VBOs and IBOs of the heightmap
 // -------------------------------------------------
 GLuint generate_vao(const std::vector<glm::vec3> &vertices, const std::vector<glm::uvec3> &indices)
 {
+   return create_vao((GLsizeiptr)(vertices.size() * sizeof(glm::vec3)), glm::value_ptr(vertices[0]),
+                     (GLsizeiptr)(indices.size() * sizeof(glm::uvec3)), glm::value_ptr(indices[0]));
+}
+
+// creates a VAO with interleaved positions and normals, without data the buffers are only allocated
+// -----------------------------------------------------------------------------------------------------
+GLuint create_vao(GLsizeiptr vertexBytes, const void *vertexData, GLsizeiptr indexBytes, const void *indexData)
+{
+   PROFILE_ZONE("generate_vao");
    GLuint vao;
    glGenVertexArrays(1, &vao);
    glBindVertexArray(vao);
@@ -718,18 +1647,18 @@ GLuint generate_vao(const std::vector<glm::vec3> &vertices, const std::vector<gl
    GLuint vbo;
    glGenBuffers(1, &vbo);
    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-   glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), glm::value_ptr(vertices[0]), GL_STATIC_DRAW);
+   gl_buffer_data(GL_ARRAY_BUFFER, vertexBytes, vertexData, GL_STATIC_DRAW);
 
    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), nullptr);
    glEnableVertexAttribArray(0);
 
-   glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (void *)(3 * sizeof(glm::vec3)));
+   glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (void *)sizeof(glm::vec3));
    glEnableVertexAttribArray(1);
 
    GLuint ibo;
    glGenBuffers(1, &ibo);
    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-   glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(glm::uvec3), glm::value_ptr(indices[0]), GL_STATIC_DRAW);
+   gl_buffer_data(GL_ELEMENT_ARRAY_BUFFER, indexBytes, indexData, GL_STATIC_DRAW);
 
    glBindVertexArray(0);
    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
@@ -738,11 +1667,323 @@ GLuint generate_vao(const std::vector<glm::vec3> &vertices, const std::vector<gl
    return vao;
 }
 
+// copies a band of the mesh pipeline into the buffers of a VAO created for the whole grid
+// ------------------------------------------------------------------------------------------
+void upload_band(GLuint vao, const MeshBand &band)
+{
+   glBindVertexArray(vao);
+   GLint vbo = 0;
+   glGetVertexAttribiv(0, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &vbo);
+   glBindBuffer(GL_ARRAY_BUFFER, (GLuint)vbo);
+   glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(band.vertexOffset * sizeof(glm::vec3)),
+                   (GLsizeiptr)(band.vertices.size() * sizeof(glm::vec3)), band.vertices.data());
+   if (!band.indices.empty())
+      glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (GLintptr)(band.indexOffset * sizeof(glm::uvec3)),
+                      (GLsizeiptr)(band.indices.size() * sizeof(glm::uvec3)), band.indices.data());
+   glBindVertexArray(0);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// opens a height store as the height data of the grid, replacing a loaded image or store
+// -----------------------------------------------------------------------------------------
+bool open_height_store(const std::string &filename)
+{
+   tileStreamer.stop();
+   framePlayer.close();
+   if (!heightStore.open(filename, (long long)storeBudgetMB << 20))
+      return false;
+   tileStreamer.start(&heightStore);
+   fileWatcher.stop();
+   // the store replaces a previously loaded image
+   image = HeightPlane();
+   imageMemory.set(0);
+   mortonImage.clear();
+   ++imageVersion;
+   image_width = heightStore.width();
+   image_height = heightStore.height();
+   std::cout << "Height store opened: " << image_width << "x" << image_height << '\n';
+   imageLoaded = true;
+   storeLoaded = true;
+   storeLevel = 0;
+   strncpy(currentFilename, filename.c_str(), sizeof(currentFilename) - 1);
+   hash_source_async(currentFilename);
+   return true;
+}
+
+// writes a procedural heightfield into a new height store on the job system and opens it once it is complete. The
+// store currently open may be the file being replaced, so it is closed first
+// ------------------------------------------------------------------------------------------------------------------
+void build_noise_store_async(const std::string &filename, int size, const NoiseOptions &options)
+{
+   ++backgroundTasks;
+   if (storeLoaded)
+   {
+      tileStreamer.stop();
+      heightStore.close();
+      imageLoaded = false;
+      storeLoaded = false;
+   }
+   noiseRowsDone = 0;
+   noiseRows = size;
+   double start = glfwGetTime();
+   JobSystem::instance().submit([filename, size, options, start]() {
+      bool success = build_noise_store(filename, size, size, options, 0, &noiseRowsDone);
+      JobSystem::instance().runOnMainThread([filename, size, success, start]() {
+         --backgroundTasks;
+         noiseRows = 0;
+         if (!success)
+            return;
+         std::cout << "Generated " << size << "x" << size << " terrain in " << glfwGetTime() - start << " s\n";
+         open_height_store(filename);
+      });
+   });
+}
+
+// Converts an ESRI ASCII grid or XYZ file into a height store next to it on the job system and opens the store once
+// it is complete. Text DEMs are far too slow to sample directly, the store is what the grid is generated from
+// ------------------------------------------------------------------------------------------------------------------
+void import_text_dem_async(const std::string &filename)
+{
+   std::error_code error;
+   long long bytes = (long long)fs::file_size(filename, error);
+   if (error)
+   {
+      std::cout << "Failed to open " << filename << '\n';
+      return;
+   }
+   std::string storeFilename = fs::path(filename).replace_extension(".hts").string();
+   ++backgroundTasks;
+   if (storeLoaded)
+   {
+      tileStreamer.stop();
+      heightStore.close();
+      imageLoaded = false;
+      storeLoaded = false;
+   }
+   importBytesDone = 0;
+   importBytes = 2 * bytes;
+   double start = glfwGetTime();
+   JobSystem::instance().submit([filename, storeFilename, start]() {
+      TextDemInfo info;
+      bool success = build_text_dem_store(filename, storeFilename, true, 0, &importBytesDone, &info);
+      JobSystem::instance().runOnMainThread([storeFilename, info, success, start]() {
+         --backgroundTasks;
+         importBytes = 0;
+         if (!success)
+            return;
+         std::cout << "Imported " << info.width << "x" << info.height << " text DEM (" << info.bytes / (1024 * 1024)
+                   << " MB, heights " << info.minimum << " to " << info.maximum << ") in " << glfwGetTime() - start
+                   << " s\n";
+         open_height_store(storeFilename);
+      });
+   });
+}
+
+// Streams an image too large to decode into a height store next to it and opens the store, tiled mode for Load File.
+// The pixels are decoded like in the full and strided modes
+// ------------------------------------------------------------------------------------------------------------------
+void build_image_store_async(const std::string &filename, const HeightDecoding &decoding)
+{
+   std::string storeFilename = fs::path(filename).replace_extension(".hts").string();
+   ++backgroundTasks;
+   if (storeLoaded)
+   {
+      tileStreamer.stop();
+      heightStore.close();
+      imageLoaded = false;
+      storeLoaded = false;
+   }
+   double start = glfwGetTime();
+   JobSystem::instance().submit([filename, storeFilename, decoding, start]() {
+      bool success = build_height_store(filename, storeFilename, true, decoding);
+      JobSystem::instance().runOnMainThread([storeFilename, success, start]() {
+         --backgroundTasks;
+         if (!success)
+            return;
+         std::cout << "Converted into " << storeFilename << " in " << glfwGetTime() - start << " s\n";
+         open_height_store(storeFilename);
+      });
+   });
+}
+
+// Bins the points of a LAS or XYZ file into a height plane on the job system and makes it the loaded image, which is
+// meshed like any other. The mesh cache key hashes the binned heights, they depend on the options as much as on the file
+// ------------------------------------------------------------------------------------------------------------------------
+void grid_point_cloud_async(const std::string &filename, const PointCloudOptions &options)
+{
+   ++backgroundTasks;
+   griddingPoints = true;
+   pointsDone = 0;
+   double start = glfwGetTime();
+   JobSystem::instance().submit([filename, options, start]() {
+      std::shared_ptr<HeightPlane> plane = std::make_shared<HeightPlane>();
+      PointCloudInfo info;
+      bool success = grid_point_cloud(filename, options, *plane, 0, &pointsDone, &info);
+      uint64_t hash = success ? hash_bytes(plane->heights.data(), plane->heights.size() * sizeof(float)) : 0;
+      JobSystem::instance().runOnMainThread([filename, plane, info, success, hash, start]() {
+         --backgroundTasks;
+         griddingPoints = false;
+         if (!success)
+            return;
+         std::cout << "Gridded " << info.binned << " of " << info.points << " points into " << plane->width << "x"
+                   << plane->height << " cells of " << info.cellSize << " (" << info.holes << " holes) in "
+                   << glfwGetTime() - start << " s\n";
+         framePlayer.close();
+         tileStreamer.stop();
+         heightStore.close();
+         fileWatcher.stop();
+         std::swap(image, *plane);
+         imageMemory.set(image.heights);
+         ++imageVersion;
+         image_width = image.width;
+         image_height = image.height;
+         imageLoaded = true;
+         storeLoaded = false;
+         storeLevel = 0;
+         strncpy(currentFilename, filename.c_str(), sizeof(currentFilename) - 1);
+         sourceHash = hash == 0 ? 1 : hash;
+      });
+   });
+}
+
+// Indexes a directory of DEM tiles and sets the window to the whole mosaic, with a stride that keeps the longer side of
+// the window at no more than 4096 samples
+// ------------------------------------------------------------------------------------------------------------------
+bool open_mosaic(const std::string &directory)
+{
+   if (!mosaic.open(directory))
+      return false;
+   mosaic.setBudget((long long)mosaicBudgetMB << 20);
+   mosaicStride = std::max(1, (std::max(mosaic.width(), mosaic.height()) + 4095) / 4096);
+   mosaicOrigin[0] = mosaicOrigin[1] = 0;
+   mosaicSize[0] = (mosaic.width() + mosaicStride - 1) / mosaicStride;
+   mosaicSize[1] = (mosaic.height() + mosaicStride - 1) / mosaicStride;
+   return true;
+}
+
+// Decodes the tiles below the window on the job system and makes the window the loaded image. Tiles decoded for an
+// earlier window come from the cache of the mosaic, so panning the window only decodes the tiles it moved onto
+// ------------------------------------------------------------------------------------------------------------------
+void read_mosaic_window_async()
+{
+   ++backgroundTasks;
+   int x = mosaicOrigin[0];
+   int y = mosaicOrigin[1];
+   int width = mosaicSize[0];
+   int height = mosaicSize[1];
+   int stride = mosaicStride;
+   HeightDecoding decoding = heightDecoding;
+   JobSystem::instance().submit([x, y, width, height, stride, decoding]() {
+      std::shared_ptr<HeightPlane> plane = std::make_shared<HeightPlane>();
+      bool success = mosaic.readWindow(x, y, width, height, stride, decoding, *plane);
+      uint64_t hash = success ? hash_bytes(plane->heights.data(), plane->heights.size() * sizeof(float)) : 0;
+      JobSystem::instance().runOnMainThread([plane, success, hash]() {
+         --backgroundTasks;
+         if (!success)
+            return;
+         std::cout << "Loaded " << plane->width << "x" << plane->height << " mosaic window in "
+                   << mosaic.stats().decodeMs << " ms\n";
+         framePlayer.close();
+         tileStreamer.stop();
+         heightStore.close();
+         fileWatcher.stop();
+         std::swap(image, *plane);
+         imageMemory.set(image.heights);
+         ++imageVersion;
+         image_width = image.width;
+         image_height = image.height;
+         imageLoaded = true;
+         storeLoaded = false;
+         storeLevel = 0;
+         strncpy(currentFilename, "mosaic window", sizeof(currentFilename) - 1);
+         sourceHash = hash == 0 ? 1 : hash;
+      });
+   });
+}
+
+// true if the current grid is the complete full resolution grid of the loaded image, so changes of the image can be
+// applied to its vertex buffer span by span
+// ------------------------------------------------------------------------------------------------------------------
+bool grid_updates_incrementally(GLuint vao)
+{
+   return vao != 0 && gridStride == 1 && refineStride == 0 && gridView.heights != nullptr &&
+          gridView.heights == image.heights.data() && gridHeightScaling == heightScaling;
+}
+
+// Makes a decoded frame of the sequence the loaded image. Frames of the same size only re-mesh the vertices around
+// changed pixels, like a hot reload, other frames regenerate the grid
+// ------------------------------------------------------------------------------------------------------------------
+void present_frame(DecodedFrame &frame, std::vector<glm::vec3> &vertices, std::vector<glm::uvec3> &indices, GLuint &vao)
+{
+   double start = glfwGetTime();
+   const HeightPlane &plane = frame.plane;
+   bool incremental = grid_updates_incrementally(vao) && plane.width == image_width && plane.height == image_height;
+   if (incremental)
+   {
+      std::vector<GridSpan> spans;
+      std::vector<glm::vec3> changed;
+      grid_dirty_spans(N, M, image.heights.data(), plane.heights.data(), plane.width, plane.height, spans, 0);
+      generate_vertex_spans(N, M, HeightmapView(plane.heights.data(), plane.width, plane.height), heightScaling, spans,
+                            changed, 0);
+      upload_vertex_spans(vao, spans, changed);
+   }
+   if (storeLoaded)
+   {
+      tileStreamer.stop();
+      heightStore.close();
+   }
+   std::swap(image, frame.plane);
+   imageMemory.set(image.heights);
+   ++imageVersion;
+   image_width = image.width;
+   image_height = image.height;
+   imageLoaded = true;
+   storeLoaded = false;
+   shownFrame = frame.index;
+   strncpy(currentFilename, framePlayer.frameName(frame.index).c_str(), sizeof(currentFilename) - 1);
+   hash_source_async(currentFilename);
+   if (incremental)
+      gridView = current_heightmap();
+   else
+      generate_heightmap_progressive(current_heightmap(), vertices, indices, vao);
+   frameUpdateMs = (float)((glfwGetTime() - start) * 1000.0);
+}
+
+// Copies re-meshed vertex spans into the vertex buffer of the current full resolution grid. Spans that are adjacent in
+// the buffer, like whole rows one after the other, go up with a single glBufferSubData
+// ---------------------------------------------------------------------------------------------------------------------
+void upload_vertex_spans(GLuint vao, const std::vector<GridSpan> &spans, const std::vector<glm::vec3> &vertices)
+{
+   PROFILE_ZONE("upload_vertex_spans");
+   if (vao == 0 || spans.empty())
+      return;
+   glBindVertexArray(vao);
+   GLint vbo = 0;
+   glGetVertexAttribiv(0, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &vbo);
+   glBindBuffer(GL_ARRAY_BUFFER, (GLuint)vbo);
+   size_t source = 0;
+   size_t s = 0;
+   while (s < spans.size())
+   {
+      size_t offset = ((size_t)spans[s].row * (M + 1) + spans[s].firstColumn) * 2;
+      size_t end = ((size_t)spans[s].row * (M + 1) + spans[s].endColumn) * 2;
+      for (++s; s < spans.size() && ((size_t)spans[s].row * (M + 1) + spans[s].firstColumn) * 2 == end; ++s)
+         end = ((size_t)spans[s].row * (M + 1) + spans[s].endColumn) * 2;
+      glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(offset * sizeof(glm::vec3)), (GLsizeiptr)((end - offset) * sizeof(glm::vec3)),
+                      &vertices[source]);
+      source += end - offset;
+   }
+   glBindVertexArray(0);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 // Draws the actual heightmap based on a given VAO
 // ---------------------------------------
-void draw_vao(GLuint vao, GLsizei n)
+void draw_vao(GLuint vao, GLsizei n, size_t first)
 {
+   if (vao == 0 || n <= 0)
+      return;
    glBindVertexArray(vao);
-   glDrawElements(GL_TRIANGLES, (GLsizei)n, GL_UNSIGNED_INT, NULL);
+   glDrawElements(GL_TRIANGLES, (GLsizei)n, GL_UNSIGNED_INT, (void *)(first * sizeof(GLuint)));
    glBindVertexArray(0);
 }
\ No newline at end of file